@@ -0,0 +1,545 @@
+#include "BVH.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <memory>
+
+#include "Parallel.h"
+
+namespace dae
+{
+	constexpr uint32_t SAH_NUM_BINS{ 16 };
+	constexpr uint32_t SAH_MAX_LEAF_SIZE{ 8 };
+	constexpr uint32_t PARALLEL_CHUNK_SIZE{ 4096 }; //ranges smaller than this are processed on the calling thread
+	constexpr uint32_t INVALID_NODE{ UINT32_MAX };
+
+	namespace
+	{
+		//Runs function(begin, end) over count items split in chunks, in parallel when there is enough work
+		template<typename Function>
+		void ParallelChunks(uint32_t count, Function&& function)
+		{
+			const uint32_t numChunks{ (count + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE };
+			if (numChunks <= 1)
+			{
+				function(0u, count);
+				return;
+			}
+			Parallel::For(0u, numChunks, [&](uint32_t chunk)
+			{
+				function(chunk * PARALLEL_CHUNK_SIZE, std::min(count, (chunk + 1) * PARALLEL_CHUNK_SIZE));
+			}, 1);
+		}
+
+		struct Bounds
+		{
+			float min[3]{ FLT_MAX, FLT_MAX, FLT_MAX };
+			float max[3]{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+			void Grow(const float minPoint[3], const float maxPoint[3])
+			{
+				for (int axis{}; axis < 3; ++axis)
+				{
+					min[axis] = std::min(min[axis], minPoint[axis]);
+					max[axis] = std::max(max[axis], maxPoint[axis]);
+				}
+			}
+			void Grow(const Bounds& bounds) { Grow(bounds.min, bounds.max); }
+			float GetHalfArea() const
+			{
+				const float extent[3]{ max[0] - min[0], max[1] - min[1], max[2] - min[2] };
+				return extent[0] < 0.f ? 0.f : extent[0] * extent[1] + extent[1] * extent[2] + extent[2] * extent[0];
+			}
+		};
+
+		void GetCentroid(const BVH::Node& triangleBounds, float centroid[3])
+		{
+			for (int axis{}; axis < 3; ++axis)
+				centroid[axis] = 0.5f * (triangleBounds.min[axis] + triangleBounds.max[axis]);
+		}
+
+		//Spreads the lower 10 bits of value so there are two zero bits between each of them
+		uint32_t ExpandBits(uint32_t value)
+		{
+			value = (value * 0x00010001u) & 0xFF0000FFu;
+			value = (value * 0x00000101u) & 0x0F00F00Fu;
+			value = (value * 0x00000011u) & 0xC30C30C3u;
+			value = (value * 0x00000005u) & 0x49249249u;
+			return value;
+		}
+	}
+
+	void BVH::Build(std::span<const Vector3> positions, std::span<const int> indices, BVHBuildMode mode)
+	{
+		const auto buildStart{ std::chrono::steady_clock::now() };
+
+		Clear();
+		const uint32_t numTriangles{ static_cast<uint32_t>(indices.size() / 3) };
+		if (numTriangles == 0 || mode == BVHBuildMode::None)
+			return;
+
+		//Triangle bounds are shared by both builders
+		m_TriangleBounds.resize(numTriangles);
+		ParallelChunks(numTriangles, [&](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t triangle{ begin }; triangle < end; ++triangle)
+			{
+				Node& bounds = m_TriangleBounds[triangle];
+				const Vector3& v0 = positions[indices[3 * triangle]];
+				const Vector3& v1 = positions[indices[3 * triangle + 1]];
+				const Vector3& v2 = positions[indices[3 * triangle + 2]];
+				bounds.min[0] = std::min(v0.x, std::min(v1.x, v2.x));
+				bounds.min[1] = std::min(v0.y, std::min(v1.y, v2.y));
+				bounds.min[2] = std::min(v0.z, std::min(v1.z, v2.z));
+				bounds.max[0] = std::max(v0.x, std::max(v1.x, v2.x));
+				bounds.max[1] = std::max(v0.y, std::max(v1.y, v2.y));
+				bounds.max[2] = std::max(v0.z, std::max(v1.z, v2.z));
+				bounds.left = triangle;
+				bounds.right = LEAF_FLAG | 1u;
+			}
+		});
+
+		if (mode == BVHBuildMode::LBVH)
+			BuildLBVH();
+		else
+			BuildBinnedSAH();
+
+		m_LastBuildTime = std::chrono::duration<float>(std::chrono::steady_clock::now() - buildStart).count();
+	}
+
+	void BVH::Clear()
+	{
+		m_Nodes.clear();
+		m_TriangleIndices.clear();
+	}
+
+#pragma region LBVH
+	//Karras 2012, "Maximizing Parallelism in the Construction of BVHs, Octrees, and k-d Trees"
+	//Every internal node finds its own key range and split independently, bounds are filled in bottom-up afterwards
+	void BVH::BuildLBVH()
+	{
+		const uint32_t numTriangles{ static_cast<uint32_t>(m_TriangleBounds.size()) };
+
+		//Centroid bounds, reduced per chunk
+		const uint32_t numChunks{ (numTriangles + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE };
+		std::vector<Bounds> chunkBounds(numChunks);
+		ParallelChunks(numTriangles, [&](uint32_t begin, uint32_t end)
+		{
+			Bounds& bounds = chunkBounds[begin / PARALLEL_CHUNK_SIZE];
+			for (uint32_t triangle{ begin }; triangle < end; ++triangle)
+			{
+				float centroid[3]{};
+				GetCentroid(m_TriangleBounds[triangle], centroid);
+				bounds.Grow(centroid, centroid);
+			}
+		});
+		Bounds centroidBounds{};
+		for (const Bounds& bounds : chunkBounds)
+			centroidBounds.Grow(bounds);
+
+		//30-bit Morton codes in the upper half, triangle index in the lower half
+		float scale[3]{};
+		for (int axis{}; axis < 3; ++axis)
+		{
+			const float extent{ centroidBounds.max[axis] - centroidBounds.min[axis] };
+			scale[axis] = extent > 0.f ? 1023.f / extent : 0.f;
+		}
+
+		std::vector<uint64_t> keys(numTriangles);
+		ParallelChunks(numTriangles, [&](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t triangle{ begin }; triangle < end; ++triangle)
+			{
+				float centroid[3]{};
+				GetCentroid(m_TriangleBounds[triangle], centroid);
+				const uint32_t x{ static_cast<uint32_t>((centroid[0] - centroidBounds.min[0]) * scale[0]) };
+				const uint32_t y{ static_cast<uint32_t>((centroid[1] - centroidBounds.min[1]) * scale[1]) };
+				const uint32_t z{ static_cast<uint32_t>((centroid[2] - centroidBounds.min[2]) * scale[2]) };
+				const uint32_t code{ (ExpandBits(x) << 2) | (ExpandBits(y) << 1) | ExpandBits(z) };
+				keys[triangle] = (static_cast<uint64_t>(code) << 32) | triangle;
+			}
+		});
+
+		//Parallel LSD radix sort on the code, 8 bits per pass
+		//Chunks histogram their digits, an exclusive scan (digit major, chunk minor) gives every chunk its own stable output range
+		std::vector<uint64_t> sortedKeys(numTriangles);
+		std::vector<uint32_t> histograms(static_cast<size_t>(numChunks) * 256);
+		for (uint32_t shift{ 32 }; shift < 62; shift += 8)
+		{
+			std::fill(histograms.begin(), histograms.end(), 0u);
+			ParallelChunks(numTriangles, [&](uint32_t begin, uint32_t end)
+			{
+				uint32_t* pHistogram = histograms.data() + static_cast<size_t>(begin / PARALLEL_CHUNK_SIZE) * 256;
+				for (uint32_t idx{ begin }; idx < end; ++idx)
+					++pHistogram[(keys[idx] >> shift) & 0xFF];
+			});
+
+			uint32_t offset{};
+			for (uint32_t digit{}; digit < 256; ++digit)
+			{
+				for (uint32_t chunk{}; chunk < numChunks; ++chunk)
+				{
+					uint32_t& count = histograms[static_cast<size_t>(chunk) * 256 + digit];
+					const uint32_t chunkCount{ count };
+					count = offset;
+					offset += chunkCount;
+				}
+			}
+
+			ParallelChunks(numTriangles, [&](uint32_t begin, uint32_t end)
+			{
+				uint32_t* pOffsets = histograms.data() + static_cast<size_t>(begin / PARALLEL_CHUNK_SIZE) * 256;
+				for (uint32_t idx{ begin }; idx < end; ++idx)
+					sortedKeys[pOffsets[(keys[idx] >> shift) & 0xFF]++] = keys[idx];
+			});
+			keys.swap(sortedKeys);
+		}
+
+		//Internal nodes [0, n - 1), leaves [n - 1, 2n - 1), the root is node 0
+		const uint32_t numInternalNodes{ numTriangles - 1 };
+		m_Nodes.resize(static_cast<size_t>(numTriangles) * 2 - 1);
+		m_TriangleIndices.resize(numTriangles);
+		std::vector<uint32_t> parents(m_Nodes.size(), INVALID_NODE);
+
+		ParallelChunks(numTriangles, [&](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t idx{ begin }; idx < end; ++idx)
+			{
+				const uint32_t triangle{ static_cast<uint32_t>(keys[idx]) };
+				m_TriangleIndices[idx] = triangle;
+				Node& leaf = m_Nodes[numInternalNodes + idx];
+				leaf = m_TriangleBounds[triangle];
+				leaf.left = idx;
+			}
+		});
+
+		//Length of the common prefix of two sorted keys, equal codes are told apart by their position
+		const int numKeys{ static_cast<int>(numTriangles) };
+		const auto delta = [&keys, numKeys](int i, int j)
+		{
+			if (j < 0 || j >= numKeys)
+				return -1;
+			const uint32_t codeI{ static_cast<uint32_t>(keys[i] >> 32) };
+			const uint32_t codeJ{ static_cast<uint32_t>(keys[j] >> 32) };
+			if (codeI == codeJ)
+				return 32 + std::countl_zero(static_cast<uint32_t>(i ^ j));
+			return std::countl_zero(codeI ^ codeJ);
+		};
+
+		ParallelChunks(numInternalNodes, [&](uint32_t begin, uint32_t end)
+		{
+			for (int i{ static_cast<int>(begin) }; i < static_cast<int>(end); ++i)
+			{
+				//Direction and other end of the key range covered by this node
+				const int direction{ delta(i, i + 1) - delta(i, i - 1) > 0 ? 1 : -1 };
+				const int minDelta{ delta(i, i - direction) };
+				int maxLength{ 2 };
+				while (delta(i, i + maxLength * direction) > minDelta)
+					maxLength <<= 1;
+				int length{};
+				for (int step{ maxLength >> 1 }; step >= 1; step >>= 1)
+				{
+					if (delta(i, i + (length + step) * direction) > minDelta)
+						length += step;
+				}
+				const int first{ std::min(i, i + length * direction) };
+				const int last{ std::max(i, i + length * direction) };
+
+				//Split where the highest differing bit flips
+				const int nodeDelta{ delta(first, last) };
+				int split{ first };
+				int step{ last - first };
+				do
+				{
+					step = (step + 1) >> 1;
+					const int newSplit{ split + step };
+					if (newSplit < last && delta(first, newSplit) > nodeDelta)
+						split = newSplit;
+				} while (step > 1);
+
+				Node& node = m_Nodes[i];
+				node.left = split == first ? numInternalNodes + split : split;
+				node.right = split + 1 == last ? numInternalNodes + split + 1 : split + 1;
+				parents[node.left] = i;
+				parents[node.right] = i;
+			}
+		});
+
+		//Bounds bottom-up, the second child to arrive at a node merges both and carries on upwards
+		const auto arrivals = std::make_unique<std::atomic<uint32_t>[]>(std::max(numInternalNodes, 1u));
+		ParallelChunks(numTriangles, [&](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t idx{ begin }; idx < end; ++idx)
+			{
+				uint32_t nodeIndex{ parents[numInternalNodes + idx] };
+				while (nodeIndex != INVALID_NODE && arrivals[nodeIndex].fetch_add(1, std::memory_order_acq_rel) == 1)
+				{
+					Node& node = m_Nodes[nodeIndex];
+					const Node& left = m_Nodes[node.left];
+					const Node& right = m_Nodes[node.right];
+					for (int axis{}; axis < 3; ++axis)
+					{
+						node.min[axis] = std::min(left.min[axis], right.min[axis]);
+						node.max[axis] = std::max(left.max[axis], right.max[axis]);
+					}
+					nodeIndex = parents[nodeIndex];
+				}
+			}
+		});
+	}
+#pragma endregion
+
+#pragma region Binned SAH
+	void BVH::BuildBinnedSAH()
+	{
+		const uint32_t numTriangles{ static_cast<uint32_t>(m_TriangleBounds.size()) };
+
+		//The triangle bounds themselves get partitioned so every pass reads them in order, their left member holds the triangle index
+		m_PartitionScratch.resize(numTriangles);
+
+		//Worst case node count, so the node array never reallocates while subtrees are built in parallel
+		m_Nodes.resize(static_cast<size_t>(numTriangles) * 2 - 1);
+		std::atomic<uint32_t> numNodes{ 1 };
+		SubdivideSAH(0, 0, numTriangles, 0, numNodes);
+		m_Nodes.resize(numNodes.load());
+
+		m_TriangleIndices.resize(numTriangles);
+		ParallelChunks(numTriangles, [&](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t idx{ begin }; idx < end; ++idx)
+				m_TriangleIndices[idx] = m_TriangleBounds[idx].left;
+		});
+	}
+
+	void BVH::SubdivideSAH(uint32_t nodeIndex, uint32_t first, uint32_t count, uint32_t depth, std::atomic<uint32_t>& numNodes)
+	{
+		struct Bin
+		{
+			Bounds bounds{};
+			uint32_t count{};
+		};
+		struct RangeInfo
+		{
+			Bounds bounds{};
+			Bounds centroidBounds{};
+		};
+
+		const auto makeLeaf = [&](const Bounds& bounds)
+		{
+			Node& node = m_Nodes[nodeIndex];
+			std::copy_n(bounds.min, 3, node.min);
+			std::copy_n(bounds.max, 3, node.max);
+			node.left = first;
+			node.right = LEAF_FLAG | count;
+		};
+
+		//Node and centroid bounds of the range
+		//Small ranges, which is most of them, keep their per-chunk data on the stack
+		const uint32_t numChunks{ (count + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE };
+		RangeInfo localInfo{};
+		std::vector<RangeInfo> chunkInfo(numChunks > 1 ? numChunks : 0);
+		RangeInfo* pChunkInfo{ numChunks > 1 ? chunkInfo.data() : &localInfo };
+		ParallelChunks(count, [&](uint32_t begin, uint32_t end)
+		{
+			RangeInfo& info = pChunkInfo[begin / PARALLEL_CHUNK_SIZE];
+			for (uint32_t idx{ first + begin }; idx < first + end; ++idx)
+			{
+				const Node& triangleBounds = m_TriangleBounds[idx];
+				float centroid[3]{};
+				GetCentroid(triangleBounds, centroid);
+				info.bounds.Grow(triangleBounds.min, triangleBounds.max);
+				info.centroidBounds.Grow(centroid, centroid);
+			}
+		});
+		RangeInfo range{ localInfo };
+		for (const RangeInfo& info : chunkInfo)
+		{
+			range.bounds.Grow(info.bounds);
+			range.centroidBounds.Grow(info.centroidBounds);
+		}
+
+		//Unbalanced splits (exponentially spaced geometry) can peel off a few triangles per level, past MAX_DEPTH the rest becomes one leaf
+		if (count <= 2 || depth >= MAX_DEPTH)
+		{
+			makeLeaf(range.bounds);
+			return;
+		}
+
+		//Bin the centroids along all three axes, per chunk, then merge
+		float binScale[3]{};
+		for (int axis{}; axis < 3; ++axis)
+		{
+			const float extent{ range.centroidBounds.max[axis] - range.centroidBounds.min[axis] };
+			binScale[axis] = extent > 0.f ? SAH_NUM_BINS / extent : 0.f;
+		}
+		const auto getBin = [&](const Node& triangleBounds, int axis)
+		{
+			const float centroid{ 0.5f * (triangleBounds.min[axis] + triangleBounds.max[axis]) };
+			return std::min(SAH_NUM_BINS - 1, static_cast<uint32_t>((centroid - range.centroidBounds.min[axis]) * binScale[axis]));
+		};
+
+		Bin localBins[3 * SAH_NUM_BINS]{};
+		std::vector<Bin> chunkBins(numChunks > 1 ? static_cast<size_t>(numChunks) * 3 * SAH_NUM_BINS : 0);
+		Bin* pChunkBins{ numChunks > 1 ? chunkBins.data() : localBins };
+		ParallelChunks(count, [&](uint32_t begin, uint32_t end)
+		{
+			Bin* pBins = pChunkBins + static_cast<size_t>(begin / PARALLEL_CHUNK_SIZE) * 3 * SAH_NUM_BINS;
+			for (uint32_t idx{ first + begin }; idx < first + end; ++idx)
+			{
+				const Node& triangleBounds = m_TriangleBounds[idx];
+				for (int axis{}; axis < 3; ++axis)
+				{
+					Bin& bin = pBins[axis * SAH_NUM_BINS + getBin(triangleBounds, axis)];
+					bin.bounds.Grow(triangleBounds.min, triangleBounds.max);
+					++bin.count;
+				}
+			}
+		});
+
+		//Sweep the split planes between bins, cost relative to the parent: 1 traversal step + expected triangle tests
+		float bestCost{ FLT_MAX };
+		int bestAxis{ -1 };
+		uint32_t bestSplit{};
+		const float parentArea{ range.bounds.GetHalfArea() };
+		for (int axis{}; axis < 3; ++axis)
+		{
+			if (binScale[axis] == 0.f)
+				continue;
+
+			//The other chunks are merged into the first one
+			Bin* bins = pChunkBins + axis * SAH_NUM_BINS;
+			for (uint32_t chunk{ 1 }; chunk < numChunks; ++chunk)
+			{
+				for (uint32_t binIndex{}; binIndex < SAH_NUM_BINS; ++binIndex)
+				{
+					const Bin& chunkBin = pChunkBins[(static_cast<size_t>(chunk) * 3 + axis) * SAH_NUM_BINS + binIndex];
+					bins[binIndex].bounds.Grow(chunkBin.bounds);
+					bins[binIndex].count += chunkBin.count;
+				}
+			}
+
+			//Empty bins leave both sides unchanged, so they are skipped in both sweeps
+			float rightArea[SAH_NUM_BINS]{};
+			uint32_t rightCount[SAH_NUM_BINS]{};
+			Bounds rightBounds{};
+			float rightBoundsArea{};
+			uint32_t rightSum{};
+			for (uint32_t binIndex{ SAH_NUM_BINS - 1 }; binIndex > 0; --binIndex)
+			{
+				if (bins[binIndex].count > 0)
+				{
+					rightBounds.Grow(bins[binIndex].bounds);
+					rightBoundsArea = rightBounds.GetHalfArea();
+					rightSum += bins[binIndex].count;
+				}
+				rightArea[binIndex] = rightBoundsArea;
+				rightCount[binIndex] = rightSum;
+			}
+
+			Bounds leftBounds{};
+			uint32_t leftSum{};
+			for (uint32_t split{ 1 }; split < SAH_NUM_BINS; ++split)
+			{
+				const Bin& bin = bins[split - 1];
+				if (bin.count == 0)
+					continue;
+
+				leftBounds.Grow(bin.bounds);
+				leftSum += bin.count;
+				if (rightCount[split] == 0)
+					break;
+
+				const float cost{ leftSum * leftBounds.GetHalfArea() + rightCount[split] * rightArea[split] };
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = split;
+				}
+			}
+		}
+		bestCost = 1.f + bestCost / std::max(parentArea, FLT_MIN);
+
+		const bool isSplitWorthIt{ bestAxis >= 0 && bestCost < static_cast<float>(count) };
+		if (!isSplitWorthIt && count <= SAH_MAX_LEAF_SIZE)
+		{
+			makeLeaf(range.bounds);
+			return;
+		}
+
+		//Partition the range, large ranges go through the scratch buffer chunk by chunk
+		uint32_t leftCount{ count / 2 };
+		if (bestAxis >= 0)
+		{
+			const auto isLeft = [&](const Node& triangleBounds) { return getBin(triangleBounds, bestAxis) < bestSplit; };
+			if (numChunks <= 1)
+			{
+				leftCount = static_cast<uint32_t>(std::partition(m_TriangleBounds.begin() + first, m_TriangleBounds.begin() + first + count, isLeft) - (m_TriangleBounds.begin() + first));
+			}
+			else
+			{
+				std::vector<uint32_t> chunkLeftCounts(numChunks);
+				ParallelChunks(count, [&](uint32_t begin, uint32_t end)
+				{
+					uint32_t numLeft{};
+					for (uint32_t idx{ first + begin }; idx < first + end; ++idx)
+						numLeft += isLeft(m_TriangleBounds[idx]);
+					chunkLeftCounts[begin / PARALLEL_CHUNK_SIZE] = numLeft;
+				});
+
+				std::vector<uint32_t> chunkLeftOffsets(numChunks), chunkRightOffsets(numChunks);
+				uint32_t totalLeft{};
+				for (uint32_t chunk{}; chunk < numChunks; ++chunk)
+				{
+					chunkLeftOffsets[chunk] = totalLeft;
+					totalLeft += chunkLeftCounts[chunk];
+				}
+				for (uint32_t chunk{}, rightOffset{ totalLeft }; chunk < numChunks; ++chunk)
+				{
+					chunkRightOffsets[chunk] = rightOffset;
+					rightOffset += std::min(count, (chunk + 1) * PARALLEL_CHUNK_SIZE) - chunk * PARALLEL_CHUNK_SIZE - chunkLeftCounts[chunk];
+				}
+
+				ParallelChunks(count, [&](uint32_t begin, uint32_t end)
+				{
+					uint32_t leftOffset{ first + chunkLeftOffsets[begin / PARALLEL_CHUNK_SIZE] };
+					uint32_t rightOffset{ first + chunkRightOffsets[begin / PARALLEL_CHUNK_SIZE] };
+					for (uint32_t idx{ first + begin }; idx < first + end; ++idx)
+					{
+						const Node& triangleBounds = m_TriangleBounds[idx];
+						m_PartitionScratch[isLeft(triangleBounds) ? leftOffset++ : rightOffset++] = triangleBounds;
+					}
+				});
+				std::copy_n(m_PartitionScratch.begin() + first, count, m_TriangleBounds.begin() + first);
+				leftCount = totalLeft;
+			}
+		}
+
+		//All centroids in one spot, split the range in the middle instead
+		if (leftCount == 0 || leftCount == count)
+			leftCount = count / 2;
+
+		const uint32_t leftChild{ numNodes.fetch_add(2, std::memory_order_relaxed) };
+		{
+			Node& node = m_Nodes[nodeIndex];
+			std::copy_n(range.bounds.min, 3, node.min);
+			std::copy_n(range.bounds.max, 3, node.max);
+			node.left = leftChild;
+			node.right = leftChild + 1;
+		}
+
+		if (count > PARALLEL_CHUNK_SIZE)
+		{
+			Parallel::Invoke(
+				[&] { SubdivideSAH(leftChild, first, leftCount, depth + 1, numNodes); },
+				[&] { SubdivideSAH(leftChild + 1, first + leftCount, count - leftCount, depth + 1, numNodes); });
+		}
+		else
+		{
+			SubdivideSAH(leftChild, first, leftCount, depth + 1, numNodes);
+			SubdivideSAH(leftChild + 1, first + leftCount, count - leftCount, depth + 1, numNodes);
+		}
+	}
+#pragma endregion
+}
@@ -0,0 +1,255 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <initializer_list>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "Math.h"
+#include "RayStats.h"
+
+namespace dae
+{
+	enum class BVHBuildMode : uint32_t
+	{
+		None, //brute force loop over every triangle
+		LBVH, //Morton codes + radix sort, fast enough to rebuild animated meshes every frame
+		BinnedSAH //better trees for static meshes, slower to build
+	};
+
+	//Bounding volume hierarchy over the triangles of one mesh, built in world space from the transformed positions
+	//Both builders run on the Parallel thread pool
+	class BVH final
+	{
+	public:
+		struct Node
+		{
+			float min[3];
+			uint32_t left; //leaf: first entry in the triangle index list
+			float max[3];
+			uint32_t right; //leaf: LEAF_FLAG | triangle count
+
+			bool IsLeaf() const { return (right & LEAF_FLAG) != 0; }
+			uint32_t GetCount() const { return right & ~LEAF_FLAG; }
+		};
+		static constexpr uint32_t LEAF_FLAG{ 0x80000000u };
+
+		//Conservative bounds of a bundle of segments start + s * delta with s in [0, 1]
+		//Shadow rays towards one point light are stored light first, so the starts nearly coincide and the bounds stay tight
+		struct SegmentBundle
+		{
+			float startMin[3];
+			float startMax[3];
+			float deltaMin[3];
+			float deltaMax[3];
+		};
+		//One ray of a bundle, set maxT below minT to take it out once it is done
+		struct BundleRay
+		{
+			float origin[3];
+			float inverseDirection[3];
+			float minT;
+			float maxT;
+		};
+
+		void Build(std::span<const Vector3> positions, std::span<const int> indices, BVHBuildMode mode);
+		void Clear();
+		bool IsEmpty() const { return m_Nodes.empty(); }
+
+		//Original triangle indices, leaves reference a range of this list
+		const std::vector<uint32_t>& GetTriangleIndices() const { return m_TriangleIndices; }
+		size_t GetNumNodes() const { return m_Nodes.size(); }
+		float GetLastBuildTime() const { return m_LastBuildTime; }
+
+		//Walks the nodes hit by the ray front to back and calls visitLeaf(first, count) on every leaf
+		//maxT is re-read after every leaf so closest-hit queries can tighten it, visitLeaf returns true to stop (any-hit)
+		template<typename LeafVisitor>
+		void Traverse(const Vector3& rayOrigin, const Vector3& rayDirection, float minT, const float& maxT, LeafVisitor&& visitLeaf) const;
+		//Calls visitLeaf(leaf, firstRay) on the leaves rays of the bundle reach, in no particular order, until it returns true
+		//Nodes are culled for the whole bundle with interval arithmetic first, then by looking for the first ray that still hits them
+		//Rays before firstRay miss the leaf, rays may be switched off (maxT < minT) by the visitor
+		template<typename LeafVisitor>
+		void TraverseBundle(const SegmentBundle& bundle, std::span<const BundleRay> rays, LeafVisitor&& visitLeaf) const;
+
+		//Slab test of one ray, entryT is where it enters the box
+		static bool IntersectNode(const Node& node, const float origin[3], const float inverseDirection[3], float minT, float maxT, float& entryT);
+		//Interval arithmetic version of the slab test, false only when no segment of the bundle can touch the box
+		static bool IntersectNode(const Node& node, const SegmentBundle& bundle);
+
+	private:
+		//Deepest level a leaf may sit at, traversal holds at most one pending sibling per level plus the two children it just pushed
+		//LBVH trees stay within it by construction, every level splits on a longer common prefix of the 64-bit keys
+		static constexpr uint32_t MAX_DEPTH{ 64 };
+		static constexpr int MAX_STACK_SIZE{ 96 };
+		static_assert(MAX_DEPTH + 2 <= MAX_STACK_SIZE, "a tree of MAX_DEPTH could overflow the traversal stack");
+
+		//Both work on m_TriangleBounds, filled in by Build
+		void BuildLBVH();
+		void BuildBinnedSAH();
+		void SubdivideSAH(uint32_t nodeIndex, uint32_t first, uint32_t count, uint32_t depth, std::atomic<uint32_t>& numNodes);
+
+		std::vector<Node> m_Nodes{};
+		std::vector<uint32_t> m_TriangleIndices{};
+		float m_LastBuildTime{}; //seconds
+
+		//Build scratch
+		std::vector<Node> m_TriangleBounds{};
+		std::vector<Node> m_PartitionScratch{};
+	};
+
+	inline bool BVH::IntersectNode(const Node& node, const float origin[3], const float inverseDirection[3], float minT, float maxT, float& entryT)
+	{
+		RAY_STAT(AABBTests);
+		for (int axis{}; axis < 3; ++axis)
+		{
+			float t0{ (node.min[axis] - origin[axis]) * inverseDirection[axis] };
+			float t1{ (node.max[axis] - origin[axis]) * inverseDirection[axis] };
+			if (t0 > t1)
+				std::swap(t0, t1);
+			minT = t0 > minT ? t0 : minT;
+			maxT = t1 < maxT ? t1 : maxT;
+		}
+		entryT = minT;
+		return minT <= maxT;
+	}
+
+	inline bool BVH::IntersectNode(const Node& node, const SegmentBundle& bundle)
+	{
+		RAY_STAT(AABBTests);
+		//Slack for the rounding of the per ray tests, culling a node that a ray grazes would let its shadow through
+		constexpr float epsilon{ 1e-4f };
+		float minS{ -epsilon };
+		float maxS{ 1.f + epsilon };
+		for (int axis{}; axis < 3; ++axis)
+		{
+			//Directions on both sides of zero leave this axis unconstrained
+			if (bundle.deltaMin[axis] <= 0.f && bundle.deltaMax[axis] >= 0.f)
+				continue;
+
+			//[node.min - startMax, node.max - startMin] / [deltaMin, deltaMax], the extremes are among the four corner quotients
+			const float lower{ node.min[axis] - bundle.startMax[axis] };
+			const float upper{ node.max[axis] - bundle.startMin[axis] };
+			const float q0{ lower / bundle.deltaMin[axis] };
+			const float q1{ lower / bundle.deltaMax[axis] };
+			const float q2{ upper / bundle.deltaMin[axis] };
+			const float q3{ upper / bundle.deltaMax[axis] };
+			const float s0{ std::min(std::min(q0, q1), std::min(q2, q3)) };
+			const float s1{ std::max(std::max(q0, q1), std::max(q2, q3)) };
+			minS = s0 - epsilon > minS ? s0 - epsilon : minS;
+			maxS = s1 + epsilon < maxS ? s1 + epsilon : maxS;
+		}
+		return minS <= maxS;
+	}
+
+	template<typename LeafVisitor>
+	void BVH::Traverse(const Vector3& rayOrigin, const Vector3& rayDirection, float minT, const float& maxT, LeafVisitor&& visitLeaf) const
+	{
+		if (m_Nodes.empty())
+			return;
+
+		const float origin[3]{ rayOrigin.x, rayOrigin.y, rayOrigin.z };
+		const float inverseDirection[3]{ 1.f / rayDirection.x, 1.f / rayDirection.y, 1.f / rayDirection.z };
+
+		float entryT{};
+		if (!IntersectNode(m_Nodes[0], origin, inverseDirection, minT, maxT, entryT))
+			return;
+
+		uint32_t stack[MAX_STACK_SIZE];
+		float stackEntryT[MAX_STACK_SIZE];
+		int stackSize{};
+		stack[stackSize] = 0;
+		stackEntryT[stackSize++] = entryT;
+
+		while (stackSize > 0)
+		{
+			--stackSize;
+			//Skip nodes that got occluded since they were pushed
+			if (stackEntryT[stackSize] > maxT)
+				continue;
+
+			const Node& node = m_Nodes[stack[stackSize]];
+			if (node.IsLeaf())
+			{
+				if (visitLeaf(node.left, node.GetCount()))
+					return;
+				continue;
+			}
+
+			float leftT{}, rightT{};
+			const bool hitLeft{ IntersectNode(m_Nodes[node.left], origin, inverseDirection, minT, maxT, leftT) };
+			const bool hitRight{ IntersectNode(m_Nodes[node.right], origin, inverseDirection, minT, maxT, rightT) };
+
+			//Push the far child first so the near one is visited next
+			if (hitLeft && hitRight)
+			{
+				const bool isLeftNear{ leftT <= rightT };
+				stack[stackSize] = isLeftNear ? node.right : node.left;
+				stackEntryT[stackSize++] = isLeftNear ? rightT : leftT;
+				stack[stackSize] = isLeftNear ? node.left : node.right;
+				stackEntryT[stackSize++] = isLeftNear ? leftT : rightT;
+			}
+			else if (hitLeft || hitRight)
+			{
+				stack[stackSize] = hitLeft ? node.left : node.right;
+				stackEntryT[stackSize++] = hitLeft ? leftT : rightT;
+			}
+			assert(stackSize < MAX_STACK_SIZE);
+		}
+	}
+
+	template<typename LeafVisitor>
+	void BVH::TraverseBundle(const SegmentBundle& bundle, std::span<const BundleRay> rays, LeafVisitor&& visitLeaf) const
+	{
+		//Index of the first ray of the bundle that hits the node, rays.size() when none does
+		const auto findFirstRay = [&](const Node& node, uint32_t firstRay)
+		{
+			if (!IntersectNode(node, bundle))
+				return static_cast<uint32_t>(rays.size());
+			for (; firstRay < rays.size(); ++firstRay)
+			{
+				const BundleRay& ray = rays[firstRay];
+				float entryT{};
+				if (ray.minT <= ray.maxT && IntersectNode(node, ray.origin, ray.inverseDirection, ray.minT, ray.maxT, entryT))
+					break;
+			}
+			return firstRay;
+		};
+
+		if (m_Nodes.empty())
+			return;
+		const uint32_t firstRootRay{ findFirstRay(m_Nodes[0], 0) };
+		if (firstRootRay == rays.size())
+			return;
+
+		uint32_t stack[MAX_STACK_SIZE];
+		uint32_t stackFirstRay[MAX_STACK_SIZE];
+		int stackSize{};
+		stack[stackSize] = 0;
+		stackFirstRay[stackSize++] = firstRootRay;
+		while (stackSize > 0)
+		{
+			--stackSize;
+			const Node& node = m_Nodes[stack[stackSize]];
+			const uint32_t firstRay{ stackFirstRay[stackSize] };
+			if (node.IsLeaf())
+			{
+				if (visitLeaf(node, firstRay))
+					return;
+				continue;
+			}
+
+			for (uint32_t child : { node.left, node.right })
+			{
+				const uint32_t firstChildRay{ findFirstRay(m_Nodes[child], firstRay) };
+				if (firstChildRay == rays.size())
+					continue;
+				stack[stackSize] = child;
+				stackFirstRay[stackSize++] = firstChildRay;
+			}
+			assert(stackSize < MAX_STACK_SIZE);
+		}
+	}
+}
@@ -0,0 +1,381 @@
+#include "Benchmarks.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "BRDFs.h"
+#include "BVH.h"
+#include "FastBRDF.h"
+#include "Material.h"
+#include "Parallel.h"
+#include "Renderer.h"
+#include "Scene.h"
+#include "Timer.h"
+#include "Utils.h"
+
+namespace dae
+{
+	namespace Benchmarks
+	{
+		namespace
+		{
+			//Largest error of a fast approximation against the reference
+			//The relative error is taken against at least 1e-3, terms that go to 0 would otherwise divide by almost nothing
+			struct ApproximationError
+			{
+				float maxAbsolute{};
+				float maxRelative{};
+
+				void Add(float reference, float approximation)
+				{
+					const float absolute{ std::abs(approximation - reference) };
+					//NaN would slip through std::max
+					if (!std::isfinite(absolute))
+					{
+						maxAbsolute = maxRelative = INFINITY;
+						return;
+					}
+					maxAbsolute = std::max(maxAbsolute, absolute);
+					maxRelative = std::max(maxRelative, absolute / std::max(std::abs(reference), 1e-3f));
+				}
+			};
+
+			//Material_LambertPhong::Shade written with the reference terms
+			ColorRGB ReferenceLambertPhong(const ColorRGB& diffuseColor, float kd, float ks, float exponent, const Vector3& n, const Vector3& l, const Vector3& v)
+			{
+				const ColorRGB diffuse{ BRDF::Lambert(kd, diffuseColor) };
+				return diffuse + BRDF::Phong(ks, exponent, l, -v, n);
+			}
+
+			//Material_CookTorrence::Shade as it was written with the reference terms
+			ColorRGB ReferenceCookTorrance(const ColorRGB& albedo, float metalness, float roughness, const Vector3& n, const Vector3& l, const Vector3& v)
+			{
+				const bool isMetal{ metalness > 0.f };
+				const ColorRGB f0{ isMetal ? albedo : ColorRGB{ 0.04f, 0.04f, 0.04f } };
+				const Vector3 h{ (v + l) / (v + l).Magnitude() };
+
+				const ColorRGB F{ BRDF::FresnelFunction_Schlick(h, v, f0) };
+				const float D{ BRDF::NormalDistribution_GGX(n, h, roughness) };
+				const float G{ BRDF::GeometryFunction_Smith(n, v, l, roughness) };
+				const float denominator{ 4 * std::max(0.f, Vector3::Dot(v, n)) * std::max(0.f, Vector3::Dot(l, n)) };
+				const ColorRGB cookTorrance{ F * (D * G / denominator) };
+				if (isMetal)
+					return cookTorrance;
+
+				const ColorRGB kd{ 1 - F.r, 1 - F.g, 1 - F.b };
+				return BRDF::Lambert(kd, albedo) + cookTorrance;
+			}
+		}
+
+		int BuildBVH(const std::string& objFilename, int repeats)
+		{
+			std::vector<Vector3> positions{};
+			std::vector<Vector3> normals{};
+			std::vector<int> indices{};
+			if (!Utils::ParseOBJ(objFilename, positions, normals, indices) || indices.empty())
+			{
+				std::cout << "Could not load " << objFilename << std::endl;
+				return 1;
+			}
+
+			const size_t numTriangles{ indices.size() / 3 };
+			std::cout << objFilename << ": " << numTriangles << " triangles, best of " << repeats << " builds\n";
+
+			const std::pair<BVHBuildMode, const char*> modes[]{ { BVHBuildMode::LBVH, "LBVH" }, { BVHBuildMode::BinnedSAH, "Binned SAH" } };
+			for (const auto& [mode, name] : modes)
+			{
+				BVH bvh{};
+				float bestTime{ FLT_MAX };
+				for (int repeat{}; repeat < repeats; ++repeat)
+				{
+					bvh.Build(positions, indices, mode);
+					bestTime = std::min(bestTime, bvh.GetLastBuildTime());
+				}
+
+				const float bestTimeMs{ bestTime * 1000.f };
+				std::cout << "  " << name << ": " << bestTimeMs << " ms, " << bestTimeMs * 1'000'000.f / numTriangles
+					<< " ms per million triangles, " << bvh.GetNumNodes() << " nodes\n";
+			}
+			return 0;
+		}
+
+		int BRDFAccuracy(int numSamples)
+		{
+			std::mt19937 generator{ 1234 };
+			std::uniform_real_distribution<float> unit{ 0.f, 1.f };
+			const auto randomDirection = [&]()
+			{
+				//Uniform on the sphere
+				const float z{ unit(generator) * 2.f - 1.f };
+				const float phi{ unit(generator) * 2.f * PI };
+				const float radius{ std::sqrt(std::max(0.f, 1.f - z * z)) };
+				return Vector3{ radius * std::cos(phi), radius * std::sin(phi), z };
+			};
+			const auto randomHemisphere = [&](const Vector3& n)
+			{
+				const Vector3 direction{ randomDirection() };
+				return Vector3::Dot(direction, n) < 0.f ? -direction : direction;
+			};
+
+			//Cook-Torrance divides by NdotL * NdotV, at grazing angles both sides blow up and float rounding decides the difference
+			//Those samples only go into the terms without the denominator
+			constexpr float MIN_COSINE{ 0.05f };
+
+			ApproximationError fresnel{};
+			ApproximationError distribution{};
+			ApproximationError geometry{};
+			ApproximationError phongInteger{};
+			ApproximationError phongFractional{};
+			ApproximationError power{};
+			ApproximationError batchSpecular{};
+			ApproximationError batchFresnel{};
+
+			std::vector<float> NdotL(numSamples), NdotV(numSamples), NdotH(numSamples), VdotH(numSamples);
+			std::vector<float> roughness(numSamples), specular(numSamples), fresnelWeight(numSamples);
+			std::vector<Vector3> normals(numSamples), viewDirections(numSamples), lightDirections(numSamples);
+			std::vector<bool> isGrazing(numSamples);
+			for (int idx{}; idx < numSamples; ++idx)
+			{
+				const Vector3 n{ normals[idx] = randomDirection() };
+				const Vector3 v{ viewDirections[idx] = randomHemisphere(n) };
+				const Vector3 l{ lightDirections[idx] = randomHemisphere(n) };
+				const Vector3 h{ (v + l).Normalized() };
+				const ColorRGB f0{ unit(generator), unit(generator), unit(generator) };
+				roughness[idx] = 0.05f + 0.95f * unit(generator);
+				const auto constants{ FastBRDF::CookTorranceConstants::Create(f0, 1.f, roughness[idx]) };
+
+				NdotL[idx] = Vector3::Dot(n, l);
+				NdotV[idx] = Vector3::Dot(n, v);
+				NdotH[idx] = Vector3::Dot(n, h);
+				VdotH[idx] = Vector3::Dot(v, h);
+				isGrazing[idx] = NdotL[idx] < MIN_COSINE || NdotV[idx] < MIN_COSINE;
+
+				fresnel.Add(BRDF::FresnelFunction_Schlick(h, v, f0).g, FastBRDF::Fresnel_Schlick(VdotH[idx], constants.f0).g);
+				distribution.Add(BRDF::NormalDistribution_GGX(n, h, roughness[idx]), FastBRDF::NormalDistribution_GGX(NdotH[idx], constants.alphaSquared));
+				geometry.Add(BRDF::GeometryFunction_Smith(n, v, l, roughness[idx]), FastBRDF::Geometry_Smith(NdotV[idx], NdotL[idx], constants.kDirect));
+
+				//The reference has no clamp, only compare where the lobe faces the viewer
+				const Vector3 reflect{ l - 2.f * Vector3::Dot(n, l) * n };
+				if (Vector3::Dot(reflect, v) > 0.f)
+				{
+					const float integerExponent{ std::floor(1.f + unit(generator) * 64.f) };
+					const float fractionalExponent{ 1.f + unit(generator) * 64.f };
+					phongInteger.Add(BRDF::Phong(1.f, integerExponent, l, v, n).r,
+						FastBRDF::Phong(1.f, integerExponent, FastBRDF::GetIntegerExponent(integerExponent), l, v, n));
+					phongFractional.Add(BRDF::Phong(1.f, fractionalExponent, l, v, n).r, FastBRDF::Phong(1.f, fractionalExponent, 0, l, v, n));
+				}
+
+				const float x{ unit(generator) };
+				const float exponent{ 0.5f + unit(generator) * 127.5f };
+				power.Add(powf(x, exponent), FastBRDF::FastPow(x, exponent));
+			}
+
+			//Batch against the reference terms, one material per call like the renderer would use it
+			constexpr float BATCH_ROUGHNESS{ 0.5f };
+			const auto constants{ FastBRDF::CookTorranceConstants::Create(colors::White, 1.f, BATCH_ROUGHNESS) };
+			FastBRDF::CookTorranceBatch(constants, NdotL, NdotV, NdotH, VdotH, specular, fresnelWeight);
+			for (int idx{}; idx < numSamples; ++idx)
+			{
+				batchFresnel.Add(powf(1.f - VdotH[idx], 5.f), fresnelWeight[idx]);
+				if (isGrazing[idx])
+					continue;
+
+				const Vector3& n{ normals[idx] };
+				const Vector3& v{ viewDirections[idx] };
+				const Vector3& l{ lightDirections[idx] };
+				const Vector3 h{ (v + l).Normalized() };
+				const float D{ BRDF::NormalDistribution_GGX(n, h, BATCH_ROUGHNESS) };
+				const float G{ BRDF::GeometryFunction_Smith(n, v, l, BATCH_ROUGHNESS) };
+				batchSpecular.Add(D * G / (4.f * NdotL[idx] * NdotV[idx]), specular[idx]);
+			}
+
+			//Material::Shade and Material::ShadeBatch against the materials written out with the reference terms
+			std::vector<float> batchArrays[12]{};
+			for (std::vector<float>& array : batchArrays)
+				array.resize(numSamples);
+			for (int idx{}; idx < numSamples; ++idx)
+			{
+				const Vector3* const directions[3]{ &normals[idx], &viewDirections[idx], &lightDirections[idx] };
+				for (int direction{}; direction < 3; ++direction)
+				{
+					batchArrays[direction * 3][idx] = directions[direction]->x;
+					batchArrays[direction * 3 + 1][idx] = directions[direction]->y;
+					batchArrays[direction * 3 + 2][idx] = directions[direction]->z;
+				}
+			}
+			const ShadingBatch shadingBatch{ batchArrays[0], batchArrays[1], batchArrays[2], batchArrays[3], batchArrays[4], batchArrays[5],
+				batchArrays[6], batchArrays[7], batchArrays[8] };
+			const ShadedColors shadedColors{ batchArrays[9], batchArrays[10], batchArrays[11] };
+
+			struct MaterialCheck
+			{
+				const char* name;
+				std::unique_ptr<Material> pMaterial;
+				std::function<ColorRGB(const Vector3& n, const Vector3& l, const Vector3& v)> reference;
+				bool isPhong;
+				float tolerance;
+				ApproximationError shade{};
+				ApproximationError batch{};
+			};
+			const auto lambertPhong = [](const ColorRGB& diffuseColor, float kd, float ks, float exponent)
+			{
+				return [=](const Vector3& n, const Vector3& l, const Vector3& v) { return ReferenceLambertPhong(diffuseColor, kd, ks, exponent, n, l, v); };
+			};
+			const auto cookTorrance = [](const ColorRGB& albedo, float metalness, float roughness)
+			{
+				return [=](const Vector3& n, const Vector3& l, const Vector3& v) { return ReferenceCookTorrance(albedo, metalness, roughness, n, l, v); };
+			};
+			const ColorRGB plastic{ 0.75f, 0.75f, 0.75f };
+			const ColorRGB silver{ 0.972f, 0.960f, 0.915f };
+			//Roughness 0.1 puts the GGX peak at 1 - NdotH ~ alpha^2 = 1e-4, where an ulp of NdotH moves D by ~0.1% in the reference as much as in the batch
+			MaterialCheck materialChecks[]{
+				{ "Lambert-Phong, integer exponent", std::make_unique<Material_LambertPhong>(colors::Blue, 0.5f, 0.5f, 60.f), lambertPhong(colors::Blue, 0.5f, 0.5f, 60.f), true, 1e-3f },
+				{ "Lambert-Phong, fractional exponent", std::make_unique<Material_LambertPhong>(colors::Blue, 0.5f, 0.5f, 37.5f), lambertPhong(colors::Blue, 0.5f, 0.5f, 37.5f), true, 1e-3f },
+				{ "Cook-Torrance, dielectric", std::make_unique<Material_CookTorrence>(plastic, 0.f, 0.6f), cookTorrance(plastic, 0.f, 0.6f), false, 1e-3f },
+				{ "Cook-Torrance, metal", std::make_unique<Material_CookTorrence>(silver, 1.f, 0.1f), cookTorrance(silver, 1.f, 0.1f), false, 1e-2f } };
+			for (MaterialCheck& check : materialChecks)
+			{
+				check.pMaterial->ShadeBatch(shadingBatch, shadedColors);
+				for (int idx{}; idx < numSamples; ++idx)
+				{
+					const Vector3& n{ normals[idx] };
+					const Vector3& v{ viewDirections[idx] };
+					const Vector3& l{ lightDirections[idx] };
+					//Same exclusions as the terms, Phong is shaded with -v like the renderer does
+					const Vector3 reflect{ l - 2.f * Vector3::Dot(n, l) * n };
+					if (check.isPhong ? Vector3::Dot(reflect, -v) <= 0.f : isGrazing[idx])
+						continue;
+
+					HitRecord hitRecord{};
+					hitRecord.normal = n;
+					const ColorRGB reference{ check.reference(n, l, v) };
+					const ColorRGB shaded{ check.pMaterial->Shade(hitRecord, l, v) };
+					check.shade.Add(reference.r, shaded.r);
+					check.shade.Add(reference.b, shaded.b);
+					check.batch.Add(reference.r, shadedColors.r[idx]);
+					check.batch.Add(reference.b, shadedColors.b[idx]);
+				}
+			}
+
+			//Tolerances sit well above what the fast versions reach and well below what a wrong or missing term costs
+			struct Result
+			{
+				std::string name;
+				const ApproximationError* pError;
+				float tolerance;
+			};
+			std::vector<Result> results{ { "Fresnel Schlick", &fresnel, 1e-5f }, { "GGX distribution", &distribution, 1e-4f },
+				{ "Smith geometry", &geometry, 1e-5f }, { "Phong integer exponent", &phongInteger, 1e-4f },
+				{ "Phong fractional exponent", &phongFractional, 1e-4f }, { "FastPow", &power, 1e-4f },
+				{ "Cook-Torrance batch, D*G/(4 NdotL NdotV)", &batchSpecular, 1e-5f }, { "Cook-Torrance batch, Fresnel weight", &batchFresnel, 1e-5f } };
+			for (const MaterialCheck& check : materialChecks)
+			{
+				results.push_back({ std::string{ check.name } + " Shade", &check.shade, check.tolerance });
+				results.push_back({ std::string{ check.name } + " ShadeBatch", &check.batch, check.tolerance });
+			}
+
+			std::cout << "BRDF accuracy over " << numSamples << " samples against the reference terms, max absolute / max relative error\n";
+			bool isAccurate{ true };
+			for (const Result& result : results)
+			{
+				const bool isWithinTolerance{ result.pError->maxRelative <= result.tolerance };
+				isAccurate &= isWithinTolerance;
+				std::cout << "  " << result.name << ": " << result.pError->maxAbsolute << " / " << result.pError->maxRelative;
+				if (isWithinTolerance)
+					std::cout << "   ok\n";
+				else
+					std::cout << "   FAILED, tolerance " << result.tolerance << "\n";
+			}
+
+			//Timing of the terms that had a pow, the sums go into a checksum so nothing is optimized away
+			double checksum{};
+			const auto measure = [&](const auto& function)
+			{
+				const auto start{ std::chrono::steady_clock::now() };
+				float sum{};
+				for (int idx{}; idx < numSamples; ++idx)
+					sum += function(idx);
+				const float time{ std::chrono::duration<float, std::nano>(std::chrono::steady_clock::now() - start).count() / numSamples };
+				checksum += sum;
+				return time;
+			};
+			const float referencePow{ measure([&](int idx) { return powf(NdotH[idx], 1.f + 63.f * roughness[idx]); }) };
+			const float fastPow{ measure([&](int idx) { return FastBRDF::FastPow(NdotH[idx], 1.f + 63.f * roughness[idx]); }) };
+			const float referenceFresnel{ measure([&](int idx) { return powf(1.f - VdotH[idx], 5); }) };
+			const float fastFresnel{ measure([&](int idx) { return FastBRDF::Pow5(1.f - VdotH[idx]); }) };
+			const float referencePhong{ measure([&](int idx) { return BRDF::Phong(1.f, 60.f, lightDirections[idx], viewDirections[idx], normals[idx]).r; }) };
+			const float fastPhong{ measure([&](int idx) { return FastBRDF::Phong(1.f, 60.f, 60, lightDirections[idx], viewDirections[idx], normals[idx]); }) };
+			const float fastPhongFractional{ measure([&](int idx) { return FastBRDF::Phong(1.f, 60.5f, 0, lightDirections[idx], viewDirections[idx], normals[idx]); }) };
+			std::cout << "  powf " << referencePow << " ns, FastPow " << fastPow << " ns\n"
+				<< "  powf(x, 5) " << referenceFresnel << " ns, Pow5 " << fastFresnel << " ns\n"
+				<< "  Phong " << referencePhong << " ns, fast Phong " << fastPhong << " ns (integer exponent), " << fastPhongFractional << " ns (fractional exponent)\n"
+				<< "  (checksum " << checksum << ")\n";
+
+			if (!isAccurate)
+				std::cout << "BRDF accuracy check FAILED\n";
+			return isAccurate ? 0 : 1;
+		}
+
+		int RenderFrames(const FrameSettings& settings)
+		{
+			Scene* const pScene{ CreateScene(settings.sceneFilename) };
+			if (!pScene)
+				return 1;
+
+			//Bounce depth follows the measured frame time by default, which would make the work differ between runs
+			const auto pRenderer = new Renderer(settings.width, settings.height);
+			pRenderer->SetTargetFrameTime(0.f);
+			const auto pTimer = new Timer();
+			pTimer->SetFixedTimeStep(1.f / settings.fps);
+			pTimer->Start();
+
+			std::vector<float> frameTimes{};
+			frameTimes.reserve(settings.numFrames);
+			for (uint32_t frame{}; frame < settings.numWarmupFrames + settings.numFrames; ++frame)
+			{
+				const auto frameStart{ std::chrono::steady_clock::now() };
+				pScene->Update(pTimer);
+				pRenderer->Render(pScene);
+				const float frameTime{ std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - frameStart).count() };
+				pTimer->Update();
+
+				if (frame >= settings.numWarmupFrames)
+					frameTimes.push_back(frameTime);
+			}
+			pTimer->Stop();
+
+			delete pTimer;
+			delete pRenderer;
+			delete pScene;
+
+			if (frameTimes.empty())
+				return 0;
+
+			//Percentiles rather than the average alone, a few slow frames (BVH rebuilds, cache misses) hide in it
+			std::vector<float> sortedTimes{ frameTimes };
+			std::sort(sortedTimes.begin(), sortedTimes.end());
+			const auto percentile = [&sortedTimes](float fraction)
+			{
+				return sortedTimes[std::min(static_cast<size_t>(fraction * sortedTimes.size()), sortedTimes.size() - 1)];
+			};
+			const float average{ std::accumulate(frameTimes.begin(), frameTimes.end(), 0.f) / frameTimes.size() };
+			const float megapixels{ settings.width * settings.height / 1'000'000.f };
+
+			std::cout << (settings.sceneFilename.empty() ? "Reference scene" : settings.sceneFilename) << ": " << settings.width << "x" << settings.height
+				<< ", " << frameTimes.size() << " frames after " << settings.numWarmupFrames << " warm-up frames, " << Parallel::GetNumThreads() << " threads\n"
+				<< "  average " << average << " ms (" << 1000.f / average << " FPS, " << megapixels * 1000.f / average << " Mpixels/s)\n"
+				<< "  min " << sortedTimes.front() << " ms, median " << percentile(0.5f) << " ms, 95th percentile " << percentile(0.95f)
+				<< " ms, max " << sortedTimes.back() << " ms\n";
+			return 0;
+		}
+	}
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+namespace dae
+{
+	//Command line benchmarks and accuracy checks, they print their results and return the process exit code
+	namespace Benchmarks
+	{
+		//Best build time of every BVH build mode over repeats builds of the mesh
+		int BuildBVH(const std::string& objFilename, int repeats);
+
+		//Largest error of the fast BRDF terms and batched material shading against the reference ones, and their timings
+		//Returns 1 when a term is out of its tolerance
+		int BRDFAccuracy(int numSamples);
+
+		struct FrameSettings
+		{
+			std::string sceneFilename{}; //empty: the reference scene
+			int width{ 640 };
+			int height{ 480 };
+			uint32_t numFrames{ 100 };
+			uint32_t numWarmupFrames{ 10 }; //not measured, acceleration structures and caches settle first
+			float fps{ 30.f }; //fixed time step of the scene, every run renders the same frames
+		};
+		//Renders frames without a window and prints the frame time distribution
+		int RenderFrames(const FrameSettings& settings);
+	}
+}
@@ -1,8 +1,10 @@
 #pragma once
 #include <cassert>
+#include <iostream>
+#if defined(RT_ENABLE_SDL)
 #include <SDL_keyboard.h>
 #include <SDL_mouse.h>
-#include <iostream>
+#endif
 
 #include "Math.h"
 #include "Timer.h"
@@ -64,6 +66,8 @@ namespace dae
 
 		void Update(Timer* pTimer)
 		{
+			//Builds without SDL have no input, the camera only moves when the scene moves it
+#if defined(RT_ENABLE_SDL)
 			const float deltaTime = pTimer->GetElapsed();
 
 			//Keyboard Input
@@ -144,6 +148,9 @@ namespace dae
 					totalPitch += rotationSpeed * deltaTime;
 				}
 			}
+#else
+			(void)pTimer;
+#endif
 
 			cameraToWorld = CalculateCameraToWorld();
 			//todo: W2 DONE
@@ -1,7 +1,11 @@
 #pragma once
 #include <cassert>
+#include <span>
 
+#include "BVH.h"
 #include "Math.h"
+#include "MeshSimplifier.h"
+#include "Profiler.h"
 #include "vector"
 
 namespace dae
@@ -54,6 +58,24 @@ namespace dae
 		unsigned char materialIndex{};
 	};
 
+	//Simplified copy of a mesh, with its own transformed vertices and BVH
+	struct TriangleMeshLOD
+	{
+		std::vector<Vector3> positions{};
+		std::vector<Vector3> normals{};
+		std::vector<int> indices{};
+		std::vector<Vector2> texcoords{}; //of the vertex each one was collapsed into
+		std::vector<Vector3> vertexNormals{}; //same
+
+		std::vector<Vector3> transformedPositions{};
+		std::vector<Vector3> transformedNormals{};
+		std::vector<Vector3> transformedVertexNormals{};
+		bool isTransformDirty{ true }; //only the level in use is transformed
+
+		BVH bvh{};
+		bool isBVHDirty{ true };
+	};
+
 	struct TriangleMesh
 	{
 		TriangleMesh() = default;
@@ -76,6 +98,9 @@ namespace dae
 		std::vector<Vector3> positions{};
 		std::vector<Vector3> normals{};
 		std::vector<int> indices{};
+		std::vector<Vector2> texcoords{}; //one per position, empty for meshes without texture coordinates
+		//One per position, interpolated over the triangle at a hit, empty for flat shading with the face normals
+		std::vector<Vector3> vertexNormals{};
 		unsigned char materialIndex{};
 
 		TriangleCullMode cullMode{TriangleCullMode::BackFaceCulling};
@@ -93,6 +118,21 @@ namespace dae
 
 		std::vector<Vector3> transformedPositions{};
 		std::vector<Vector3> transformedNormals{};
+		std::vector<Vector3> transformedVertexNormals{};
+
+		bool isTransformDirty{ true }; //like the LODs, transformed once the mesh itself is the level in use
+
+		//Built over the transformed positions, rebuilt by Scene::PrepareFrame after the transforms change
+		BVH bvh{};
+		BVHBuildMode bvhBuildMode{ BVHBuildMode::BinnedSAH };
+		bool isBVHDirty{};
+
+		//Coarser versions of the mesh, each about half the triangles of the one before
+		//activeLOD is picked per frame by Scene::PrepareFrame from the screen size of the mesh, 0 is the mesh itself
+		std::vector<TriangleMeshLOD> lods{};
+		uint32_t activeLOD{};
+
+		const TriangleMeshLOD* GetActiveLOD() const { return activeLOD == 0 ? nullptr : &lods[activeLOD - 1]; }
 
 		void Translate(const Vector3& translation)
 		{
@@ -139,6 +179,11 @@ namespace dae
 		}
 
 		void CalculateNormals()
+		{
+			CalculateNormals(positions, indices, normals);
+		}
+
+		static void CalculateNormals(const std::vector<Vector3>& positions, const std::vector<int>& indices, std::vector<Vector3>& normals)
 		{
 			Vector3 edgeA{}, edgeB{}, normal{};
 			for (int idx{}; idx < indices.size(); idx += 3)
@@ -150,16 +195,106 @@ namespace dae
 			}
 		}
 
-		void UpdateTransforms()
+		//Smooth shading, switches the mesh from its face normals to interpolated vertex normals
+		void CalculateVertexNormals()
+		{
+			CalculateVertexNormals(positions, indices, vertexNormals);
+		}
+
+		//Area weighted average of the faces around each vertex, the unnormalized cross product is twice the face area
+		static void CalculateVertexNormals(const std::vector<Vector3>& positions, const std::vector<int>& indices, std::vector<Vector3>& vertexNormals)
+		{
+			vertexNormals.assign(positions.size(), Vector3{});
+			for (size_t idx{}; idx < indices.size(); idx += 3)
+			{
+				const int i0{ indices[idx] }, i1{ indices[idx + 1] }, i2{ indices[idx + 2] };
+				const Vector3 areaNormal{ Vector3::Cross(positions[i1] - positions[i0], positions[i2] - positions[i0]) };
+				vertexNormals[i0] += areaNormal;
+				vertexNormals[i1] += areaNormal;
+				vertexNormals[i2] += areaNormal;
+			}
+			for (Vector3& normal : vertexNormals)
+			{
+				//Unused and fully degenerate vertices keep a zero normal
+				if (normal.SqrMagnitude() > 0.f)
+					normal.Normalize();
+			}
+		}
+
+		//Simplifies the mesh down by half per level until it gets below minTriangles or stops shrinking
+		void BuildLODs(uint32_t maxLevels, size_t minTriangles = 256)
+		{
+			lods.clear();
+			lods.reserve(maxLevels);
+			activeLOD = 0;
+
+			const std::vector<Vector3>* pPositions = &positions;
+			const std::vector<int>* pIndices = &indices;
+			const std::vector<Vector2>* pTexcoords = &texcoords;
+			const std::vector<Vector3>* pVertexNormals = &vertexNormals;
+			std::vector<int> sourceVertices{};
+			for (uint32_t level{}; level < maxLevels; ++level)
+			{
+				const size_t numTriangles{ pIndices->size() / 3 };
+				if (numTriangles / 2 < minTriangles)
+					break;
+
+				TriangleMeshLOD lod{};
+				if (!MeshSimplifier::Simplify(*pPositions, *pIndices, numTriangles / 2, lod.positions, lod.indices, &sourceVertices) ||
+					lod.indices.size() / 3 > numTriangles * 9 / 10)
+					break;
+
+				CalculateNormals(lod.positions, lod.indices, lod.normals);
+				if (!pTexcoords->empty())
+				{
+					lod.texcoords.reserve(sourceVertices.size());
+					for (const int source : sourceVertices)
+						lod.texcoords.push_back((*pTexcoords)[source]);
+				}
+				//The normals of the original surface still shade the coarser one smoothly
+				if (!pVertexNormals->empty())
+				{
+					lod.vertexNormals.reserve(sourceVertices.size());
+					for (const int source : sourceVertices)
+						lod.vertexNormals.push_back((*pVertexNormals)[source]);
+				}
+				lods.push_back(std::move(lod));
+				pPositions = &lods.back().positions;
+				pIndices = &lods.back().indices;
+				pTexcoords = &lods.back().texcoords;
+				pVertexNormals = &lods.back().vertexNormals;
+			}
+		}
+
+		Matrix GetFinalTransform() const
 		{
-			//Calculate Final Transform
 			Matrix finalTransform = scaleTransform;
 			finalTransform *= rotationTransform;
 			finalTransform *= translationTransform;
+			return finalTransform;
+		}
+
+		//Only moves the bounds, the vertices of every level are transformed by Scene::PrepareFrame once that level is in use
+		void UpdateTransforms()
+		{
+			UpdateTransformedAABB(GetFinalTransform());
+			isTransformDirty = true;
+			isBVHDirty = true;
+
+			for (TriangleMeshLOD& lod : lods)
+			{
+				lod.isTransformDirty = true;
+				lod.isBVHDirty = true;
+			}
+		}
+
+		void UpdateBaseTransforms()
+		{
+			PROFILE_SCOPE("UpdateTransforms");
+			const Matrix finalTransform = GetFinalTransform();
 
 			transformedPositions.clear();
 			transformedPositions.reserve(positions.size());
-
 			for (const auto& position : positions)
 			{
 				transformedPositions.emplace_back(finalTransform.TransformPoint(position));
@@ -167,13 +302,45 @@ namespace dae
 
 			transformedNormals.clear();
 			transformedNormals.reserve(normals.size());
-
 			for (const auto& normal : normals)
 			{
 				transformedNormals.emplace_back(rotationTransform.TransformVector(normal));
 			}
 
-			UpdateTransformedAABB(finalTransform);
+			transformedVertexNormals.clear();
+			transformedVertexNormals.reserve(vertexNormals.size());
+			for (const auto& normal : vertexNormals)
+			{
+				transformedVertexNormals.emplace_back(rotationTransform.TransformVector(normal));
+			}
+			isTransformDirty = false;
+		}
+
+		void UpdateLODTransforms(TriangleMeshLOD& lod) const
+		{
+			const Matrix finalTransform = GetFinalTransform();
+
+			lod.transformedPositions.clear();
+			lod.transformedPositions.reserve(lod.positions.size());
+			for (const auto& position : lod.positions)
+			{
+				lod.transformedPositions.emplace_back(finalTransform.TransformPoint(position));
+			}
+
+			lod.transformedNormals.clear();
+			lod.transformedNormals.reserve(lod.normals.size());
+			for (const auto& normal : lod.normals)
+			{
+				lod.transformedNormals.emplace_back(rotationTransform.TransformVector(normal));
+			}
+
+			lod.transformedVertexNormals.clear();
+			lod.transformedVertexNormals.reserve(lod.vertexNormals.size());
+			for (const auto& normal : lod.vertexNormals)
+			{
+				lod.transformedVertexNormals.emplace_back(rotationTransform.TransformVector(normal));
+			}
+			lod.isTransformDirty = false;
 		}
 
 		void UpdateAABB()
@@ -190,41 +357,18 @@ namespace dae
 			}
 		}
 
+		//Bounds of the 8 transformed corners of the object space box
 		void UpdateTransformedAABB(const Matrix& finalTransform)
 		{
-			Vector3 tMinAABB = finalTransform.TransformPoint(minAABB.x, minAABB.y, minAABB.z);
-			Vector3 tMaxAABB = tMinAABB;
-
-			Vector3 tAABB = finalTransform.TransformPoint(maxAABB.x, minAABB.y, minAABB.z);
-			tMinAABB = Vector3::Min(tAABB, tMinAABB);
-			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
-
-			tAABB = finalTransform.TransformPoint(maxAABB.x, minAABB.y, maxAABB.z);
-			tMinAABB = Vector3::Min(tAABB, tMinAABB);
-			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
-
-			tAABB = finalTransform.TransformPoint(minAABB.x, minAABB.y, maxAABB.z);
-			tMinAABB = Vector3::Min(tAABB, tMinAABB);
-			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
-
-			tAABB = finalTransform.TransformPoint(minAABB.x, maxAABB.y, minAABB.z);
-			tMinAABB = Vector3::Min(tAABB, tMinAABB);
-			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
-
-			tAABB = finalTransform.TransformPoint(maxAABB.x, maxAABB.y, minAABB.z);
-			tMinAABB = Vector3::Min(tAABB, tMinAABB);
-			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
-
-			tAABB = finalTransform.TransformPoint(maxAABB.x, maxAABB.y, maxAABB.z);
-			tMinAABB = Vector3::Min(tAABB, tMinAABB);
-			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
-
-			tAABB = finalTransform.TransformPoint(minAABB.x, maxAABB.y, minAABB.z);
-			tMinAABB = Vector3::Min(tAABB, tMinAABB);
-			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
-
-			transformedMinAABB = tMinAABB;
-			transformedMaxAABB = tMaxAABB;
+			transformedMinAABB = finalTransform.TransformPoint(minAABB);
+			transformedMaxAABB = transformedMinAABB;
+			for (int corner{ 1 }; corner < 8; ++corner)
+			{
+				const Vector3 cornerPosition{ corner & 1 ? maxAABB.x : minAABB.x, corner & 2 ? maxAABB.y : minAABB.y, corner & 4 ? maxAABB.z : minAABB.z };
+				const Vector3 transformedCorner{ finalTransform.TransformPoint(cornerPosition) };
+				transformedMinAABB = Vector3::Min(transformedCorner, transformedMinAABB);
+				transformedMaxAABB = Vector3::Max(transformedCorner, transformedMaxAABB);
+			}
 		}
 	};
 #pragma endregion
@@ -246,6 +390,12 @@ namespace dae
 	};
 #pragma endregion
 #pragma region MISC
+	struct AABB
+	{
+		Vector3 min{};
+		Vector3 max{};
+	};
+
 	struct Ray
 	{
 		Vector3 origin{};
@@ -253,6 +403,11 @@ namespace dae
 
 		float min{ 0.0001f };
 		float max{ FLT_MAX };
+
+		//Ray cone (Akenine-Moller et al. 2019), the cheap stand-in for ray differentials: the pixel footprint is
+		//coneWidth + t * coneSpread along the ray, used to pick texture mip levels, zero for shadow rays
+		float coneWidth{};
+		float coneSpread{};
 	};
 
 	struct HitRecord
@@ -263,6 +418,61 @@ namespace dae
 
 		bool didHit{ false };
 		unsigned char materialIndex{ 0 };
+
+		//Texture coordinates of meshes with texcoords, 0 otherwise
+		Vector2 texcoord{};
+		//Width of the ray cone at the hit in texture coordinate units, picks the mip level
+		float texcoordFootprint{};
+	};
+
+	//Arguments of Material::Shade for a batch of hits sharing a material, one entry per hit and light pair
+	//Every array has the same length, directions are normalized, view points from the hit towards the viewer
+	struct ShadingBatch
+	{
+		std::span<const float> normalX{};
+		std::span<const float> normalY{};
+		std::span<const float> normalZ{};
+		std::span<const float> viewX{};
+		std::span<const float> viewY{};
+		std::span<const float> viewZ{};
+		std::span<const float> lightX{};
+		std::span<const float> lightY{};
+		std::span<const float> lightZ{};
+		//HitRecord::texcoord and texcoordFootprint per entry, left empty when the hits have none
+		std::span<const float> texcoordU{};
+		std::span<const float> texcoordV{};
+		std::span<const float> texcoordFootprint{};
+
+		size_t GetSize() const { return normalX.size(); }
+	};
+
+	//Colors returned by Material::ShadeBatch, one array per channel and the same length as the batch
+	struct ShadedColors
+	{
+		std::span<float> r{};
+		std::span<float> g{};
+		std::span<float> b{};
+	};
+
+	enum class PrimitiveType : unsigned char
+	{
+		None,
+		Sphere,
+		Plane,
+		Triangle
+	};
+
+	//What the intersection loops keep track of, the HitRecord is only built for the closest candidate
+	//primitiveId indexes the scene's sphere/plane span or the triangles of a mesh, instanceId is the mesh index
+	struct HitCandidate
+	{
+		float t = FLT_MAX;
+		uint32_t primitiveId{ UINT32_MAX };
+		uint32_t instanceId{ UINT32_MAX };
+		//Barycentric weights of v1 and v2 for triangle hits
+		float u{};
+		float v{};
+		PrimitiveType type{ PrimitiveType::None };
 	};
 #pragma endregion
 }
\ No newline at end of file
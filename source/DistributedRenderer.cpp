@@ -0,0 +1,429 @@
+#include "DistributedRenderer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "ImageWriter.h"
+#include "Renderer.h"
+#include "Scene.h"
+#include "Socket.h"
+
+namespace dae
+{
+	namespace DistributedRenderer
+	{
+#pragma region Protocol
+		//All messages start with a MessageHeader, payloads are raw little-endian structs
+		constexpr uint32_t PROTOCOL_MAGIC{ 0x4B575452 }; //"RTWK"
+		constexpr uint32_t PROTOCOL_VERSION{ 2 };
+
+		enum class MessageType : uint32_t
+		{
+			Hello, //worker >> coordinator
+			Setup, //coordinator >> worker, followed by the scene filename
+			Tile, //coordinator >> worker
+			TileResult, //worker >> coordinator, followed by width * height * 3 bytes RGB
+			Done //coordinator >> worker
+		};
+
+		struct MessageHeader
+		{
+			uint32_t magic{ PROTOCOL_MAGIC };
+			MessageType type{};
+			uint32_t payloadSize{};
+		};
+
+		struct SetupMessage
+		{
+			uint32_t version{ PROTOCOL_VERSION };
+			int32_t width{};
+			int32_t height{};
+			uint32_t sceneFilenameLength{};
+			int32_t maxBounces{ -1 };
+			int64_t bounceRayBudget{ -1 };
+		};
+
+		struct TileMessage
+		{
+			uint32_t tileId{};
+			int32_t x{};
+			int32_t y{};
+			int32_t width{};
+			int32_t height{};
+		};
+
+		struct TileResultMessage
+		{
+			TileMessage tile{};
+			float renderTime{}; //seconds spent inside RenderTile
+		};
+
+		bool SendMessage(const Socket& socket, MessageType type, const void* pPayload, uint32_t payloadSize, const void* pExtra = nullptr, uint32_t extraSize = 0)
+		{
+			MessageHeader header{};
+			header.type = type;
+			header.payloadSize = payloadSize + extraSize;
+			return socket.SendAll(&header, sizeof(header)) &&
+				(payloadSize == 0 || socket.SendAll(pPayload, payloadSize)) &&
+				(extraSize == 0 || socket.SendAll(pExtra, extraSize));
+		}
+
+		bool ReceiveHeader(const Socket& socket, MessageHeader& header)
+		{
+			return socket.ReceiveAll(&header, sizeof(header)) && header.magic == PROTOCOL_MAGIC;
+		}
+#pragma endregion
+
+#pragma region Coordinator
+		struct Tile
+		{
+			TileMessage message{};
+			bool isDone{};
+			int numAssignments{}; //> 1 once the tile was stolen
+			std::chrono::steady_clock::time_point firstAssigned{};
+		};
+
+		struct WorkerConnection
+		{
+			Socket socket{};
+			std::deque<uint32_t> tilesInFlight{};
+			bool isAlive{ true };
+
+			//Statistics
+			int numTiles{};
+			int numStolenTiles{}; //tiles finished for a slower worker
+			int numWastedTiles{}; //duplicates that arrived after another worker finished the tile
+			uint64_t numPixels{};
+			double renderTime{};
+		};
+
+		//Two tiles per worker keep it busy while a result travels back
+		constexpr size_t MAX_TILES_IN_FLIGHT{ 2 };
+
+		void SpawnLocalWorkers(const CoordinatorSettings& settings)
+		{
+			for (int idx{}; idx < settings.numWorkers; ++idx)
+			{
+				const std::string command{ "\"" + settings.executablePath + "\" --worker " + settings.address };
+				std::thread([command]() { std::system(command.c_str()); }).detach();
+			}
+		}
+
+		bool AssignTile(WorkerConnection& worker, Tile& tile)
+		{
+			if (tile.numAssignments == 0)
+				tile.firstAssigned = std::chrono::steady_clock::now();
+			++tile.numAssignments;
+			worker.tilesInFlight.push_back(tile.message.tileId);
+			return SendMessage(worker.socket, MessageType::Tile, &tile.message, sizeof(tile.message));
+		}
+
+		int RunCoordinator(const CoordinatorSettings& settings)
+		{
+			if (settings.width <= 0 || settings.height <= 0 || settings.tileSize <= 0 || settings.numWorkers <= 0)
+			{
+				std::cout << "Invalid coordinator settings\n";
+				return 1;
+			}
+
+			Socket listenSocket{};
+			if (!listenSocket.Listen(settings.address))
+			{
+				std::cout << "Could not listen on " << settings.address << "\n";
+				return 1;
+			}
+			std::cout << "Coordinator listening on " << settings.address << ", waiting for " << settings.numWorkers << " workers\n";
+
+			if (settings.spawnLocalWorkers)
+				SpawnLocalWorkers(settings);
+
+			//Connect & set up all workers
+			std::vector<std::unique_ptr<WorkerConnection>> workers{};
+			SetupMessage setup{};
+			setup.width = settings.width;
+			setup.height = settings.height;
+			setup.sceneFilenameLength = static_cast<uint32_t>(settings.sceneFilename.size());
+			setup.maxBounces = settings.maxBounces;
+			setup.bounceRayBudget = settings.bounceRayBudget;
+			while (static_cast<int>(workers.size()) < settings.numWorkers)
+			{
+				auto pWorker = std::make_unique<WorkerConnection>();
+				MessageHeader hello{};
+				uint32_t version{};
+				if (!listenSocket.Accept(pWorker->socket) || !ReceiveHeader(pWorker->socket, hello) || hello.type != MessageType::Hello ||
+					hello.payloadSize != sizeof(version) || !pWorker->socket.ReceiveAll(&version, sizeof(version)) || version != PROTOCOL_VERSION)
+				{
+					std::cout << "Rejected a worker connection\n";
+					continue;
+				}
+				if (!SendMessage(pWorker->socket, MessageType::Setup, &setup, sizeof(setup), settings.sceneFilename.data(), setup.sceneFilenameLength))
+					continue;
+
+				workers.push_back(std::move(pWorker));
+				std::cout << "Worker " << workers.size() << "/" << settings.numWorkers << " connected\n";
+			}
+
+			//Split the frame
+			std::vector<Tile> tiles{};
+			for (int y{}; y < settings.height; y += settings.tileSize)
+			{
+				for (int x{}; x < settings.width; x += settings.tileSize)
+				{
+					Tile tile{};
+					tile.message.tileId = static_cast<uint32_t>(tiles.size());
+					tile.message.x = x;
+					tile.message.y = y;
+					tile.message.width = std::min(settings.tileSize, settings.width - x);
+					tile.message.height = std::min(settings.tileSize, settings.height - y);
+					tiles.push_back(tile);
+				}
+			}
+
+			std::deque<uint32_t> pendingTiles{};
+			for (const Tile& tile : tiles)
+				pendingTiles.push_back(tile.message.tileId);
+
+			std::vector<uint8_t> image(static_cast<size_t>(settings.width) * settings.height * 3);
+			std::vector<uint8_t> tilePixels{};
+			size_t numTilesDone{};
+			const auto renderStart{ std::chrono::steady_clock::now() };
+
+			const auto dropWorker = [&](WorkerConnection& worker)
+			{
+				//Its unfinished tiles go back to the front of the queue
+				worker.isAlive = false;
+				worker.socket.Close();
+				for (const uint32_t tileId : worker.tilesInFlight)
+				{
+					if (!tiles[tileId].isDone)
+						pendingTiles.push_front(tileId);
+				}
+				worker.tilesInFlight.clear();
+				std::cout << "Lost a worker, requeued its tiles\n";
+			};
+
+			while (numTilesDone < tiles.size())
+			{
+				//Hand out work: fresh tiles first, once those run out idle workers steal the oldest unfinished tile of someone else
+				for (auto& pWorker : workers)
+				{
+					WorkerConnection& worker = *pWorker;
+					while (worker.isAlive && worker.tilesInFlight.size() < MAX_TILES_IN_FLIGHT)
+					{
+						while (!pendingTiles.empty() && tiles[pendingTiles.front()].isDone)
+							pendingTiles.pop_front();
+
+						Tile* pTile{};
+						if (!pendingTiles.empty())
+						{
+							pTile = &tiles[pendingTiles.front()];
+							pendingTiles.pop_front();
+						}
+						else if (worker.tilesInFlight.empty())
+						{
+							for (Tile& tile : tiles)
+							{
+								const bool isCandidate{ !tile.isDone && tile.numAssignments == 1 };
+								if (isCandidate && (!pTile || tile.firstAssigned < pTile->firstAssigned))
+									pTile = &tile;
+							}
+						}
+
+						if (!pTile)
+							break;
+						if (!AssignTile(worker, *pTile))
+							dropWorker(worker);
+					}
+				}
+
+				std::vector<const Socket*> sockets{};
+				for (const auto& pWorker : workers)
+					sockets.push_back(&pWorker->socket);
+
+				if (std::none_of(workers.begin(), workers.end(), [](const auto& pWorker) { return pWorker->isAlive; }))
+				{
+					std::cout << "All workers are gone, giving up\n";
+					return 1;
+				}
+
+				std::vector<bool> isReadable{};
+				if (!Socket::WaitReadable(sockets, 1000, isReadable))
+					continue;
+
+				for (size_t workerIdx{}; workerIdx < workers.size(); ++workerIdx)
+				{
+					WorkerConnection& worker = *workers[workerIdx];
+					if (!isReadable[workerIdx] || !worker.isAlive)
+						continue;
+
+					MessageHeader header{};
+					TileResultMessage result{};
+					if (!ReceiveHeader(worker.socket, header) || header.type != MessageType::TileResult || header.payloadSize < sizeof(result) ||
+						!worker.socket.ReceiveAll(&result, sizeof(result)) || result.tile.tileId >= tiles.size())
+					{
+						dropWorker(worker);
+						continue;
+					}
+
+					Tile& tile = tiles[result.tile.tileId];
+					const TileMessage& rect = tile.message;
+					const size_t numPixelBytes{ static_cast<size_t>(rect.width) * rect.height * 3 };
+					tilePixels.resize(numPixelBytes);
+					if (header.payloadSize != sizeof(result) + numPixelBytes || !worker.socket.ReceiveAll(tilePixels.data(), numPixelBytes))
+					{
+						dropWorker(worker);
+						continue;
+					}
+
+					const auto it = std::find(worker.tilesInFlight.begin(), worker.tilesInFlight.end(), rect.tileId);
+					if (it != worker.tilesInFlight.end())
+						worker.tilesInFlight.erase(it);
+
+					worker.renderTime += result.renderTime;
+					if (tile.isDone)
+					{
+						++worker.numWastedTiles;
+						continue;
+					}
+
+					tile.isDone = true;
+					++numTilesDone;
+					++worker.numTiles;
+					worker.numPixels += static_cast<uint64_t>(rect.width) * rect.height;
+					if (tile.numAssignments > 1)
+						++worker.numStolenTiles;
+
+					for (int row{}; row < rect.height; ++row)
+					{
+						std::copy_n(tilePixels.data() + static_cast<size_t>(row) * rect.width * 3, rect.width * 3,
+							image.data() + (static_cast<size_t>(rect.y + row) * settings.width + rect.x) * 3);
+					}
+				}
+			}
+
+			const float totalTime{ std::chrono::duration<float>(std::chrono::steady_clock::now() - renderStart).count() };
+
+			for (const auto& pWorker : workers)
+			{
+				if (pWorker->isAlive)
+					SendMessage(pWorker->socket, MessageType::Done, nullptr, 0);
+			}
+
+			//Report
+			std::cout << "Rendered " << settings.width << "x" << settings.height << " in " << tiles.size() << " tiles, " << totalTime << " s\n";
+			for (size_t idx{}; idx < workers.size(); ++idx)
+			{
+				const WorkerConnection& worker = *workers[idx];
+				const double megaPixelsPerSecond{ worker.renderTime > 0.0 ? worker.numPixels / worker.renderTime / 1e6 : 0.0 };
+				std::cout << ">> worker " << idx << ": " << worker.numTiles << " tiles (" << worker.numStolenTiles << " stolen, "
+					<< worker.numWastedTiles << " duplicates), " << worker.numPixels << " px, busy " << std::fixed << std::setprecision(3)
+					<< worker.renderTime << " s, " << megaPixelsPerSecond << " Mpx/s" << std::defaultfloat << "\n";
+			}
+
+			//PNG when asked for, anything else stays PPM
+			ImageFormat format{};
+			const bool isPNG{ ImageWriter::GetFormat(settings.outputFilename, format) && format == ImageFormat::PNG };
+			const bool isWritten{ isPNG ? ImageWriter::WritePNG(settings.outputFilename, settings.width, settings.height, image)
+				: ImageWriter::WritePPM(settings.outputFilename, settings.width, settings.height, image) };
+			if (!isWritten)
+			{
+				std::cout << "Could not write " << settings.outputFilename << "\n";
+				return 1;
+			}
+			std::cout << "Saved " << settings.outputFilename << "\n";
+			return 0;
+		}
+#pragma endregion
+
+#pragma region Worker
+		int RunWorker(const std::string& address)
+		{
+			Socket socket{};
+
+			//The coordinator might still be starting up
+			for (int attempt{}; attempt < 50 && !socket.Connect(address); ++attempt)
+				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+			if (!socket.IsValid())
+			{
+				std::cout << "Could not connect to coordinator at " << address << "\n";
+				return 1;
+			}
+
+			const uint32_t version{ PROTOCOL_VERSION };
+			MessageHeader header{};
+			SetupMessage setup{};
+			if (!SendMessage(socket, MessageType::Hello, &version, sizeof(version)) || !ReceiveHeader(socket, header) ||
+				header.type != MessageType::Setup || header.payloadSize < sizeof(setup) || !socket.ReceiveAll(&setup, sizeof(setup)) ||
+				setup.version != PROTOCOL_VERSION || header.payloadSize != sizeof(setup) + setup.sceneFilenameLength)
+			{
+				std::cout << "Handshake with coordinator failed\n";
+				return 1;
+			}
+
+			std::string sceneFilename(setup.sceneFilenameLength, '\0');
+			if (!sceneFilename.empty() && !socket.ReceiveAll(sceneFilename.data(), sceneFilename.size()))
+				return 1;
+
+			//Load the same scene as the coordinator
+			Scene* const pScene{ CreateScene(sceneFilename) };
+			if (!pScene)
+				return 1;
+
+			//The scene doesn't change between tiles, build its acceleration structures once
+			pScene->PrepareFrame(setup.height);
+
+			const auto pRenderer = new Renderer(setup.width, setup.height);
+			if (setup.maxBounces >= 0)
+				pRenderer->SetMaxBounces(setup.maxBounces);
+			if (setup.bounceRayBudget >= 0)
+				pRenderer->SetBounceRayBudget(static_cast<uint32_t>(std::min<int64_t>(setup.bounceRayBudget, UINT32_MAX)));
+			std::vector<uint8_t> pixels{};
+
+			int exitCode{ 0 };
+			while (true)
+			{
+				TileMessage tile{};
+				if (!ReceiveHeader(socket, header))
+				{
+					exitCode = 1;
+					break;
+				}
+				if (header.type == MessageType::Done)
+					break;
+				if (header.type != MessageType::Tile || header.payloadSize != sizeof(tile) || !socket.ReceiveAll(&tile, sizeof(tile)) ||
+					tile.x < 0 || tile.y < 0 || tile.width <= 0 || tile.height <= 0 || tile.x + tile.width > setup.width || tile.y + tile.height > setup.height)
+				{
+					exitCode = 1;
+					break;
+				}
+
+				pixels.resize(static_cast<size_t>(tile.width) * tile.height * 3);
+				const auto tileStart{ std::chrono::steady_clock::now() };
+				pRenderer->RenderTile(pScene, tile.x, tile.y, tile.width, tile.height, pixels.data());
+
+				TileResultMessage result{};
+				result.tile = tile;
+				result.renderTime = std::chrono::duration<float>(std::chrono::steady_clock::now() - tileStart).count();
+				if (!SendMessage(socket, MessageType::TileResult, &result, sizeof(result), pixels.data(), static_cast<uint32_t>(pixels.size())))
+				{
+					exitCode = 1;
+					break;
+				}
+			}
+
+			delete pRenderer;
+			delete pScene;
+			return exitCode;
+		}
+#pragma endregion
+	}
+}
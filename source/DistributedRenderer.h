@@ -0,0 +1,29 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+namespace dae
+{
+	//Tile based rendering spread over worker processes
+	//The coordinator splits the frame into tiles and hands them out on request, workers render them with Renderer::RenderTile
+	namespace DistributedRenderer
+	{
+		struct CoordinatorSettings
+		{
+			std::string address{ "127.0.0.1:5555" };
+			std::string sceneFilename{}; //empty >> built-in reference scene
+			std::string outputFilename{ "RayTracing_Distributed.ppm" };
+			std::string executablePath{}; //used to spawn local workers
+			int width{ 640 };
+			int height{ 480 };
+			int tileSize{ 32 };
+			int maxBounces{ -1 }; //-1: the renderer's default
+			int64_t bounceRayBudget{ -1 }; //rays per frame, every tile gets the part of it its area covers, -1: the renderer's default
+			int numWorkers{ 2 };
+			bool spawnLocalWorkers{ false };
+		};
+
+		int RunCoordinator(const CoordinatorSettings& settings);
+		int RunWorker(const std::string& address);
+	}
+}
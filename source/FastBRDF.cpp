@@ -0,0 +1,273 @@
+#include "FastBRDF.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+namespace dae
+{
+	namespace FastBRDF
+	{
+		namespace
+		{
+			//One entry of CookTorranceShadeBatch, also the tail of the vector loop
+			void CookTorranceShadeEntry(const CookTorranceConstants& constants, const ColorRGB& albedo, const ShadingBatch& batch, const ShadedColors& colors, size_t idx)
+			{
+				const Vector3 n{ batch.normalX[idx], batch.normalY[idx], batch.normalZ[idx] };
+				const Vector3 v{ batch.viewX[idx], batch.viewY[idx], batch.viewZ[idx] };
+				const Vector3 l{ batch.lightX[idx], batch.lightY[idx], batch.lightZ[idx] };
+				const Vector3 h{ (v + l).Normalized() };
+				const float NdotL{ std::max(Vector3::Dot(n, l), 0.f) };
+				const float NdotV{ std::max(Vector3::Dot(n, v), 0.f) };
+				const float NdotH{ Vector3::Dot(n, h) };
+
+				const float distribution{ NdotH * NdotH * (constants.alphaSquared - 1.f) + 1.f };
+				const float geometryV{ NdotV * (1.f - constants.kDirect) + constants.kDirect };
+				const float geometryL{ NdotL * (1.f - constants.kDirect) + constants.kDirect };
+				const float specular{ constants.alphaSquared / (4.f * PI * distribution * distribution * geometryV * geometryL) };
+				const ColorRGB F{ Fresnel_Schlick(Vector3::Dot(v, h), constants.f0) };
+
+				ColorRGB color{ F * specular };
+				if (!constants.isMetal)
+					color += ColorRGB{ (1.f - F.r) * albedo.r, (1.f - F.g) * albedo.g, (1.f - F.b) * albedo.b } / PI;
+				colors.r[idx] = color.r;
+				colors.g[idx] = color.g;
+				colors.b[idx] = color.b;
+			}
+
+#if defined(__AVX__)
+			//AVX has no 256-bit integer shifts, they go through the two SSE halves
+			__m256i ShiftRight23(__m256i bits)
+			{
+				const __m128i low{ _mm_srli_epi32(_mm256_castsi256_si128(bits), 23) };
+				const __m128i high{ _mm_srli_epi32(_mm256_extractf128_si256(bits, 1), 23) };
+				return _mm256_insertf128_si256(_mm256_castsi128_si256(low), high, 1);
+			}
+
+			__m256i ShiftLeft23(__m256i bits)
+			{
+				const __m128i low{ _mm_slli_epi32(_mm256_castsi256_si128(bits), 23) };
+				const __m128i high{ _mm_slli_epi32(_mm256_extractf128_si256(bits, 1), 23) };
+				return _mm256_insertf128_si256(_mm256_castsi128_si256(low), high, 1);
+			}
+
+			//FastPow for 8 lanes, x <= 0 gives 0
+			__m256 FastPow8(__m256 x, __m256 exponent)
+			{
+				const __m256 one{ _mm256_set1_ps(1.f) };
+
+				//FastLog2
+				const __m256 floatExponent{ _mm256_sub_ps(_mm256_cvtepi32_ps(ShiftRight23(_mm256_castps_si256(x))), _mm256_set1_ps(127.f)) };
+				__m256 mantissa{ _mm256_or_ps(_mm256_and_ps(x, _mm256_castsi256_ps(_mm256_set1_epi32(0x007FFFFF))), one) };
+				const __m256 isHigh{ _mm256_cmp_ps(mantissa, _mm256_set1_ps(1.41421356f), _CMP_GT_OQ) };
+				mantissa = _mm256_mul_ps(mantissa, _mm256_blendv_ps(one, _mm256_set1_ps(0.5f), isHigh));
+				const __m256 t{ _mm256_div_ps(_mm256_sub_ps(mantissa, one), _mm256_add_ps(mantissa, one)) };
+				const __m256 t2{ _mm256_mul_ps(t, t) };
+				__m256 series{ _mm256_add_ps(_mm256_mul_ps(t2, _mm256_set1_ps(2.f / 7.f)), _mm256_set1_ps(2.f / 5.f)) };
+				series = _mm256_add_ps(_mm256_mul_ps(t2, series), _mm256_set1_ps(2.f / 3.f));
+				series = _mm256_add_ps(_mm256_mul_ps(t2, series), _mm256_set1_ps(2.f));
+				series = _mm256_mul_ps(t, series);
+				const __m256 log2{ _mm256_add_ps(_mm256_add_ps(floatExponent, _mm256_and_ps(isHigh, one)), _mm256_mul_ps(series, _mm256_set1_ps(1.44269504f))) };
+
+				//FastExp2, only called with y <= 0 from the cosines here, so only underflow needs a mask
+				const __m256 y{ _mm256_max_ps(_mm256_mul_ps(exponent, log2), _mm256_set1_ps(-127.f)) };
+				const __m256 whole{ _mm256_floor_ps(_mm256_add_ps(y, _mm256_set1_ps(0.5f))) };
+				const __m256 f{ _mm256_mul_ps(_mm256_sub_ps(y, whole), _mm256_set1_ps(0.693147181f)) };
+				__m256 fraction{ _mm256_add_ps(_mm256_mul_ps(f, _mm256_set1_ps(1.f / 120.f)), _mm256_set1_ps(1.f / 24.f)) };
+				fraction = _mm256_add_ps(_mm256_mul_ps(f, fraction), _mm256_set1_ps(1.f / 6.f));
+				fraction = _mm256_add_ps(_mm256_mul_ps(f, fraction), _mm256_set1_ps(0.5f));
+				fraction = _mm256_add_ps(_mm256_mul_ps(f, fraction), one);
+				fraction = _mm256_add_ps(_mm256_mul_ps(f, fraction), one);
+				const __m256 scale{ _mm256_castsi256_ps(ShiftLeft23(_mm256_cvtps_epi32(_mm256_add_ps(whole, _mm256_set1_ps(127.f))))) };
+
+				const __m256 isValid{ _mm256_and_ps(_mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_GT_OQ), _mm256_cmp_ps(y, _mm256_set1_ps(-126.f), _CMP_GE_OQ)) };
+				return _mm256_and_ps(_mm256_mul_ps(fraction, scale), isValid);
+			}
+
+			__m256 Dot8(__m256 ax, __m256 ay, __m256 az, __m256 bx, __m256 by, __m256 bz)
+			{
+				return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, bx), _mm256_mul_ps(ay, by)), _mm256_mul_ps(az, bz));
+			}
+#endif
+		}
+
+		void CookTorranceBatch(const CookTorranceConstants& constants, std::span<const float> NdotL, std::span<const float> NdotV, std::span<const float> NdotH,
+			std::span<const float> VdotH, std::span<float> specular, std::span<float> fresnelWeight)
+		{
+			const size_t count{ specular.size() };
+			size_t first{};
+
+#if defined(__AVX__)
+			constexpr size_t LANE_COUNT{ 8 };
+			const __m256 one{ _mm256_set1_ps(1.f) };
+			const __m256 alphaSquared{ _mm256_set1_ps(constants.alphaSquared) };
+			const __m256 alphaSquaredMinusOne{ _mm256_set1_ps(constants.alphaSquared - 1.f) };
+			const __m256 kDirect{ _mm256_set1_ps(constants.kDirect) };
+			const __m256 oneMinusK{ _mm256_set1_ps(1.f - constants.kDirect) };
+			const __m256 fourPi{ _mm256_set1_ps(4.f * PI) };
+			for (; first + LANE_COUNT <= count; first += LANE_COUNT)
+			{
+				const __m256 nl{ _mm256_loadu_ps(NdotL.data() + first) };
+				const __m256 nv{ _mm256_loadu_ps(NdotV.data() + first) };
+				const __m256 nh{ _mm256_loadu_ps(NdotH.data() + first) };
+				const __m256 vh{ _mm256_loadu_ps(VdotH.data() + first) };
+
+				//D = a2 / (PI * (NdotH^2 (a2 - 1) + 1)^2)
+				const __m256 distribution{ _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(nh, nh), alphaSquaredMinusOne), one) };
+				//G = NdotV / (NdotV (1 - k) + k) * NdotL / (NdotL (1 - k) + k)
+				const __m256 geometryV{ _mm256_add_ps(_mm256_mul_ps(nv, oneMinusK), kDirect) };
+				const __m256 geometryL{ _mm256_add_ps(_mm256_mul_ps(nl, oneMinusK), kDirect) };
+				//D * G / (4 NdotL NdotV), the NdotL and NdotV of G cancel against the denominator
+				const __m256 denominator{ _mm256_mul_ps(_mm256_mul_ps(fourPi, _mm256_mul_ps(distribution, distribution)), _mm256_mul_ps(geometryV, geometryL)) };
+				_mm256_storeu_ps(specular.data() + first, _mm256_div_ps(alphaSquared, denominator));
+
+				const __m256 x{ _mm256_sub_ps(one, vh) };
+				const __m256 x2{ _mm256_mul_ps(x, x) };
+				_mm256_storeu_ps(fresnelWeight.data() + first, _mm256_mul_ps(_mm256_mul_ps(x2, x2), x));
+			}
+#endif
+
+			for (size_t idx{ first }; idx < count; ++idx)
+			{
+				const float distribution{ NdotH[idx] * NdotH[idx] * (constants.alphaSquared - 1.f) + 1.f };
+				const float geometryV{ NdotV[idx] * (1.f - constants.kDirect) + constants.kDirect };
+				const float geometryL{ NdotL[idx] * (1.f - constants.kDirect) + constants.kDirect };
+				specular[idx] = constants.alphaSquared / (4.f * PI * distribution * distribution * geometryV * geometryL);
+				fresnelWeight[idx] = Pow5(1.f - VdotH[idx]);
+			}
+		}
+
+		void LambertPhongBatch(const ColorRGB& diffuse, float ks, float exponent, uint32_t integerExponent, const ShadingBatch& batch, const ShadedColors& colors)
+		{
+			const size_t count{ batch.GetSize() };
+			size_t first{};
+
+#if defined(__AVX__)
+			constexpr size_t LANE_COUNT{ 8 };
+			const __m256 two{ _mm256_set1_ps(2.f) };
+			const __m256 specularReflectance{ _mm256_set1_ps(ks) };
+			const __m256 phongExponent{ _mm256_set1_ps(exponent) };
+			for (; first + LANE_COUNT <= count; first += LANE_COUNT)
+			{
+				const __m256 nx{ _mm256_loadu_ps(batch.normalX.data() + first) };
+				const __m256 ny{ _mm256_loadu_ps(batch.normalY.data() + first) };
+				const __m256 nz{ _mm256_loadu_ps(batch.normalZ.data() + first) };
+				const __m256 lx{ _mm256_loadu_ps(batch.lightX.data() + first) };
+				const __m256 ly{ _mm256_loadu_ps(batch.lightY.data() + first) };
+				const __m256 lz{ _mm256_loadu_ps(batch.lightZ.data() + first) };
+
+				//reflect(l, n) against -v
+				const __m256 twoNdotL{ _mm256_mul_ps(two, Dot8(nx, ny, nz, lx, ly, lz)) };
+				const __m256 reflectX{ _mm256_sub_ps(lx, _mm256_mul_ps(twoNdotL, nx)) };
+				const __m256 reflectY{ _mm256_sub_ps(ly, _mm256_mul_ps(twoNdotL, ny)) };
+				const __m256 reflectZ{ _mm256_sub_ps(lz, _mm256_mul_ps(twoNdotL, nz)) };
+				const __m256 RdotV{ Dot8(reflectX, reflectY, reflectZ,
+					_mm256_loadu_ps(batch.viewX.data() + first), _mm256_loadu_ps(batch.viewY.data() + first), _mm256_loadu_ps(batch.viewZ.data() + first)) };
+				const __m256 cosine{ _mm256_max_ps(_mm256_sub_ps(_mm256_setzero_ps(), RdotV), _mm256_setzero_ps()) };
+
+				__m256 lobe{};
+				if (integerExponent > 0)
+				{
+					//PowInt, every lane has the same exponent
+					lobe = _mm256_set1_ps(1.f);
+					__m256 power{ cosine };
+					for (uint32_t remaining{ integerExponent }; remaining > 0; remaining >>= 1)
+					{
+						if (remaining & 1)
+							lobe = _mm256_mul_ps(lobe, power);
+						power = _mm256_mul_ps(power, power);
+					}
+				}
+				else
+				{
+					lobe = FastPow8(cosine, phongExponent);
+				}
+
+				const __m256 specular{ _mm256_mul_ps(specularReflectance, lobe) };
+				_mm256_storeu_ps(colors.r.data() + first, _mm256_add_ps(_mm256_set1_ps(diffuse.r), specular));
+				_mm256_storeu_ps(colors.g.data() + first, _mm256_add_ps(_mm256_set1_ps(diffuse.g), specular));
+				_mm256_storeu_ps(colors.b.data() + first, _mm256_add_ps(_mm256_set1_ps(diffuse.b), specular));
+			}
+#endif
+
+			for (size_t idx{ first }; idx < count; ++idx)
+			{
+				const Vector3 n{ batch.normalX[idx], batch.normalY[idx], batch.normalZ[idx] };
+				const Vector3 v{ batch.viewX[idx], batch.viewY[idx], batch.viewZ[idx] };
+				const Vector3 l{ batch.lightX[idx], batch.lightY[idx], batch.lightZ[idx] };
+				const float specular{ Phong(ks, exponent, integerExponent, l, -v, n) };
+				colors.r[idx] = diffuse.r + specular;
+				colors.g[idx] = diffuse.g + specular;
+				colors.b[idx] = diffuse.b + specular;
+			}
+		}
+
+		void CookTorranceShadeBatch(const CookTorranceConstants& constants, const ColorRGB& albedo, const ShadingBatch& batch, const ShadedColors& colors)
+		{
+			const size_t count{ batch.GetSize() };
+			size_t first{};
+
+#if defined(__AVX__)
+			constexpr size_t LANE_COUNT{ 8 };
+			const __m256 zero{ _mm256_setzero_ps() };
+			const __m256 one{ _mm256_set1_ps(1.f) };
+			const __m256 alphaSquared{ _mm256_set1_ps(constants.alphaSquared) };
+			const __m256 alphaSquaredMinusOne{ _mm256_set1_ps(constants.alphaSquared - 1.f) };
+			const __m256 kDirect{ _mm256_set1_ps(constants.kDirect) };
+			const __m256 oneMinusK{ _mm256_set1_ps(1.f - constants.kDirect) };
+			const __m256 fourPi{ _mm256_set1_ps(4.f * PI) };
+			//Lambert with kd = 1 - F, zero for metals
+			const float diffuseWeight{ constants.isMetal ? 0.f : 1.f / PI };
+			const __m256 f0[3]{ _mm256_set1_ps(constants.f0.r), _mm256_set1_ps(constants.f0.g), _mm256_set1_ps(constants.f0.b) };
+			const __m256 diffuse[3]{ _mm256_set1_ps(albedo.r * diffuseWeight), _mm256_set1_ps(albedo.g * diffuseWeight), _mm256_set1_ps(albedo.b * diffuseWeight) };
+			float* const pOutputs[3]{ colors.r.data(), colors.g.data(), colors.b.data() };
+			for (; first + LANE_COUNT <= count; first += LANE_COUNT)
+			{
+				const __m256 nx{ _mm256_loadu_ps(batch.normalX.data() + first) };
+				const __m256 ny{ _mm256_loadu_ps(batch.normalY.data() + first) };
+				const __m256 nz{ _mm256_loadu_ps(batch.normalZ.data() + first) };
+				const __m256 vx{ _mm256_loadu_ps(batch.viewX.data() + first) };
+				const __m256 vy{ _mm256_loadu_ps(batch.viewY.data() + first) };
+				const __m256 vz{ _mm256_loadu_ps(batch.viewZ.data() + first) };
+				const __m256 lx{ _mm256_loadu_ps(batch.lightX.data() + first) };
+				const __m256 ly{ _mm256_loadu_ps(batch.lightY.data() + first) };
+				const __m256 lz{ _mm256_loadu_ps(batch.lightZ.data() + first) };
+
+				__m256 hx{ _mm256_add_ps(vx, lx) };
+				__m256 hy{ _mm256_add_ps(vy, ly) };
+				__m256 hz{ _mm256_add_ps(vz, lz) };
+				const __m256 inverseLength{ _mm256_div_ps(one, _mm256_sqrt_ps(Dot8(hx, hy, hz, hx, hy, hz))) };
+				hx = _mm256_mul_ps(hx, inverseLength);
+				hy = _mm256_mul_ps(hy, inverseLength);
+				hz = _mm256_mul_ps(hz, inverseLength);
+
+				const __m256 nl{ _mm256_max_ps(Dot8(nx, ny, nz, lx, ly, lz), zero) };
+				const __m256 nv{ _mm256_max_ps(Dot8(nx, ny, nz, vx, vy, vz), zero) };
+				const __m256 nh{ Dot8(nx, ny, nz, hx, hy, hz) };
+				const __m256 vh{ Dot8(vx, vy, vz, hx, hy, hz) };
+
+				//Same terms as CookTorranceBatch
+				const __m256 distribution{ _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(nh, nh), alphaSquaredMinusOne), one) };
+				const __m256 geometryV{ _mm256_add_ps(_mm256_mul_ps(nv, oneMinusK), kDirect) };
+				const __m256 geometryL{ _mm256_add_ps(_mm256_mul_ps(nl, oneMinusK), kDirect) };
+				const __m256 denominator{ _mm256_mul_ps(_mm256_mul_ps(fourPi, _mm256_mul_ps(distribution, distribution)), _mm256_mul_ps(geometryV, geometryL)) };
+				const __m256 specular{ _mm256_div_ps(alphaSquared, denominator) };
+
+				const __m256 x{ _mm256_sub_ps(one, vh) };
+				const __m256 x2{ _mm256_mul_ps(x, x) };
+				const __m256 fresnelWeight{ _mm256_mul_ps(_mm256_mul_ps(x2, x2), x) };
+
+				for (int channel{}; channel < 3; ++channel)
+				{
+					const __m256 F{ _mm256_add_ps(f0[channel], _mm256_mul_ps(_mm256_sub_ps(one, f0[channel]), fresnelWeight)) };
+					const __m256 color{ _mm256_add_ps(_mm256_mul_ps(F, specular), _mm256_mul_ps(_mm256_sub_ps(one, F), diffuse[channel])) };
+					_mm256_storeu_ps(pOutputs[channel] + first, color);
+				}
+			}
+#endif
+
+			for (size_t idx{ first }; idx < count; ++idx)
+				CookTorranceShadeEntry(constants, albedo, batch, colors, idx);
+		}
+	}
+}
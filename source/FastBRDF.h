@@ -0,0 +1,174 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include "DataTypes.h"
+#include "Math.h"
+
+namespace dae
+{
+	//Fast versions of the BRDF terms in BRDFs.h, the shading path of the materials
+	//Per material constants are computed once (CookTorranceConstants), small integer powers are multiplies
+	//FastPow is a polynomial log2/exp2 (~1e-5 relative error) for the batched paths, where std::pow can't be vectorized,
+	//a single scalar powf from the C library is about as fast
+	//Vectors are expected normalized, unlike the reference versions these don't normalize them again
+	//Benchmarks::BRDFAccuracy checks both against each other with tolerances (RayTracerBench --brdf, RayTracer --brdf-accuracy)
+	namespace FastBRDF
+	{
+		//Everything Cook-Torrance needs that only depends on the material
+		struct CookTorranceConstants
+		{
+			ColorRGB f0{};
+			float alphaSquared{}; //roughness^4, the GGX alpha squared (UE4 remapping alpha = roughness^2)
+			float kDirect{}; //Schlick-GGX k for direct lighting, (alpha + 1)^2 / 8
+			bool isMetal{};
+
+			static CookTorranceConstants Create(const ColorRGB& albedo, float metalness, float roughness)
+			{
+				const float alpha{ roughness * roughness };
+				CookTorranceConstants constants{};
+				constants.isMetal = metalness > 0.f;
+				constants.f0 = constants.isMetal ? albedo : ColorRGB{ 0.04f, 0.04f, 0.04f };
+				constants.alphaSquared = alpha * alpha;
+				constants.kDirect = (alpha + 1.f) * (alpha + 1.f) / 8.f;
+				return constants;
+			}
+		};
+
+		inline float Pow5(float x)
+		{
+			const float x2{ x * x };
+			return x2 * x2 * x;
+		}
+
+		//Exponentiation by squaring
+		inline float PowInt(float x, uint32_t exponent)
+		{
+			float result{ 1.f };
+			while (exponent > 0)
+			{
+				if (exponent & 1)
+					result *= x;
+				x *= x;
+				exponent >>= 1;
+			}
+			return result;
+		}
+
+		//log2 for x > 0, the mantissa is brought into [sqrt(1/2), sqrt(2)) and goes through the atanh series
+		inline float FastLog2(float x)
+		{
+			uint32_t bits{};
+			std::memcpy(&bits, &x, sizeof(bits));
+			int exponent{ static_cast<int>((bits >> 23) & 0xFF) - 127 };
+			bits = (bits & 0x007FFFFFu) | 0x3F800000u;
+			float mantissa{};
+			std::memcpy(&mantissa, &bits, sizeof(mantissa));
+			//Branchless, the comparison is a coin flip for random input
+			const bool isHigh{ mantissa > 1.41421356f };
+			mantissa *= isHigh ? 0.5f : 1.f;
+			exponent += isHigh;
+
+			const float t{ (mantissa - 1.f) / (mantissa + 1.f) };
+			const float t2{ t * t };
+			const float series{ t * (2.f + t2 * (2.f / 3.f + t2 * (2.f / 5.f + t2 * (2.f / 7.f)))) };
+			return exponent + series * 1.44269504f;
+		}
+
+		//2^y, the fraction goes through a degree 5 Taylor polynomial of e^(f ln2) for f in [-0.5, 0.5]
+		inline float FastExp2(float y)
+		{
+			if (y < -126.f)
+				return 0.f;
+			if (y > 127.f)
+				return INFINITY;
+
+			const float whole{ std::floor(y + 0.5f) };
+			const float f{ (y - whole) * 0.693147181f };
+			const float fraction{ 1.f + f * (1.f + f * (0.5f + f * (1.f / 6.f + f * (1.f / 24.f + f * (1.f / 120.f))))) };
+			const uint32_t scaleBits{ static_cast<uint32_t>(static_cast<int>(whole) + 127) << 23 };
+			float scale{};
+			std::memcpy(&scale, &scaleBits, sizeof(scale));
+			return fraction * scale;
+		}
+
+		//x^exponent for x >= 0
+		inline float FastPow(float x, float exponent)
+		{
+			return x > 0.f ? FastExp2(exponent * FastLog2(x)) : 0.f;
+		}
+
+		//Schlick with cosine = dot(h, v)
+		inline ColorRGB Fresnel_Schlick(float cosine, const ColorRGB& f0)
+		{
+			const float weight{ Pow5(1.f - cosine) };
+			return { f0.r + (1.f - f0.r) * weight, f0.g + (1.f - f0.g) * weight, f0.b + (1.f - f0.b) * weight };
+		}
+
+		inline float NormalDistribution_GGX(float NdotH, float alphaSquared)
+		{
+			const float denominator{ NdotH * NdotH * (alphaSquared - 1.f) + 1.f };
+			return alphaSquared / (PI * denominator * denominator);
+		}
+
+		inline float Geometry_SchlickGGX(float NdotX, float kDirect)
+		{
+			return NdotX / (NdotX * (1.f - kDirect) + kDirect);
+		}
+
+		inline float Geometry_Smith(float NdotV, float NdotL, float kDirect)
+		{
+			return Geometry_SchlickGGX(NdotV, kDirect) * Geometry_SchlickGGX(NdotL, kDirect);
+		}
+
+		//Full Cook-Torrance of Material_CookTorrence::Shade, Lambert with kd = 1 - F added for dielectrics
+		inline ColorRGB CookTorrance(const CookTorranceConstants& constants, const ColorRGB& albedo, const Vector3& n, const Vector3& l, const Vector3& v)
+		{
+			const Vector3 h{ (v + l).Normalized() };
+			const float NdotV{ Vector3::Dot(n, v) };
+			const float NdotL{ Vector3::Dot(n, l) };
+
+			const ColorRGB F{ Fresnel_Schlick(Vector3::Dot(h, v), constants.f0) };
+			const float D{ NormalDistribution_GGX(Vector3::Dot(n, h), constants.alphaSquared) };
+			const float G{ Geometry_Smith(NdotV, NdotL, constants.kDirect) };
+			const float denominator{ 4 * std::max(0.f, NdotV) * std::max(0.f, NdotL) };
+			const ColorRGB cookTorrance{ F * (D * G / denominator) };
+
+			if (constants.isMetal)
+				return cookTorrance;
+
+			const ColorRGB kd{ 1 - F.r, 1 - F.g, 1 - F.b };
+			return ColorRGB{ kd * albedo } / PI + cookTorrance;
+		}
+
+		//Phong lobe ks * max(dot(reflect(l, n), v), 0)^exponent, integerExponent > 0 replaces the pow by multiplies
+		//Clamped unlike the reference, which returns NaN or a negative lobe when the reflection points away from v
+		inline float Phong(float ks, float exponent, uint32_t integerExponent, const Vector3& l, const Vector3& v, const Vector3& n)
+		{
+			const float NdotL{ n.x * l.x + n.y * l.y + n.z * l.z };
+			const float reflectX{ l.x - 2.f * NdotL * n.x };
+			const float reflectY{ l.y - 2.f * NdotL * n.y };
+			const float reflectZ{ l.z - 2.f * NdotL * n.z };
+			const float cosine{ std::max(reflectX * v.x + reflectY * v.y + reflectZ * v.z, 0.f) };
+			return ks * (integerExponent > 0 ? PowInt(cosine, integerExponent) : std::pow(cosine, exponent));
+		}
+
+		//Exponent as an integer when it is one (and small enough for squaring to pay off), 0 otherwise
+		inline uint32_t GetIntegerExponent(float exponent)
+		{
+			return exponent >= 1.f && exponent <= 1024.f && std::floor(exponent) == exponent ? static_cast<uint32_t>(exponent) : 0u;
+		}
+
+		//Batch of Cook-Torrance evaluations of one material, all spans the same length
+		//Writes the specular D * G / (4 NdotL NdotV) and the Schlick weight (1 - VdotH)^5 per entry, F = f0 + (1 - f0) * weight
+		//8 entries per iteration with AVX, scalar loop otherwise
+		void CookTorranceBatch(const CookTorranceConstants& constants, std::span<const float> NdotL, std::span<const float> NdotV, std::span<const float> NdotH,
+			std::span<const float> VdotH, std::span<float> specular, std::span<float> fresnelWeight);
+
+		//Whole materials over a ShadingBatch, the batched counterparts of Material::Shade
+		//Phong gets -view like Material_LambertPhong::Shade, fractional exponents use FastPow in the vector loop
+		void LambertPhongBatch(const ColorRGB& diffuse, float ks, float exponent, uint32_t integerExponent, const ShadingBatch& batch, const ShadedColors& colors);
+		//NdotV and NdotL are clamped to 0, so a normal facing away from the viewer doesn't divide by zero like the scalar Shade
+		void CookTorranceShadeBatch(const CookTorranceConstants& constants, const ColorRGB& albedo, const ShadingBatch& batch, const ShadedColors& colors);
+	}
+}
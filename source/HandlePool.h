@@ -0,0 +1,176 @@
+#pragma once
+#include <cassert>
+#include <cstdint>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+#include "MemoryArena.h"
+
+namespace dae
+{
+	//Reference to an object in a HandlePool
+	//The generation is bumped whenever a slot is reused, so stale handles resolve to nullptr instead of another object
+	template<typename T>
+	struct Handle
+	{
+		static constexpr uint32_t INVALID_INDEX{ UINT32_MAX };
+
+		uint32_t index{ INVALID_INDEX };
+		uint32_t generation{};
+
+		bool IsValid() const { return index != INVALID_INDEX; }
+		bool operator==(const Handle& other) const = default;
+	};
+
+	//Densely packed object storage backed by a MemoryArena
+	//Objects are iterated as one contiguous array, handles stay valid when other objects are added or removed
+	//Raw pointers (Get, begin/end) are only stable until the next Add/Remove
+	template<typename T>
+	class HandlePool final
+	{
+	public:
+		explicit HandlePool(MemoryArena& arena):
+			m_Arena{ arena }
+		{
+		}
+
+		~HandlePool()
+		{
+			if constexpr (!std::is_trivially_destructible_v<T>)
+			{
+				for (uint32_t idx{}; idx < m_Size; ++idx)
+					m_pObjects[idx].~T();
+			}
+		}
+
+		HandlePool(const HandlePool&) = delete;
+		HandlePool(HandlePool&&) noexcept = delete;
+		HandlePool& operator=(const HandlePool&) = delete;
+		HandlePool& operator=(HandlePool&&) noexcept = delete;
+
+		void Reserve(size_t capacity)
+		{
+			if (capacity <= m_Capacity)
+				return;
+
+			const uint32_t newCapacity{ static_cast<uint32_t>(capacity) };
+
+			//The old arrays stay behind in the arena, growing geometrically keeps that waste bounded
+			T* pObjects = m_Arena.AllocateArray<T>(newCapacity);
+			uint32_t* pObjectSlots = m_Arena.AllocateArray<uint32_t>(newCapacity);
+			Slot* pSlots = m_Arena.AllocateArray<Slot>(newCapacity);
+
+			for (uint32_t idx{}; idx < m_Size; ++idx)
+			{
+				new (&pObjects[idx]) T(std::move(m_pObjects[idx]));
+				if constexpr (!std::is_trivially_destructible_v<T>)
+					m_pObjects[idx].~T();
+				pObjectSlots[idx] = m_pObjectSlots[idx];
+			}
+			for (uint32_t idx{}; idx < m_NumSlots; ++idx)
+				pSlots[idx] = m_pSlots[idx];
+
+			m_pObjects = pObjects;
+			m_pObjectSlots = pObjectSlots;
+			m_pSlots = pSlots;
+			m_Capacity = newCapacity;
+		}
+
+		template<typename... Args>
+		Handle<T> Add(Args&&... args)
+		{
+			if (m_Size == m_Capacity)
+				Reserve(m_Capacity ? 2 * size_t{ m_Capacity } : 16);
+
+			//Reuse a freed slot if there is one
+			uint32_t slotIndex{ m_FreeSlot };
+			if (slotIndex != Handle<T>::INVALID_INDEX)
+			{
+				m_FreeSlot = m_pSlots[slotIndex].objectIndex;
+			}
+			else
+			{
+				slotIndex = m_NumSlots++;
+				m_pSlots[slotIndex].generation = 0;
+			}
+
+			new (&m_pObjects[m_Size]) T(std::forward<Args>(args)...);
+			m_pObjectSlots[m_Size] = slotIndex;
+			m_pSlots[slotIndex].objectIndex = m_Size;
+			++m_Size;
+
+			return { slotIndex, m_pSlots[slotIndex].generation };
+		}
+
+		bool Remove(Handle<T> handle)
+		{
+			if (!IsAlive(handle))
+				return false;
+
+			//Move the last object into the hole to keep the array dense
+			Slot& slot = m_pSlots[handle.index];
+			const uint32_t lastIndex{ m_Size - 1 };
+			if (slot.objectIndex != lastIndex)
+			{
+				m_pObjects[slot.objectIndex] = std::move(m_pObjects[lastIndex]);
+				m_pObjectSlots[slot.objectIndex] = m_pObjectSlots[lastIndex];
+				m_pSlots[m_pObjectSlots[lastIndex]].objectIndex = slot.objectIndex;
+			}
+			if constexpr (!std::is_trivially_destructible_v<T>)
+				m_pObjects[lastIndex].~T();
+			--m_Size;
+
+			++slot.generation;
+			slot.objectIndex = m_FreeSlot;
+			m_FreeSlot = handle.index;
+			return true;
+		}
+
+		bool IsAlive(Handle<T> handle) const
+		{
+			return handle.index < m_NumSlots && m_pSlots[handle.index].generation == handle.generation &&
+				m_pSlots[handle.index].objectIndex < m_Size && m_pObjectSlots[m_pSlots[handle.index].objectIndex] == handle.index;
+		}
+
+		T* Get(Handle<T> handle)
+		{
+			return IsAlive(handle) ? &m_pObjects[m_pSlots[handle.index].objectIndex] : nullptr;
+		}
+
+		const T* Get(Handle<T> handle) const
+		{
+			return IsAlive(handle) ? &m_pObjects[m_pSlots[handle.index].objectIndex] : nullptr;
+		}
+
+		size_t size() const { return m_Size; }
+		bool empty() const { return m_Size == 0; }
+
+		T& operator[](size_t index) { assert(index < m_Size); return m_pObjects[index]; }
+		const T& operator[](size_t index) const { assert(index < m_Size); return m_pObjects[index]; }
+
+		T* begin() { return m_pObjects; }
+		T* end() { return m_pObjects + m_Size; }
+		const T* begin() const { return m_pObjects; }
+		const T* end() const { return m_pObjects + m_Size; }
+
+		std::span<T> GetSpan() { return { m_pObjects, m_Size }; }
+		std::span<const T> GetSpan() const { return { m_pObjects, m_Size }; }
+
+	private:
+		struct Slot
+		{
+			uint32_t objectIndex{}; //next free slot while the slot is unused
+			uint32_t generation{};
+		};
+
+		MemoryArena& m_Arena;
+		T* m_pObjects{};
+		uint32_t* m_pObjectSlots{};
+		Slot* m_pSlots{};
+		uint32_t m_Size{};
+		uint32_t m_Capacity{};
+		uint32_t m_NumSlots{};
+		uint32_t m_FreeSlot{ Handle<T>::INVALID_INDEX };
+	};
+}
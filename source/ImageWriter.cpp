@@ -0,0 +1,567 @@
+#include "ImageWriter.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "Parallel.h"
+
+namespace dae
+{
+	namespace
+	{
+#pragma region Deflate
+		//Deflate with the fixed Huffman codes of RFC 1951 and a hash chain LZ77 matcher
+		//The image is cut into chunks that are compressed in parallel; a chunk may still reference the 32KB before it,
+		//since the decompressor has that output anyway, and ends on a byte boundary so the streams can simply be concatenated
+		constexpr int WINDOW_SIZE{ 32768 };
+		constexpr int HASH_BITS{ 15 };
+		constexpr int MAX_CHAIN_LENGTH{ 32 };
+		constexpr int MIN_MATCH{ 3 };
+		constexpr int MAX_MATCH{ 258 };
+		constexpr size_t CHUNK_SIZE{ 128 * 1024 };
+
+		constexpr uint16_t LENGTH_BASES[29]{ 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+		constexpr uint8_t LENGTH_EXTRA_BITS[29]{ 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+		constexpr uint16_t DISTANCE_BASES[30]{ 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+			8193, 12289, 16385, 24577 };
+		constexpr uint8_t DISTANCE_EXTRA_BITS[30]{ 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+		class BitWriter final
+		{
+		public:
+			explicit BitWriter(std::vector<uint8_t>& output) : m_Output{ output } {}
+
+			//Plain values go least significant bit first
+			void Write(uint32_t value, int numBits)
+			{
+				m_Bits |= static_cast<uint64_t>(value) << m_NumBits;
+				m_NumBits += numBits;
+				while (m_NumBits >= 8)
+				{
+					m_Output.push_back(static_cast<uint8_t>(m_Bits));
+					m_Bits >>= 8;
+					m_NumBits -= 8;
+				}
+			}
+			//Huffman codes go most significant bit first
+			void WriteCode(uint32_t code, int numBits)
+			{
+				uint32_t reversed{};
+				for (int bit{}; bit < numBits; ++bit)
+					reversed |= ((code >> bit) & 1) << (numBits - 1 - bit);
+				Write(reversed, numBits);
+			}
+			void AlignToByte()
+			{
+				if (m_NumBits > 0)
+					Write(0, 8 - m_NumBits);
+			}
+
+		private:
+			std::vector<uint8_t>& m_Output;
+			uint64_t m_Bits{};
+			int m_NumBits{};
+		};
+
+		void WriteSymbol(BitWriter& writer, uint32_t symbol)
+		{
+			if (symbol < 144)
+				writer.WriteCode(0x30 + symbol, 8);
+			else if (symbol < 256)
+				writer.WriteCode(0x190 + symbol - 144, 9);
+			else if (symbol < 280)
+				writer.WriteCode(symbol - 256, 7);
+			else
+				writer.WriteCode(0xC0 + symbol - 280, 8);
+		}
+
+		void WriteMatch(BitWriter& writer, int length, int distance)
+		{
+			const int lengthCode{ static_cast<int>(std::upper_bound(std::begin(LENGTH_BASES), std::end(LENGTH_BASES), length) - std::begin(LENGTH_BASES)) - 1 };
+			WriteSymbol(writer, 257 + lengthCode);
+			writer.Write(length - LENGTH_BASES[lengthCode], LENGTH_EXTRA_BITS[lengthCode]);
+
+			const int distanceCode{ static_cast<int>(std::upper_bound(std::begin(DISTANCE_BASES), std::end(DISTANCE_BASES), distance) - std::begin(DISTANCE_BASES)) - 1 };
+			writer.WriteCode(distanceCode, 5);
+			writer.Write(distance - DISTANCE_BASES[distanceCode], DISTANCE_EXTRA_BITS[distanceCode]);
+		}
+
+		//Compresses data[begin, end) into one fixed Huffman block, matches may reach back into the window before begin
+		void DeflateChunk(std::span<const uint8_t> data, size_t begin, size_t end, bool isLast, std::vector<uint8_t>& output)
+		{
+			std::vector<int32_t> head(size_t{ 1 } << HASH_BITS, -1);
+			std::vector<int32_t> previous(WINDOW_SIZE, -1);
+			const auto insert = [&](size_t position)
+			{
+				if (position + MIN_MATCH > data.size())
+					return;
+				const uint32_t hash{ ((data[position] << 16 | data[position + 1] << 8 | data[position + 2]) * 2654435761u) >> (32 - HASH_BITS) };
+				previous[position & (WINDOW_SIZE - 1)] = head[hash];
+				head[hash] = static_cast<int32_t>(position);
+			};
+			const auto getHead = [&](size_t position)
+			{
+				const uint32_t hash{ ((data[position] << 16 | data[position + 1] << 8 | data[position + 2]) * 2654435761u) >> (32 - HASH_BITS) };
+				return head[hash];
+			};
+
+			for (size_t position{ begin > WINDOW_SIZE ? begin - WINDOW_SIZE : 0 }; position < begin; ++position)
+				insert(position);
+
+			BitWriter writer{ output };
+			writer.Write(isLast ? 1 : 0, 1);
+			writer.Write(1, 2); //fixed Huffman codes
+
+			size_t position{ begin };
+			while (position < end)
+			{
+				const int maxLength{ static_cast<int>(std::min<size_t>(MAX_MATCH, end - position)) };
+				int bestLength{};
+				int bestDistance{};
+				if (maxLength >= MIN_MATCH)
+				{
+					int32_t candidate{ getHead(position) };
+					for (int chain{}; chain < MAX_CHAIN_LENGTH && candidate >= 0; ++chain)
+					{
+						const size_t distance{ position - candidate };
+						if (distance > WINDOW_SIZE)
+							break;
+
+						int length{};
+						while (length < maxLength && data[candidate + length] == data[position + length])
+							++length;
+						if (length > bestLength)
+						{
+							bestLength = length;
+							bestDistance = static_cast<int>(distance);
+							if (length == maxLength)
+								break;
+						}
+						candidate = previous[candidate & (WINDOW_SIZE - 1)];
+					}
+				}
+
+				if (bestLength >= MIN_MATCH)
+				{
+					WriteMatch(writer, bestLength, bestDistance);
+					for (int offset{}; offset < bestLength; ++offset)
+						insert(position + offset);
+					position += bestLength;
+				}
+				else
+				{
+					WriteSymbol(writer, data[position]);
+					insert(position);
+					++position;
+				}
+			}
+			WriteSymbol(writer, 256); //end of block
+
+			//An empty stored block brings the next chunk onto a byte boundary
+			if (!isLast)
+			{
+				writer.Write(0, 3);
+				writer.AlignToByte();
+				output.insert(output.end(), { 0x00, 0x00, 0xFF, 0xFF });
+			}
+			writer.AlignToByte();
+		}
+
+		uint32_t GetAdler32(std::span<const uint8_t> data)
+		{
+			constexpr uint32_t MODULO{ 65521 };
+			constexpr size_t MAX_RUN{ 5552 }; //longest run before the sums can overflow
+			uint32_t a{ 1 };
+			uint32_t b{};
+			for (size_t first{}; first < data.size(); first += MAX_RUN)
+			{
+				const size_t last{ std::min(first + MAX_RUN, data.size()) };
+				for (size_t idx{ first }; idx < last; ++idx)
+				{
+					a += data[idx];
+					b += a;
+				}
+				a %= MODULO;
+				b %= MODULO;
+			}
+			return (b << 16) | a;
+		}
+
+		//zlib stream: header, concatenated chunks, Adler-32 of the uncompressed data
+		std::vector<uint8_t> Compress(std::span<const uint8_t> data)
+		{
+			const size_t numChunks{ std::max<size_t>((data.size() + CHUNK_SIZE - 1) / CHUNK_SIZE, 1) };
+			std::vector<std::vector<uint8_t>> chunks(numChunks);
+			Parallel::For(size_t{}, numChunks, [&](size_t chunk)
+			{
+				const size_t begin{ chunk * CHUNK_SIZE };
+				DeflateChunk(data, begin, std::min(begin + CHUNK_SIZE, data.size()), chunk + 1 == numChunks, chunks[chunk]);
+			}, 1);
+
+			std::vector<uint8_t> stream{ 0x78, 0x01 };
+			for (const std::vector<uint8_t>& chunk : chunks)
+				stream.insert(stream.end(), chunk.begin(), chunk.end());
+			const uint32_t adler{ GetAdler32(data) };
+			stream.insert(stream.end(), { static_cast<uint8_t>(adler >> 24), static_cast<uint8_t>(adler >> 16), static_cast<uint8_t>(adler >> 8), static_cast<uint8_t>(adler) });
+			return stream;
+		}
+#pragma endregion
+
+#pragma region PNG
+		uint32_t GetCRC32(std::span<const uint8_t> data, uint32_t crc = 0)
+		{
+			static const std::array<uint32_t, 256> table = []
+			{
+				std::array<uint32_t, 256> values{};
+				for (uint32_t idx{}; idx < 256; ++idx)
+				{
+					uint32_t value{ idx };
+					for (int bit{}; bit < 8; ++bit)
+						value = (value & 1) ? 0xEDB88320u ^ (value >> 1) : value >> 1;
+					values[idx] = value;
+				}
+				return values;
+			}();
+
+			crc = ~crc;
+			for (uint8_t byte : data)
+				crc = table[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+			return ~crc;
+		}
+
+		void AppendBigEndian(std::vector<uint8_t>& output, uint32_t value)
+		{
+			output.insert(output.end(), { static_cast<uint8_t>(value >> 24), static_cast<uint8_t>(value >> 16), static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value) });
+		}
+
+		void AppendChunk(std::vector<uint8_t>& output, const char type[4], std::span<const uint8_t> data)
+		{
+			AppendBigEndian(output, static_cast<uint32_t>(data.size()));
+			const size_t typeStart{ output.size() };
+			output.insert(output.end(), type, type + 4);
+			output.insert(output.end(), data.begin(), data.end());
+			AppendBigEndian(output, GetCRC32({ output.data() + typeStart, output.size() - typeStart }));
+		}
+
+		uint8_t GetPaethPredictor(int left, int up, int upLeft)
+		{
+			const int estimate{ left + up - upLeft };
+			const int distanceLeft{ std::abs(estimate - left) };
+			const int distanceUp{ std::abs(estimate - up) };
+			const int distanceUpLeft{ std::abs(estimate - upLeft) };
+			if (distanceLeft <= distanceUp && distanceLeft <= distanceUpLeft)
+				return static_cast<uint8_t>(left);
+			return static_cast<uint8_t>(distanceUp <= distanceUpLeft ? up : upLeft);
+		}
+
+		//Picks per row the filter with the smallest sum of absolute residuals, the usual heuristic
+		void FilterRow(std::span<const uint8_t> row, std::span<const uint8_t> previousRow, uint8_t* pOutput)
+		{
+			constexpr int BYTES_PER_PIXEL{ 3 };
+			std::vector<uint8_t> filtered(5 * row.size());
+			uint64_t bestCost{ UINT64_MAX };
+			int bestFilter{};
+			for (int filter{}; filter < 5; ++filter)
+			{
+				uint8_t* pFiltered{ filtered.data() + filter * row.size() };
+				uint64_t cost{};
+				for (size_t idx{}; idx < row.size(); ++idx)
+				{
+					const int left{ idx >= BYTES_PER_PIXEL ? row[idx - BYTES_PER_PIXEL] : 0 };
+					const int up{ previousRow.empty() ? 0 : previousRow[idx] };
+					const int upLeft{ !previousRow.empty() && idx >= BYTES_PER_PIXEL ? previousRow[idx - BYTES_PER_PIXEL] : 0 };
+					int prediction{};
+					switch (filter)
+					{
+					case 1: prediction = left; break;
+					case 2: prediction = up; break;
+					case 3: prediction = (left + up) / 2; break;
+					case 4: prediction = GetPaethPredictor(left, up, upLeft); break;
+					default: break;
+					}
+					pFiltered[idx] = static_cast<uint8_t>(row[idx] - prediction);
+					cost += std::abs(static_cast<int8_t>(pFiltered[idx]));
+				}
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestFilter = filter;
+				}
+			}
+
+			pOutput[0] = static_cast<uint8_t>(bestFilter);
+			std::copy_n(filtered.data() + bestFilter * row.size(), row.size(), pOutput + 1);
+		}
+#pragma endregion
+
+		bool WriteFile(const std::string& filename, const std::string& header, const void* pData, size_t size)
+		{
+			std::ofstream file(filename, std::ios::binary);
+			file << header;
+			file.write(static_cast<const char*>(pData), static_cast<std::streamsize>(size));
+			return static_cast<bool>(file);
+		}
+	}
+
+	ImageWriter::ImageWriter(uint32_t numBuffers)
+		: m_Frames(std::max(numBuffers, 1u))
+	{
+		for (Frame& frame : m_Frames)
+			m_FreeFrames.push_back(&frame);
+		m_Thread = std::thread([this] { Run(); });
+	}
+
+	ImageWriter::~ImageWriter()
+	{
+		{
+			std::lock_guard lock{ m_Mutex };
+			m_IsStopping = true;
+		}
+		m_FrameQueued.notify_one();
+		m_Thread.join();
+		CloseStream();
+	}
+
+	ImageWriter::Frame& ImageWriter::Acquire()
+	{
+		std::unique_lock lock{ m_Mutex };
+		m_FrameWritten.wait(lock, [this] { return !m_FreeFrames.empty(); });
+		Frame* pFrame{ m_FreeFrames.front() };
+		m_FreeFrames.pop_front();
+		return *pFrame;
+	}
+
+	void ImageWriter::Submit(Frame& frame)
+	{
+		{
+			std::lock_guard lock{ m_Mutex };
+			m_QueuedFrames.push_back(&frame);
+		}
+		m_FrameQueued.notify_one();
+	}
+
+	void ImageWriter::Flush()
+	{
+		std::unique_lock lock{ m_Mutex };
+		m_FrameWritten.wait(lock, [this] { return m_QueuedFrames.empty() && m_NumWriting == 0; });
+	}
+
+	uint32_t ImageWriter::GetNumFailed() const
+	{
+		std::lock_guard lock{ m_Mutex };
+		return m_NumFailed;
+	}
+
+	void ImageWriter::Run()
+	{
+		std::unique_lock lock{ m_Mutex };
+		while (true)
+		{
+			m_FrameQueued.wait(lock, [this] { return m_IsStopping || !m_QueuedFrames.empty(); });
+			if (m_QueuedFrames.empty())
+				return;
+
+			Frame* pFrame{ m_QueuedFrames.front() };
+			m_QueuedFrames.pop_front();
+			++m_NumWriting;
+
+			lock.unlock();
+			const bool isWritten{ WriteFrame(*pFrame) };
+			if (!isWritten)
+				std::cout << "Could not write " << pFrame->filename << "\n";
+			lock.lock();
+
+			--m_NumWriting;
+			if (!isWritten)
+				++m_NumFailed;
+			m_FreeFrames.push_back(pFrame);
+			m_FrameWritten.notify_all();
+		}
+	}
+
+	bool ImageWriter::WriteFrame(const Frame& frame)
+	{
+		if (frame.format == ImageFormat::RawRGB || frame.format == ImageFormat::Y4M)
+			return WriteToStream(frame);
+		return Write(frame);
+	}
+
+	bool ImageWriter::WriteToStream(const Frame& frame)
+	{
+		if (!m_pStream || frame.width != m_StreamWidth || frame.height != m_StreamHeight || frame.rgb.size() < static_cast<size_t>(frame.width) * frame.height * 3)
+			return false;
+
+		if (frame.format == ImageFormat::RawRGB)
+			return std::fwrite(frame.rgb.data(), 1, frame.rgb.size(), m_pStream) == frame.rgb.size() && std::fflush(m_pStream) == 0;
+
+		//Full range BT.601 (JPEG) YUV, chroma averaged over 2x2 pixels
+		const int chromaWidth{ (frame.width + 1) / 2 };
+		const int chromaHeight{ (frame.height + 1) / 2 };
+		const size_t lumaSize{ static_cast<size_t>(frame.width) * frame.height };
+		const size_t chromaSize{ static_cast<size_t>(chromaWidth) * chromaHeight };
+		m_StreamPlanes.resize(lumaSize + 2 * chromaSize);
+		uint8_t* pLuma{ m_StreamPlanes.data() };
+		uint8_t* pBlue{ pLuma + lumaSize };
+		uint8_t* pRed{ pBlue + chromaSize };
+		const auto toByte = [](float value) { return static_cast<uint8_t>(std::clamp(value + 0.5f, 0.f, 255.f)); };
+
+		Parallel::For(0, chromaHeight, [&](int chromaY)
+		{
+			for (int chromaX{}; chromaX < chromaWidth; ++chromaX)
+			{
+				float sums[3]{};
+				int numPixels{};
+				for (int y{ 2 * chromaY }; y < std::min(2 * chromaY + 2, frame.height); ++y)
+				{
+					for (int x{ 2 * chromaX }; x < std::min(2 * chromaX + 2, frame.width); ++x)
+					{
+						const uint8_t* pRGB{ frame.rgb.data() + 3 * (static_cast<size_t>(y) * frame.width + x) };
+						pLuma[static_cast<size_t>(y) * frame.width + x] = toByte(0.299f * pRGB[0] + 0.587f * pRGB[1] + 0.114f * pRGB[2]);
+						for (int channel{}; channel < 3; ++channel)
+							sums[channel] += pRGB[channel];
+						++numPixels;
+					}
+				}
+
+				const float r{ sums[0] / numPixels };
+				const float g{ sums[1] / numPixels };
+				const float b{ sums[2] / numPixels };
+				const size_t chromaIndex{ static_cast<size_t>(chromaY) * chromaWidth + chromaX };
+				pBlue[chromaIndex] = toByte(128.f - 0.168736f * r - 0.331264f * g + 0.5f * b);
+				pRed[chromaIndex] = toByte(128.f + 0.5f * r - 0.418688f * g - 0.081312f * b);
+			}
+		});
+
+		return std::fputs("FRAME\n", m_pStream) >= 0 && std::fwrite(m_StreamPlanes.data(), 1, m_StreamPlanes.size(), m_pStream) == m_StreamPlanes.size()
+			&& std::fflush(m_pStream) == 0;
+	}
+
+	bool ImageWriter::OpenStream(const std::string& target, ImageFormat format, int width, int height, int framesPerSecond)
+	{
+		CloseStream();
+
+		m_IsStdout = target == "-";
+		if (m_IsStdout)
+		{
+#if defined(_WIN32)
+			_setmode(_fileno(stdout), _O_BINARY);
+#endif
+			m_pStream = stdout;
+		}
+		else
+		{
+			m_pStream = std::fopen(target.c_str(), "wb");
+			if (!m_pStream)
+			{
+				std::cout << "Could not open " << target << " for writing\n";
+				return false;
+			}
+		}
+
+		m_StreamWidth = width;
+		m_StreamHeight = height;
+		//C420jpeg only gives the chroma siting, without XCOLORRANGE players assume limited range and the full range samples get clipped
+		if (format == ImageFormat::Y4M)
+			std::fprintf(m_pStream, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XCOLORRANGE=FULL\n", width, height, std::max(framesPerSecond, 1));
+		return true;
+	}
+
+	void ImageWriter::CloseStream()
+	{
+		Flush();
+		if (!m_pStream)
+			return;
+
+		if (m_IsStdout)
+			std::fflush(m_pStream);
+		else
+			std::fclose(m_pStream);
+		m_pStream = nullptr;
+	}
+
+	bool ImageWriter::Write(const Frame& frame)
+	{
+		switch (frame.format)
+		{
+		case ImageFormat::PNG:
+			return WritePNG(frame.filename, frame.width, frame.height, frame.rgb);
+		case ImageFormat::PFM:
+			return WritePFM(frame.filename, frame.width, frame.height, frame.hdrRGB);
+		default:
+			return WritePPM(frame.filename, frame.width, frame.height, frame.rgb);
+		}
+	}
+
+	bool ImageWriter::WritePPM(const std::string& filename, int width, int height, std::span<const uint8_t> rgb)
+	{
+		if (rgb.size() < static_cast<size_t>(width) * height * 3)
+			return false;
+		return WriteFile(filename, "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n", rgb.data(), static_cast<size_t>(width) * height * 3);
+	}
+
+	bool ImageWriter::WritePNG(const std::string& filename, int width, int height, std::span<const uint8_t> rgb)
+	{
+		const size_t rowSize{ static_cast<size_t>(width) * 3 };
+		if (rgb.size() < rowSize * height)
+			return false;
+
+		//Every row starts with its filter type
+		std::vector<uint8_t> filtered((rowSize + 1) * height);
+		Parallel::For(0, height, [&](int row)
+		{
+			FilterRow(rgb.subspan(row * rowSize, rowSize), row > 0 ? rgb.subspan((row - 1) * rowSize, rowSize) : std::span<const uint8_t>{},
+				filtered.data() + row * (rowSize + 1));
+		});
+
+		std::vector<uint8_t> header{};
+		AppendBigEndian(header, static_cast<uint32_t>(width));
+		AppendBigEndian(header, static_cast<uint32_t>(height));
+		header.insert(header.end(), { 8, 2, 0, 0, 0 }); //8 bits per channel, RGB, deflate, adaptive filtering, no interlacing
+
+		std::vector<uint8_t> file{ 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+		AppendChunk(file, "IHDR", header);
+		AppendChunk(file, "IDAT", Compress(filtered));
+		AppendChunk(file, "IEND", {});
+		return WriteFile(filename, "", file.data(), file.size());
+	}
+
+	bool ImageWriter::WritePFM(const std::string& filename, int width, int height, std::span<const float> rgb)
+	{
+		const size_t rowSize{ static_cast<size_t>(width) * 3 };
+		if (rgb.size() < rowSize * height)
+			return false;
+
+		//Rows go bottom to top, the negative scale marks little endian floats
+		std::vector<float> rows(rowSize * height);
+		for (int row{}; row < height; ++row)
+			std::copy_n(rgb.data() + row * rowSize, rowSize, rows.data() + (height - 1 - row) * rowSize);
+		return WriteFile(filename, "PF\n" + std::to_string(width) + " " + std::to_string(height) + "\n-1.0\n", rows.data(), rows.size() * sizeof(float));
+	}
+
+	bool ImageWriter::GetFormat(const std::string& filename, ImageFormat& format)
+	{
+		const size_t dot{ filename.find_last_of('.') };
+		if (dot == std::string::npos)
+			return false;
+
+		std::string extension{ filename.substr(dot + 1) };
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+		if (extension == "ppm")
+			format = ImageFormat::PPM;
+		else if (extension == "png")
+			format = ImageFormat::PNG;
+		else if (extension == "pfm")
+			format = ImageFormat::PFM;
+		else
+			return false;
+		return true;
+	}
+}
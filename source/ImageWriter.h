@@ -0,0 +1,96 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace dae
+{
+	enum class ImageFormat
+	{
+		PPM, //binary 8-bit RGB, no compression
+		PNG, //8-bit RGB, deflate compressed in parallel chunks
+		PFM, //32-bit float RGB, unclamped radiance for HDR
+
+		//Stream formats, every frame is appended to the stream opened with OpenStream
+		RawRGB, //8-bit RGB frames back to back without any header, for encoders reading a pipe
+		Y4M //YUV4MPEG2 video, full range YUV 4:2:0
+	};
+
+	//Saves finished frames from a background thread, so the render loop never waits for compression or the disk
+	//Frames are copied into a ring of buffers, acquiring one only blocks while every buffer is still queued for writing
+	//With two buffers per output, rendering frame N + 1 overlaps writing frame N
+	class ImageWriter final
+	{
+	public:
+		struct Frame
+		{
+			std::string filename{};
+			ImageFormat format{};
+			int width{};
+			int height{};
+			std::vector<uint8_t> rgb{}; //PPM and PNG, 3 bytes per pixel, top row first
+			std::vector<float> hdrRGB{}; //PFM, 3 floats per pixel, top row first
+		};
+
+		explicit ImageWriter(uint32_t numBuffers = 3);
+		//Writes whatever is still queued before the thread stops
+		~ImageWriter();
+
+		ImageWriter(const ImageWriter&) = delete;
+		ImageWriter(ImageWriter&&) noexcept = delete;
+		ImageWriter& operator=(const ImageWriter&) = delete;
+		ImageWriter& operator=(ImageWriter&&) noexcept = delete;
+
+		//Free buffer of the ring, fill it in and hand it back with Submit
+		Frame& Acquire();
+		void Submit(Frame& frame);
+		//Blocks until every submitted frame is written
+		void Flush();
+		uint32_t GetNumFailed() const;
+
+		//Synchronous writers, false when the file could not be written
+		static bool Write(const Frame& frame);
+		static bool WritePPM(const std::string& filename, int width, int height, std::span<const uint8_t> rgb);
+		static bool WritePNG(const std::string& filename, int width, int height, std::span<const uint8_t> rgb);
+		static bool WritePFM(const std::string& filename, int width, int height, std::span<const float> rgb);
+
+		//Format from the extension (.ppm, .png or .pfm), false for anything else
+		static bool GetFormat(const std::string& filename, ImageFormat& format);
+
+		//Opens the target ("-" for stdout, a named pipe or a regular file) for frames in a stream format
+		//Y4M needs the frame size and rate up front, frames of another size are rejected
+		bool OpenStream(const std::string& target, ImageFormat format, int width, int height, int framesPerSecond);
+		//Writes what is still queued and closes the stream
+		void CloseStream();
+
+	private:
+		void Run();
+		bool WriteFrame(const Frame& frame);
+		bool WriteToStream(const Frame& frame);
+
+		std::vector<Frame> m_Frames{};
+		std::deque<Frame*> m_FreeFrames{};
+		std::deque<Frame*> m_QueuedFrames{};
+		uint32_t m_NumWriting{};
+		uint32_t m_NumFailed{};
+		bool m_IsStopping{};
+
+		mutable std::mutex m_Mutex{};
+		std::condition_variable m_FrameQueued{};
+		std::condition_variable m_FrameWritten{};
+		std::thread m_Thread{};
+
+		//Only touched by the writer thread while frames are queued
+		std::FILE* m_pStream{};
+		bool m_IsStdout{};
+		int m_StreamWidth{};
+		int m_StreamHeight{};
+		std::vector<uint8_t> m_StreamPlanes{};
+	};
+}
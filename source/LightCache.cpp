@@ -0,0 +1,232 @@
+#include "LightCache.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Parallel.h"
+
+namespace dae
+{
+	namespace
+	{
+		constexpr uint32_t INVALIDATE_CHUNK_SIZE{ 16384 };
+
+		//Slab test of the segment from start to end against a box grown by margin
+		bool DoesSegmentHitBox(const Vector3& start, const Vector3& end, const Vector3& boxMin, const Vector3& boxMax, float margin)
+		{
+			const float origin[3]{ start.x, start.y, start.z };
+			const float delta[3]{ end.x - start.x, end.y - start.y, end.z - start.z };
+			const float minBounds[3]{ boxMin.x - margin, boxMin.y - margin, boxMin.z - margin };
+			const float maxBounds[3]{ boxMax.x + margin, boxMax.y + margin, boxMax.z + margin };
+
+			float minT{ 0.f };
+			float maxT{ 1.f };
+			for (int axis{}; axis < 3; ++axis)
+			{
+				if (delta[axis] == 0.f)
+				{
+					if (origin[axis] < minBounds[axis] || origin[axis] > maxBounds[axis])
+						return false;
+					continue;
+				}
+
+				const float inverseDelta{ 1.f / delta[axis] };
+				float t0{ (minBounds[axis] - origin[axis]) * inverseDelta };
+				float t1{ (maxBounds[axis] - origin[axis]) * inverseDelta };
+				if (t0 > t1)
+					std::swap(t0, t1);
+				minT = std::max(minT, t0);
+				maxT = std::min(maxT, t1);
+				if (minT > maxT)
+					return false;
+			}
+			return true;
+		}
+	}
+
+	void LightCache::Initialize(float cellSize, uint32_t capacityLog2)
+	{
+		m_CellSize = std::max(cellSize, 0.f);
+		m_InverseCellSize = m_CellSize > 0.f ? 1.f / m_CellSize : 0.f;
+		if (!IsEnabled())
+		{
+			m_SlotMask = 0;
+			m_pSlots.reset();
+			m_NumCells.store(0, std::memory_order_relaxed);
+			return;
+		}
+
+		const uint64_t capacity{ 1ull << capacityLog2 };
+		m_SlotMask = capacity - 1;
+		m_pSlots = std::make_unique<Slot[]>(capacity);
+		Clear();
+	}
+
+	void LightCache::Clear()
+	{
+		if (!IsEnabled())
+			return;
+
+		for (uint64_t slot{}; slot <= m_SlotMask; ++slot)
+		{
+			m_pSlots[slot].key.store(0, std::memory_order_relaxed);
+			m_pSlots[slot].visibility.store(0, std::memory_order_relaxed);
+		}
+		m_NumCells.store(0, std::memory_order_relaxed);
+	}
+
+	void LightCache::Update(const SceneChangeTracker& changes, std::span<const Light> lights)
+	{
+		if (!IsEnabled())
+			return;
+
+		//Cells are never given back one by one, a full table starts over as well
+		if (changes.IsRestarted() || GetNumCells() > (m_SlotMask + 1) / 4 * 3)
+		{
+			Clear();
+			return;
+		}
+		if (changes.GetChangedLights() != 0)
+			ForgetLights(changes.GetChangedLights());
+		if (!changes.GetMovedBounds().empty())
+			Invalidate(changes.GetMovedBounds(), lights, ~changes.GetChangedLights());
+	}
+
+	bool LightCache::Lookup(const Vector3& point, const Vector3& normal, uint32_t lightIndex, bool& isOccluded) const
+	{
+		uint64_t key{};
+		if (lightIndex >= MAX_LIGHTS || !GetKey(point, normal, key))
+			return false;
+
+		uint64_t slot{ GetSlot(key) };
+		for (uint32_t probe{}; probe < MAX_PROBES; ++probe, slot = (slot + 1) & m_SlotMask)
+		{
+			const uint64_t slotKey{ m_pSlots[slot].key.load(std::memory_order_acquire) };
+			if (slotKey == 0)
+				return false;
+			if (slotKey != key)
+				continue;
+
+			const uint64_t visibility{ m_pSlots[slot].visibility.load(std::memory_order_relaxed) };
+			if ((visibility & (1ull << lightIndex)) == 0)
+				return false;
+			isOccluded = (visibility & (1ull << (32 + lightIndex))) != 0;
+			return true;
+		}
+		return false;
+	}
+
+	void LightCache::Store(const Vector3& point, const Vector3& normal, uint32_t lightIndex, bool isOccluded)
+	{
+		uint64_t key{};
+		if (lightIndex >= MAX_LIGHTS || !GetKey(point, normal, key))
+			return;
+
+		uint64_t slot{ GetSlot(key) };
+		for (uint32_t probe{}; probe < MAX_PROBES; ++probe, slot = (slot + 1) & m_SlotMask)
+		{
+			//Claim an empty slot, a failed exchange leaves the key another thread just wrote in slotKey
+			uint64_t slotKey{ m_pSlots[slot].key.load(std::memory_order_acquire) };
+			if (slotKey == 0 && m_pSlots[slot].key.compare_exchange_strong(slotKey, key, std::memory_order_acq_rel))
+			{
+				slotKey = key;
+				m_NumCells.fetch_add(1, std::memory_order_relaxed);
+			}
+			if (slotKey != key)
+				continue;
+
+			m_pSlots[slot].visibility.fetch_or((1ull << lightIndex) | (isOccluded ? 1ull << (32 + lightIndex) : 0), std::memory_order_relaxed);
+			return;
+		}
+		//Neighbourhood full, the point simply isn't cached
+	}
+
+	bool LightCache::GetKey(const Vector3& point, const Vector3& normal, uint64_t& key) const
+	{
+		constexpr int64_t maxCoordinate{ (1 << COORDINATE_BITS) - 1 };
+		const int64_t x{ static_cast<int64_t>(std::floor(point.x * m_InverseCellSize)) + COORDINATE_OFFSET };
+		const int64_t y{ static_cast<int64_t>(std::floor(point.y * m_InverseCellSize)) + COORDINATE_OFFSET };
+		const int64_t z{ static_cast<int64_t>(std::floor(point.z * m_InverseCellSize)) + COORDINATE_OFFSET };
+		if (x < 0 || y < 0 || z < 0 || x > maxCoordinate || y > maxCoordinate || z > maxCoordinate)
+			return false;
+
+		//Dominant normal axis and its sign, 0..5
+		const float absNormal[3]{ std::abs(normal.x), std::abs(normal.y), std::abs(normal.z) };
+		const int axis{ absNormal[0] >= absNormal[1] && absNormal[0] >= absNormal[2] ? 0 : (absNormal[1] >= absNormal[2] ? 1 : 2) };
+		const float component{ axis == 0 ? normal.x : (axis == 1 ? normal.y : normal.z) };
+		const uint64_t normalBucket{ static_cast<uint64_t>(axis * 2 + (component < 0.f ? 1 : 0)) };
+
+		key = USED_FLAG | (normalBucket << (3 * COORDINATE_BITS)) | (static_cast<uint64_t>(x) << (2 * COORDINATE_BITS))
+			| (static_cast<uint64_t>(y) << COORDINATE_BITS) | static_cast<uint64_t>(z);
+		return true;
+	}
+
+	Vector3 LightCache::GetCellCenter(uint64_t key) const
+	{
+		constexpr uint64_t coordinateMask{ (1ull << COORDINATE_BITS) - 1 };
+		const int64_t x{ static_cast<int64_t>((key >> (2 * COORDINATE_BITS)) & coordinateMask) - COORDINATE_OFFSET };
+		const int64_t y{ static_cast<int64_t>((key >> COORDINATE_BITS) & coordinateMask) - COORDINATE_OFFSET };
+		const int64_t z{ static_cast<int64_t>(key & coordinateMask) - COORDINATE_OFFSET };
+		return { (x + 0.5f) * m_CellSize, (y + 0.5f) * m_CellSize, (z + 0.5f) * m_CellSize };
+	}
+
+	uint64_t LightCache::GetSlot(uint64_t key) const
+	{
+		constexpr uint64_t blockMask{ ~((3ull << (2 * COORDINATE_BITS)) | (3ull << COORDINATE_BITS) | 3ull) };
+		const uint64_t cellInBlock{ ((key >> (2 * COORDINATE_BITS)) & 3) | (((key >> COORDINATE_BITS) & 3) << 2) | ((key & 3) << 4) };
+
+		//64-bit finalizer of MurmurHash3
+		uint64_t hash{ key & blockMask };
+		hash ^= hash >> 33;
+		hash *= 0xff51afd7ed558ccdull;
+		hash ^= hash >> 33;
+		hash *= 0xc4ceb9fe1a85ec53ull;
+		hash ^= hash >> 33;
+		return (hash + cellInBlock) & m_SlotMask;
+	}
+
+	void LightCache::Invalidate(std::span<const AABB> movedBounds, std::span<const Light> lights, uint32_t lightMask)
+	{
+		//Points anywhere in the cell use its entry, grow the boxes by half the cell diagonal plus the shadow ray offset
+		const float margin{ m_CellSize * 0.8660254f + 0.01f };
+		const uint32_t numLights{ static_cast<uint32_t>(std::min<size_t>(lights.size(), MAX_LIGHTS)) };
+		const uint32_t numChunks{ static_cast<uint32_t>((m_SlotMask + INVALIDATE_CHUNK_SIZE) / INVALIDATE_CHUNK_SIZE) };
+
+		Parallel::For(0u, numChunks, [&](uint32_t chunk)
+		{
+			const uint64_t firstSlot{ static_cast<uint64_t>(chunk) * INVALIDATE_CHUNK_SIZE };
+			const uint64_t lastSlot{ std::min(firstSlot + INVALIDATE_CHUNK_SIZE, m_SlotMask + 1) };
+			for (uint64_t slot{ firstSlot }; slot < lastSlot; ++slot)
+			{
+				const uint64_t key{ m_pSlots[slot].key.load(std::memory_order_relaxed) };
+				const uint32_t knownLights{ static_cast<uint32_t>(m_pSlots[slot].visibility.load(std::memory_order_relaxed)) & lightMask };
+				if (key == 0 || knownLights == 0)
+					continue;
+
+				const Vector3 center{ GetCellCenter(key) };
+				uint64_t forgetMask{};
+				for (uint32_t lightIndex{}; lightIndex < numLights; ++lightIndex)
+				{
+					if ((knownLights & (1u << lightIndex)) == 0)
+						continue;
+
+					//Directional lights have no end point, anything that moved may have changed what they light
+					bool isAffected{ lights[lightIndex].type == LightType::Directional };
+					for (size_t boxIndex{}; boxIndex < movedBounds.size() && !isAffected; ++boxIndex)
+						isAffected = DoesSegmentHitBox(center, lights[lightIndex].origin, movedBounds[boxIndex].min, movedBounds[boxIndex].max, margin);
+					if (isAffected)
+						forgetMask |= (1ull << lightIndex) | (1ull << (32 + lightIndex));
+				}
+				if (forgetMask != 0)
+					m_pSlots[slot].visibility.fetch_and(~forgetMask, std::memory_order_relaxed);
+			}
+		}, 1);
+	}
+
+	void LightCache::ForgetLights(uint32_t lightMask)
+	{
+		const uint64_t forgetMask{ static_cast<uint64_t>(lightMask) | (static_cast<uint64_t>(lightMask) << 32) };
+		for (uint64_t slot{}; slot <= m_SlotMask; ++slot)
+			m_pSlots[slot].visibility.fetch_and(~forgetMask, std::memory_order_relaxed);
+	}
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "DataTypes.h"
+#include "Math.h"
+#include "SceneChangeTracker.h"
+
+namespace dae
+{
+	//World space cache of which lights a surface point sees, so static parts of the scene skip their shadow rays after the first frame
+	//Points are snapped to cubic cells of cellSize, split by the dominant axis of the normal so both sides of thin walls stay apart
+	//Each cell keeps a known and an occluded bit per light, the first shadow ray traced from a cell decides for the whole cell
+	//Lock free: open addressing over atomic keys, bits are OR-ed in, so render threads read and fill it concurrently
+	//A cell forgets a light when its path to the light crosses the old or new bounds of something that moved (see SceneChangeTracker)
+	class LightCache final
+	{
+	public:
+		static constexpr uint32_t MAX_LIGHTS{ SceneChangeTracker::MAX_TRACKED_LIGHTS };
+
+		LightCache() = default;
+		~LightCache() = default;
+
+		LightCache(const LightCache&) = delete;
+		LightCache(LightCache&&) noexcept = delete;
+		LightCache& operator=(const LightCache&) = delete;
+		LightCache& operator=(LightCache&&) noexcept = delete;
+
+		//cellSize 0 disables the cache, the table has 2^capacityLog2 cells
+		void Initialize(float cellSize, uint32_t capacityLog2 = 20);
+		bool IsEnabled() const { return m_CellSize > 0.f; }
+		float GetCellSize() const { return m_CellSize; }
+		//Forgets every cell
+		void Clear();
+
+		//Once per frame before tracing, after the tracker compared the scene with the last frame
+		void Update(const SceneChangeTracker& changes, std::span<const Light> lights);
+
+		//True when the cell of the point already knows about light lightIndex
+		bool Lookup(const Vector3& point, const Vector3& normal, uint32_t lightIndex, bool& isOccluded) const;
+		void Store(const Vector3& point, const Vector3& normal, uint32_t lightIndex, bool isOccluded);
+
+		//Cells claimed since the last Clear
+		uint32_t GetNumCells() const { return m_NumCells.load(std::memory_order_relaxed); }
+
+	private:
+		//Key and visibility side by side, a lookup touches one cache line
+		//The low half of the visibility word flags known lights, the high half occluded ones
+		struct alignas(16) Slot
+		{
+			std::atomic<uint64_t> key;
+			std::atomic<uint64_t> visibility;
+		};
+
+		//20 bits per cell coordinate and 3 for the normal axis, bit 63 marks the slot as used
+		static constexpr int COORDINATE_BITS{ 20 };
+		static constexpr int COORDINATE_OFFSET{ 1 << (COORDINATE_BITS - 1) };
+		static constexpr uint64_t USED_FLAG{ 1ull << 63 };
+		static constexpr uint32_t MAX_PROBES{ 16 };
+
+		bool GetKey(const Vector3& point, const Vector3& normal, uint64_t& key) const;
+		Vector3 GetCellCenter(uint64_t key) const;
+		//Blocks of 4x4x4 cells hash to one spot and fill consecutive slots, so neighbouring pixels stay in the same cache lines
+		uint64_t GetSlot(uint64_t key) const;
+		//Drops the lights in lightMask from every cell whose path to them crosses one of the boxes
+		void Invalidate(std::span<const AABB> movedBounds, std::span<const Light> lights, uint32_t lightMask);
+		void ForgetLights(uint32_t lightMask);
+
+		float m_CellSize{};
+		float m_InverseCellSize{};
+		uint64_t m_SlotMask{};
+		std::atomic<uint32_t> m_NumCells{};
+		std::unique_ptr<Slot[]> m_pSlots{};
+	};
+}
@@ -0,0 +1,113 @@
+#include "MappedFile.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace dae;
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+#if defined(_WIN32)
+bool MappedFile::Open(const std::string& filename)
+{
+	Close();
+
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize{};
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	void* pView = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!pView)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	m_FileHandle = file;
+	m_MappingHandle = mapping;
+	m_pData = static_cast<const uint8_t*>(pView);
+	m_Size = static_cast<size_t>(fileSize.QuadPart);
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_pData)
+		UnmapViewOfFile(m_pData);
+	if (m_MappingHandle)
+		CloseHandle(m_MappingHandle);
+	if (m_FileHandle)
+		CloseHandle(m_FileHandle);
+
+	m_pData = nullptr;
+	m_Size = 0;
+	m_MappingHandle = nullptr;
+	m_FileHandle = nullptr;
+}
+#else
+bool MappedFile::Open(const std::string& filename)
+{
+	Close();
+
+	const int fileDescriptor = open(filename.c_str(), O_RDONLY);
+	if (fileDescriptor < 0)
+		return false;
+
+	struct stat fileStats{};
+	if (fstat(fileDescriptor, &fileStats) != 0 || fileStats.st_size == 0)
+	{
+		close(fileDescriptor);
+		return false;
+	}
+
+	void* pView = mmap(nullptr, static_cast<size_t>(fileStats.st_size), PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+	if (pView == MAP_FAILED)
+	{
+		close(fileDescriptor);
+		return false;
+	}
+
+	m_FileDescriptor = fileDescriptor;
+	m_pData = static_cast<const uint8_t*>(pView);
+	m_Size = static_cast<size_t>(fileStats.st_size);
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_pData)
+		munmap(const_cast<uint8_t*>(m_pData), m_Size);
+	if (m_FileDescriptor >= 0)
+		close(m_FileDescriptor);
+
+	m_pData = nullptr;
+	m_Size = 0;
+	m_FileDescriptor = -1;
+}
+#endif
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace dae
+{
+	//Read-only view of a whole file mapped into memory, the OS pages it in on demand
+	class MappedFile final
+	{
+	public:
+		MappedFile() = default;
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile(MappedFile&&) noexcept = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+		MappedFile& operator=(MappedFile&&) noexcept = delete;
+
+		bool Open(const std::string& filename);
+		void Close();
+
+		const uint8_t* GetData() const { return m_pData; }
+		size_t GetSize() const { return m_Size; }
+		bool IsOpen() const { return m_pData != nullptr; }
+
+	private:
+		const uint8_t* m_pData{};
+		size_t m_Size{};
+
+#if defined(_WIN32)
+		void* m_FileHandle{};
+		void* m_MappingHandle{};
+#else
+		int m_FileDescriptor{ -1 };
+#endif
+	};
+}
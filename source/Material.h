@@ -1,7 +1,10 @@
 #pragma once
+#include <algorithm>
 #include "Math.h"
 #include "DataTypes.h"
 #include "BRDFs.h"
+#include "FastBRDF.h"
+#include "TextureCache.h"
 
 namespace dae
 {
@@ -25,6 +28,40 @@ namespace dae
 		 * \return color
 		 */
 		virtual ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) = 0;
+
+		/**
+		 * \brief Shade for a whole batch of hits with this material, one virtual call instead of one per hit and light
+		 * \param batch normals, light and view directions, same meaning as the arguments of Shade
+		 * \param colors receives one color per entry of the batch
+		 */
+		virtual void ShadeBatch(const ShadingBatch& batch, const ShadedColors& colors)
+		{
+			for (size_t idx{}; idx < batch.GetSize(); ++idx)
+			{
+				HitRecord hitRecord{};
+				hitRecord.normal = { batch.normalX[idx], batch.normalY[idx], batch.normalZ[idx] };
+				if (!batch.texcoordU.empty())
+				{
+					hitRecord.texcoord = { batch.texcoordU[idx], batch.texcoordV[idx] };
+					hitRecord.texcoordFootprint = batch.texcoordFootprint[idx];
+				}
+				const ColorRGB color{ Shade(hitRecord, { batch.lightX[idx], batch.lightY[idx], batch.lightZ[idx] }, { batch.viewX[idx], batch.viewY[idx], batch.viewZ[idx] }) };
+				colors.r[idx] = color.r;
+				colors.g[idx] = color.g;
+				colors.b[idx] = color.b;
+			}
+		}
+
+		/**
+		 * \brief Function used to calculate how much light the material mirrors along the reflected view direction
+		 * \param hitRecord current hitrecord
+		 * \param v view direction
+		 * \return reflectance per channel, black means no reflection bounce is traced
+		 */
+		virtual ColorRGB GetReflectance(const HitRecord& hitRecord = {}, const Vector3& v = {}) const
+		{
+			return {};
+		}
 	};
 #pragma endregion
 
@@ -43,6 +80,13 @@ namespace dae
 			return m_Color;
 		}
 
+		void ShadeBatch(const ShadingBatch& batch, const ShadedColors& colors) override
+		{
+			std::fill(colors.r.begin(), colors.r.end(), m_Color.r);
+			std::fill(colors.g.begin(), colors.g.end(), m_Color.g);
+			std::fill(colors.b.begin(), colors.b.end(), m_Color.b);
+		}
+
 	private:
 		ColorRGB m_Color{colors::White};
 	};
@@ -55,17 +99,26 @@ namespace dae
 	{
 	public:
 		Material_Lambert(const ColorRGB& diffuseColor, float diffuseReflectance) :
-			m_DiffuseColor(diffuseColor), m_DiffuseReflectance(diffuseReflectance){}
+			m_DiffuseColor(diffuseColor), m_DiffuseReflectance(diffuseReflectance),
+			m_Diffuse(BRDF::Lambert(diffuseReflectance, diffuseColor)){}
 
 		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) override
 		{
 			//todo: W3 DONE
-			return BRDF::Lambert(m_DiffuseReflectance,m_DiffuseColor);
+			return m_Diffuse;
+		}
+
+		void ShadeBatch(const ShadingBatch& batch, const ShadedColors& colors) override
+		{
+			std::fill(colors.r.begin(), colors.r.end(), m_Diffuse.r);
+			std::fill(colors.g.begin(), colors.g.end(), m_Diffuse.g);
+			std::fill(colors.b.begin(), colors.b.end(), m_Diffuse.b);
 		}
 
 	private:
 		ColorRGB m_DiffuseColor{colors::White};
 		float m_DiffuseReflectance{1.f}; //kd
+		ColorRGB m_Diffuse{}; //Lambert term, constant over the surface
 	};
 #pragma endregion
 
@@ -77,14 +130,21 @@ namespace dae
 	public:
 		Material_LambertPhong(const ColorRGB& diffuseColor, float kd, float ks, float phongExponent):
 			m_DiffuseColor(diffuseColor), m_DiffuseReflectance(kd), m_SpecularReflectance(ks),
-			m_PhongExponent(phongExponent)
+			m_PhongExponent(phongExponent),
+			m_Diffuse(BRDF::Lambert(kd, diffuseColor)), m_IntegerPhongExponent(FastBRDF::GetIntegerExponent(phongExponent))
 		{
 		}
 
 		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) override
 		{
 			//todo: W3 DONE
-			return BRDF::Lambert(m_DiffuseReflectance,m_DiffuseColor) + BRDF::Phong(m_SpecularReflectance,m_PhongExponent,l,-v,hitRecord.normal);
+			const float specular{ FastBRDF::Phong(m_SpecularReflectance, m_PhongExponent, m_IntegerPhongExponent, l, -v, hitRecord.normal) };
+			return { m_Diffuse.r + specular, m_Diffuse.g + specular, m_Diffuse.b + specular };
+		}
+
+		void ShadeBatch(const ShadingBatch& batch, const ShadedColors& colors) override
+		{
+			FastBRDF::LambertPhongBatch(m_Diffuse, m_SpecularReflectance, m_PhongExponent, m_IntegerPhongExponent, batch, colors);
 		}
 
 	private:
@@ -92,6 +152,8 @@ namespace dae
 		float m_DiffuseReflectance{0.5f}; //kd
 		float m_SpecularReflectance{0.5f}; //ks
 		float m_PhongExponent{1.f}; //Phong Exponent
+		ColorRGB m_Diffuse{}; //Lambert term, constant over the surface
+		uint32_t m_IntegerPhongExponent{}; //0 when the exponent has a fraction
 	};
 #pragma endregion
 
@@ -101,46 +163,84 @@ namespace dae
 	{
 	public:
 		Material_CookTorrence(const ColorRGB& albedo, float metalness, float roughness):
-			m_Albedo(albedo), m_Metalness(metalness), m_Roughness(roughness)
+			m_Albedo(albedo), m_Metalness(metalness), m_Roughness(roughness),
+			m_Constants(FastBRDF::CookTorranceConstants::Create(albedo, metalness, roughness)),
+			m_Smoothness(Square(1.f - roughness))
 		{
 		}
 
 		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) override
 		{
 			//todo: W3 DONE
-			ColorRGB f0{ 0.04f, 0.04f, 0.04f };
-			const Vector3 h{ (v + l) / (v + l).Magnitude() };
-			ColorRGB kd{0,0,0};
-			if (m_Metalness > 0.f)
-			{
-				f0 = m_Albedo;
-			}
-
-			ColorRGB F = BRDF::FresnelFunction_Schlick(h, v, f0);
-			float D = BRDF::NormalDistribution_GGX(hitRecord.normal, h, m_Roughness);
-			float G = BRDF::GeometryFunction_Smith(hitRecord.normal, v, l, m_Roughness);
-			ColorRGB cookTorrance{D * F * G};
-			const float denominator{ 4 * (std::max(0.f,Vector3::Dot(v,hitRecord.normal))) * std::max(0.f,Vector3::Dot(l,hitRecord.normal)) };
-
-			if (m_Metalness == 0.f)
-			{
-				kd.r = 1 - F.r;
-				kd.g = 1 - F.g;
-				kd.b = 1 - F.b;
-			}
-
-			cookTorrance.r /= denominator;
-			cookTorrance.g /= denominator;
-			cookTorrance.b /= denominator;
+			return FastBRDF::CookTorrance(m_Constants, m_Albedo, hitRecord.normal, l, v);
+		}
 
-			return BRDF::Lambert(kd,m_Albedo) + cookTorrance;
+		void ShadeBatch(const ShadingBatch& batch, const ShadedColors& colors) override
+		{
+			FastBRDF::CookTorranceShadeBatch(m_Constants, m_Albedo, batch, colors);
+		}
 
+		ColorRGB GetReflectance(const HitRecord& hitRecord = {}, const Vector3& v = {}) const override
+		{
+			//Mirror direction >> the half vector equals the normal
+			//Rough surfaces scatter the reflection over the whole lobe, only smooth ones act like a mirror
+			return FastBRDF::Fresnel_Schlick(Vector3::Dot(hitRecord.normal, v), m_Constants.f0) * m_Smoothness;
 		}
 
 	private:
 		ColorRGB m_Albedo{0.955f, 0.637f, 0.538f}; //Copper
 		float m_Metalness{1.0f};
 		float m_Roughness{0.1f}; // [1.0 > 0.0] >> [ROUGH > SMOOTH]
+		FastBRDF::CookTorranceConstants m_Constants{};
+		float m_Smoothness{};
+	};
+#pragma endregion
+
+#pragma region Material TEXTURED COOK TORRENCE
+	//TEXTURED COOK TORRENCE
+	//Cook-Torrance with the albedo (sRGB, tinted by color) and optionally the roughness (green channel, scaled by roughness) from textures
+	//The constants depend on the texels, so they are made per hit instead of once
+	class Material_TexturedCookTorrence final : public Material
+	{
+	public:
+		Material_TexturedCookTorrence(const TextureCache& textureCache, const ColorRGB& tint, float metalness, float roughness,
+			uint32_t albedoTexture, uint32_t roughnessTexture = TextureCache::INVALID_TEXTURE) :
+			m_TextureCache(textureCache), m_Tint(tint), m_Metalness(metalness), m_Roughness(roughness),
+			m_AlbedoTexture(albedoTexture), m_RoughnessTexture(roughnessTexture)
+		{
+		}
+
+		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) override
+		{
+			ColorRGB albedo{};
+			const FastBRDF::CookTorranceConstants constants{ GetConstants(hitRecord, albedo) };
+			return FastBRDF::CookTorrance(constants, albedo, hitRecord.normal, l, v);
+		}
+
+		ColorRGB GetReflectance(const HitRecord& hitRecord = {}, const Vector3& v = {}) const override
+		{
+			ColorRGB albedo{};
+			const FastBRDF::CookTorranceConstants constants{ GetConstants(hitRecord, albedo) };
+			const float roughness{ std::sqrt(std::sqrt(constants.alphaSquared)) };
+			return FastBRDF::Fresnel_Schlick(Vector3::Dot(hitRecord.normal, v), constants.f0) * Square(1.f - roughness);
+		}
+
+	private:
+		FastBRDF::CookTorranceConstants GetConstants(const HitRecord& hitRecord, ColorRGB& albedo) const
+		{
+			albedo = m_Tint * m_TextureCache.Sample(m_AlbedoTexture, hitRecord.texcoord, hitRecord.texcoordFootprint);
+			float roughness{ m_Roughness };
+			if (m_RoughnessTexture != TextureCache::INVALID_TEXTURE)
+				roughness *= m_TextureCache.Sample(m_RoughnessTexture, hitRecord.texcoord, hitRecord.texcoordFootprint).g;
+			return FastBRDF::CookTorranceConstants::Create(albedo, m_Metalness, roughness);
+		}
+
+		const TextureCache& m_TextureCache;
+		ColorRGB m_Tint{ colors::White };
+		float m_Metalness{};
+		float m_Roughness{ 1.f };
+		uint32_t m_AlbedoTexture{ TextureCache::INVALID_TEXTURE };
+		uint32_t m_RoughnessTexture{ TextureCache::INVALID_TEXTURE };
 	};
 #pragma endregion
 }
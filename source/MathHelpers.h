@@ -1,5 +1,7 @@
 #pragma once
+#include <cfloat>
 #include <cmath>
+#include <cstdint>
 
 namespace dae
 {
@@ -27,4 +29,22 @@ namespace dae
 	{
 		return abs(a - b) < epsilon;
 	}
+
+	/* --- RANDOM --- */
+	//PCG hash, used to seed a cheap per-pixel random stream
+	inline uint32_t HashUint(uint32_t value)
+	{
+		const uint32_t state = value * 747796405u + 2891336453u;
+		const uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+		return (word >> 22u) ^ word;
+	}
+
+	//Uniform float in [0, 1), advances the given state (xorshift32)
+	inline float RandomFloat(uint32_t& state)
+	{
+		state ^= state << 13u;
+		state ^= state >> 17u;
+		state ^= state << 5u;
+		return static_cast<float>(state >> 8u) / 16777216.f;
+	}
 }
\ No newline at end of file
@@ -0,0 +1,75 @@
+#include "MemoryArena.h"
+
+#include <algorithm>
+#include <cassert>
+
+using namespace dae;
+
+MemoryArena::MemoryArena(size_t blockSize):
+	m_BlockSize{ blockSize }
+{
+}
+
+MemoryArena::~MemoryArena()
+{
+	Reset();
+}
+
+void* MemoryArena::Allocate(size_t size, size_t alignment)
+{
+	assert(alignment != 0 && (alignment & (alignment - 1)) == 0 && "Alignment must be a power of two");
+
+	//Try the current block first
+	if (!m_Blocks.empty())
+	{
+		Block& block = m_Blocks.back();
+		const uintptr_t address = reinterpret_cast<uintptr_t>(block.pData) + block.used;
+		const size_t padding = (alignment - (address & (alignment - 1))) & (alignment - 1);
+		if (block.used + padding + size <= block.size)
+		{
+			block.used += padding + size;
+			m_BytesAllocated += size;
+			return block.pData + block.used - size;
+		}
+	}
+
+	//Big allocations get a block of their own, so they don't waste the rest of a regular block
+	const size_t blockSize{ std::max(m_BlockSize, size + alignment) };
+	Block block{};
+	block.pData = static_cast<uint8_t*>(::operator new(blockSize));
+	block.size = blockSize;
+
+	const uintptr_t address = reinterpret_cast<uintptr_t>(block.pData);
+	const size_t padding = (alignment - (address & (alignment - 1))) & (alignment - 1);
+	block.used = padding + size;
+	m_BytesAllocated += size;
+
+	//Keep the block with the most free space at the back
+	if (!m_Blocks.empty() && block.size - block.used < m_Blocks.back().size - m_Blocks.back().used)
+	{
+		m_Blocks.insert(m_Blocks.end() - 1, block);
+	}
+	else
+	{
+		m_Blocks.push_back(block);
+	}
+
+	return block.pData + padding;
+}
+
+void MemoryArena::Reset()
+{
+	//Only objects with a non-trivial destructor are visited, the rest is released with its block
+	for (DestructorNode* pNode = m_pDestructors; pNode; pNode = pNode->pNext)
+	{
+		pNode->pDestroy(pNode->pObject);
+	}
+	m_pDestructors = nullptr;
+
+	for (const Block& block : m_Blocks)
+	{
+		::operator delete(block.pData);
+	}
+	m_Blocks.clear();
+	m_BytesAllocated = 0;
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace dae
+{
+	//Bump allocator handing out memory from a few large blocks
+	//Nothing is freed individually, Reset() (or the destructor) releases everything at once
+	class MemoryArena final
+	{
+	public:
+		explicit MemoryArena(size_t blockSize = 1 << 20);
+		~MemoryArena();
+
+		MemoryArena(const MemoryArena&) = delete;
+		MemoryArena(MemoryArena&&) noexcept = delete;
+		MemoryArena& operator=(const MemoryArena&) = delete;
+		MemoryArena& operator=(MemoryArena&&) noexcept = delete;
+
+		void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+		//Uninitialized storage for count objects
+		template<typename T>
+		T* AllocateArray(size_t count)
+		{
+			return static_cast<T*>(Allocate(sizeof(T) * count, alignof(T)));
+		}
+
+		//Constructs an object in the arena, its destructor runs on Reset() if it has one
+		template<typename T, typename... Args>
+		T* New(Args&&... args)
+		{
+			T* pObject = new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+			if constexpr (!std::is_trivially_destructible_v<T>)
+			{
+				DestructorNode* pNode = new (Allocate(sizeof(DestructorNode), alignof(DestructorNode))) DestructorNode{};
+				pNode->pObject = pObject;
+				pNode->pDestroy = [](void* p) { static_cast<T*>(p)->~T(); };
+				pNode->pNext = m_pDestructors;
+				m_pDestructors = pNode;
+			}
+			return pObject;
+		}
+
+		void Reset();
+
+		size_t GetNumBlocks() const { return m_Blocks.size(); }
+		size_t GetBytesAllocated() const { return m_BytesAllocated; }
+
+	private:
+		struct Block
+		{
+			uint8_t* pData{};
+			size_t size{};
+			size_t used{};
+		};
+
+		struct DestructorNode
+		{
+			void* pObject{};
+			void (*pDestroy)(void*) {};
+			DestructorNode* pNext{};
+		};
+
+		const size_t m_BlockSize;
+		std::vector<Block> m_Blocks{};
+		size_t m_BytesAllocated{};
+		DestructorNode* m_pDestructors{};
+	};
+}
@@ -0,0 +1,388 @@
+#include "MeshSimplifier.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <queue>
+#include <utility>
+
+namespace dae
+{
+	namespace MeshSimplifier
+	{
+		namespace
+		{
+			constexpr double BORDER_WEIGHT{ 100.0 }; //keeps open borders from shrinking
+			constexpr double MIN_NORMAL_DOT{ 0.2 }; //rejects collapses that turn a triangle by more than ~78 degrees
+			constexpr uint32_t REMOVED{ UINT32_MAX };
+
+			//Accumulation and solving is done in double, quadrics of large flat areas lose too much precision in float
+			struct Double3
+			{
+				double x, y, z;
+			};
+			Double3 operator+(const Double3& a, const Double3& b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+			Double3 operator-(const Double3& a, const Double3& b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+			Double3 operator*(const Double3& a, double scale) { return { a.x * scale, a.y * scale, a.z * scale }; }
+			double Dot(const Double3& a, const Double3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+			Double3 Cross(const Double3& a, const Double3& b) { return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x }; }
+
+			//Symmetric 4x4 matrix, only the upper triangle is stored
+			struct Quadric
+			{
+				double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+
+				//Squared distance to the plane n.p + d = 0
+				static Quadric FromPlane(const Double3& n, double d, double weight)
+				{
+					return {
+						weight * n.x * n.x, weight * n.x * n.y, weight * n.x * n.z, weight * n.x * d,
+						weight * n.y * n.y, weight * n.y * n.z, weight * n.y * d,
+						weight * n.z * n.z, weight * n.z * d,
+						weight * d * d };
+				}
+
+				Quadric& operator+=(const Quadric& q)
+				{
+					a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+					b2 += q.b2; bc += q.bc; bd += q.bd;
+					c2 += q.c2; cd += q.cd;
+					d2 += q.d2;
+					return *this;
+				}
+
+				double Evaluate(const Double3& p) const
+				{
+					return a2 * p.x * p.x + 2.0 * ab * p.x * p.y + 2.0 * ac * p.x * p.z + 2.0 * ad * p.x
+						+ b2 * p.y * p.y + 2.0 * bc * p.y * p.z + 2.0 * bd * p.y
+						+ c2 * p.z * p.z + 2.0 * cd * p.z
+						+ d2;
+				}
+
+				//Point with the lowest error, false if the 3x3 part is (close to) singular
+				bool FindMinimum(Double3& p) const
+				{
+					const double det{ a2 * (b2 * c2 - bc * bc) - ab * (ab * c2 - bc * ac) + ac * (ab * bc - b2 * ac) };
+					const double trace{ a2 + b2 + c2 };
+					if (std::abs(det) <= 1e-12 * trace * trace * trace)
+						return false;
+
+					//Cramer's rule on A.p = -b
+					const double inverseDet{ 1.0 / det };
+					p.x = -inverseDet * (ad * (b2 * c2 - bc * bc) - ab * (bd * c2 - bc * cd) + ac * (bd * bc - b2 * cd));
+					p.y = -inverseDet * (a2 * (bd * c2 - cd * bc) - ad * (ab * c2 - bc * ac) + ac * (ab * cd - bd * ac));
+					p.z = -inverseDet * (a2 * (b2 * cd - bc * bd) - ab * (ab * cd - bd * ac) + ad * (ab * bc - b2 * ac));
+					return true;
+				}
+			};
+
+			struct Candidate
+			{
+				double cost;
+				uint32_t v0, v1; //v1 gets merged into v0
+				uint32_t version0, version1; //stale once either vertex changed after the candidate was queued
+				Double3 target;
+
+				bool operator>(const Candidate& other) const { return cost > other.cost; }
+			};
+		}
+
+		bool Simplify(std::span<const Vector3> positions, std::span<const int> indices, size_t targetTriangles,
+			std::vector<Vector3>& outPositions, std::vector<int>& outIndices, std::vector<int>* pOutSourceVertices)
+		{
+			const uint32_t numVertices{ static_cast<uint32_t>(positions.size()) };
+			const uint32_t numTriangles{ static_cast<uint32_t>(indices.size() / 3) };
+			if (numTriangles <= targetTriangles)
+				return false;
+
+			std::vector<Double3> vertices(numVertices);
+			for (uint32_t vertex{}; vertex < numVertices; ++vertex)
+				vertices[vertex] = { positions[vertex].x, positions[vertex].y, positions[vertex].z };
+
+			//Weld coincident vertices first, UV seams and poles would otherwise be open borders that tear apart
+			std::vector<uint32_t> welded(numVertices);
+			{
+				std::vector<uint32_t> order(numVertices);
+				for (uint32_t vertex{}; vertex < numVertices; ++vertex)
+					order[vertex] = vertex;
+				const auto isLess = [&](uint32_t a, uint32_t b)
+				{
+					const Vector3& pa = positions[a];
+					const Vector3& pb = positions[b];
+					return pa.x != pb.x ? pa.x < pb.x : pa.y != pb.y ? pa.y < pb.y : pa.z < pb.z;
+				};
+				std::sort(order.begin(), order.end(), isLess);
+				for (uint32_t idx{}; idx < numVertices; ++idx)
+				{
+					const bool isDuplicate{ idx > 0 && !isLess(order[idx - 1], order[idx]) };
+					welded[order[idx]] = isDuplicate ? welded[order[idx - 1]] : order[idx];
+				}
+			}
+
+			//The first corner of a removed triangle is set to REMOVED, removed vertices get REMOVED as version
+			std::vector<uint32_t> triangles(3 * static_cast<size_t>(numTriangles));
+			for (size_t idx{}; idx < triangles.size(); ++idx)
+				triangles[idx] = welded[indices[idx]];
+			size_t numLiveTriangles{ numTriangles };
+			for (uint32_t triangle{}; triangle < numTriangles; ++triangle)
+			{
+				const uint32_t* pCorners = &triangles[3 * triangle];
+				if (pCorners[0] == pCorners[1] || pCorners[1] == pCorners[2] || pCorners[2] == pCorners[0])
+				{
+					triangles[3 * triangle] = REMOVED;
+					--numLiveTriangles;
+				}
+			}
+			std::vector<uint32_t> versions(numVertices);
+			std::vector<std::vector<uint32_t>> vertexTriangles(numVertices);
+			std::vector<Quadric> quadrics(numVertices);
+
+			const auto getNormal = [&](uint32_t triangle)
+			{
+				const Double3& p0 = vertices[triangles[3 * triangle]];
+				return Cross(vertices[triangles[3 * triangle + 1]] - p0, vertices[triangles[3 * triangle + 2]] - p0);
+			};
+
+			//Plane of every triangle, weighted by its area
+			for (uint32_t triangle{}; triangle < numTriangles; ++triangle)
+			{
+				if (triangles[3 * triangle] == REMOVED)
+					continue;
+
+				Double3 normal{ getNormal(triangle) };
+				const double length{ std::sqrt(Dot(normal, normal)) };
+				for (int corner{}; corner < 3; ++corner)
+					vertexTriangles[triangles[3 * triangle + corner]].push_back(triangle);
+				if (length == 0.0)
+					continue;
+
+				normal = normal * (1.0 / length);
+				const Quadric quadric{ Quadric::FromPlane(normal, -Dot(normal, vertices[triangles[3 * triangle]]), 0.5 * length) };
+				for (int corner{}; corner < 3; ++corner)
+					quadrics[triangles[3 * triangle + corner]] += quadric;
+			}
+
+			//Sorted edge list, edges shared by two triangles end up next to each other
+			std::vector<std::pair<uint64_t, uint32_t>> edges{};
+			edges.reserve(3 * static_cast<size_t>(numTriangles));
+			for (uint32_t triangle{}; triangle < numTriangles; ++triangle)
+			{
+				if (triangles[3 * triangle] == REMOVED)
+					continue;
+
+				for (int corner{}; corner < 3; ++corner)
+				{
+					const uint32_t a{ triangles[3 * triangle + corner] };
+					const uint32_t b{ triangles[3 * triangle + (corner + 1) % 3] };
+					edges.emplace_back((static_cast<uint64_t>(std::min(a, b)) << 32) | std::max(a, b), triangle);
+				}
+			}
+			std::sort(edges.begin(), edges.end());
+
+			std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> candidates{};
+			const auto pushCandidate = [&](uint32_t v0, uint32_t v1)
+			{
+				Quadric quadric{ quadrics[v0] };
+				quadric += quadrics[v1];
+
+				//Fall back to the end and mid points when the optimum is undefined or runs off
+				const Double3 midPoint{ (vertices[v0] + vertices[v1]) * 0.5 };
+				const Double3 edge{ vertices[v1] - vertices[v0] };
+				Double3 target{};
+				double cost{};
+				if (quadric.FindMinimum(target) && Dot(target - midPoint, target - midPoint) <= Dot(edge, edge))
+				{
+					cost = quadric.Evaluate(target);
+				}
+				else
+				{
+					cost = DBL_MAX;
+					for (const Double3& option : { vertices[v0], vertices[v1], midPoint })
+					{
+						const double optionCost{ quadric.Evaluate(option) };
+						if (optionCost < cost)
+						{
+							cost = optionCost;
+							target = option;
+						}
+					}
+				}
+				candidates.push({ std::max(cost, 0.0), v0, v1, versions[v0], versions[v1], target });
+			};
+
+			for (size_t idx{}; idx < edges.size();)
+			{
+				size_t end{ idx + 1 };
+				while (end < edges.size() && edges[end].first == edges[idx].first)
+					++end;
+
+				const uint32_t v0{ static_cast<uint32_t>(edges[idx].first >> 32) };
+				const uint32_t v1{ static_cast<uint32_t>(edges[idx].first) };
+				if (end - idx == 1)
+				{
+					//Border edge: add a plane through the edge, perpendicular to its triangle
+					const Double3 edge{ vertices[v1] - vertices[v0] };
+					Double3 borderNormal{ Cross(edge, getNormal(edges[idx].second)) };
+					const double length{ std::sqrt(Dot(borderNormal, borderNormal)) };
+					if (length > 0.0)
+					{
+						borderNormal = borderNormal * (1.0 / length);
+						const Quadric quadric{ Quadric::FromPlane(borderNormal, -Dot(borderNormal, vertices[v0]), BORDER_WEIGHT * Dot(edge, edge)) };
+						quadrics[v0] += quadric;
+						quadrics[v1] += quadric;
+					}
+				}
+				idx = end;
+			}
+			for (size_t idx{}; idx < edges.size(); ++idx)
+			{
+				if (idx == 0 || edges[idx].first != edges[idx - 1].first)
+					pushCandidate(static_cast<uint32_t>(edges[idx].first >> 32), static_cast<uint32_t>(edges[idx].first));
+			}
+			edges = {};
+
+			const auto isRemoved = [&](uint32_t triangle) { return triangles[3 * triangle] == REMOVED; };
+			const auto contains = [&](uint32_t triangle, uint32_t vertex)
+			{
+				return triangles[3 * triangle] == vertex || triangles[3 * triangle + 1] == vertex || triangles[3 * triangle + 2] == vertex;
+			};
+			const auto gatherNeighbors = [&](uint32_t vertex, std::vector<uint32_t>& neighbors)
+			{
+				neighbors.clear();
+				for (const uint32_t triangle : vertexTriangles[vertex])
+				{
+					if (isRemoved(triangle))
+						continue;
+					for (int corner{}; corner < 3; ++corner)
+					{
+						if (triangles[3 * triangle + corner] != vertex)
+							neighbors.push_back(triangles[3 * triangle + corner]);
+					}
+				}
+				std::sort(neighbors.begin(), neighbors.end());
+				neighbors.erase(std::unique(neighbors.begin(), neighbors.end()), neighbors.end());
+			};
+			//Moving vertex to target must not turn any of its triangles that survive the collapse
+			const auto doesFlip = [&](uint32_t vertex, uint32_t other, const Double3& target)
+			{
+				for (const uint32_t triangle : vertexTriangles[vertex])
+				{
+					if (isRemoved(triangle) || contains(triangle, other))
+						continue;
+
+					Double3 corners[3]{};
+					for (int corner{}; corner < 3; ++corner)
+					{
+						const uint32_t cornerVertex{ triangles[3 * triangle + corner] };
+						corners[corner] = cornerVertex == vertex ? target : vertices[cornerVertex];
+					}
+					const Double3 oldNormal{ getNormal(triangle) };
+					const Double3 newNormal{ Cross(corners[1] - corners[0], corners[2] - corners[0]) };
+					if (Dot(oldNormal, newNormal) <= MIN_NORMAL_DOT * std::sqrt(Dot(oldNormal, oldNormal) * Dot(newNormal, newNormal)))
+						return true;
+				}
+				return false;
+			};
+
+			std::vector<uint32_t> neighbors0{}, neighbors1{};
+			while (numLiveTriangles > targetTriangles && !candidates.empty())
+			{
+				const Candidate candidate{ candidates.top() };
+				candidates.pop();
+				const uint32_t v0{ candidate.v0 };
+				const uint32_t v1{ candidate.v1 };
+				if (versions[v0] != candidate.version0 || versions[v1] != candidate.version1)
+					continue;
+
+				//Link condition: the endpoints may only share the vertices opposite to the edge, anything else pinches the surface
+				gatherNeighbors(v0, neighbors0);
+				gatherNeighbors(v1, neighbors1);
+				size_t numSharedTriangles{};
+				for (const uint32_t triangle : vertexTriangles[v0])
+					numSharedTriangles += !isRemoved(triangle) && contains(triangle, v1);
+
+				size_t numSharedNeighbors{};
+				for (auto it0{ neighbors0.begin() }, it1{ neighbors1.begin() }; it0 != neighbors0.end() && it1 != neighbors1.end();)
+				{
+					if (*it0 < *it1)
+						++it0;
+					else if (*it1 < *it0)
+						++it1;
+					else
+					{
+						++numSharedNeighbors;
+						++it0;
+						++it1;
+					}
+				}
+				if (numSharedTriangles == 0 || numSharedNeighbors > numSharedTriangles)
+					continue;
+
+				if (doesFlip(v0, v1, candidate.target) || doesFlip(v1, v0, candidate.target))
+					continue;
+
+				//Merge v1 into v0, triangles on the edge collapse to lines and are removed
+				vertices[v0] = candidate.target;
+				quadrics[v0] += quadrics[v1];
+				for (const uint32_t triangle : vertexTriangles[v1])
+				{
+					if (isRemoved(triangle))
+						continue;
+
+					if (contains(triangle, v0))
+					{
+						triangles[3 * triangle] = REMOVED;
+						--numLiveTriangles;
+						continue;
+					}
+					for (int corner{}; corner < 3; ++corner)
+					{
+						if (triangles[3 * triangle + corner] == v1)
+							triangles[3 * triangle + corner] = v0;
+					}
+					vertexTriangles[v0].push_back(triangle);
+				}
+				std::erase_if(vertexTriangles[v0], isRemoved);
+				std::vector<uint32_t>{}.swap(vertexTriangles[v1]);
+				versions[v1] = REMOVED;
+				++versions[v0];
+
+				gatherNeighbors(v0, neighbors0);
+				for (const uint32_t neighbor : neighbors0)
+					pushCandidate(v0, neighbor);
+			}
+
+			if (numLiveTriangles == numTriangles)
+				return false;
+
+			//Compact the surviving vertices and triangles
+			std::vector<int> remap(numVertices, -1);
+			outPositions.clear();
+			outIndices.clear();
+			if (pOutSourceVertices)
+				pOutSourceVertices->clear();
+			outIndices.reserve(3 * numLiveTriangles);
+			for (uint32_t triangle{}; triangle < numTriangles; ++triangle)
+			{
+				if (isRemoved(triangle))
+					continue;
+
+				for (int corner{}; corner < 3; ++corner)
+				{
+					const uint32_t vertex{ triangles[3 * triangle + corner] };
+					if (remap[vertex] < 0)
+					{
+						remap[vertex] = static_cast<int>(outPositions.size());
+						const Double3& position = vertices[vertex];
+						outPositions.emplace_back(static_cast<float>(position.x), static_cast<float>(position.y), static_cast<float>(position.z));
+						if (pOutSourceVertices)
+							pOutSourceVertices->push_back(static_cast<int>(vertex));
+					}
+					outIndices.push_back(remap[vertex]);
+				}
+			}
+			return true;
+		}
+	}
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <cstddef>
+#include <span>
+#include <vector>
+
+#include "Math.h"
+
+namespace dae
+{
+	//Quadric error metric edge collapse (Garland & Heckbert 1997), used to build mesh LOD chains at load time
+	namespace MeshSimplifier
+	{
+		//Collapses edges until at most targetTriangles are left or no collapse is allowed anymore
+		//Open borders are kept in place and collapses that flip a triangle or pinch the surface are rejected
+		//The output gets its own compacted vertex list, returns false if nothing could be removed
+		//pOutSourceVertices receives the input vertex every output vertex was collapsed into, to carry per vertex attributes over
+		bool Simplify(std::span<const Vector3> positions, std::span<const int> indices, size_t targetTriangles,
+			std::vector<Vector3>& outPositions, std::vector<int>& outIndices, std::vector<int>* pOutSourceVertices = nullptr);
+	}
+}
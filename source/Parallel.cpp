@@ -0,0 +1,147 @@
+#include "Parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dae
+{
+	namespace Parallel
+	{
+		namespace
+		{
+			//One RunChunks call, chunks are claimed by whoever gets to the counter first
+			struct Job
+			{
+				void (*pFunction)(void*, uint32_t){};
+				void* pContext{};
+				uint32_t numChunks{};
+				std::atomic<uint32_t> nextChunk{};
+				uint32_t numWorkers{}; //pool threads still inside the job, guarded by the pool's mutex
+			};
+
+			void RunJob(Job& job)
+			{
+				for (uint32_t chunk{ job.nextChunk.fetch_add(1, std::memory_order_relaxed) }; chunk < job.numChunks;
+					chunk = job.nextChunk.fetch_add(1, std::memory_order_relaxed))
+				{
+					job.pFunction(job.pContext, chunk);
+				}
+			}
+
+			class ThreadPool final
+			{
+			public:
+				ThreadPool()
+				{
+					const uint32_t numHardwareThreads{ std::max(std::thread::hardware_concurrency(), 1u) };
+					m_Workers.reserve(numHardwareThreads - 1);
+					for (uint32_t idx{ 1 }; idx < numHardwareThreads; ++idx)
+						m_Workers.emplace_back([this] { RunWorker(); });
+				}
+
+				~ThreadPool()
+				{
+					{
+						const std::lock_guard lock{ m_Mutex };
+						m_IsStopping = true;
+					}
+					m_WorkAvailable.notify_all();
+					for (std::thread& worker : m_Workers)
+						worker.join();
+				}
+
+				ThreadPool(const ThreadPool&) = delete;
+				ThreadPool(ThreadPool&&) noexcept = delete;
+				ThreadPool& operator=(const ThreadPool&) = delete;
+				ThreadPool& operator=(ThreadPool&&) noexcept = delete;
+
+				uint32_t GetNumThreads() const { return static_cast<uint32_t>(m_Workers.size()) + 1; }
+
+				void Run(Job& job)
+				{
+					if (!m_Workers.empty())
+					{
+						{
+							const std::lock_guard lock{ m_Mutex };
+							m_Jobs.push_back(&job);
+						}
+						m_WorkAvailable.notify_all();
+					}
+
+					RunJob(job);
+
+					//Every chunk is claimed, once the job is out of the queue no worker can join it anymore
+					if (!m_Workers.empty())
+					{
+						std::unique_lock lock{ m_Mutex };
+						const auto it = std::find(m_Jobs.begin(), m_Jobs.end(), &job);
+						if (it != m_Jobs.end())
+							m_Jobs.erase(it);
+						m_JobFinished.wait(lock, [&job] { return job.numWorkers == 0; });
+					}
+				}
+
+			private:
+				void RunWorker()
+				{
+					std::unique_lock lock{ m_Mutex };
+					while (true)
+					{
+						m_WorkAvailable.wait(lock, [this] { return m_IsStopping || !m_Jobs.empty(); });
+						if (m_IsStopping)
+							return;
+
+						//Oldest job first, a job whose chunks are all claimed leaves the queue
+						Job& job = *m_Jobs.front();
+						if (job.nextChunk.load(std::memory_order_relaxed) >= job.numChunks)
+						{
+							m_Jobs.pop_front();
+							continue;
+						}
+						++job.numWorkers;
+						lock.unlock();
+
+						RunJob(job);
+
+						//The caller may return (and the job go out of scope) as soon as the count drops to 0 and the lock is released
+						lock.lock();
+						if (--job.numWorkers == 0)
+							m_JobFinished.notify_all();
+					}
+				}
+
+				std::vector<std::thread> m_Workers{};
+				std::mutex m_Mutex{};
+				std::condition_variable m_WorkAvailable{};
+				std::condition_variable m_JobFinished{};
+				std::deque<Job*> m_Jobs{};
+				bool m_IsStopping{};
+			};
+
+			ThreadPool& GetThreadPool()
+			{
+				static ThreadPool threadPool{};
+				return threadPool;
+			}
+		}
+
+		uint32_t GetNumThreads()
+		{
+			return GetThreadPool().GetNumThreads();
+		}
+
+		void RunChunks(uint32_t numChunks, void (*pFunction)(void*, uint32_t), void* pContext)
+		{
+			Job job{};
+			job.pFunction = pFunction;
+			job.pContext = pContext;
+			job.numChunks = numChunks;
+			GetThreadPool().Run(job);
+		}
+	}
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+
+namespace dae
+{
+	//Portable stand-in for PPL's parallel_for / parallel_invoke on one pool of worker threads shared by the whole program
+	//The calling thread works on its own loop too, so nested loops (BVH builds) can't run out of threads
+	namespace Parallel
+	{
+		//Worker threads of the pool plus the calling thread
+		uint32_t GetNumThreads();
+
+		//Runs function(context, chunk) for every chunk in [0, numChunks) and returns once all of them are done
+		void RunChunks(uint32_t numChunks, void (*pFunction)(void*, uint32_t), void* pContext);
+
+		//function(index) for every index in [begin, end), in chunks of grainSize indices
+		//grainSize 0 splits the range into about 8 chunks per thread, enough to balance uneven iterations
+		template<typename Index, typename Function>
+		void For(Index begin, Index end, const Function& function, uint64_t grainSize = 0)
+		{
+			if (!(begin < end))
+				return;
+
+			const uint64_t count{ static_cast<uint64_t>(end - begin) };
+			if (grainSize == 0)
+				grainSize = std::max<uint64_t>(count / (uint64_t{ GetNumThreads() } * 8), 1);
+			const uint64_t numChunks{ (count + grainSize - 1) / grainSize };
+			if (numChunks == 1)
+			{
+				for (Index index{ begin }; index < end; ++index)
+					function(index);
+				return;
+			}
+
+			struct Context
+			{
+				const Function& function;
+				Index begin;
+				uint64_t count;
+				uint64_t grainSize;
+			} context{ function, begin, count, grainSize };
+
+			RunChunks(static_cast<uint32_t>(numChunks), [](void* pContext, uint32_t chunk)
+				{
+					const Context& context = *static_cast<const Context*>(pContext);
+					const uint64_t first{ chunk * context.grainSize };
+					const uint64_t last{ std::min(first + context.grainSize, context.count) };
+					for (uint64_t offset{ first }; offset < last; ++offset)
+						context.function(static_cast<Index>(context.begin + static_cast<Index>(offset)));
+				}, &context);
+		}
+
+		//Calls every function once, in parallel
+		template<typename... Functions>
+		void Invoke(const Functions&... functions)
+		{
+			const auto call = [&](uint32_t index)
+			{
+				uint32_t current{};
+				((current++ == index ? static_cast<void>(functions()) : void()), ...);
+			};
+			For(0u, static_cast<uint32_t>(sizeof...(Functions)), call, 1);
+		}
+	}
+}
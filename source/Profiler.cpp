@@ -0,0 +1,218 @@
+#include "Profiler.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace dae
+{
+	namespace Profiler
+	{
+		constexpr const char* STAGE_NAMES[static_cast<size_t>(Stage::Count)]
+		{
+			"RayGeneration",
+			"GetClosestHit",
+			"DoesHit",
+			"Material::Shade"
+		};
+
+		//Gaps shorter than this are merged when coalescing events
+		constexpr uint64_t COALESCE_GAP_NS{ 50'000 };
+
+		struct Event
+		{
+			const char* name{};
+			uint64_t startNs{};
+			uint64_t endNs{};
+			uint32_t threadId{};
+			bool isCounter{};
+			float counterValues[static_cast<size_t>(Stage::Count)]{};
+		};
+
+		//Every thread only writes its own data, it is read on the main thread between frames
+		struct alignas(64) ThreadData
+		{
+			uint32_t threadId{};
+			std::vector<Event> events{};
+			Event pendingEvent{}; //coalesced event that is still growing
+			std::atomic<uint64_t> stageTimeNs[static_cast<size_t>(Stage::Count)]{};
+		};
+
+		struct Session
+		{
+			std::string filename{};
+			std::mutex mutex{};
+			std::vector<std::unique_ptr<ThreadData>> threads{};
+			std::vector<Event> counterEvents{};
+			uint64_t startNs{};
+		};
+
+		std::atomic<bool> g_IsSessionActive{ false };
+		std::atomic<uint32_t> g_SessionId{ 0 };
+		Session g_Session{};
+
+		ThreadData& GetThreadData()
+		{
+			//Re-register when a new session started since this thread last recorded something
+			thread_local ThreadData* pThreadData{};
+			thread_local uint32_t sessionId{ UINT32_MAX };
+
+			const uint32_t currentSessionId{ g_SessionId.load(std::memory_order_acquire) };
+			if (!pThreadData || sessionId != currentSessionId)
+			{
+				const std::lock_guard lock{ g_Session.mutex };
+				auto pData = std::make_unique<ThreadData>();
+				pData->threadId = static_cast<uint32_t>(g_Session.threads.size());
+				pThreadData = pData.get();
+				g_Session.threads.push_back(std::move(pData));
+				sessionId = currentSessionId;
+			}
+			return *pThreadData;
+		}
+
+		uint64_t GetTimeNs()
+		{
+			return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count());
+		}
+
+		bool IsSessionActive()
+		{
+			return g_IsSessionActive.load(std::memory_order_relaxed);
+		}
+
+		bool BeginSession(const std::string& filename)
+		{
+#if defined(RT_ENABLE_PROFILING)
+			EndSession();
+
+			const std::lock_guard lock{ g_Session.mutex };
+			g_Session.filename = filename;
+			g_Session.threads.clear();
+			g_Session.counterEvents.clear();
+			g_Session.startNs = GetTimeNs();
+			g_SessionId.fetch_add(1, std::memory_order_release);
+			g_IsSessionActive.store(true, std::memory_order_release);
+			return true;
+#else
+			std::cout << "Profiling is not compiled in, rebuild with RT_ENABLE_PROFILING to write " << filename << "\n";
+			return false;
+#endif
+		}
+
+		void RecordEvent(const char* name, uint64_t startNs, uint64_t endNs, bool coalesce)
+		{
+			ThreadData& threadData = GetThreadData();
+			Event& pending = threadData.pendingEvent;
+
+			if (coalesce && pending.name == name && startNs - pending.endNs < COALESCE_GAP_NS)
+			{
+				pending.endNs = endNs;
+				return;
+			}
+
+			if (pending.name)
+			{
+				threadData.events.push_back(pending);
+				pending.name = nullptr;
+			}
+
+			Event event{};
+			event.name = name;
+			event.startNs = startNs;
+			event.endNs = endNs;
+			event.threadId = threadData.threadId;
+			if (coalesce)
+				pending = event;
+			else
+				threadData.events.push_back(event);
+		}
+
+		void RecordStage(Stage stage, uint64_t durationNs)
+		{
+			//Single writer per counter, no need for a locked add
+			std::atomic<uint64_t>& counter = GetThreadData().stageTimeNs[static_cast<size_t>(stage)];
+			counter.store(counter.load(std::memory_order_relaxed) + durationNs, std::memory_order_relaxed);
+		}
+
+		void EndFrame()
+		{
+			if (!IsSessionActive())
+				return;
+
+			const uint64_t nowNs{ GetTimeNs() };
+			const std::lock_guard lock{ g_Session.mutex };
+
+			//One counter event per thread, every stage is a series (milliseconds spent this frame)
+			for (const auto& pThreadData : g_Session.threads)
+			{
+				Event counter{};
+				counter.name = "Stage time";
+				counter.startNs = nowNs;
+				counter.threadId = pThreadData->threadId;
+				counter.isCounter = true;
+
+				bool hasData{};
+				for (size_t stage{}; stage < static_cast<size_t>(Stage::Count); ++stage)
+				{
+					const uint64_t timeNs{ pThreadData->stageTimeNs[stage].exchange(0, std::memory_order_relaxed) };
+					counter.counterValues[stage] = static_cast<float>(timeNs) / 1e6f;
+					hasData = hasData || timeNs != 0;
+				}
+				if (hasData)
+					g_Session.counterEvents.push_back(counter);
+			}
+		}
+
+		void EndSession()
+		{
+			if (!g_IsSessionActive.exchange(false, std::memory_order_acq_rel))
+				return;
+
+			const std::lock_guard lock{ g_Session.mutex };
+			std::ofstream file(g_Session.filename);
+			if (!file)
+			{
+				std::cout << "Could not write trace file " << g_Session.filename << "\n";
+				return;
+			}
+
+			const auto toMicroseconds = [](uint64_t timeNs) { return static_cast<double>(timeNs - g_Session.startNs) / 1000.0; };
+
+			file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+			bool isFirst{ true };
+			const auto separator = [&isFirst]() { const char* pSeparator = isFirst ? "" : ",\n"; isFirst = false; return pSeparator; };
+
+			for (const auto& pThreadData : g_Session.threads)
+			{
+				file << separator() << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << pThreadData->threadId
+					<< ",\"args\":{\"name\":\"" << (pThreadData->threadId == 0 ? "Main" : "Worker ") << pThreadData->threadId << "\"}}";
+
+				if (pThreadData->pendingEvent.name)
+					pThreadData->events.push_back(pThreadData->pendingEvent);
+
+				for (const Event& event : pThreadData->events)
+				{
+					file << separator() << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.threadId
+						<< ",\"ts\":" << toMicroseconds(event.startNs) << ",\"dur\":" << static_cast<double>(event.endNs - event.startNs) / 1000.0 << "}";
+				}
+			}
+
+			for (const Event& counter : g_Session.counterEvents)
+			{
+				file << separator() << "{\"name\":\"" << counter.name << " T" << counter.threadId << "\",\"ph\":\"C\",\"pid\":1,\"ts\":"
+					<< toMicroseconds(counter.startNs) << ",\"args\":{";
+				for (size_t stage{}; stage < static_cast<size_t>(Stage::Count); ++stage)
+					file << (stage ? "," : "") << "\"" << STAGE_NAMES[stage] << "\":" << counter.counterValues[stage];
+				file << "}}";
+			}
+			file << "\n]}\n";
+
+			std::cout << "Trace written to " << g_Session.filename << "\n";
+		}
+	}
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+//Instrumentation is compiled in for debug builds, release builds need RT_ENABLE_PROFILING defined
+#if !defined(RT_ENABLE_PROFILING) && defined(_DEBUG)
+#define RT_ENABLE_PROFILING
+#endif
+
+namespace dae
+{
+	//Scoped hot-path instrumentation, exported as a chrome://tracing / Perfetto JSON timeline
+	//- Events (PROFILE_SCOPE) end up on the timeline of the thread that ran them
+	//- Stages (PROFILE_STAGE) are too hot to log one by one, they accumulate time per thread and are emitted as counters once per frame
+	namespace Profiler
+	{
+		enum class Stage : uint32_t
+		{
+			RayGeneration,
+			ClosestHit,
+			DoesHit,
+			Shade,
+			Count
+		};
+
+		bool BeginSession(const std::string& filename);
+		void EndSession(); //writes the trace file
+		bool IsSessionActive();
+
+		//Emits the accumulated stage counters of every thread and resets them
+		void EndFrame();
+
+		uint64_t GetTimeNs();
+
+		//Raw time stamp counter, only meaningful as a difference on the same core
+		inline uint64_t ReadCycleCounter()
+		{
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+			return __rdtsc();
+#else
+			return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+		}
+		//coalesce merges back-to-back events of the same name on a thread into one bar, gaps stay visible
+		void RecordEvent(const char* name, uint64_t startNs, uint64_t endNs, bool coalesce);
+		void RecordStage(Stage stage, uint64_t durationNs);
+
+		class ScopedEvent final
+		{
+		public:
+			explicit ScopedEvent(const char* name, bool coalesce = false):
+				m_Name{ name }, m_Coalesce{ coalesce }, m_Start{ IsSessionActive() ? GetTimeNs() : 0 } {}
+			~ScopedEvent()
+			{
+				if (m_Start != 0)
+					RecordEvent(m_Name, m_Start, GetTimeNs(), m_Coalesce);
+			}
+
+			ScopedEvent(const ScopedEvent&) = delete;
+			ScopedEvent(ScopedEvent&&) noexcept = delete;
+			ScopedEvent& operator=(const ScopedEvent&) = delete;
+			ScopedEvent& operator=(ScopedEvent&&) noexcept = delete;
+
+		private:
+			const char* m_Name;
+			bool m_Coalesce;
+			uint64_t m_Start;
+		};
+
+		class ScopedStage final
+		{
+		public:
+			explicit ScopedStage(Stage stage):
+				m_Stage{ stage }, m_Start{ IsSessionActive() ? GetTimeNs() : 0 } {}
+			~ScopedStage()
+			{
+				if (m_Start != 0)
+					RecordStage(m_Stage, GetTimeNs() - m_Start);
+			}
+
+			ScopedStage(const ScopedStage&) = delete;
+			ScopedStage(ScopedStage&&) noexcept = delete;
+			ScopedStage& operator=(const ScopedStage&) = delete;
+			ScopedStage& operator=(ScopedStage&&) noexcept = delete;
+
+		private:
+			Stage m_Stage;
+			uint64_t m_Start;
+		};
+	}
+}
+
+#if defined(RT_ENABLE_PROFILING)
+#define RT_PROFILE_CONCAT_INNER(a, b) a##b
+#define RT_PROFILE_CONCAT(a, b) RT_PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) const dae::Profiler::ScopedEvent RT_PROFILE_CONCAT(profileEvent, __LINE__){ name }
+#define PROFILE_COALESCED_SCOPE(name) const dae::Profiler::ScopedEvent RT_PROFILE_CONCAT(profileEvent, __LINE__){ name, true }
+#define PROFILE_STAGE(stage) const dae::Profiler::ScopedStage RT_PROFILE_CONCAT(profileStage, __LINE__){ dae::Profiler::Stage::stage }
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_COALESCED_SCOPE(name)
+#define PROFILE_STAGE(stage)
+#endif
@@ -0,0 +1,116 @@
+#include "RayStats.h"
+
+#include <algorithm>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+namespace dae
+{
+	namespace RayStats
+	{
+		constexpr const char* COUNTER_NAMES[NUM_COUNTERS]
+		{
+			"primaryRays",
+			"bounceRays",
+			"closestHitQueries",
+			"shadowQueries",
+			"aabbTests",
+			"sphereTests",
+			"planeTests",
+			"triangleTests",
+			"hits",
+			"shadowEarlyOuts",
+			"shadowCacheHits"
+		};
+
+		std::mutex g_Mutex{};
+		std::vector<ThreadCounters*> g_ThreadCounters{};
+		FrameStats g_RetiredCounts{}; //counts of threads that exited since the last collect
+
+		//Registers the counters of a thread on first use and folds them into g_RetiredCounts when the thread exits
+		class ThreadRegistration final
+		{
+		public:
+			ThreadRegistration()
+			{
+				const std::lock_guard lock{ g_Mutex };
+				g_ThreadCounters.push_back(&m_Counters);
+			}
+			~ThreadRegistration()
+			{
+				const std::lock_guard lock{ g_Mutex };
+				for (size_t idx{}; idx < NUM_COUNTERS; ++idx)
+					g_RetiredCounts.values[idx] += m_Counters.values[idx];
+				g_ThreadCounters.erase(std::find(g_ThreadCounters.begin(), g_ThreadCounters.end(), &m_Counters));
+			}
+
+			ThreadRegistration(const ThreadRegistration&) = delete;
+			ThreadRegistration(ThreadRegistration&&) noexcept = delete;
+			ThreadRegistration& operator=(const ThreadRegistration&) = delete;
+			ThreadRegistration& operator=(ThreadRegistration&&) noexcept = delete;
+
+			ThreadCounters& GetCounters() { return m_Counters; }
+
+		private:
+			ThreadCounters m_Counters{};
+		};
+
+		ThreadCounters& GetThreadCounters()
+		{
+			thread_local ThreadRegistration registration{};
+			return registration.GetCounters();
+		}
+
+		FrameStats CollectFrame()
+		{
+			const std::lock_guard lock{ g_Mutex };
+
+			FrameStats stats{ g_RetiredCounts };
+			g_RetiredCounts = {};
+			for (ThreadCounters* pCounters : g_ThreadCounters)
+			{
+				for (size_t idx{}; idx < NUM_COUNTERS; ++idx)
+				{
+					stats.values[idx] += pCounters->values[idx];
+					pCounters->values[idx] = 0;
+				}
+			}
+			return stats;
+		}
+
+		void Print(std::ostream& stream, const FrameStats& stats)
+		{
+			const auto ratio = [](uint64_t numerator, uint64_t denominator)
+			{
+				return denominator ? static_cast<double>(numerator) / static_cast<double>(denominator) : 0.0;
+			};
+
+			const uint64_t numQueries{ stats[Counter::ClosestHitQueries] + stats[Counter::ShadowQueries] };
+			stream << "rays: " << stats[Counter::PrimaryRays] << " primary, " << stats[Counter::BounceRays] << " bounce, "
+				<< stats[Counter::ShadowQueries] << " shadow"
+				<< " | tests/ray: aabb " << ratio(stats[Counter::AABBTests], numQueries)
+				<< ", sphere " << ratio(stats[Counter::SphereTests], numQueries)
+				<< ", plane " << ratio(stats[Counter::PlaneTests], numQueries)
+				<< ", triangle " << ratio(stats[Counter::TriangleTests], numQueries)
+				<< " | hit rate " << 100.0 * ratio(stats[Counter::Hits], stats[Counter::ClosestHitQueries])
+				<< "%, shadow early-outs " << 100.0 * ratio(stats[Counter::ShadowEarlyOuts], stats[Counter::ShadowQueries]) << "%\n";
+		}
+
+		void WriteCsvHeader(std::ostream& stream)
+		{
+			stream << "frame,frameTime";
+			for (const char* pName : COUNTER_NAMES)
+				stream << ',' << pName;
+			stream << '\n';
+		}
+
+		void WriteCsvRow(std::ostream& stream, uint32_t frameIndex, float frameTime, const FrameStats& stats)
+		{
+			stream << frameIndex << ',' << frameTime;
+			for (uint64_t value : stats.values)
+				stream << ',' << value;
+			stream << '\n';
+		}
+	}
+}
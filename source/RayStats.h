@@ -0,0 +1,72 @@
+#pragma once
+#include <cstdint>
+#include <iosfwd>
+
+//Counting is compiled in for debug builds, release builds need RT_ENABLE_RAY_STATS defined
+#if !defined(RT_ENABLE_RAY_STATS) && defined(_DEBUG)
+#define RT_ENABLE_RAY_STATS
+#endif
+
+namespace dae
+{
+	//Per-thread ray and intersection counters, summed once per frame
+	namespace RayStats
+	{
+#if defined(RT_ENABLE_RAY_STATS)
+		constexpr bool IS_ENABLED{ true };
+#else
+		constexpr bool IS_ENABLED{ false };
+#endif
+
+		enum class Counter : uint32_t
+		{
+			PrimaryRays,
+			BounceRays,
+			ClosestHitQueries,
+			ShadowQueries,
+			AABBTests,
+			SphereTests,
+			PlaneTests,
+			TriangleTests,
+			Hits,
+			ShadowEarlyOuts,
+			ShadowCacheHits, //shadow rays answered by the LightCache
+			Count
+		};
+
+		constexpr size_t NUM_COUNTERS{ static_cast<size_t>(Counter::Count) };
+
+		struct FrameStats
+		{
+			uint64_t values[NUM_COUNTERS]{};
+
+			uint64_t operator[](Counter counter) const { return values[static_cast<size_t>(counter)]; }
+		};
+
+		//Every thread owns one cache line aligned block, so counting never causes false sharing
+		struct alignas(64) ThreadCounters
+		{
+			uint64_t values[NUM_COUNTERS]{};
+		};
+
+		ThreadCounters& GetThreadCounters();
+
+		inline void Increment(Counter counter, uint64_t amount = 1)
+		{
+			GetThreadCounters().values[static_cast<size_t>(counter)] += amount;
+		}
+
+		//Sums and resets the counters of every thread, call between frames when no rays are in flight
+		FrameStats CollectFrame();
+
+		void Print(std::ostream& stream, const FrameStats& stats);
+		void WriteCsvHeader(std::ostream& stream);
+		void WriteCsvRow(std::ostream& stream, uint32_t frameIndex, float frameTime, const FrameStats& stats);
+	}
+}
+
+#if defined(RT_ENABLE_RAY_STATS)
+#define RAY_STAT(counter) dae::RayStats::Increment(dae::RayStats::Counter::counter)
+#else
+#define RAY_STAT(counter) ((void)0)
+#endif
@@ -1,7 +1,9 @@
 //External includes
+#if defined(RT_ENABLE_SDL)
 #include "SDL.h"
 #include "SDL_surface.h"
 #include "SDL_events.h"
+#endif
 
 //Project includes
 #include "Renderer.h"
@@ -11,38 +13,88 @@
 #include "Scene.h"
 #include "Utils.h"
 #include "Vector3.h"
+#include "Profiler.h"
+#include "RayStats.h"
+#include "ImageWriter.h"
+#include "Parallel.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <future> //Async
-#include <ppl.h> //Parallel
+#include <initializer_list>
+#include <iterator>
 
 using namespace dae;
 
 //#define ASYNC
 #define PARALLEL
 
+#if defined(RT_ENABLE_SDL)
 Renderer::Renderer(SDL_Window * pWindow) :
 	m_pWindow(pWindow),
 	m_pBuffer(SDL_GetWindowSurface(pWindow)),
-	m_AreShadowsEnabled{true}
+	m_AreShadowsEnabled{true},
+	m_AreReflectionsEnabled{true}
 {
 	//Initialize
 	SDL_GetWindowSize(pWindow, &m_Width, &m_Height);
 	m_pBufferPixels = static_cast<uint32_t*>(m_pBuffer->pixels);
 
+	//Allow on average two bounce rays per pixel
+	m_BounceRayBudget = static_cast<uint32_t>(m_Width * m_Height * 2);
+	m_HeatValues.resize(m_Width * m_Height);
+	m_Depth.resize(m_Width * m_Height, -1.f);
+	m_Normals.resize(m_Width * m_Height);
 }
+#endif
+
+Renderer::Renderer(int width, int height) :
+	m_OwnPixels(static_cast<size_t>(width) * height),
+	m_Width{width},
+	m_Height{height},
+	m_AreShadowsEnabled{true},
+	m_AreReflectionsEnabled{true}
+{
+	m_pBufferPixels = m_OwnPixels.data();
+	m_BounceRayBudget = static_cast<uint32_t>(m_Width * m_Height * 2);
+	m_HeatValues.resize(m_Width * m_Height);
+	m_Depth.resize(m_Width * m_Height, -1.f);
+	m_Normals.resize(m_Width * m_Height);
+}
+
+Renderer::~Renderer() = default;
 
 void Renderer::Render(Scene* pScene) 
 {
+	PROFILE_SCOPE("Render");
+	const auto frameStart{ std::chrono::steady_clock::now() };
+	m_BounceRayPool.store(0, std::memory_order_relaxed);
+	pScene->PrepareFrame(m_Height);
+
 	Camera& camera = pScene->GetCamera();
-	camera.CalculateCameraToWorld();
+	camera.cameraToWorld = camera.CalculateCameraToWorld();
 	
 	const float aspectRatio{ m_Width / static_cast<float>(m_Height) };
 
-	auto& materials = pScene->GetMaterials();
-	auto& lights = pScene->GetLights();
+	const auto& materials = pScene->GetMaterials();
+	const auto lights = pScene->GetLights();
 
 	const int numPixels{ m_Width * m_Height };
 
 
+	//The shortcuts below only produce 8-bit colours for the pixels they don't trace, HDR capture traces everything
+	const bool isHdrCapture{ !m_HdrPixels.empty() };
+	const bool isReprojected{ m_IsReprojectionEnabled && !isHdrCapture && Reproject(pScene, camera, aspectRatio, lights, materials) };
+#if defined(PARALLEL)
+	const bool isReducedDensity{ !isReprojected && !isHdrCapture && m_IsDynamicResolutionEnabled && m_ResolutionQuality < MAX_RESOLUTION_QUALITY && !IsHeatmapMode(m_CurrentLightingMode)
+		&& HasPackedPixels() };
+	const bool isCheckerboard{ !isReprojected && !isReducedDensity && !isHdrCapture && m_IsCheckerboardEnabled && !IsHeatmapMode(m_CurrentLightingMode) };
+#else
+	const bool isReducedDensity{ false };
+	const bool isCheckerboard{ false };
+#endif
+	if (!isReprojected)
+	{
 #if defined(ASYNC)
 	//Asynchronous execution
 
@@ -86,10 +138,12 @@ void Renderer::Render(Scene* pScene)
 #elif defined(PARALLEL)
 	//Parallel execution
 
-	concurrency::parallel_for(0, numPixels, [=, this](int i)
-	{
-			RenderPixel(pScene, i, camera.FOV, aspectRatio, camera, lights, materials);
-	});
+	if (isReducedDensity)
+		RenderReducedDensity(pScene, aspectRatio, camera, lights, materials);
+	else if (isCheckerboard)
+		RenderCheckerboard(pScene, aspectRatio, camera, lights, materials);
+	else
+		RenderRect(pScene, 0, 0, m_Width, m_Height, aspectRatio, camera, lights, materials);
 #else
 	//Synchronous execution
 	for (int i{}; i < numPixels ; ++i)
@@ -98,19 +152,406 @@ void Renderer::Render(Scene* pScene)
 	}
 #endif
 
+		//Spread the ages so the refresh of stale pixels is spread over the next frames instead of all landing on one
+		if (m_IsReprojectionEnabled)
+		{
+			for (int i{}; i < numPixels; ++i)
+				m_Age[i] = static_cast<uint8_t>(HashUint(i) % MAX_REPROJECTED_AGE);
+		}
+	}
+
+	//Heatmaps don't leave a frame worth reprojecting, neither do frames that interpolated most of their pixels
+	if (m_IsReprojectionEnabled)
+	{
+		m_HasHistory = !IsHeatmapMode(m_CurrentLightingMode) && !isReducedDensity && !isCheckerboard;
+		m_HistoryView = GetViewBasis(camera);
+	}
+	//Every pixel left in the buffer was traced with this view, except the interpolated ones of a reduced density frame
+	m_HasCheckerboardHistory = !IsHeatmapMode(m_CurrentLightingMode) && !isReducedDensity;
+	m_CheckerboardView = GetViewBasis(camera);
+
+	if (IsHeatmapMode(m_CurrentLightingMode))
+		ResolveHeatmap(0, 0, m_Width, m_Height);
+
 	//@END
 	//Update SDL Surface
-	SDL_UpdateWindowSurface(m_pWindow);
+#if defined(RT_ENABLE_SDL)
+	if (m_pWindow)
+	{
+		PROFILE_SCOPE("Present");
+		SDL_UpdateWindowSurface(m_pWindow);
+	}
+#endif
+
+	const float frameTime{ std::chrono::duration<float>(std::chrono::steady_clock::now() - frameStart).count() };
+	AdaptBounceDepth(frameTime);
+	AdaptResolution(frameTime);
+	++m_FrameIndex;
 }
 
-void dae::Renderer::RenderPixel(Scene* pScene, uint32_t pixelIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& materials) const
+void Renderer::RenderTile(Scene* pScene, int x, int y, int width, int height, uint8_t* pRGBOut)
 {
-	const int px = pixelIndex % m_Width;
-	const int py = pixelIndex / m_Width;
+	Camera& camera = pScene->GetCamera();
+	camera.cameraToWorld = camera.CalculateCameraToWorld();
+
+	const float aspectRatio{ m_Width / static_cast<float>(m_Height) };
+	const auto& materials = pScene->GetMaterials();
+	const auto lights = pScene->GetLights();
+
+	//Same path as Render, restricted to the tile
+	//The blocks get their share of the frame's bounce ray budget, so the tile as a whole gets the part of it its area covers
+	m_BounceRayPool.store(0, std::memory_order_relaxed);
+	RenderRect(pScene, x, y, width, height, aspectRatio, camera, lights, materials);
+
+	if (IsHeatmapMode(m_CurrentLightingMode))
+		ResolveHeatmap(x, y, width, height);
+
+	for (int row{}; row < height; ++row)
+	{
+		for (int column{}; column < width; ++column)
+		{
+			uint8_t* pRGB = pRGBOut + 3 * (row * width + column);
+			UnpackRGB(m_pBufferPixels[(y + row) * m_Width + x + column], pRGB);
+		}
+	}
+}
+
+void Renderer::RenderRect(Scene* pScene, int x, int y, int width, int height, float aspectRatio, const Camera& camera, std::span<const Light> lights, const std::vector<Material*>& materials) const
+{
+	if (IsHeatmapMode(m_CurrentLightingMode))
+	{
+		Parallel::For(0, width * height, [=, this](int i)
+		{
+			const uint32_t pixelIndex{ static_cast<uint32_t>((y + i / width) * m_Width + x + i % width) };
+			RenderPixel(pScene, pixelIndex, camera.FOV, aspectRatio, camera, lights, materials);
+		});
+		return;
+	}
+
+	const int numBlocksX{ (width + BLOCK_SIZE - 1) / BLOCK_SIZE };
+	const int numBlocksY{ (height + BLOCK_SIZE - 1) / BLOCK_SIZE };
+	Parallel::For(0, numBlocksX * numBlocksY, [=, this](int blockIndex)
+	{
+		const int blockX{ x + (blockIndex % numBlocksX) * BLOCK_SIZE };
+		const int blockY{ y + (blockIndex / numBlocksX) * BLOCK_SIZE };
+		RenderBlock(pScene, blockX, blockY, std::min(BLOCK_SIZE, x + width - blockX), std::min(BLOCK_SIZE, y + height - blockY), aspectRatio, camera, lights, materials);
+	});
+}
+
+void Renderer::RenderBlock(Scene* pScene, int x, int y, int width, int height, float aspectRatio, const Camera& camera, std::span<const Light> lights, const std::vector<Material*>& materials,
+	int stride, int checkerboardParity) const
+{
+	PROFILE_COALESCED_SCOPE("RenderPixels");
+	constexpr int MAX_BLOCK_PIXELS{ BLOCK_SIZE * BLOCK_SIZE };
+
+	//Pixels of the block that get traced
+	int pixelX[MAX_BLOCK_PIXELS];
+	int pixelY[MAX_BLOCK_PIXELS];
+	int numPixels{};
+	for (int py{ y }; py < y + height; py += stride)
+	{
+		for (int px{ x }; px < x + width; px += stride)
+		{
+			if (checkerboardParity >= 0 && ((px + py) & 1) != checkerboardParity)
+				continue;
+			pixelX[numPixels] = px;
+			pixelY[numPixels++] = py;
+		}
+	}
+
+	Ray viewRays[MAX_BLOCK_PIXELS];
+	HitRecord closestHits[MAX_BLOCK_PIXELS];
+	for (int i{}; i < numPixels; ++i)
+	{
+		viewRays[i] = GenerateViewRay(pixelX[i], pixelY[i], aspectRatio, camera);
+		RAY_STAT(PrimaryRays);
+		pScene->GetClosestHit(viewRays[i], closestHits[i]);
+		const int pixelIndex{ pixelX[i] + pixelY[i] * m_Width };
+		m_Depth[pixelIndex] = closestHits[i].didHit ? closestHits[i].t : FLT_MAX;
+		m_Normals[pixelIndex] = closestHits[i].normal;
+	}
+
+	//Shadow rays of the block towards one light all end in the same point, the scene traces them as a packet
+	//Pixels whose cell in the light cache already knows the light don't need one
+	std::vector<uint8_t> lightOcclusion(m_AreShadowsEnabled ? numPixels * lights.size() : 0);
+	if (m_AreShadowsEnabled)
+	{
+		LightCache* pLightCache{ pScene->GetLightCache() };
+		Ray shadowRays[MAX_BLOCK_PIXELS];
+		uint8_t isOccluded[MAX_BLOCK_PIXELS];
+		int shadowRayPixels[MAX_BLOCK_PIXELS];
+		for (size_t lightIndex{}; lightIndex < lights.size(); ++lightIndex)
+		{
+			int numShadowRays{};
+			for (int i{}; i < numPixels; ++i)
+			{
+				if (!closestHits[i].didHit || !GetShadowRay(closestHits[i], lights[lightIndex], shadowRays[numShadowRays]))
+					continue;
+
+				bool isCachedOccluded{};
+				if (pLightCache && pLightCache->Lookup(closestHits[i].origin, closestHits[i].normal, static_cast<uint32_t>(lightIndex), isCachedOccluded))
+				{
+					RAY_STAT(ShadowCacheHits);
+					lightOcclusion[i * lights.size() + lightIndex] = isCachedOccluded;
+					continue;
+				}
+				shadowRayPixels[numShadowRays++] = i;
+			}
+
+			pScene->DoesHit(std::span<const Ray>{ shadowRays, static_cast<size_t>(numShadowRays) }, std::span<uint8_t>{ isOccluded, static_cast<size_t>(numShadowRays) });
+			for (int rayIndex{}; rayIndex < numShadowRays; ++rayIndex)
+			{
+				const HitRecord& hitRecord = closestHits[shadowRayPixels[rayIndex]];
+				lightOcclusion[shadowRayPixels[rayIndex] * lights.size() + lightIndex] = isOccluded[rayIndex];
+				if (pLightCache)
+					pLightCache->Store(hitRecord.origin, hitRecord.normal, static_cast<uint32_t>(lightIndex), isOccluded[rayIndex] != 0);
+			}
+		}
+	}
+
+	//The modes that go through the materials shade the whole block in batches, the others are cheap enough per pixel
+	const LightingMode lightingMode{ IsHeatmapMode(m_CurrentLightingMode) ? LightingMode::Combined : m_CurrentLightingMode };
+	const bool isBatchShaded{ lightingMode == LightingMode::BRDF || lightingMode == LightingMode::Combined };
+	ColorRGB directColors[MAX_BLOCK_PIXELS];
+	if (isBatchShaded)
+	{
+		ShadeBlock(std::span<const Ray>{ viewRays, static_cast<size_t>(numPixels) }, std::span<const HitRecord>{ closestHits, static_cast<size_t>(numPixels) }, lights, materials,
+			lightOcclusion, std::span<ColorRGB>{ directColors, static_cast<size_t>(numPixels) });
+	}
+
+	//The share of the whole block, pixels a stride or parity skips leave theirs to the pool
+	uint32_t bounceRaysLeft{ GetBounceRayShare(x, y, width, height) };
+
+	for (int i{}; i < numPixels; ++i)
+	{
+		const int px{ pixelX[i] };
+		const int py{ pixelY[i] };
+		const std::span<const uint8_t> pixelOcclusion{ m_AreShadowsEnabled ? std::span<const uint8_t>{ lightOcclusion }.subspan(i * lights.size(), lights.size()) : std::span<const uint8_t>{} };
+
+		ColorRGB finalColor{ isBatchShaded ? directColors[i] : ShadeDirect(pScene, viewRays[i], closestHits[i], lights, materials, pixelOcclusion) };
+		finalColor += TraceReflections(pScene, static_cast<uint32_t>(px + py * m_Width), viewRays[i], closestHits[i], lights, materials, bounceRaysLeft);
+		WritePixel(px, py, finalColor);
+	}
+	ReturnBounceRays(bounceRaysLeft);
+}
+
+void Renderer::RenderReducedDensity(Scene* pScene, float aspectRatio, const Camera& camera, std::span<const Light> lights, const std::vector<Material*>& materials) const
+{
+	const int numBlocksX{ (m_Width + BLOCK_SIZE - 1) / BLOCK_SIZE };
+	const int numBlocksY{ (m_Height + BLOCK_SIZE - 1) / BLOCK_SIZE };
+	m_BlockStrides.resize(numBlocksX * numBlocksY);
+	for (int blockIndex{}; blockIndex < numBlocksX * numBlocksY; ++blockIndex)
+		m_BlockStrides[blockIndex] = static_cast<uint8_t>(GetBlockStride((blockIndex % numBlocksX) * BLOCK_SIZE, (blockIndex / numBlocksX) * BLOCK_SIZE));
+
+	//Trace every block on its lattice, strides divide BLOCK_SIZE so lattices of equal stride line up across blocks
+	Parallel::For(0, numBlocksX * numBlocksY, [=, this](int blockIndex)
+	{
+		const int blockX{ (blockIndex % numBlocksX) * BLOCK_SIZE };
+		const int blockY{ (blockIndex / numBlocksX) * BLOCK_SIZE };
+		RenderBlock(pScene, blockX, blockY, std::min(BLOCK_SIZE, m_Width - blockX), std::min(BLOCK_SIZE, m_Height - blockY), aspectRatio, camera, lights, materials,
+			m_BlockStrides[blockIndex]);
+	});
+
+	//Fill the pixels in between bilinearly, cell by cell of the lattice
+	//Corners that fall in a coarser neighbour snap to that neighbour's lattice, strides are powers of two so the snap is a mask
+	const auto getTracedPixel = [this, numBlocksX](int px, int py)
+	{
+		px = std::min(px, m_Width - 1);
+		py = std::min(py, m_Height - 1);
+		const int strideMask{ ~(m_BlockStrides[(px / BLOCK_SIZE) + (py / BLOCK_SIZE) * numBlocksX] - 1) };
+		return m_pBufferPixels[(px & strideMask) + (py & strideMask) * m_Width];
+	};
+	Parallel::For(0, numBlocksX * numBlocksY, [&](int blockIndex)
+	{
+		PROFILE_COALESCED_SCOPE("Upsample");
+		const int stride{ m_BlockStrides[blockIndex] };
+		if (stride == 1)
+			return;
+
+		const int blockX{ (blockIndex % numBlocksX) * BLOCK_SIZE };
+		const int blockY{ (blockIndex / numBlocksX) * BLOCK_SIZE };
+		const int blockWidth{ std::min(BLOCK_SIZE, m_Width - blockX) };
+		const int blockHeight{ std::min(BLOCK_SIZE, m_Height - blockY) };
+		for (int y0{ blockY }; y0 < blockY + blockHeight; y0 += stride)
+		{
+			for (int x0{ blockX }; x0 < blockX + blockWidth; x0 += stride)
+			{
+				const uint32_t corners[4]{ getTracedPixel(x0, y0), getTracedPixel(x0 + stride, y0), getTracedPixel(x0, y0 + stride), getTracedPixel(x0 + stride, y0 + stride) };
+				for (int py{ y0 }; py < std::min(y0 + stride, blockY + blockHeight); ++py)
+				{
+					for (int px{ x0 }; px < std::min(x0 + stride, blockX + blockWidth); ++px)
+					{
+						if (px == x0 && py == y0)
+							continue;
+
+						const uint32_t weightX{ static_cast<uint32_t>((px - x0) * 256 / stride) };
+						const uint32_t weightY{ static_cast<uint32_t>((py - y0) * 256 / stride) };
+						const uint32_t weights[4]{ (256 - weightX) * (256 - weightY), weightX * (256 - weightY), (256 - weightX) * weightY, weightX * weightY };
+
+						//Every byte of the 32-bit pixel is one 8-bit channel, whichever order the format has them in
+						uint32_t pixel{};
+						for (int shift{}; shift < 32; shift += 8)
+						{
+							uint32_t channel{ 1u << 15 };
+							for (int corner{}; corner < 4; ++corner)
+								channel += weights[corner] * ((corners[corner] >> shift) & 0xFF);
+							pixel |= (channel >> 16) << shift;
+						}
+						m_pBufferPixels[px + py * m_Width] = pixel;
+						m_Depth[px + py * m_Width] = -1.f;
+					}
+				}
+			}
+		}
+	});
+}
+
+void Renderer::RenderCheckerboard(Scene* pScene, float aspectRatio, const Camera& camera, std::span<const Light> lights, const std::vector<Material*>& materials)
+{
+	//Parity flips every frame, so the other half was traced last frame
+	const int parity{ static_cast<int>(m_FrameIndex & 1) };
+	const ViewBasis view{ GetViewBasis(camera) };
+	//Moving objects and lights change shading anywhere through shadows and reflections, last frame's colours only carry over a camera move
+	const bool hasHistory{ m_HasCheckerboardHistory && !pScene->GetChanges().HasChanges() };
+	const bool isStatic{ hasHistory && std::memcmp(&view, &m_CheckerboardView, sizeof(ViewBasis)) == 0 };
+	const bool isWarped{ hasHistory && !isStatic };
+	if (isWarped)
+	{
+		//Every pixel gets a new depth and normal below, traced or reconstructed
+		AllocateWarpBuffers();
+		std::copy(m_pBufferPixels, m_pBufferPixels + m_Width * m_Height, m_HistoryPixels.begin());
+		m_HistoryDepth.swap(m_Depth);
+		m_HistoryNormals.swap(m_Normals);
+		WarpHistory(m_CheckerboardView, view, aspectRatio, 1 - parity);
+	}
+
+	const int numBlocksX{ (m_Width + BLOCK_SIZE - 1) / BLOCK_SIZE };
+	const int numBlocksY{ (m_Height + BLOCK_SIZE - 1) / BLOCK_SIZE };
+	Parallel::For(0, numBlocksX * numBlocksY, [=, this](int blockIndex)
+	{
+		const int blockX{ (blockIndex % numBlocksX) * BLOCK_SIZE };
+		const int blockY{ (blockIndex / numBlocksX) * BLOCK_SIZE };
+		RenderBlock(pScene, blockX, blockY, std::min(BLOCK_SIZE, m_Width - blockX), std::min(BLOCK_SIZE, m_Height - blockY), aspectRatio, camera, lights, materials,
+			1, parity);
+	});
+
+	//Nothing moved, last frame's pixels are exact
+	if (isStatic)
+		return;
+
+	//Otherwise the other half takes last frame's sample that landed on it when its traced neighbours see the same surface,
+	//the rest is rebuilt from the four traced neighbours, across the axis where depth and normal vary least so edges stay sharp
+	constexpr float MAX_RELATIVE_DEPTH_STEP{ 0.1f };
+	constexpr float MIN_NORMAL_COSINE{ 0.9f };
+	constexpr int MIN_CONSISTENT_NEIGHBOURS{ 2 };
+	Parallel::For(0, m_Height, [&](int py)
+	{
+		PROFILE_COALESCED_SCOPE("Reconstruct");
+		for (int px{ (py + parity + 1) & 1 }; px < m_Width; px += 2)
+		{
+			const int pixelIndex{ px + py * m_Width };
+			const int neighbours[4]{ px > 0 ? pixelIndex - 1 : pixelIndex + 1, px < m_Width - 1 ? pixelIndex + 1 : pixelIndex - 1,
+				py > 0 ? pixelIndex - m_Width : pixelIndex + m_Width, py < m_Height - 1 ? pixelIndex + m_Width : pixelIndex - m_Width };
+
+			const uint64_t packed{ isWarped ? m_pWarpTargets[pixelIndex].load(std::memory_order_relaxed) : UINT64_MAX };
+			if (packed != UINT64_MAX)
+			{
+				const uint32_t source{ static_cast<uint32_t>(packed & 0xFFFFFFFFu) };
+				const uint32_t depthBits{ static_cast<uint32_t>(packed >> 32) };
+				float depth{};
+				std::memcpy(&depth, &depthBits, sizeof(depth));
+				const Vector3& normal = m_HistoryNormals[source];
+
+				//Disocclusions and surfaces the traced half doesn't see any more find no neighbours to match,
+				//a single match isn't enough either as samples off an edge still have the far side of it next to them
+				int numConsistent{};
+				for (const int neighbour : neighbours)
+				{
+					const float neighbourDepth{ m_Depth[neighbour] };
+					if (depth == FLT_MAX || neighbourDepth == FLT_MAX)
+						numConsistent += depth == neighbourDepth;
+					else
+						numConsistent += std::abs(depth - neighbourDepth) < MAX_RELATIVE_DEPTH_STEP * std::min(depth, neighbourDepth)
+							&& Vector3::Dot(normal, m_Normals[neighbour]) > MIN_NORMAL_COSINE;
+				}
+				if (numConsistent >= MIN_CONSISTENT_NEIGHBOURS)
+				{
+					//The sample can be up to half a pixel off, keeping it within the traced neighbours' range stops it from smearing detail
+					const uint32_t historyPixel{ m_HistoryPixels[source] };
+					uint32_t pixel{};
+					for (int shift{}; shift < 32; shift += 8)
+					{
+						uint32_t minChannel{ 0xFF };
+						uint32_t maxChannel{};
+						for (const int neighbour : neighbours)
+						{
+							const uint32_t channel{ (m_pBufferPixels[neighbour] >> shift) & 0xFF };
+							minChannel = std::min(minChannel, channel);
+							maxChannel = std::max(maxChannel, channel);
+						}
+						pixel |= std::clamp((historyPixel >> shift) & 0xFF, minChannel, maxChannel) << shift;
+					}
+					m_pBufferPixels[pixelIndex] = pixel;
+					m_Depth[pixelIndex] = depth;
+					m_Normals[pixelIndex] = normal;
+					continue;
+				}
+			}
 
+			//Relative depth step plus normal bend between the two neighbours of each axis
+			const auto getDiscontinuity = [this](int first, int second)
+			{
+				const float depthA{ m_Depth[first] };
+				const float depthB{ m_Depth[second] };
+				if (depthA == FLT_MAX || depthB == FLT_MAX)
+					return depthA == depthB ? 0.f : FLT_MAX;
+				return std::abs(depthA - depthB) / std::min(depthA, depthB) + (1.f - Vector3::Dot(m_Normals[first], m_Normals[second]));
+			};
+			const float discontinuityX{ getDiscontinuity(neighbours[0], neighbours[1]) };
+			const float discontinuityY{ getDiscontinuity(neighbours[2], neighbours[3]) };
 
+			//Similar axes (flat areas) average all four, otherwise only the smoother pair
+			int first{ 0 };
+			int last{ 4 };
+			if (discontinuityX < 0.5f * discontinuityY)
+				last = 2;
+			else if (discontinuityY < 0.5f * discontinuityX)
+				first = 2;
 
-	Vector3 rayDirection(0, 0, 0);
+			uint32_t pixel{};
+			for (int shift{}; shift < 32; shift += 8)
+			{
+				uint32_t channel{};
+				for (int neighbour{ first }; neighbour < last; ++neighbour)
+					channel += (m_pBufferPixels[neighbours[neighbour]] >> shift) & 0xFF;
+				pixel |= ((channel + (last - first) / 2) / (last - first)) << shift;
+			}
+			m_pBufferPixels[pixelIndex] = pixel;
+			m_Depth[pixelIndex] = m_Depth[neighbours[first]];
+			m_Normals[pixelIndex] = m_Normals[neighbours[first]];
+		}
+	});
+}
+
+int Renderer::GetBlockStride(int blockX, int blockY) const
+{
+	//Distance of the block centre to the screen centre, 1 at the corners
+	const float dx{ blockX + BLOCK_SIZE * 0.5f - m_Width * 0.5f };
+	const float dy{ blockY + BLOCK_SIZE * 0.5f - m_Height * 0.5f };
+	const float distance{ sqrtf((dx * dx + dy * dy) / (0.25f * (m_Width * m_Width + m_Height * m_Height))) };
+
+	//Quality 2 traces every pixel, between 1 and 2 a full density disc shrinks towards the centre leaving a ring at half density,
+	//below 1 the half density disc shrinks in turn leaving quarter density outside
+	if (distance < m_ResolutionQuality - 1.f)
+		return 1;
+	if (distance < std::min(m_ResolutionQuality, 1.f))
+		return 2;
+	return 4;
+}
+
+Ray Renderer::GenerateViewRay(int px, int py, float aspectRatio, const Camera& camera) const
+{
+	PROFILE_STAGE(RayGeneration);
 	// Raster space to camera space
 	const float	px_c{ float(px) + 0.5f },
 				py_c{ py + 0.5f };
@@ -119,84 +560,692 @@ void dae::Renderer::RenderPixel(Scene* pScene, uint32_t pixelIndex, float fov, f
 				c_y{ (1 - (2 * (py_c / float(m_Height)))) * camera.FOV };
 
 	// Make appropriate ray & normalize
-	rayDirection.x = c_x;
-	rayDirection.y = c_y;
-	rayDirection.z = 1.f;
+	Vector3 rayDirection(c_x, c_y, 1.f);
 	rayDirection = rayDirection.Normalized();
 
 	// Camera space to world space
 	rayDirection = camera.cameraToWorld.TransformVector(rayDirection);
+	Ray viewRay{ camera.origin, rayDirection };
+	//A pixel is 2 * FOV / height wide at distance 1
+	viewRay.coneSpread = 2.f * camera.FOV / float(m_Height);
+	return viewRay;
+}
+
+void dae::Renderer::RenderPixel(Scene* pScene, uint32_t pixelIndex, float fov, float aspectRatio, const Camera& camera, std::span<const Light> lights, const std::vector<Material*>& materials) const
+{
+	PROFILE_COALESCED_SCOPE("RenderPixels");
+	const int px = pixelIndex % m_Width;
+	const int py = pixelIndex / m_Width;
+
+	//Heatmaps measure the cost of a Combined render of the pixel
+	const bool isHeatmap{ IsHeatmapMode(m_CurrentLightingMode) };
+	const uint64_t startCycles{ isHeatmap ? Profiler::ReadCycleCounter() : 0 };
+	const RayStats::ThreadCounters startCounters{ isHeatmap && RayStats::IS_ENABLED ? RayStats::GetThreadCounters() : RayStats::ThreadCounters{} };
 
 	//Create & fill in hit record with the current view ray
-	ColorRGB finalColor{};
-	const Ray viewRay{ camera.origin , rayDirection };
+	const Ray viewRay{ GenerateViewRay(px, py, aspectRatio, camera) };
+	RAY_STAT(PrimaryRays);
 	HitRecord closestHit{};
 	pScene->GetClosestHit(viewRay, closestHit);
-
+	m_Depth[pixelIndex] = closestHit.didHit ? closestHit.t : FLT_MAX;
+	m_Normals[pixelIndex] = closestHit.normal;
 
 	//If we hit something, give it it's appropriate color
-		//Loop over the lights & apply the rendering equation
-	for (const auto& light : lights)
+	ColorRGB finalColor{ ShadeDirect(pScene, viewRay, closestHit, lights, materials) };
+	uint32_t bounceRaysLeft{ GetBounceRayShare(px, py, 1, 1) };
+	finalColor += TraceReflections(pScene, pixelIndex, viewRay, closestHit, lights, materials, bounceRaysLeft);
+	ReturnBounceRays(bounceRaysLeft);
+
+	if (isHeatmap)
 	{
-		if (closestHit.didHit)
+		const auto getDelta = [&startCounters](std::initializer_list<RayStats::Counter> counters)
+		{
+			uint64_t delta{};
+			for (RayStats::Counter counter : counters)
+				delta += RayStats::GetThreadCounters().values[static_cast<size_t>(counter)] - startCounters.values[static_cast<size_t>(counter)];
+			return static_cast<float>(delta);
+		};
+
+		float heat{};
+		switch (m_CurrentLightingMode)
 		{
-			Vector3 directionToLight = LightUtils::GetDirectionToLight(light, closestHit.origin + closestHit.normal * 0.01f);
-			const float LambertCosine{ LightUtils::GetLambertCosine(closestHit.normal, directionToLight.Normalized()) };
-			//Apply shadows
-			if (m_AreShadowsEnabled)
+		case LightingMode::HeatmapNodes:
+			heat = getDelta({ RayStats::Counter::AABBTests });
+			break;
+		case LightingMode::HeatmapPrimitives:
+			heat = getDelta({ RayStats::Counter::SphereTests, RayStats::Counter::PlaneTests, RayStats::Counter::TriangleTests });
+			break;
+		case LightingMode::HeatmapShadowRays:
+			heat = getDelta({ RayStats::Counter::ShadowQueries });
+			break;
+		default:
+			heat = static_cast<float>(Profiler::ReadCycleCounter() - startCycles);
+			break;
+		}
+		m_HeatValues[px + (py * m_Width)] = heat;
+		return;
+	}
+
+	WritePixel(px, py, finalColor);
+}
+
+ColorRGB Renderer::TraceReflections(Scene* pScene, uint32_t pixelIndex, Ray viewRay, HitRecord closestHit, std::span<const Light> lights, const std::vector<Material*>& materials,
+	uint32_t& bounceRaysLeft) const
+{
+	const LightingMode lightingMode{ IsHeatmapMode(m_CurrentLightingMode) ? LightingMode::Combined : m_CurrentLightingMode };
+	ColorRGB color{};
+
+	//Follow the mirror direction while the path still carries enough energy
+	if (!m_AreReflectionsEnabled || lightingMode != LightingMode::Combined)
+		return color;
+
+	ColorRGB throughput{ 1.f, 1.f, 1.f };
+	uint32_t randomState{ HashUint(pixelIndex ^ HashUint(m_FrameIndex)) | 1u };
+
+	for (int bounce{}; bounce < m_CurrentMaxBounces && closestHit.didHit; ++bounce)
+	{
+		throughput *= materials[closestHit.materialIndex]->GetReflectance(closestHit, -viewRay.direction);
+		const float maxThroughput{ std::max(throughput.r, std::max(throughput.g, throughput.b)) };
+		if (maxThroughput <= 0.f)
+			break;
+
+		//Russian roulette, surviving paths are reweighted so the estimate stays unbiased
+		if (bounce >= m_RussianRouletteDepth)
+		{
+			const float survivalProbability{ std::min(maxThroughput, 0.95f) };
+			if (RandomFloat(randomState) >= survivalProbability)
+				break;
+			throughput /= survivalProbability;
+		}
+
+		if (!TakeBounceRay(bounceRaysLeft))
+			break;
+
+		//Mirrors keep the spread of the cone, it only continues from the width it had at the hit
+		const float coneWidth{ viewRay.coneWidth + closestHit.t * viewRay.coneSpread };
+		const float coneSpread{ viewRay.coneSpread };
+		viewRay = Ray{ closestHit.origin + closestHit.normal * 0.01f, Vector3::Reflect(viewRay.direction, closestHit.normal) };
+		viewRay.coneWidth = coneWidth;
+		viewRay.coneSpread = coneSpread;
+		RAY_STAT(BounceRays);
+		closestHit = HitRecord{};
+		pScene->GetClosestHit(viewRay, closestHit);
+
+		ColorRGB bounceColor{ ShadeDirect(pScene, viewRay, closestHit, lights, materials) };
+		bounceColor *= throughput;
+		color += bounceColor;
+	}
+	return color;
+}
+
+uint32_t Renderer::GetBounceRayShare(int x, int y, int width, int height) const
+{
+	if (m_BounceRayBudget == UINT32_MAX)
+		return UINT32_MAX;
+
+	//Differences of the running total over the pixels in row order, the shares of all pixels add up to the budget without rounding losing any
+	const uint64_t budget{ m_BounceRayBudget };
+	const uint64_t numFramePixels{ static_cast<uint64_t>(m_Width) * m_Height };
+	uint64_t share{};
+	for (int row{ y }; row < y + height; ++row)
+	{
+		const uint64_t firstPixel{ static_cast<uint64_t>(row) * m_Width + x };
+		share += budget * (firstPixel + width) / numFramePixels - budget * firstPixel / numFramePixels;
+	}
+	return static_cast<uint32_t>(share);
+}
+
+bool Renderer::TakeBounceRay(uint32_t& bounceRaysLeft) const
+{
+	//Own share spent, borrow a few rays at a time from what others left unused
+	constexpr uint32_t BORROWED_RAYS{ 16 };
+	if (bounceRaysLeft == 0)
+	{
+		uint32_t pool{ m_BounceRayPool.load(std::memory_order_relaxed) };
+		do
+		{
+			if (pool == 0)
+				return false;
+		} while (!m_BounceRayPool.compare_exchange_weak(pool, pool - std::min(pool, BORROWED_RAYS), std::memory_order_relaxed));
+		bounceRaysLeft = std::min(pool, BORROWED_RAYS);
+	}
+	--bounceRaysLeft;
+	return true;
+}
+
+void Renderer::ReturnBounceRays(uint32_t bounceRaysLeft) const
+{
+	if (bounceRaysLeft > 0 && m_BounceRayBudget != UINT32_MAX)
+		m_BounceRayPool.fetch_add(bounceRaysLeft, std::memory_order_relaxed);
+}
+
+void Renderer::WritePixel(int px, int py, ColorRGB color) const
+{
+	if (!m_HdrPixels.empty())
+	{
+		float* pHdr{ m_HdrPixels.data() + 3 * (px + py * m_Width) };
+		pHdr[0] = color.r;
+		pHdr[1] = color.g;
+		pHdr[2] = color.b;
+	}
+
+	//Update Color in Buffer
+	color.MaxToOne();
+
+	m_pBufferPixels[px + (py * m_Width)] = PackRGB(
+		static_cast<uint8_t>(color.r * 255),
+		static_cast<uint8_t>(color.g * 255),
+		static_cast<uint8_t>(color.b * 255));
+}
+
+ColorRGB Renderer::ShadeDirect(Scene* pScene, const Ray& ray, const HitRecord& hitRecord, std::span<const Light> lights, const std::vector<Material*>& materials,
+	std::span<const uint8_t> lightOcclusion) const
+{
+	ColorRGB color{};
+	if (!hitRecord.didHit)
+		return color;
+
+	const LightingMode lightingMode{ IsHeatmapMode(m_CurrentLightingMode) ? LightingMode::Combined : m_CurrentLightingMode };
+
+	//Loop over the lights & apply the rendering equation
+	for (size_t lightIndex{}; lightIndex < lights.size(); ++lightIndex)
+	{
+		const Light& light = lights[lightIndex];
+		Vector3 directionToLight = LightUtils::GetDirectionToLight(light, hitRecord.origin + hitRecord.normal * 0.01f);
+		const float LambertCosine{ LightUtils::GetLambertCosine(hitRecord.normal, directionToLight.Normalized()) };
+		//None of the modes add anything for a surface facing away, so it doesn't need a shadow ray either
+		if (LambertCosine == 0.f)
+			continue;
+
+		//Apply shadows
+		if (m_AreShadowsEnabled)
+		{
+			if (!lightOcclusion.empty())
 			{
-				Ray shadowRay{ closestHit.origin + closestHit.normal * 0.01f, directionToLight.Normalized(), 0.0001f, directionToLight.Magnitude() };
-				if (pScene->DoesHit(shadowRay))
-				{
+				if (lightOcclusion[lightIndex])
 					continue;
-				}
 			}
-			switch (m_CurrentLightingMode)
+			else
 			{
-			case LightingMode::ObservedArea:
+				LightCache* pLightCache{ pScene->GetLightCache() };
+				bool isOccluded{};
+				if (pLightCache && pLightCache->Lookup(hitRecord.origin, hitRecord.normal, static_cast<uint32_t>(lightIndex), isOccluded))
+				{
+					RAY_STAT(ShadowCacheHits);
+				}
+				else
+				{
+					Ray shadowRay{};
+					GetShadowRay(hitRecord, light, shadowRay);
+					isOccluded = pScene->DoesHit(shadowRay);
+					if (pLightCache)
+						pLightCache->Store(hitRecord.origin, hitRecord.normal, static_cast<uint32_t>(lightIndex), isOccluded);
+				}
+				if (isOccluded)
+					continue;
+			}
+		}
+		switch (lightingMode)
+		{
+		case LightingMode::ObservedArea:
+		{
+			color += ColorRGB{ LambertCosine ,LambertCosine ,LambertCosine };
+			break;
+		}
+		case LightingMode::Radiance:
+		{
+			color += LightUtils::GetRadiance(light, hitRecord.origin);
+			break;
+		}
+		case LightingMode::BRDF:
+		{
+			PROFILE_STAGE(Shade);
+			color += materials[hitRecord.materialIndex]->Shade(hitRecord, directionToLight.Normalized(), -ray.direction);
+			break;
+		}
+		case LightingMode::Combined:
+		{
+			PROFILE_STAGE(Shade);
+			color += LightUtils::GetRadiance(light, hitRecord.origin) * materials[hitRecord.materialIndex]->Shade(hitRecord, directionToLight.Normalized(), -ray.direction) * LambertCosine;
+			break;
+		}
+		default:
+			break;
+		}
+	}
+
+	return color;
+}
+
+void Renderer::ShadeBlock(std::span<const Ray> viewRays, std::span<const HitRecord> hitRecords, std::span<const Light> lights, const std::vector<Material*>& materials,
+	std::span<const uint8_t> lightOcclusion, std::span<ColorRGB> colors) const
+{
+	constexpr int MAX_BLOCK_PIXELS{ BLOCK_SIZE * BLOCK_SIZE };
+	const int numPixels{ static_cast<int>(hitRecords.size()) };
+	const bool isCombined{ IsHeatmapMode(m_CurrentLightingMode) || m_CurrentLightingMode == LightingMode::Combined };
+	std::fill(colors.begin(), colors.end(), ColorRGB{});
+
+	//Hits sorted by material, so every material is one run
+	int order[MAX_BLOCK_PIXELS];
+	int numHits{};
+	for (int i{}; i < numPixels; ++i)
+	{
+		if (hitRecords[i].didHit)
+			order[numHits++] = i;
+	}
+	std::stable_sort(order, order + numHits, [&](int a, int b) { return hitRecords[a].materialIndex < hitRecords[b].materialIndex; });
+
+	float normalX[MAX_BLOCK_PIXELS], normalY[MAX_BLOCK_PIXELS], normalZ[MAX_BLOCK_PIXELS];
+	float viewX[MAX_BLOCK_PIXELS], viewY[MAX_BLOCK_PIXELS], viewZ[MAX_BLOCK_PIXELS];
+	float lightX[MAX_BLOCK_PIXELS], lightY[MAX_BLOCK_PIXELS], lightZ[MAX_BLOCK_PIXELS];
+	float texcoordU[MAX_BLOCK_PIXELS], texcoordV[MAX_BLOCK_PIXELS], texcoordFootprint[MAX_BLOCK_PIXELS];
+	float red[MAX_BLOCK_PIXELS], green[MAX_BLOCK_PIXELS], blue[MAX_BLOCK_PIXELS];
+	int batchPixels[MAX_BLOCK_PIXELS];
+	float lambertCosines[MAX_BLOCK_PIXELS];
+
+	//Lights in the outer loop, so every pixel sums its lights in the same order as ShadeDirect
+	for (size_t lightIndex{}; lightIndex < lights.size(); ++lightIndex)
+	{
+		const Light& light = lights[lightIndex];
+		for (int runStart{}; runStart < numHits;)
+		{
+			const unsigned char materialIndex{ hitRecords[order[runStart]].materialIndex };
+			int runEnd{ runStart };
+			int batchSize{};
+			for (; runEnd < numHits && hitRecords[order[runEnd]].materialIndex == materialIndex; ++runEnd)
 			{
-				if (LambertCosine != 0.f)
-					finalColor += ColorRGB{ LambertCosine ,LambertCosine ,LambertCosine };
-				break;
+				const int i{ order[runEnd] };
+				const HitRecord& hitRecord = hitRecords[i];
+				const Vector3 directionToLight{ LightUtils::GetDirectionToLight(light, hitRecord.origin + hitRecord.normal * 0.01f).Normalized() };
+				const float LambertCosine{ LightUtils::GetLambertCosine(hitRecord.normal, directionToLight) };
+				if (LambertCosine == 0.f || (m_AreShadowsEnabled && lightOcclusion[i * lights.size() + lightIndex]))
+					continue;
+
+				const Vector3 view{ -viewRays[i].direction };
+				normalX[batchSize] = hitRecord.normal.x;
+				normalY[batchSize] = hitRecord.normal.y;
+				normalZ[batchSize] = hitRecord.normal.z;
+				viewX[batchSize] = view.x;
+				viewY[batchSize] = view.y;
+				viewZ[batchSize] = view.z;
+				lightX[batchSize] = directionToLight.x;
+				lightY[batchSize] = directionToLight.y;
+				lightZ[batchSize] = directionToLight.z;
+				texcoordU[batchSize] = hitRecord.texcoord.x;
+				texcoordV[batchSize] = hitRecord.texcoord.y;
+				texcoordFootprint[batchSize] = hitRecord.texcoordFootprint;
+				lambertCosines[batchSize] = LambertCosine;
+				batchPixels[batchSize++] = i;
 			}
-			case LightingMode::Radiance:
+			runStart = runEnd;
+			if (batchSize == 0)
+				continue;
+
 			{
-				if (LambertCosine != 0.f)
-					finalColor += LightUtils::GetRadiance(light, closestHit.origin);
-				break;
+				PROFILE_STAGE(Shade);
+				const size_t size{ static_cast<size_t>(batchSize) };
+				const ShadingBatch batch{ { normalX, size }, { normalY, size }, { normalZ, size }, { viewX, size }, { viewY, size }, { viewZ, size },
+					{ lightX, size }, { lightY, size }, { lightZ, size }, { texcoordU, size }, { texcoordV, size }, { texcoordFootprint, size } };
+				materials[materialIndex]->ShadeBatch(batch, { { red, size }, { green, size }, { blue, size } });
 			}
-			case LightingMode::BRDF:
+
+			for (int entry{}; entry < batchSize; ++entry)
 			{
-				if (LambertCosine != 0.f)
-					finalColor += materials[closestHit.materialIndex]->Shade(closestHit, directionToLight.Normalized(), -viewRay.direction);
-				break;
+				const int i{ batchPixels[entry] };
+				const ColorRGB shaded{ red[entry], green[entry], blue[entry] };
+				if (isCombined)
+					colors[i] += LightUtils::GetRadiance(light, hitRecords[i].origin) * shaded * lambertCosines[entry];
+				else
+					colors[i] += shaded;
 			}
-			case LightingMode::Combined:
+		}
+	}
+}
+
+bool Renderer::GetShadowRay(const HitRecord& hitRecord, const Light& light, Ray& shadowRay)
+{
+	const Vector3 offsetOrigin{ hitRecord.origin + hitRecord.normal * 0.01f };
+	const Vector3 directionToLight{ LightUtils::GetDirectionToLight(light, offsetOrigin) };
+	if (LightUtils::GetLambertCosine(hitRecord.normal, directionToLight.Normalized()) == 0.f)
+		return false;
+
+	shadowRay = Ray{ offsetOrigin, directionToLight.Normalized(), 0.0001f, directionToLight.Magnitude() };
+	return true;
+}
+
+void Renderer::SetMaxBounces(int maxBounces)
+{
+	m_MaxBounces = std::max(0, maxBounces);
+	m_CurrentMaxBounces = m_MaxBounces;
+}
+
+void Renderer::SetReprojection(bool isEnabled, uint32_t maxTracedPixels)
+{
+	m_IsReprojectionEnabled = isEnabled;
+	m_ReprojectionBudget = maxTracedPixels;
+	m_HasHistory = false;
+
+	if (isEnabled)
+	{
+		const size_t numPixels{ static_cast<size_t>(m_Width * m_Height) };
+		m_Age.resize(numPixels);
+		m_HistoryAge.resize(numPixels);
+		AllocateWarpBuffers();
+	}
+}
+
+void Renderer::AllocateWarpBuffers()
+{
+	if (m_pWarpTargets)
+		return;
+
+	const size_t numPixels{ static_cast<size_t>(m_Width * m_Height) };
+	m_HistoryPixels.resize(numPixels);
+	m_HistoryDepth.resize(numPixels);
+	m_HistoryNormals.resize(numPixels);
+	m_pWarpTargets = std::make_unique<std::atomic<uint64_t>[]>(numPixels);
+}
+
+Renderer::ViewBasis Renderer::GetViewBasis(const Camera& camera)
+{
+	const Vector3 right{ camera.cameraToWorld.GetAxisX() };
+	const Vector3 up{ camera.cameraToWorld.GetAxisY() };
+	const Vector3 forward{ camera.cameraToWorld.GetAxisZ() };
+	return ViewBasis{ { camera.origin.x, camera.origin.y, camera.origin.z }, { right.x, right.y, right.z }, { up.x, up.y, up.z },
+		{ forward.x, forward.y, forward.z }, camera.FOV };
+}
+
+bool Renderer::Reproject(Scene* pScene, const Camera& camera, float aspectRatio, std::span<const Light> lights, const std::vector<Material*>& materials)
+{
+	//Moving objects and lights change shading anywhere through shadows and reflections, those frames are traced in full
+	if (!m_HasHistory || IsHeatmapMode(m_CurrentLightingMode) || pScene->GetChanges().HasChanges())
+		return false;
+
+	PROFILE_SCOPE("Reproject");
+	const int numPixels{ m_Width * m_Height };
+	const ViewBasis& oldView = m_HistoryView;
+	const ViewBasis newView{ GetViewBasis(camera) };
+
+	std::copy(m_pBufferPixels, m_pBufferPixels + numPixels, m_HistoryPixels.begin());
+	m_HistoryDepth.swap(m_Depth);
+	m_HistoryNormals.swap(m_Normals);
+	m_HistoryAge.swap(m_Age);
+	WarpHistory(oldView, newView, aspectRatio);
+
+	//Gather, pixels nothing landed on (disocclusions, cracks where the view magnifies) and stale ones get traced
+	m_TracedPixels.clear();
+	std::vector<uint32_t> stalePixels{};
+	for (int i{}; i < numPixels; ++i)
+	{
+		const uint64_t packed{ m_pWarpTargets[i].load(std::memory_order_relaxed) };
+		if (packed == UINT64_MAX)
+		{
+			m_TracedPixels.push_back(i);
+			continue;
+		}
+
+		const uint32_t source{ static_cast<uint32_t>(packed & 0xFFFFFFFFu) };
+		const uint32_t depthBits{ static_cast<uint32_t>(packed >> 32) };
+		std::memcpy(&m_Depth[i], &depthBits, sizeof(depthBits));
+		//Normals are in world space, only the camera moved since they were traced
+		m_Normals[i] = m_HistoryNormals[source];
+		m_pBufferPixels[i] = m_HistoryPixels[source];
+		m_Age[i] = static_cast<uint8_t>(std::min(m_HistoryAge[source] + 1, 255));
+		if (m_Age[i] >= MAX_REPROJECTED_AGE)
+			stalePixels.push_back(i);
+	}
+
+	//Over budget: trace an even spread of the holes, the rest borrow the pixel to their left and go first next frame
+	const size_t budget{ m_ReprojectionBudget > 0 ? m_ReprojectionBudget : SIZE_MAX };
+	if (m_TracedPixels.size() > budget)
+	{
+		const size_t numHoles{ m_TracedPixels.size() };
+		std::vector<uint32_t> tracedHoles{};
+		tracedHoles.reserve(budget);
+		for (size_t idx{}; idx < numHoles; ++idx)
+		{
+			const uint32_t pixelIndex{ m_TracedPixels[idx] };
+			if (idx * budget / numHoles != (idx + 1) * budget / numHoles)
 			{
-				if (LambertCosine != 0.f)
-					finalColor += LightUtils::GetRadiance(light, closestHit.origin) * materials[closestHit.materialIndex]->Shade(closestHit, directionToLight.Normalized(), -viewRay.direction) * LambertCosine;
-				break;
+				tracedHoles.push_back(pixelIndex);
+				continue;
 			}
+			m_pBufferPixels[pixelIndex] = pixelIndex % m_Width > 0 ? m_pBufferPixels[pixelIndex - 1] : 0;
+			m_Depth[pixelIndex] = -1.f;
+			m_Age[pixelIndex] = MAX_REPROJECTED_AGE;
+		}
+		m_TracedPixels.swap(tracedHoles);
+	}
+	const size_t numStale{ std::min(stalePixels.size(), budget - m_TracedPixels.size()) };
+	m_TracedPixels.insert(m_TracedPixels.end(), stalePixels.begin(), stalePixels.begin() + numStale);
+
+	Parallel::For(0, static_cast<int>(m_TracedPixels.size()), [&](int idx)
+	{
+		RenderPixel(pScene, m_TracedPixels[idx], camera.FOV, aspectRatio, camera, lights, materials);
+		m_Age[m_TracedPixels[idx]] = 0;
+	});
+	return true;
+}
+
+void Renderer::WarpHistory(const ViewBasis& oldView, const ViewBasis& newView, float aspectRatio, int parity)
+{
+	const int numPixels{ m_Width * m_Height };
+	for (int i{}; i < numPixels; ++i)
+		m_pWarpTargets[i].store(UINT64_MAX, std::memory_order_relaxed);
+
+	//Scatter every history pixel (of the parity) to where its surface point lands now, misses are directions and only follow the rotation
+	Parallel::For(0, m_Height, [&](int py)
+	{
+		for (int px{ parity >= 0 ? (py + parity) & 1 : 0 }; px < m_Width; px += parity >= 0 ? 2 : 1)
+		{
+			const uint32_t pixelIndex{ static_cast<uint32_t>(px + py * m_Width) };
+			const float depth{ m_HistoryDepth[pixelIndex] };
+			if (depth < 0.f)
+				continue;
+
+			//Same direction GenerateViewRay built for the pixel last frame
+			const float cameraX{ (2 * ((px + 0.5f) / float(m_Width)) - 1) * aspectRatio * oldView.FOV };
+			const float cameraY{ (1 - (2 * ((py + 0.5f) / float(m_Height)))) * oldView.FOV };
+			const float inverseLength{ 1.f / sqrtf(cameraX * cameraX + cameraY * cameraY + 1.f) };
+			float point[3]{};
+			for (int axis{}; axis < 3; ++axis)
+				point[axis] = (cameraX * oldView.right[axis] + cameraY * oldView.up[axis] + oldView.forward[axis]) * inverseLength;
+
+			float newDepth{ FLT_MAX };
+			if (depth < FLT_MAX)
+			{
+				float squaredDistance{};
+				for (int axis{}; axis < 3; ++axis)
+				{
+					point[axis] = oldView.origin[axis] + depth * point[axis] - newView.origin[axis];
+					squaredDistance += point[axis] * point[axis];
+				}
+				newDepth = sqrtf(squaredDistance);
 			}
 
+			const float localX{ point[0] * newView.right[0] + point[1] * newView.right[1] + point[2] * newView.right[2] };
+			const float localY{ point[0] * newView.up[0] + point[1] * newView.up[1] + point[2] * newView.up[2] };
+			const float localZ{ point[0] * newView.forward[0] + point[1] * newView.forward[1] + point[2] * newView.forward[2] };
+			if (localZ <= 1e-4f)
+				continue;
+
+			const float screenX{ (localX / localZ / (aspectRatio * newView.FOV) + 1.f) * 0.5f * m_Width };
+			const float screenY{ (1.f - localY / localZ / newView.FOV) * 0.5f * m_Height };
+			if (!(screenX >= 0.f && screenX < m_Width && screenY >= 0.f && screenY < m_Height))
+				continue;
+
+			//Samples that land on pixels traced this frame aren't needed
+			const int targetX{ static_cast<int>(screenX) };
+			const int targetY{ static_cast<int>(screenY) };
+			if (parity >= 0 && ((targetX + targetY) & 1) != parity)
+				continue;
+
+			//Positive floats compare like their bit patterns
+			uint32_t depthBits{};
+			std::memcpy(&depthBits, &newDepth, sizeof(depthBits));
+			const uint64_t packed{ (static_cast<uint64_t>(depthBits) << 32) | pixelIndex };
+			std::atomic<uint64_t>& target = m_pWarpTargets[targetX + targetY * m_Width];
+			uint64_t current{ target.load(std::memory_order_relaxed) };
+			while (packed < current && !target.compare_exchange_weak(current, packed, std::memory_order_relaxed))
+			{
+			}
 		}
+	});
+}
+
+void Renderer::SetDynamicResolution(bool isEnabled, float targetFrameTime)
+{
+	m_IsDynamicResolutionEnabled = isEnabled;
+	m_ResolutionTargetFrameTime = targetFrameTime;
+	m_ResolutionQuality = MAX_RESOLUTION_QUALITY;
+}
+
+void Renderer::AdaptResolution(float frameTime)
+{
+	if (!m_IsDynamicResolutionEnabled || m_ResolutionTargetFrameTime <= 0.f)
+		return;
+
+	//The traced area, and with it the frame time, changes about linearly with the quality
+	//Step in proportion to the miss, dropping fast when over target and climbing back slowly so it settles instead of oscillating
+	const float relativeError{ (m_ResolutionTargetFrameTime - frameTime) / m_ResolutionTargetFrameTime };
+	m_ResolutionQuality = std::clamp(m_ResolutionQuality + std::clamp(0.5f * relativeError, -0.25f, 0.05f), 0.f, MAX_RESOLUTION_QUALITY);
+}
+
+void Renderer::AdaptBounceDepth(float frameTime)
+{
+	if (!m_AreReflectionsEnabled || m_TargetFrameTime <= 0.f)
+		return;
+
+	//Drop a bounce as soon as we are over target, only add one back once there is clear headroom
+	if (frameTime > m_TargetFrameTime && m_CurrentMaxBounces > 0)
+	{
+		--m_CurrentMaxBounces;
 	}
+	else if (frameTime < 0.75f * m_TargetFrameTime && m_CurrentMaxBounces < m_MaxBounces)
+	{
+		++m_CurrentMaxBounces;
+	}
+}
 
-	//Update Color in Buffer
-	finalColor.MaxToOne();
+void Renderer::ResolveHeatmap(int x, int y, int width, int height)
+{
+	std::vector<float> sortedValues{};
+	sortedValues.reserve(width * height);
+	for (int row{ y }; row < y + height; ++row)
+		sortedValues.insert(sortedValues.end(), m_HeatValues.begin() + row * m_Width + x, m_HeatValues.begin() + row * m_Width + x + width);
+
+	const auto percentile = sortedValues.begin() + sortedValues.size() * 99 / 100;
+	std::nth_element(sortedValues.begin(), percentile, sortedValues.end());
+	const float scale{ *percentile > 0.f ? 1.f / *percentile : 0.f };
+
+	//Black -> blue -> cyan -> green -> yellow -> red
+	constexpr ColorRGB ramp[]{ { 0.f, 0.f, 0.f }, { 0.f, 0.f, 1.f }, { 0.f, 1.f, 1.f }, { 0.f, 1.f, 0.f }, { 1.f, 1.f, 0.f }, { 1.f, 0.f, 0.f } };
+	constexpr int numSegments{ static_cast<int>(std::size(ramp)) - 1 };
+
+	for (int row{ y }; row < y + height; ++row)
+	{
+		for (int column{ x }; column < x + width; ++column)
+		{
+			const float heat{ std::min(m_HeatValues[row * m_Width + column] * scale, 1.f) * numSegments };
+			const int segment{ std::min(static_cast<int>(heat), numSegments - 1) };
+			const float weight{ heat - segment };
 
-	m_pBufferPixels[px + (py * m_Width)] = SDL_MapRGB(m_pBuffer->format,
-		static_cast<uint8_t>(finalColor.r * 255),
-		static_cast<uint8_t>(finalColor.g * 255),
-		static_cast<uint8_t>(finalColor.b * 255));
+			ColorRGB color{ ramp[segment] };
+			color *= 1.f - weight;
+			ColorRGB next{ ramp[segment + 1] };
+			next *= weight;
+			color += next;
 
+			m_pBufferPixels[row * m_Width + column] = PackRGB(
+				static_cast<uint8_t>(color.r * 255),
+				static_cast<uint8_t>(color.g * 255),
+				static_cast<uint8_t>(color.b * 255));
+		}
+	}
 }
 
 bool Renderer::SaveBufferToImage() const
 {
-	return SDL_SaveBMP(m_pBuffer, "RayTracing_Buffer.bmp");
+#if defined(RT_ENABLE_SDL)
+	if (m_pBuffer)
+		return SDL_SaveBMP(m_pBuffer, "RayTracing_Buffer.bmp");
+#endif
+	//Without a window surface the buffer goes out as PPM, false on success like SDL_SaveBMP
+	std::vector<uint8_t> rgb(static_cast<size_t>(m_Width) * m_Height * 3);
+	for (size_t idx{}; idx < static_cast<size_t>(m_Width) * m_Height; ++idx)
+		UnpackRGB(m_pBufferPixels[idx], &rgb[3 * idx]);
+	return !ImageWriter::WritePPM("RayTracing_Buffer.ppm", m_Width, m_Height, rgb);
+}
+
+uint32_t Renderer::PackRGB(uint8_t r, uint8_t g, uint8_t b) const
+{
+#if defined(RT_ENABLE_SDL)
+	if (m_pBuffer)
+		return SDL_MapRGB(m_pBuffer->format, r, g, b);
+#endif
+	return 0xFF000000u | (uint32_t{ r } << 16) | (uint32_t{ g } << 8) | b;
+}
+
+void Renderer::UnpackRGB(uint32_t pixel, uint8_t* pRGB) const
+{
+#if defined(RT_ENABLE_SDL)
+	if (m_pBuffer)
+	{
+		SDL_GetRGB(pixel, m_pBuffer->format, &pRGB[0], &pRGB[1], &pRGB[2]);
+		return;
+	}
+#endif
+	pRGB[0] = static_cast<uint8_t>(pixel >> 16);
+	pRGB[1] = static_cast<uint8_t>(pixel >> 8);
+	pRGB[2] = static_cast<uint8_t>(pixel);
+}
+
+bool Renderer::HasPackedPixels() const
+{
+#if defined(RT_ENABLE_SDL)
+	if (m_pBuffer)
+		return m_pBuffer->format->BytesPerPixel == 4;
+#endif
+	return true;
+}
+
+void Renderer::SubmitFrame(ImageWriter& writer, const std::string& filename, ImageFormat format) const
+{
+	PROFILE_SCOPE("SubmitFrame");
+	const size_t numPixels{ static_cast<size_t>(m_Width) * m_Height };
+	ImageWriter::Frame& frame = writer.Acquire();
+	frame.filename = filename;
+	frame.format = format;
+	frame.width = m_Width;
+	frame.height = m_Height;
+
+	if (format == ImageFormat::PFM && !m_HdrPixels.empty())
+	{
+		frame.hdrRGB.assign(m_HdrPixels.begin(), m_HdrPixels.end());
+	}
+	else
+	{
+		frame.rgb.resize(numPixels * 3);
+		for (size_t idx{}; idx < numPixels; ++idx)
+			UnpackRGB(m_pBufferPixels[idx], &frame.rgb[3 * idx]);
+
+		//Float output without HDR capture still gets the clamped colours
+		if (format == ImageFormat::PFM)
+		{
+			frame.hdrRGB.resize(numPixels * 3);
+			std::transform(frame.rgb.begin(), frame.rgb.end(), frame.hdrRGB.begin(), [](uint8_t value) { return value / 255.f; });
+		}
+	}
+	writer.Submit(frame);
+}
+
+void Renderer::SetHdrCapture(bool isEnabled)
+{
+	m_HdrPixels.assign(isEnabled ? static_cast<size_t>(m_Width) * m_Height * 3 : 0, 0.f);
+	InvalidateHistory();
 }
 
+#if defined(RT_ENABLE_SDL)
 void Renderer::ProcessKeyUpEvent(const SDL_Event& e)
 {
 	switch (e.key.keysym.scancode)
@@ -209,22 +1258,68 @@ void Renderer::ProcessKeyUpEvent(const SDL_Event& e)
 		TogglelightingMode();
 		PrintCurrentSceneState();
 		break;
+	case SDL_SCANCODE_F4:
+		ToggleReflections();
+		PrintCurrentSceneState();
+		break;
+	case SDL_SCANCODE_F5:
+		ToggleReprojection();
+		PrintCurrentSceneState();
+		break;
+	case SDL_SCANCODE_F8:
+		ToggleCheckerboard();
+		PrintCurrentSceneState();
+		break;
+	case SDL_SCANCODE_F7:
+		SetDynamicResolution(!m_IsDynamicResolutionEnabled, m_ResolutionTargetFrameTime > 0.f ? m_ResolutionTargetFrameTime : DEFAULT_RESOLUTION_TARGET_FRAME_TIME);
+		PrintCurrentSceneState();
+		break;
 	default:
 		break;
 	}
 
 
 }
+#endif
 
 
 void dae::Renderer::ToggleShadows()
 {
 	m_AreShadowsEnabled = !m_AreShadowsEnabled;
+	InvalidateHistory();
+}
+
+void dae::Renderer::ToggleReflections()
+{
+	m_AreReflectionsEnabled = !m_AreReflectionsEnabled;
+	m_CurrentMaxBounces = m_MaxBounces;
+	InvalidateHistory();
+}
+
+void dae::Renderer::ToggleCheckerboard()
+{
+	m_IsCheckerboardEnabled = !m_IsCheckerboardEnabled;
+}
+
+void dae::Renderer::InvalidateHistory()
+{
+	m_HasHistory = false;
+	m_HasCheckerboardHistory = false;
+}
+
+void dae::Renderer::ToggleReprojection()
+{
+	SetReprojection(!m_IsReprojectionEnabled, m_ReprojectionBudget);
 }
 
 void dae::Renderer::TogglelightingMode()
 {
-	m_CurrentLightingMode = static_cast<LightingMode>((static_cast<int>(m_CurrentLightingMode) + 1) % 4);
+	m_CurrentLightingMode = static_cast<LightingMode>((static_cast<int>(m_CurrentLightingMode) + 1) % 8);
+	InvalidateHistory();
+
+	//Counter based heatmaps only have data when ray statistics are compiled in
+	if (!RayStats::IS_ENABLED && IsHeatmapMode(m_CurrentLightingMode) && m_CurrentLightingMode != LightingMode::HeatmapCycles)
+		m_CurrentLightingMode = LightingMode::HeatmapCycles;
 }
 
 void dae::Renderer::PrintCurrentSceneState() const 
@@ -237,6 +1332,41 @@ void dae::Renderer::PrintCurrentSceneState() const
 	{
 		std::cout << "Shadows are disabled" << "\n";
 	}
+	if (m_AreReflectionsEnabled)
+	{
+		std::cout << "Reflections are enabled (max " << m_MaxBounces << " bounces, currently " << m_CurrentMaxBounces << ")" << "\n";
+	}
+	else
+	{
+		std::cout << "Reflections are disabled" << "\n";
+	}
+	if (m_IsReprojectionEnabled)
+	{
+		std::cout << "Reprojection is enabled";
+		if (m_ReprojectionBudget > 0)
+			std::cout << " (at most " << m_ReprojectionBudget << " traced pixels per frame)";
+		std::cout << "\n";
+	}
+	else
+	{
+		std::cout << "Reprojection is disabled" << "\n";
+	}
+	if (m_IsCheckerboardEnabled)
+	{
+		std::cout << "Checkerboard rendering is enabled" << "\n";
+	}
+	else
+	{
+		std::cout << "Checkerboard rendering is disabled" << "\n";
+	}
+	if (m_IsDynamicResolutionEnabled)
+	{
+		std::cout << "Dynamic resolution is enabled (" << 1.f / m_ResolutionTargetFrameTime << " FPS target)" << "\n";
+	}
+	else
+	{
+		std::cout << "Dynamic resolution is disabled" << "\n";
+	}
 	switch (m_CurrentLightingMode)
 	{
 	case LightingMode::ObservedArea:
@@ -251,6 +1381,18 @@ void dae::Renderer::PrintCurrentSceneState() const
 	case LightingMode::Combined:
 		std::cout << "Lighting mode is set to Combined" << "\n";
 		break;
+	case LightingMode::HeatmapNodes:
+		std::cout << "Lighting mode is set to Heatmap (AABB/BVH nodes visited)" << "\n";
+		break;
+	case LightingMode::HeatmapPrimitives:
+		std::cout << "Lighting mode is set to Heatmap (primitives tested)" << "\n";
+		break;
+	case LightingMode::HeatmapShadowRays:
+		std::cout << "Lighting mode is set to Heatmap (shadow rays fired)" << "\n";
+		break;
+	case LightingMode::HeatmapCycles:
+		std::cout << "Lighting mode is set to Heatmap (CPU cycles)" << "\n";
+		break;
 	default:
 		break;
 	}
@@ -1,26 +1,40 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
 #include <vector>
 
 
 struct SDL_Window;
 struct SDL_Surface;
-struct ColorRGB;
+union SDL_Event;
 
 namespace dae
 {
 	class Scene;
 	class Material;
+	class ImageWriter;
+	enum class ImageFormat;
 
+	struct ColorRGB;
 	struct Light;
 	struct Camera;
+	struct Ray;
+	struct HitRecord;
+	struct Vector3;
 
 	class Renderer final
 	{
 	public:
+#if defined(RT_ENABLE_SDL)
 		Renderer(SDL_Window* pWindow);
-		~Renderer() = default;
+#endif
+		//Headless renderer drawing into its own ARGB8888 buffer, used by render workers and builds without SDL
+		Renderer(int width, int height);
+		~Renderer();
 
 		Renderer(const Renderer&) = delete;
 		Renderer(Renderer&&) noexcept = delete;
@@ -28,30 +42,177 @@ namespace dae
 		Renderer& operator=(Renderer&&) noexcept = delete;
 
 		void Render(Scene* pScene) ;
-		void RenderPixel(Scene* pScene, uint32_t pixelIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& materials) const;
+		//Renders a rectangle of the frame and copies it out as packed 8-bit RGB (3 bytes per pixel)
+		void RenderTile(Scene* pScene, int x, int y, int width, int height, uint8_t* pRGBOut);
+		void RenderPixel(Scene* pScene, uint32_t pixelIndex, float fov, float aspectRatio, const Camera& camera, std::span<const Light> lights, const std::vector<Material*>& materials) const;
+		//RayTracing_Buffer.bmp (.ppm without a window), false on success
 		bool SaveBufferToImage() const;
+		//Copies the frame into a buffer of the writer, which saves it from its own thread
+		void SubmitFrame(ImageWriter& writer, const std::string& filename, ImageFormat format) const;
+		//Keeps the unclamped colour of every pixel for PFM output, frames are traced in full while it's on
+		void SetHdrCapture(bool isEnabled);
+#if defined(RT_ENABLE_SDL)
 		void ProcessKeyUpEvent(const SDL_Event& e);
+#endif
+
+		//Reflection bounces, by default 3 deep and on average 2 bounce rays per pixel, a budget of 0 doesn't limit them
+		void SetMaxBounces(int maxBounces);
+		void SetBounceRayBudget(uint32_t maxRaysPerFrame) { m_BounceRayBudget = maxRaysPerFrame > 0 ? maxRaysPerFrame : UINT32_MAX; }
+		void SetTargetFrameTime(float seconds) { m_TargetFrameTime = seconds; }
+
+		//Temporal reprojection, last frame's pixels are warped into the new view and only disoccluded or stale pixels are traced
+		//maxTracedPixels bounds the pixels traced in a reprojected frame (0: no limit), holes left over borrow a neighbour until a later frame
+		//Frames where anything but the camera changed are traced in full
+		void SetReprojection(bool isEnabled, uint32_t maxTracedPixels = 0);
+
+		//Dynamic resolution, blocks away from the screen centre are traced at every 2nd or 4th pixel and interpolated to hold targetFrameTime
+		//The density adapts every frame from the measured frame time, the centre is the last to lose resolution
+		static constexpr float DEFAULT_RESOLUTION_TARGET_FRAME_TIME{ 1.f / 60.f };
+		void SetDynamicResolution(bool isEnabled, float targetFrameTime = DEFAULT_RESOLUTION_TARGET_FRAME_TIME);
+
+		//Checkerboard rendering, each frame traces the pixels of one parity, the others reuse last frame's samples warped into the view
+		//where the traced neighbours agree on the surface, and are interpolated from those neighbours where they don't
+		void SetCheckerboard(bool isEnabled) { m_IsCheckerboardEnabled = isEnabled; }
 
 		enum class LightingMode
 		{
 			ObservedArea = 0, //Lambert Cosine Law
 			Radiance = 1, //Incident Radiance
 			BRDF = 2, //Scattering of the light
-			Combined = 3 // ObservedArea*Radiance*BRDF
+			Combined = 3, // ObservedArea*Radiance*BRDF
+
+			//Cost heatmaps, the pixel is traced like Combined and coloured by what that cost
+			HeatmapNodes = 4, //AABB/BVH nodes visited (needs RT_ENABLE_RAY_STATS)
+			HeatmapPrimitives = 5, //Spheres, planes and triangles tested (needs RT_ENABLE_RAY_STATS)
+			HeatmapShadowRays = 6, //Shadow rays fired (needs RT_ENABLE_RAY_STATS)
+			HeatmapCycles = 7 //CPU cycles spent on the pixel
 		};
 		LightingMode m_CurrentLightingMode{ LightingMode::Combined };
 	private:
+		//Pixels are rendered in blocks of BLOCK_SIZE x BLOCK_SIZE, the shadow rays of a block go to the scene as one packet per light
+		static constexpr int BLOCK_SIZE{ 8 };
+
+		//Renders a rectangle of the frame in parallel, block by block (pixel by pixel for the heatmaps, which measure single pixels)
+		void RenderRect(Scene* pScene, int x, int y, int width, int height, float aspectRatio, const Camera& camera, std::span<const Light> lights, const std::vector<Material*>& materials) const;
+		//stride > 1 only traces the pixels on a stride x stride lattice starting at the block corner
+		//checkerboardParity 0 or 1 only traces the pixels where (x + y) % 2 matches it
+		void RenderBlock(Scene* pScene, int x, int y, int width, int height, float aspectRatio, const Camera& camera, std::span<const Light> lights, const std::vector<Material*>& materials,
+			int stride = 1, int checkerboardParity = -1) const;
+		//Whole frame at the density GetBlockStride picks per block, the untraced pixels are interpolated from their lattice neighbours
+		void RenderReducedDensity(Scene* pScene, float aspectRatio, const Camera& camera, std::span<const Light> lights, const std::vector<Material*>& materials) const;
+		int GetBlockStride(int blockX, int blockY) const;
+		//Traces half the pixels, the rest keep last frame's colour when nothing moved, reuse its warped samples when only the camera moved,
+		//and are reconstructed edge-aware from their traced neighbours where no sample landed or it doesn't match them
+		void RenderCheckerboard(Scene* pScene, float aspectRatio, const Camera& camera, std::span<const Light> lights, const std::vector<Material*>& materials);
+		Ray GenerateViewRay(int px, int py, float aspectRatio, const Camera& camera) const;
+		//Colour gathered along the mirror bounces after the first hit, bounceRaysLeft is the share of the bounce ray budget the caller still holds
+		ColorRGB TraceReflections(Scene* pScene, uint32_t pixelIndex, Ray viewRay, HitRecord closestHit, std::span<const Light> lights, const std::vector<Material*>& materials,
+			uint32_t& bounceRaysLeft) const;
+		//The bounce ray budget is split over the pixels of the frame, a rectangle of them gets the part its area covers
+		//Spent shares borrow from the pool of rays other blocks returned unused, so no part of the screen loses its reflections to the ones traced first
+		uint32_t GetBounceRayShare(int x, int y, int width, int height) const;
+		bool TakeBounceRay(uint32_t& bounceRaysLeft) const;
+		void ReturnBounceRays(uint32_t bounceRaysLeft) const;
+		void WritePixel(int px, int py, ColorRGB color) const;
+		//Pixels in the format of the window surface, ARGB8888 in the renderer's own buffer
+		uint32_t PackRGB(uint8_t r, uint8_t g, uint8_t b) const;
+		void UnpackRGB(uint32_t pixel, uint8_t* pRGB) const;
+		//Reduced density frames copy pixels as 32-bit values
+		bool HasPackedPixels() const;
+
+		//lightOcclusion holds a 0/1 per light when the shadow rays were already traced as a packet, empty traces them one by one
+		ColorRGB ShadeDirect(Scene* pScene, const Ray& ray, const HitRecord& hitRecord, std::span<const Light> lights, const std::vector<Material*>& materials,
+			std::span<const uint8_t> lightOcclusion = {}) const;
+		//ShadeDirect for every hit of a block at once in the BRDF and Combined modes, the hits of one light and material go to Material::ShadeBatch together
+		void ShadeBlock(std::span<const Ray> viewRays, std::span<const HitRecord> hitRecords, std::span<const Light> lights, const std::vector<Material*>& materials,
+			std::span<const uint8_t> lightOcclusion, std::span<ColorRGB> colors) const;
+		//False when the light can't contribute (surface faces away), no shadow ray is needed then
+		static bool GetShadowRay(const HitRecord& hitRecord, const Light& light, Ray& shadowRay);
+		void AdaptBounceDepth(float frameTime);
+		void AdaptResolution(float frameTime);
+		//Maps m_HeatValues of a rectangle onto a colour ramp, scaled to the 99th percentile so outliers don't wash it out
+		void ResolveHeatmap(int x, int y, int width, int height);
+		static bool IsHeatmapMode(LightingMode mode) { return mode >= LightingMode::HeatmapNodes; }
 
+		//Camera basis as plain floats for the per pixel warp
+		struct ViewBasis
+		{
+			float origin[3];
+			float right[3];
+			float up[3];
+			float forward[3];
+			float FOV;
+		};
+		static ViewBasis GetViewBasis(const Camera& camera);
+		//Warps the previous frame into the view and traces what it can't provide, false when there is no usable history
+		bool Reproject(Scene* pScene, const Camera& camera, float aspectRatio, std::span<const Light> lights, const std::vector<Material*>& materials);
+		//History buffers and warp targets, shared by reprojection and checkerboard rendering which never both use them in one frame
+		void AllocateWarpBuffers();
+		//Scatters the history pixels to where their surface point lands in newView, the closest one per pixel ends up in m_pWarpTargets
+		//parity 0 or 1 only warps the history pixels of that parity, and keeps the ones that land on pixels of that parity again
+		void WarpHistory(const ViewBasis& oldView, const ViewBasis& newView, float aspectRatio, int parity = -1);
 
 		void ToggleShadows();
+		void ToggleReflections();
+		void ToggleReprojection();
+		void ToggleCheckerboard();
+		//The buffer no longer matches what the current settings would render
+		void InvalidateHistory();
 		void TogglelightingMode();
 		void PrintCurrentSceneState() const;
 		SDL_Window* m_pWindow{};
 		SDL_Surface* m_pBuffer{};
+		std::vector<uint32_t> m_OwnPixels{}; //headless renderers
 		uint32_t* m_pBufferPixels{};
 
 		int m_Width{};
 		int m_Height{};
 		bool m_AreShadowsEnabled{};
+
+		//Reflection bounces, the depth is lowered/raised between frames to hold m_TargetFrameTime
+		bool m_AreReflectionsEnabled{};
+		int m_MaxBounces{ 3 };
+		int m_CurrentMaxBounces{ 3 };
+		int m_RussianRouletteDepth{ 1 }; //bounces traced before russian roulette may terminate a path
+		uint32_t m_BounceRayBudget{};
+		float m_TargetFrameTime{ 0.1f };
+		uint32_t m_FrameIndex{};
+		mutable std::atomic<uint32_t> m_BounceRayPool{}; //rays returned unused by the pixels and blocks done so far this frame (or tile)
+
+		//Per-pixel cost of the heatmap modes
+		mutable std::vector<float> m_HeatValues{};
+		//Unclamped RGB per pixel, empty unless HDR capture is on
+		mutable std::vector<float> m_HdrPixels{};
+
+		//Temporal reprojection
+		//Pixels are reused for at most MAX_REPROJECTED_AGE frames, view dependent shading drifts while the camera moves
+		static constexpr uint8_t MAX_REPROJECTED_AGE{ 8 };
+		bool m_IsReprojectionEnabled{};
+		uint32_t m_ReprojectionBudget{};
+		bool m_HasHistory{};
+		ViewBasis m_HistoryView{};
+		mutable std::vector<float> m_Depth{}; //t of the primary hit, FLT_MAX for misses and negative when the pixel holds no surface
+		mutable std::vector<Vector3> m_Normals{}; //normal of the primary hit
+		std::vector<uint8_t> m_Age{}; //frames since the pixel was traced
+		std::vector<uint32_t> m_HistoryPixels{};
+		std::vector<float> m_HistoryDepth{};
+		std::vector<Vector3> m_HistoryNormals{};
+		std::vector<uint8_t> m_HistoryAge{};
+		//Nearest history pixel landing on each pixel, depth bits in the high half so an atomic min keeps the closest
+		std::unique_ptr<std::atomic<uint64_t>[]> m_pWarpTargets{};
+		std::vector<uint32_t> m_TracedPixels{};
+
+		//Dynamic resolution
+		//Quality 2 traces every pixel, 1 every other pixel in both directions and 0 every 4th (see GetBlockStride)
+		static constexpr float MAX_RESOLUTION_QUALITY{ 2.f };
+		bool m_IsDynamicResolutionEnabled{};
+		float m_ResolutionTargetFrameTime{};
+		float m_ResolutionQuality{ MAX_RESOLUTION_QUALITY };
+		mutable std::vector<uint8_t> m_BlockStrides{};
+
+		//Checkerboard rendering
+		bool m_IsCheckerboardEnabled{};
+		bool m_HasCheckerboardHistory{};
+		ViewBasis m_CheckerboardView{};
 	};
 }
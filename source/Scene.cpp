@@ -1,6 +1,12 @@
 #include "Scene.h"
 #include "Utils.h"
 #include "Material.h"
+#include "MappedFile.h"
+#include "Profiler.h"
+#include "RayStats.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <iostream>
 
 
@@ -8,90 +14,214 @@ namespace dae {
 
 #pragma region Base Scene
 	//Initialize Scene with Default Solid Color Material (RED)
-	Scene::Scene():
-		m_Materials({ new Material_SolidColor({1,0,0})})
+	Scene::Scene()
 	{
-		m_SphereGeometries.reserve(32);
-		m_PlaneGeometries.reserve(32);
-		m_TriangleMeshGeometries.reserve(32);
-		m_Lights.reserve(32);
+		AddMaterial<Material_SolidColor>(ColorRGB{ 1,0,0 });
+
+		m_SphereGeometries.Reserve(32);
+		m_PlaneGeometries.Reserve(32);
+		m_TriangleMeshGeometries.Reserve(32);
+		m_Lights.Reserve(32);
 	}
 
-	Scene::~Scene()
+	//Pools and materials are torn down together with the arena
+	Scene::~Scene() = default;
+
+	namespace
 	{
-		for(auto& pMaterial : m_Materials)
+		//Triangles wanted per pixel of the mesh' projected bounding sphere, about half of them face away from the camera
+		constexpr float LOD_TRIANGLES_PER_PIXEL{ 1.f };
+
+		//Coarsest level that still has enough triangles for the area the mesh covers on screen
+		uint32_t SelectLOD(const TriangleMesh& mesh, const Camera& camera, uint32_t viewHeight)
 		{
-			delete pMaterial;
-			pMaterial = nullptr;
+			if (mesh.lods.empty())
+				return 0;
+
+			const Vector3 center{ (mesh.transformedMinAABB + mesh.transformedMaxAABB) * 0.5f };
+			const float radius{ (mesh.transformedMaxAABB - mesh.transformedMinAABB).Magnitude() * 0.5f };
+			const float distance{ (center - camera.origin).Magnitude() };
+			if (distance <= radius)
+				return 0;
+
+			//Projected radius in pixels, the view spans 2 * tan(fov / 2) at distance 1
+			const float tanHalfFov{ tanf(camera.fovAngle * TO_RADIANS * 0.5f) };
+			const float pixelRadius{ radius / (distance * tanHalfFov) * viewHeight * 0.5f };
+			const float wantedTriangles{ PI * pixelRadius * pixelRadius * LOD_TRIANGLES_PER_PIXEL };
+
+			uint32_t level{};
+			while (level < mesh.lods.size() && mesh.lods[level].indices.size() / 3 >= wantedTriangles)
+				++level;
+			return level;
 		}
 
-		m_Materials.clear();
+		void RebuildBVH(BVH& bvh, const std::vector<Vector3>& positions, const std::vector<int>& indices, BVHBuildMode mode, uint32_t lodLevel)
+		{
+			bvh.Build(positions, indices, mode);
+
+			//Animated meshes rebuild every frame, only report the one-off SAH builds
+			const size_t numTriangles{ indices.size() / 3 };
+			if (mode == BVHBuildMode::BinnedSAH && numTriangles > 0)
+			{
+				const float buildTimeMs{ bvh.GetLastBuildTime() * 1000.f };
+				std::cout << "BVH (binned SAH, LOD " << lodLevel << "): " << numTriangles << " triangles, " << bvh.GetNumNodes() << " nodes in "
+					<< buildTimeMs << " ms (" << buildTimeMs * 1'000'000.f / numTriangles << " ms per million triangles)\n";
+			}
+		}
 	}
 
-	void dae::Scene::GetClosestHit(const Ray& ray, HitRecord& closestHit) const
+	void Scene::PrepareFrame(uint32_t viewHeight)
 	{
-		HitRecord temp{};
-		for (const auto& sphere : m_SphereGeometries)
+		//Only the level in use gets transformed and its BVH (re)built
+		for (auto& mesh : m_TriangleMeshGeometries)
 		{
-			if (GeometryUtils::HitTest_Sphere_Geometric(sphere, ray, temp))
+			mesh.activeLOD = SelectLOD(mesh, m_Camera, viewHeight);
+			if (mesh.activeLOD == 0)
 			{
-				if (temp.t <= closestHit.t)
+				if (mesh.isTransformDirty)
+					mesh.UpdateBaseTransforms();
+				if (mesh.isBVHDirty)
 				{
-					closestHit.didHit = temp.didHit;
-					closestHit.materialIndex = temp.materialIndex;
-					closestHit.normal = temp.normal;
-					closestHit.origin = temp.origin;
-					closestHit.t = temp.t;
+					RebuildBVH(mesh.bvh, mesh.transformedPositions, mesh.indices, mesh.bvhBuildMode, 0);
+					mesh.isBVHDirty = false;
 				}
+				continue;
 			}
+
+			TriangleMeshLOD& lod = mesh.lods[mesh.activeLOD - 1];
+			if (lod.isTransformDirty)
+				mesh.UpdateLODTransforms(lod);
+			if (lod.isBVHDirty)
+			{
+				RebuildBVH(lod.bvh, lod.transformedPositions, lod.indices, mesh.bvhBuildMode, mesh.activeLOD);
+				lod.isBVHDirty = false;
+			}
+		}
+
+		m_ChangeTracker.Update(m_SphereGeometries.GetSpan(), m_TriangleMeshGeometries.GetSpan(), m_Lights.GetSpan());
+		m_LightCache.Update(m_ChangeTracker, m_Lights.GetSpan());
+
+		//Still spheres keep the grid or SoA copy of the last frame
+		if (m_ChangeTracker.AreSpheresChanged())
+		{
+			if (m_SphereAcceleration != SphereAcceleration::None)
+				m_SphereGrid.Build(m_SphereGeometries.GetSpan(), m_SphereAcceleration == SphereAcceleration::HashedGrid);
+			else
+				m_SphereSoA.Build(m_SphereGeometries.GetSpan());
+		}
+	}
+
+	void Scene::SetSphereAcceleration(SphereAcceleration sphereAcceleration)
+	{
+		m_SphereAcceleration = sphereAcceleration;
+		if (m_SphereAcceleration == SphereAcceleration::None)
+		{
+			m_SphereGrid.Clear();
+			m_SphereSoA.Build(m_SphereGeometries.GetSpan());
 		}
+		else
+		{
+			m_SphereSoA.Clear();
+			m_SphereGrid.Build(m_SphereGeometries.GetSpan(), m_SphereAcceleration == SphereAcceleration::HashedGrid);
+		}
+	}
 
-		for (const auto& plane : m_PlaneGeometries)
+	void dae::Scene::GetClosestHit(const Ray& ray, HitRecord& closestHit) const
+	{
+		PROFILE_STAGE(ClosestHit);
+		RAY_STAT(ClosestHitQueries);
+		//Only t and what was hit are tracked while testing, the hit record is filled in once for the winner
+		//Ties go to the primitive tested last, like before
+		HitCandidate candidate{};
+		candidate.t = closestHit.t;
+
+		float t{};
+		uint32_t sphereIndex{};
+		const bool didHitSphere{ m_SphereAcceleration != SphereAcceleration::None ?
+			m_SphereGrid.GetClosestHit(m_SphereGeometries.GetSpan(), ray, t, sphereIndex) :
+			m_SphereSoA.GetClosestHit(ray, t, sphereIndex) };
+		if (didHitSphere && t <= candidate.t)
 		{
-			if (GeometryUtils::HitTest_Plane(plane, ray, temp))
+			candidate.t = t;
+			candidate.primitiveId = sphereIndex;
+			candidate.type = PrimitiveType::Sphere;
+		}
+
+		const std::span<const Plane> planes{ m_PlaneGeometries.GetSpan() };
+		for (uint32_t planeIndex{}; planeIndex < planes.size(); ++planeIndex)
+		{
+			if (GeometryUtils::Intersect_Plane(planes[planeIndex], ray, t) && t <= candidate.t)
 			{
-				if (temp.t <= closestHit.t)
-				{
-					closestHit.didHit = temp.didHit;
-					closestHit.materialIndex = temp.materialIndex;
-					closestHit.normal = temp.normal;
-					closestHit.origin = temp.origin;
-					closestHit.t = temp.t;
-				}
+				candidate.t = t;
+				candidate.primitiveId = planeIndex;
+				candidate.type = PrimitiveType::Plane;
 			}
 		}
 
-		for (const auto& mesh : m_TriangleMeshGeometries)
+		const std::span<const TriangleMesh> meshes{ m_TriangleMeshGeometries.GetSpan() };
+		for (uint32_t meshIndex{}; meshIndex < meshes.size(); ++meshIndex)
 		{
-			if (GeometryUtils::HitTest_TriangleMesh(mesh, ray, temp, false))
+			uint32_t triangleIndex{};
+			float u{}, v{};
+			if (GeometryUtils::Intersect_TriangleMesh(meshes[meshIndex], ray, false, t, triangleIndex, u, v) && t <= candidate.t)
 			{
-				if (temp.t <= closestHit.t)
-				{
-					closestHit.didHit = temp.didHit;
-					closestHit.materialIndex = temp.materialIndex;
-					closestHit.normal = temp.normal;
-					closestHit.origin = temp.origin;
-					closestHit.t = temp.t;
-				}
+				candidate.t = t;
+				candidate.primitiveId = triangleIndex;
+				candidate.instanceId = meshIndex;
+				candidate.u = u;
+				candidate.v = v;
+				candidate.type = PrimitiveType::Triangle;
 			}
 		}
 
+		if (candidate.type == PrimitiveType::None)
+			return;
+
+		ResolveHit(ray, candidate, closestHit);
+		RAY_STAT(Hits);
+	}
+
+	void Scene::ResolveHit(const Ray& ray, const HitCandidate& candidate, HitRecord& hitRecord) const
+	{
+		switch (candidate.type)
+		{
+		case PrimitiveType::Sphere:
+			GeometryUtils::ResolveHit_Sphere(m_SphereGeometries[candidate.primitiveId], ray, candidate.t, hitRecord);
+			break;
+		case PrimitiveType::Plane:
+			GeometryUtils::ResolveHit_Plane(m_PlaneGeometries[candidate.primitiveId], ray, candidate.t, hitRecord);
+			break;
+		case PrimitiveType::Triangle:
+			GeometryUtils::ResolveHit_TriangleMesh(m_TriangleMeshGeometries[candidate.instanceId], ray, candidate.t, candidate.primitiveId, candidate.u, candidate.v, hitRecord);
+			break;
+		default:
+			break;
+		}
 	}
 
 	bool Scene::DoesHit(const Ray& ray) const
 	{
-		for (const auto& sphere : m_SphereGeometries)
+		PROFILE_STAGE(DoesHit);
+		RAY_STAT(ShadowQueries);
+		if (m_SphereAcceleration != SphereAcceleration::None)
 		{
-			if (GeometryUtils::HitTest_Sphere_Geometric(sphere, ray))
+			if (m_SphereGrid.DoesHit(m_SphereGeometries.GetSpan(), ray))
 			{
+				RAY_STAT(ShadowEarlyOuts);
 				return true;
 			}
 		}
+		else if (m_SphereSoA.DoesHit(ray))
+		{
+			RAY_STAT(ShadowEarlyOuts);
+			return true;
+		}
 
 		for (const auto& mesh : m_TriangleMeshGeometries)
 		{
 			if (GeometryUtils::HitTest_TriangleMesh(mesh, ray))
 			{
+				RAY_STAT(ShadowEarlyOuts);
 				return true;
 			}
 		}
@@ -99,40 +229,63 @@ namespace dae {
 		return false;
 	}
 
+	void Scene::DoesHit(std::span<const Ray> shadowRays, std::span<uint8_t> isOccluded) const
+	{
+		PROFILE_STAGE(DoesHit);
+		assert(shadowRays.size() == isOccluded.size());
+		if constexpr (RayStats::IS_ENABLED)
+			RayStats::Increment(RayStats::Counter::ShadowQueries, shadowRays.size());
+
+		//Spheres are cheap enough with the SoA kernel or the grid to stay per ray
+		for (size_t idx{}; idx < shadowRays.size(); ++idx)
+		{
+			isOccluded[idx] = m_SphereAcceleration != SphereAcceleration::None ?
+				m_SphereGrid.DoesHit(m_SphereGeometries.GetSpan(), shadowRays[idx]) :
+				m_SphereSoA.DoesHit(shadowRays[idx]);
+		}
+
+		for (size_t first{}; first < shadowRays.size(); first += GeometryUtils::MAX_SHADOW_BUNDLE_SIZE)
+		{
+			const size_t count{ std::min(GeometryUtils::MAX_SHADOW_BUNDLE_SIZE, shadowRays.size() - first) };
+			for (const auto& mesh : m_TriangleMeshGeometries)
+				GeometryUtils::Occluded_TriangleMesh(mesh, shadowRays.subspan(first, count), isOccluded.subspan(first, count));
+		}
+
+		if constexpr (RayStats::IS_ENABLED)
+			RayStats::Increment(RayStats::Counter::ShadowEarlyOuts, std::count(isOccluded.begin(), isOccluded.end(), uint8_t{ 1 }));
+	}
+
 #pragma region Scene Helpers
-	Sphere* Scene::AddSphere(const Vector3& origin, float radius, unsigned char materialIndex)
+	SphereHandle Scene::AddSphere(const Vector3& origin, float radius, unsigned char materialIndex)
 	{
 		Sphere s;
 		s.origin = origin;
 		s.radius = radius;
 		s.materialIndex = materialIndex;
 
-		m_SphereGeometries.emplace_back(s);
-		return &m_SphereGeometries.back();
+		return m_SphereGeometries.Add(s);
 	}
 
-	Plane* Scene::AddPlane(const Vector3& origin, const Vector3& normal, unsigned char materialIndex)
+	PlaneHandle Scene::AddPlane(const Vector3& origin, const Vector3& normal, unsigned char materialIndex)
 	{
 		Plane p;
 		p.origin = origin;
 		p.normal = normal;
 		p.materialIndex = materialIndex;
 
-		m_PlaneGeometries.emplace_back(p);
-		return &m_PlaneGeometries.back();
+		return m_PlaneGeometries.Add(p);
 	}
 
-	TriangleMesh* Scene::AddTriangleMesh(TriangleCullMode cullMode, unsigned char materialIndex)
+	TriangleMeshHandle Scene::AddTriangleMesh(TriangleCullMode cullMode, unsigned char materialIndex)
 	{
 		TriangleMesh m{};
 		m.cullMode = cullMode;
 		m.materialIndex = materialIndex;
 
-		m_TriangleMeshGeometries.emplace_back(m);
-		return &m_TriangleMeshGeometries.back();
+		return m_TriangleMeshGeometries.Add(std::move(m));
 	}
 
-	Light* Scene::AddPointLight(const Vector3& origin, float intensity, const ColorRGB& color)
+	LightHandle Scene::AddPointLight(const Vector3& origin, float intensity, const ColorRGB& color)
 	{
 		Light l;
 		l.origin = origin;
@@ -140,11 +293,10 @@ namespace dae {
 		l.color = color;
 		l.type = LightType::Point;
 
-		m_Lights.emplace_back(l);
-		return &m_Lights.back();
+		return m_Lights.Add(l);
 	}
 
-	Light* Scene::AddDirectionalLight(const Vector3& direction, float intensity, const ColorRGB& color)
+	LightHandle Scene::AddDirectionalLight(const Vector3& direction, float intensity, const ColorRGB& color)
 	{
 		Light l;
 		l.direction = direction;
@@ -152,12 +304,12 @@ namespace dae {
 		l.color = color;
 		l.type = LightType::Directional;
 
-		m_Lights.emplace_back(l);
-		return &m_Lights.back();
+		return m_Lights.Add(l);
 	}
 
 	unsigned char Scene::AddMaterial(Material* pMaterial)
 	{
+		assert(m_Materials.size() < 256 && "Material indices are stored as unsigned char");
 		m_Materials.push_back(pMaterial);
 		return static_cast<unsigned char>(m_Materials.size() - 1);
 	}
@@ -169,10 +321,10 @@ namespace dae {
 	{
 		//default: Material id0 >> SolidColor Material (RED)
 		constexpr unsigned char matId_Solid_Red = 0;
-		const unsigned char matId_Solid_Blue = AddMaterial(new Material_SolidColor{ colors::Blue });
-		const unsigned char matId_Solid_Yellow = AddMaterial(new Material_SolidColor{ colors::Yellow });
-		const unsigned char matId_Solid_Green = AddMaterial(new Material_SolidColor{ colors::Green });
-		const unsigned char matId_Solid_Magenta = AddMaterial(new Material_SolidColor{ colors::Magenta });
+		const unsigned char matId_Solid_Blue = AddMaterial<Material_SolidColor>(colors::Blue);
+		const unsigned char matId_Solid_Yellow = AddMaterial<Material_SolidColor>(colors::Yellow);
+		const unsigned char matId_Solid_Green = AddMaterial<Material_SolidColor>(colors::Green);
+		const unsigned char matId_Solid_Magenta = AddMaterial<Material_SolidColor>(colors::Magenta);
 		
 
 		//Spheres
@@ -196,11 +348,11 @@ namespace dae {
 
 		//default: Material id0 >> SolidColor Material (RED)
 		constexpr unsigned char matId_Solid_Red = 0;
-		const unsigned char matId_Solid_Blue = AddMaterial(new Material_SolidColor{ colors::Blue });
+		const unsigned char matId_Solid_Blue = AddMaterial<Material_SolidColor>(colors::Blue);
 
-		const unsigned char matId_Solid_Yellow = AddMaterial(new Material_SolidColor{ colors::Yellow });
-		const unsigned char matId_Solid_Green = AddMaterial(new Material_SolidColor{ colors::Green });
-		const unsigned char matId_Solid_Magenta = AddMaterial(new Material_SolidColor{ colors::Magenta });
+		const unsigned char matId_Solid_Yellow = AddMaterial<Material_SolidColor>(colors::Yellow);
+		const unsigned char matId_Solid_Green = AddMaterial<Material_SolidColor>(colors::Green);
+		const unsigned char matId_Solid_Magenta = AddMaterial<Material_SolidColor>(colors::Magenta);
 
 		//Plane
 		AddPlane({ -5.f, 0.f, 0.f }, { 1.f, 0.f,0.f }, matId_Solid_Green);
@@ -229,14 +381,14 @@ namespace dae {
 		m_Camera.fovAngle = 45.f;
 
 		//default: Material id0 >> SolidColor Material (RED)
-		const auto matCT_GrayRoughMetal = AddMaterial(new Material_CookTorrence{ {0.972f, 0.960f, 0.915f}, 1.f,1.f });
-		const auto matCT_GrayMediumMetal = AddMaterial(new Material_CookTorrence{ {0.972f, 0.960f, 0.915f}, 1.f,0.6f });
-		const auto matCT_GraySmoothMetal = AddMaterial(new Material_CookTorrence{ {0.972f, 0.960f, 0.915f}, 1.f,0.1f });
-		const auto matCT_GrayRoughPlastic = AddMaterial(new Material_CookTorrence{ {0.75f, 0.75f, 0.75f}, 0.f,1.f });
-		const auto matCT_GrayMediumPlastic = AddMaterial(new Material_CookTorrence{ {0.75f, 0.75f, 0.75f}, 0.f,0.6f });
-		const auto matCT_GraySmoothPlastic = AddMaterial(new Material_CookTorrence{ {0.75f, 0.75f, 0.75f}, 0.f,0.1f });
+		const auto matCT_GrayRoughMetal = AddMaterial<Material_CookTorrence>(ColorRGB{ 0.972f, 0.960f, 0.915f }, 1.f,1.f);
+		const auto matCT_GrayMediumMetal = AddMaterial<Material_CookTorrence>(ColorRGB{ 0.972f, 0.960f, 0.915f }, 1.f,0.6f);
+		const auto matCT_GraySmoothMetal = AddMaterial<Material_CookTorrence>(ColorRGB{ 0.972f, 0.960f, 0.915f }, 1.f,0.1f);
+		const auto matCT_GrayRoughPlastic = AddMaterial<Material_CookTorrence>(ColorRGB{ 0.75f, 0.75f, 0.75f }, 0.f,1.f);
+		const auto matCT_GrayMediumPlastic = AddMaterial<Material_CookTorrence>(ColorRGB{ 0.75f, 0.75f, 0.75f }, 0.f,0.6f);
+		const auto matCT_GraySmoothPlastic = AddMaterial<Material_CookTorrence>(ColorRGB{ 0.75f, 0.75f, 0.75f }, 0.f,0.1f);
 
-		const auto matLambert_GrayBlue = AddMaterial(new Material_Lambert{ {0.49f, 0.57f, 0.57f}, 1.f });
+		const auto matLambert_GrayBlue = AddMaterial<Material_Lambert>(ColorRGB{ 0.49f, 0.57f, 0.57f }, 1.f);
 
 		//Plane
 		AddPlane({ 0.f, 0.f, 10.f }, { 0.f, 0.f,-1.f }, matLambert_GrayBlue);
@@ -268,9 +420,9 @@ namespace dae {
 		m_Camera.origin = { 0.f, 1.f, -5.f };
 		m_Camera.fovAngle = 45.f;
 
-		const auto matLambert_Red = AddMaterial(new Material_Lambert(colors::Red, 1.f));
-		const unsigned char matLambertPhong_Blue = AddMaterial(new Material_LambertPhong(colors::Blue, 1.f, 1.f, 60.f));
-		const unsigned char matLambert_Yellow = AddMaterial(new Material_Lambert(colors::Yellow, 1.f));
+		const auto matLambert_Red = AddMaterial<Material_Lambert>(colors::Red, 1.f);
+		const unsigned char matLambertPhong_Blue = AddMaterial<Material_LambertPhong>(colors::Blue, 1.f, 1.f, 60.f);
+		const unsigned char matLambert_Yellow = AddMaterial<Material_Lambert>(colors::Yellow, 1.f);
 
 		AddSphere({ -.75f, 1.f, .0f }, 1.f, matLambert_Red);
 		AddSphere({ .75f, 1.f, .0f }, 1.f, matLambertPhong_Blue);
@@ -288,15 +440,15 @@ namespace dae {
 		m_Camera.origin = { 0.f, 3.f, -9.f };
 		m_Camera.fovAngle = 45.f;
 
-		const auto matCT_GreyRoughMetal = AddMaterial(new Material_CookTorrence{ {0.972f, 0.960f, 0.915f}, 1.f,1.f });
-		const auto matCT_GreyMediumMetal = AddMaterial(new Material_CookTorrence{ {0.972f, 0.960f, 0.915f}, 1.f,0.6f });
-		const auto matCT_GreySmoothMetal = AddMaterial(new Material_CookTorrence{ {0.972f, 0.960f, 0.915f}, 1.f,0.1f });
-		const auto matCT_GreyRoughPlastic = AddMaterial(new Material_CookTorrence{ {0.75f, 0.75f, 0.75f}, 0.f,1.f });
-		const auto matCT_GreyMediumPlastic = AddMaterial(new Material_CookTorrence{ {0.75f, 0.75f, 0.75f}, 0.f,0.6f });
-		const auto matCT_GreySmoothPlastic = AddMaterial(new Material_CookTorrence{ {0.75f, 0.75f, 0.75f}, 0.f,0.1f });
+		const auto matCT_GreyRoughMetal = AddMaterial<Material_CookTorrence>(ColorRGB{ 0.972f, 0.960f, 0.915f }, 1.f,1.f);
+		const auto matCT_GreyMediumMetal = AddMaterial<Material_CookTorrence>(ColorRGB{ 0.972f, 0.960f, 0.915f }, 1.f,0.6f);
+		const auto matCT_GreySmoothMetal = AddMaterial<Material_CookTorrence>(ColorRGB{ 0.972f, 0.960f, 0.915f }, 1.f,0.1f);
+		const auto matCT_GreyRoughPlastic = AddMaterial<Material_CookTorrence>(ColorRGB{ 0.75f, 0.75f, 0.75f }, 0.f,1.f);
+		const auto matCT_GreyMediumPlastic = AddMaterial<Material_CookTorrence>(ColorRGB{ 0.75f, 0.75f, 0.75f }, 0.f,0.6f);
+		const auto matCT_GreySmoothPlastic = AddMaterial<Material_CookTorrence>(ColorRGB{ 0.75f, 0.75f, 0.75f }, 0.f,0.1f);
 
-		const auto matLambert_GreyBlue = AddMaterial(new Material_Lambert{ {0.49f, 0.57f, 0.57f}, 1.f });
-		const auto matLambert_White = AddMaterial(new Material_Lambert{ colors::White, 1.f });
+		const auto matLambert_GreyBlue = AddMaterial<Material_Lambert>(ColorRGB{ 0.49f, 0.57f, 0.57f }, 1.f);
+		const auto matLambert_White = AddMaterial<Material_Lambert>(colors::White, 1.f);
 
 
 		AddPlane({ 0.f, 0.f, 10.f }, { 0.f, 0.f, -1.f }, matLambert_GreyBlue);
@@ -314,29 +466,19 @@ namespace dae {
 
 
 		Triangle baseTriangle = { Vector3(-0.75f,1.5f,0.f), Vector3(0.75f,0.f, 0.f), Vector3(-0.75f,0.f,0.f) };
-		int idx{};
-
-		m_pMeshes[idx] = AddTriangleMesh(TriangleCullMode::BackFaceCulling, matLambert_White);
-		m_pMeshes[idx]->AppendTriangle(baseTriangle, true);
-		m_pMeshes[idx]->Translate({-1.75f, 4.5f, 0.f});
-		m_pMeshes[idx]->UpdateAABB();
-		m_pMeshes[idx]->UpdateTransforms();
-
-		++idx;
-
-		m_pMeshes[idx] = AddTriangleMesh(TriangleCullMode::NoCulling, matLambert_White);
-		m_pMeshes[idx]->AppendTriangle(baseTriangle, true);
-		m_pMeshes[idx]->Translate({0.f, 4.5f, 0.f});
-		m_pMeshes[idx]->UpdateAABB();
-		m_pMeshes[idx]->UpdateTransforms();
-
-		++idx;
+		const TriangleCullMode cullModes[3]{ TriangleCullMode::BackFaceCulling, TriangleCullMode::NoCulling, TriangleCullMode::FrontFaceCulling };
+		const float offsetsX[3]{ -1.75f, 0.f, 1.75f };
 
-		m_pMeshes[idx] = AddTriangleMesh(TriangleCullMode::FrontFaceCulling, matLambert_White);
-		m_pMeshes[idx]->AppendTriangle(baseTriangle, true);
-		m_pMeshes[idx]->Translate({1.75f, 4.5f, 0.f});
-		m_pMeshes[idx]->UpdateAABB();
-		m_pMeshes[idx]->UpdateTransforms();
+		for (int idx{}; idx < 3; ++idx)
+		{
+			m_Meshes[idx] = AddTriangleMesh(cullModes[idx], matLambert_White);
+			TriangleMesh* pMesh = GetTriangleMesh(m_Meshes[idx]);
+			pMesh->AppendTriangle(baseTriangle, true);
+			pMesh->bvhBuildMode = BVHBuildMode::LBVH;
+			pMesh->Translate({ offsetsX[idx], 4.5f, 0.f });
+			pMesh->UpdateAABB();
+			pMesh->UpdateTransforms();
+		}
 
 
 		AddPointLight({	  0.f,  5.f,  5.f }	, 50.f, ColorRGB{	1.f, 0.61f, 0.45f });
@@ -348,10 +490,11 @@ namespace dae {
 		Scene::Update(pTimer);
 
 		const float yawAngle{ (cosf(pTimer->GetTotal()) + 1.f) / 2.f * PI_2 };
-		for (const auto& mesh : m_pMeshes)
+		for (const auto& meshHandle : m_Meshes)
 		{
-			mesh->RotateY(yawAngle);
-			mesh->UpdateTransforms();
+			TriangleMesh* pMesh = GetTriangleMesh(meshHandle);
+			pMesh->RotateY(yawAngle);
+			pMesh->UpdateTransforms();
 		}
 
 	}
@@ -360,8 +503,8 @@ namespace dae {
 		sceneName = "Bunny Scene";
 		m_Camera.origin = { 0.f, 3.f, -9.f };
 		m_Camera.fovAngle = 45.f;
-		const auto matLambert_GreyBlue = AddMaterial(new Material_Lambert{ {0.49f, 0.57f, 0.57f}, 1.f });
-		const auto matLambert_White = AddMaterial(new Material_Lambert{ colors::White, 1.f });
+		const auto matLambert_GreyBlue = AddMaterial<Material_Lambert>(ColorRGB{ 0.49f, 0.57f, 0.57f }, 1.f);
+		const auto matLambert_White = AddMaterial<Material_Lambert>(colors::White, 1.f);
 
 
 		AddPlane({ 0.f, 0.f, 10.f }, { 0.f, 0.f, -1.f }, matLambert_GreyBlue);
@@ -370,11 +513,14 @@ namespace dae {
 		AddPlane({ 5.f, 0.f, 0.f }, { -1.f, 0.f, 0.f }, matLambert_GreyBlue);
 		AddPlane({ -5.f, 0.f, 0.f }, { 1.f, 0.f, 0.f }, matLambert_GreyBlue);
 
-		m_pBunnyMesh = AddTriangleMesh(TriangleCullMode::BackFaceCulling, matLambert_White);
-		Utils::ParseOBJ("Resources/lowpoly_bunny2.obj", m_pBunnyMesh->positions,m_pBunnyMesh->normals,m_pBunnyMesh->indices);
-		m_pBunnyMesh->Scale({ 2.f, 2.f, 2.f });
-		m_pBunnyMesh->UpdateAABB();
-		m_pBunnyMesh->UpdateTransforms();
+		m_BunnyMesh = AddTriangleMesh(TriangleCullMode::BackFaceCulling, matLambert_White);
+		TriangleMesh* pBunnyMesh = GetTriangleMesh(m_BunnyMesh);
+		//Smooth shaded with averaged vertex normals
+		Utils::ParseOBJ("Resources/lowpoly_bunny2.obj", pBunnyMesh->positions,pBunnyMesh->normals,pBunnyMesh->indices, nullptr, &pBunnyMesh->vertexNormals);
+		pBunnyMesh->Scale({ 2.f, 2.f, 2.f });
+		pBunnyMesh->bvhBuildMode = BVHBuildMode::LBVH; //spins every frame
+		pBunnyMesh->UpdateAABB();
+		pBunnyMesh->UpdateTransforms();
 
 
 		AddPointLight({	  0.f,  5.f,  5.f }	, 50.f, ColorRGB{	1.f, 0.61f, 0.45f });
@@ -385,9 +531,246 @@ namespace dae {
 	{
 		Scene::Update(pTimer);
 
-		m_pBunnyMesh->RotateY(PI_DIV_2 * pTimer->GetTotal());
-		m_pBunnyMesh->UpdateTransforms();
+		TriangleMesh* pBunnyMesh = GetTriangleMesh(m_BunnyMesh);
+		pBunnyMesh->RotateY(PI_DIV_2 * pTimer->GetTotal());
+		pBunnyMesh->UpdateTransforms();
 	}
 #pragma endregion
+#pragma region SCENE FILE
+	Scene_File::Scene_File(const std::string& filename):
+		m_Filename{filename}
+	{
+	}
 
+	void Scene_File::Initialize()
+	{
+		sceneName = m_Filename;
+		const auto loadStart{ std::chrono::steady_clock::now() };
+
+		//Binary scenes are used in place, text scenes are parsed into a description first
+		if (SceneFile::IsBinaryFile(m_Filename))
+		{
+			MappedFile mappedFile{};
+			SceneFile::SceneView view{};
+			m_IsLoaded = SceneFile::MapBinary(m_Filename, mappedFile, view) && Build(view);
+		}
+		else
+		{
+			SceneFile::SceneDescription description{};
+			m_IsLoaded = SceneFile::ParseText(m_Filename, description) && Build(description.GetView());
+		}
+
+		const float loadTime{ std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - loadStart).count() };
+		if (m_IsLoaded)
+		{
+			std::cout << "Loaded " << m_Filename << " in " << loadTime << " ms (" << m_SphereGeometries.size() << " spheres, "
+				<< m_PlaneGeometries.size() << " planes, " << m_TriangleMeshGeometries.size() << " meshes, " << m_Lights.size() << " lights)\n";
+		}
+	}
+
+	void Scene_File::Update(Timer* pTimer)
+	{
+		Scene::Update(pTimer);
+
+		for (const SpinningMesh& spinningMesh : m_SpinningMeshes)
+		{
+			TriangleMesh* pMesh = GetTriangleMesh(spinningMesh.mesh);
+			const Vector3& rotation = spinningMesh.rotation;
+			pMesh->rotationTransform = Matrix::CreateRotation(rotation.x, rotation.y + spinningMesh.spinSpeed * pTimer->GetTotal(), rotation.z);
+			pMesh->UpdateTransforms();
+		}
+	}
+
+	bool Scene_File::Build(const SceneFile::SceneView& view)
+	{
+		using namespace SceneFile;
+
+		const size_t numMaterials{ view.materials.size() };
+		if (numMaterials == 0 || numMaterials > 256)
+		{
+			std::cout << m_Filename << ": a scene needs between 1 and 256 materials\n";
+			return false;
+		}
+
+		m_Camera.origin = view.camera.origin;
+		m_Camera.fovAngle = view.camera.fovAngle;
+		m_Camera.FOV = tanf((m_Camera.fovAngle * TO_RADIANS) / 2.f);
+		m_Camera.totalPitch = view.camera.pitch;
+		m_Camera.totalYaw = view.camera.yaw;
+		if (view.settings.sphereAcceleration > static_cast<uint32_t>(SphereAcceleration::HashedGrid))
+		{
+			std::cout << m_Filename << ": unknown sphere acceleration structure\n";
+			return false;
+		}
+		m_SphereAcceleration = static_cast<SphereAcceleration>(view.settings.sphereAcceleration);
+		if (view.settings.lightCacheCellSize > 0.f)
+			m_LightCache.Initialize(view.settings.lightCacheCellSize);
+
+		//Textures before the materials sampling them
+		if (!view.textures.empty())
+		{
+			const size_t maxBytes{ view.settings.textureCacheMegabytes > 0 ? size_t{ view.settings.textureCacheMegabytes } << 20 : TextureCache::DEFAULT_MAX_BYTES };
+			m_pTextureCache = std::make_unique<TextureCache>(maxBytes);
+			for (const TextureDesc& texture : view.textures)
+			{
+				const std::string textureFilename(texture.filename, strnlen(texture.filename, sizeof(texture.filename)));
+				if (m_pTextureCache->AddTexture(textureFilename, texture.isSRGB != 0) == TextureCache::INVALID_TEXTURE)
+					return false;
+			}
+		}
+		const auto isValidTexture = [&view](uint32_t textureIndex) { return textureIndex < view.textures.size(); };
+
+		//Material 0 (default) is created by the Scene constructor
+		for (size_t idx{ 1 }; idx < numMaterials; ++idx)
+		{
+			const MaterialDesc& material = view.materials[idx];
+			switch (material.type)
+			{
+			case MaterialType::SolidColor:
+				AddMaterial<Material_SolidColor>(material.color);
+				break;
+			case MaterialType::Lambert:
+				AddMaterial<Material_Lambert>(material.color, material.params[0]);
+				break;
+			case MaterialType::LambertPhong:
+				AddMaterial<Material_LambertPhong>(material.color, material.params[0], material.params[1], material.params[2]);
+				break;
+			case MaterialType::CookTorrence:
+				AddMaterial<Material_CookTorrence>(material.color, material.params[0], material.params[1]);
+				break;
+			case MaterialType::TexturedCookTorrence:
+				if (!isValidTexture(material.textures[0]) || (material.textures[1] != NO_TEXTURE && !isValidTexture(material.textures[1])))
+				{
+					std::cout << m_Filename << ": texture index out of range\n";
+					return false;
+				}
+				AddMaterial<Material_TexturedCookTorrence>(*m_pTextureCache, material.color, material.params[0], material.params[1],
+					material.textures[0], material.textures[1] == NO_TEXTURE ? TextureCache::INVALID_TEXTURE : material.textures[1]);
+				break;
+			default:
+				std::cout << m_Filename << ": unknown material type\n";
+				return false;
+			}
+		}
+
+		const auto isValidMaterial = [numMaterials](uint32_t materialIndex) { return materialIndex < numMaterials; };
+
+		//Size every pool up front, large scenes then need a single arena allocation per pool
+		m_SphereGeometries.Reserve(view.spheres.size());
+		for (const SphereDesc& sphere : view.spheres)
+		{
+			if (!isValidMaterial(sphere.materialIndex))
+				return false;
+			AddSphere(sphere.origin, sphere.radius, static_cast<unsigned char>(sphere.materialIndex));
+		}
+
+		m_PlaneGeometries.Reserve(view.planes.size());
+		for (const PlaneDesc& plane : view.planes)
+		{
+			if (!isValidMaterial(plane.materialIndex))
+				return false;
+			AddPlane(plane.origin, plane.normal.Normalized(), static_cast<unsigned char>(plane.materialIndex));
+		}
+
+		m_Lights.Reserve(view.lights.size());
+		for (const LightDesc& light : view.lights)
+		{
+			if (light.type == static_cast<uint32_t>(LightType::Point))
+				AddPointLight(light.origin, light.intensity, light.color);
+			else
+				AddDirectionalLight(light.origin.Normalized(), light.intensity, light.color);
+		}
+
+		m_TriangleMeshGeometries.Reserve(view.meshes.size());
+		for (const MeshDesc& meshDesc : view.meshes)
+		{
+			const bool isValidRange =
+				isValidMaterial(meshDesc.materialIndex) && meshDesc.cullMode <= static_cast<uint32_t>(TriangleCullMode::NoCulling) &&
+				meshDesc.numIndices % 3 == 0 && meshDesc.firstIndex % 3 == 0 &&
+				uint64_t{ meshDesc.firstPosition } + meshDesc.numPositions <= view.positions.size() &&
+				uint64_t{ meshDesc.firstIndex } + meshDesc.numIndices <= view.indices.size() &&
+				(uint64_t{ meshDesc.firstIndex } + meshDesc.numIndices) / 3 <= view.normals.size() &&
+				(meshDesc.numTexcoords == 0 || meshDesc.numTexcoords == meshDesc.numPositions) &&
+				uint64_t{ meshDesc.firstTexcoord } + meshDesc.numTexcoords <= view.texcoords.size() &&
+				(meshDesc.numVertexNormals == 0 || meshDesc.numVertexNormals == meshDesc.numPositions) &&
+				uint64_t{ meshDesc.firstVertexNormal } + meshDesc.numVertexNormals <= view.vertexNormals.size();
+			if (!isValidRange)
+			{
+				std::cout << m_Filename << ": mesh data out of range\n";
+				return false;
+			}
+
+			const TriangleMeshHandle meshHandle = AddTriangleMesh(static_cast<TriangleCullMode>(meshDesc.cullMode), static_cast<unsigned char>(meshDesc.materialIndex));
+			TriangleMesh* pMesh = GetTriangleMesh(meshHandle);
+			const auto positionsBegin = view.positions.begin() + meshDesc.firstPosition;
+			const auto indicesBegin = view.indices.begin() + meshDesc.firstIndex;
+			const auto normalsBegin = view.normals.begin() + meshDesc.firstIndex / 3;
+			pMesh->positions.assign(positionsBegin, positionsBegin + meshDesc.numPositions);
+			pMesh->indices.assign(indicesBegin, indicesBegin + meshDesc.numIndices);
+			pMesh->normals.assign(normalsBegin, normalsBegin + meshDesc.numIndices / 3);
+			const auto texcoordsBegin = view.texcoords.begin() + meshDesc.firstTexcoord;
+			pMesh->texcoords.assign(texcoordsBegin, texcoordsBegin + meshDesc.numTexcoords);
+			const auto vertexNormalsBegin = view.vertexNormals.begin() + meshDesc.firstVertexNormal;
+			pMesh->vertexNormals.assign(vertexNormalsBegin, vertexNormalsBegin + meshDesc.numVertexNormals);
+
+			for (const int index : pMesh->indices)
+			{
+				if (index < 0 || static_cast<uint32_t>(index) >= meshDesc.numPositions)
+				{
+					std::cout << m_Filename << ": mesh index out of range\n";
+					return false;
+				}
+			}
+
+			if (meshDesc.lodLevels > MAX_LOD_LEVELS)
+			{
+				std::cout << m_Filename << ": at most " << MAX_LOD_LEVELS << " LOD levels per mesh\n";
+				return false;
+			}
+			if (meshDesc.lodLevels > 0)
+			{
+				const auto lodStart{ std::chrono::steady_clock::now() };
+				pMesh->BuildLODs(meshDesc.lodLevels);
+				const float lodTimeMs{ std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - lodStart).count() };
+
+				std::cout << "LOD chain: " << pMesh->indices.size() / 3;
+				for (const TriangleMeshLOD& lod : pMesh->lods)
+					std::cout << " > " << lod.indices.size() / 3;
+				std::cout << " triangles in " << lodTimeMs << " ms\n";
+			}
+
+			pMesh->Scale(meshDesc.scale);
+			if (meshDesc.spinSpeed != 0.f)
+				pMesh->bvhBuildMode = BVHBuildMode::LBVH;
+			pMesh->rotationTransform = Matrix::CreateRotation(meshDesc.rotation);
+			pMesh->Translate(meshDesc.translation);
+			pMesh->UpdateAABB();
+			pMesh->UpdateTransforms();
+
+			if (meshDesc.spinSpeed != 0.f)
+				m_SpinningMeshes.push_back({ meshHandle, meshDesc.rotation, meshDesc.spinSpeed });
+		}
+
+		return true;
+	}
+#pragma endregion
+
+	Scene* CreateScene(const std::string& filename)
+	{
+		if (filename.empty())
+		{
+			const auto pScene = new Scene_W4_ReferenceScene();
+			pScene->Initialize();
+			return pScene;
+		}
+
+		const auto pFileScene = new Scene_File(filename);
+		pFileScene->Initialize();
+		if (!pFileScene->IsLoaded())
+		{
+			delete pFileScene;
+			return nullptr;
+		}
+		return pFileScene;
+	}
 }
@@ -1,10 +1,20 @@
 #pragma once
+#include <memory>
+#include <span>
 #include <string>
 #include <vector>
 
 #include "Math.h"
 #include "DataTypes.h"
 #include "Camera.h"
+#include "HandlePool.h"
+#include "LightCache.h"
+#include "MemoryArena.h"
+#include "SceneChangeTracker.h"
+#include "SceneFile.h"
+#include "SphereGrid.h"
+#include "SphereSoA.h"
+#include "TextureCache.h"
 
 namespace dae
 {
@@ -15,7 +25,13 @@ namespace dae
 	struct Sphere;
 	struct Light;
 
+	using SphereHandle = Handle<Sphere>;
+	using PlaneHandle = Handle<Plane>;
+	using TriangleMeshHandle = Handle<TriangleMesh>;
+	using LightHandle = Handle<Light>;
+
 	//Scene Base Class
+	//All scene objects live in the scene's arena, Add* returns a handle that stays valid until the object is removed
 	class Scene
 	{
 	public:
@@ -33,33 +49,78 @@ namespace dae
 			m_Camera.Update(pTimer);
 		}
 
+		//Picks mesh LODs for a view viewHeight pixels tall and rebuilds the acceleration structures of objects that may have moved
+		//Called once per frame before tracing
+		void PrepareFrame(uint32_t viewHeight);
+		void SetSphereAcceleration(SphereAcceleration sphereAcceleration);
+		//Cell size of the light visibility cache, 0 turns it off (the default)
+		void SetLightCache(float cellSize) { m_LightCache.Initialize(cellSize); }
+		LightCache* GetLightCache() { return m_LightCache.IsEnabled() ? &m_LightCache : nullptr; }
+		//What moved between the last two PrepareFrame calls, the camera aside
+		const SceneChangeTracker& GetChanges() const { return m_ChangeTracker; }
+
 		Camera& GetCamera() { return m_Camera; }
 		void GetClosestHit(const Ray& ray, HitRecord& closestHit) const;
 		bool DoesHit(const Ray& ray) const;
+		//Occlusion of a packet of shadow rays towards the same point light, isOccluded gets a 0/1 per ray
+		//Mesh BVHs are traversed once per GeometryUtils::MAX_SHADOW_BUNDLE_SIZE rays instead of once per ray
+		void DoesHit(std::span<const Ray> shadowRays, std::span<uint8_t> isOccluded) const;
+
+		std::span<const Plane> GetPlaneGeometries() const { return m_PlaneGeometries.GetSpan(); }
+		std::span<const Sphere> GetSphereGeometries() const { return m_SphereGeometries.GetSpan(); }
+		std::span<const Light> GetLights() const { return m_Lights.GetSpan(); }
+		const std::vector<Material*>& GetMaterials() const { return m_Materials; }
 
-		const std::vector<Plane>& GetPlaneGeometries() const { return m_PlaneGeometries; }
-		const std::vector<Sphere>& GetSphereGeometries() const { return m_SphereGeometries; }
-		const std::vector<Light>& GetLights() const { return m_Lights; }
-		const std::vector<Material*> GetMaterials() const { return m_Materials; }
+		//Handle lookups return nullptr for removed objects
+		Sphere* GetSphere(SphereHandle handle) { return m_SphereGeometries.Get(handle); }
+		Plane* GetPlane(PlaneHandle handle) { return m_PlaneGeometries.Get(handle); }
+		TriangleMesh* GetTriangleMesh(TriangleMeshHandle handle) { return m_TriangleMeshGeometries.Get(handle); }
+		Light* GetLight(LightHandle handle) { return m_Lights.Get(handle); }
 
 	protected:
 		std::string	sceneName;
 
-		std::vector<Plane> m_PlaneGeometries{};
-		std::vector<Sphere> m_SphereGeometries{};
-		std::vector<TriangleMesh> m_TriangleMeshGeometries{};
-		std::vector<Light> m_Lights{};
+		//Declared first, so it outlives every pool and material allocated from it
+		MemoryArena m_Arena{};
+
+		HandlePool<Plane> m_PlaneGeometries{ m_Arena };
+		HandlePool<Sphere> m_SphereGeometries{ m_Arena };
+		HandlePool<TriangleMesh> m_TriangleMeshGeometries{ m_Arena };
+		HandlePool<Light> m_Lights{ m_Arena };
 		std::vector<Material*> m_Materials{};
-		std::vector<Triangle> m_Triangles{};
 		Camera m_Camera{};
 
-		Sphere* AddSphere(const Vector3& origin, float radius, unsigned char materialIndex = 0);
-		Plane* AddPlane(const Vector3& origin, const Vector3& normal, unsigned char materialIndex = 0);
-		TriangleMesh* AddTriangleMesh(TriangleCullMode cullMode, unsigned char materialIndex = 0);
-
-		Light* AddPointLight(const Vector3& origin, float intensity, const ColorRGB& color);
-		Light* AddDirectionalLight(const Vector3& direction, float intensity, const ColorRGB& color);
+		//Spheres are moved freely through GetSphere, the grid or the SoA copy used without one is rebuilt on frames where the change tracker sees them change
+		SphereAcceleration m_SphereAcceleration{ SphereAcceleration::None };
+		SphereGrid m_SphereGrid{};
+		SphereSoA m_SphereSoA{};
+		//Updated at the end of PrepareFrame, once meshes have their transforms and LOD for the frame
+		SceneChangeTracker m_ChangeTracker{};
+		LightCache m_LightCache{};
+
+		SphereHandle AddSphere(const Vector3& origin, float radius, unsigned char materialIndex = 0);
+		PlaneHandle AddPlane(const Vector3& origin, const Vector3& normal, unsigned char materialIndex = 0);
+		TriangleMeshHandle AddTriangleMesh(TriangleCullMode cullMode, unsigned char materialIndex = 0);
+
+		LightHandle AddPointLight(const Vector3& origin, float intensity, const ColorRGB& color);
+		LightHandle AddDirectionalLight(const Vector3& direction, float intensity, const ColorRGB& color);
+
+		bool RemoveSphere(SphereHandle handle) { return m_SphereGeometries.Remove(handle); }
+		bool RemovePlane(PlaneHandle handle) { return m_PlaneGeometries.Remove(handle); }
+		bool RemoveTriangleMesh(TriangleMeshHandle handle) { return m_TriangleMeshGeometries.Remove(handle); }
+		bool RemoveLight(LightHandle handle) { return m_Lights.Remove(handle); }
+
+		//Materials are constructed in the scene arena, the returned index is their handle
+		template<typename MaterialType, typename... Args>
+		unsigned char AddMaterial(Args&&... args)
+		{
+			return AddMaterial(m_Arena.New<MaterialType>(std::forward<Args>(args)...));
+		}
 		unsigned char AddMaterial(Material* pMaterial);
+
+	private:
+		//Builds the hit record of the closest candidate found by GetClosestHit
+		void ResolveHit(const Ray& ray, const HitCandidate& candidate, HitRecord& hitRecord) const;
 	};
 
 	//+++++++++++++++++++++++++++++++++++++++++
@@ -131,7 +192,7 @@ namespace dae
 		void Update(Timer* pTimer) override;
 
 	private:
-		TriangleMesh* m_pMeshes[3]{};
+		TriangleMeshHandle m_Meshes[3]{};
 	};
 	class Scene_W4_Bunny final : public Scene
 	{
@@ -148,7 +209,45 @@ namespace dae
 		void Update(Timer* pTimer) override;
 
 	private:
-		TriangleMesh* m_pBunnyMesh{nullptr};
+		TriangleMeshHandle m_BunnyMesh{};
+	};
+
+	//+++++++++++++++++++++++++++++++++++++++++
+	//Scene loaded from a text (.txt) or binary (.rtsb) scene description file
+	class Scene_File final : public Scene
+	{
+	public:
+		explicit Scene_File(const std::string& filename);
+		~Scene_File() override = default;
+
+		Scene_File(const Scene_File&) = delete;
+		Scene_File(Scene_File&&) noexcept = delete;
+		Scene_File& operator=(const Scene_File&) = delete;
+		Scene_File& operator=(Scene_File&&) noexcept = delete;
+
+		void Initialize() override;
+		void Update(Timer* pTimer) override;
+
+		bool IsLoaded() const { return m_IsLoaded; }
+
+	private:
+		bool Build(const SceneFile::SceneView& view);
+
+		std::string m_Filename{};
+		bool m_IsLoaded{ false };
+		//Only created for scenes with textures
+		std::unique_ptr<TextureCache> m_pTextureCache{};
+
+		struct SpinningMesh
+		{
+			TriangleMeshHandle mesh{};
+			Vector3 rotation{};
+			float spinSpeed{};
+		};
+		std::vector<SpinningMesh> m_SpinningMeshes{};
 	};
 
+	//The reference scene for an empty filename, otherwise the scene file, initialized and owned by the caller
+	//nullptr when the file couldn't be loaded
+	Scene* CreateScene(const std::string& filename);
 }
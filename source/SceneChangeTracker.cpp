@@ -0,0 +1,79 @@
+#include "SceneChangeTracker.h"
+
+namespace dae
+{
+	namespace
+	{
+		bool IsSameVector(const Vector3& a, const Vector3& b)
+		{
+			return a.x == b.x && a.y == b.y && a.z == b.z;
+		}
+
+		AABB GetSphereBounds(const Sphere& sphere)
+		{
+			const Vector3 extent{ sphere.radius, sphere.radius, sphere.radius };
+			return { sphere.origin - extent, sphere.origin + extent };
+		}
+	}
+
+	void SceneChangeTracker::Update(std::span<const Sphere> spheres, std::span<const TriangleMesh> meshes, std::span<const Light> lights)
+	{
+		//Added or removed objects and lights aren't matched up one by one
+		m_IsRestarted = spheres.size() != m_SphereBounds.size() || meshes.size() != m_MeshBounds.size() || lights.size() != m_Lights.size();
+		m_MovedBounds.clear();
+		m_ChangedLights = 0;
+		m_AreSpheresChanged = spheres.size() != m_SphereBounds.size();
+
+		if (!m_IsRestarted)
+		{
+			for (size_t idx{}; idx < spheres.size(); ++idx)
+			{
+				const AABB bounds{ GetSphereBounds(spheres[idx]) };
+				if (!IsSameVector(bounds.min, m_SphereBounds[idx].min) || !IsSameVector(bounds.max, m_SphereBounds[idx].max))
+				{
+					m_MovedBounds.push_back(m_SphereBounds[idx]);
+					m_MovedBounds.push_back(bounds);
+					m_AreSpheresChanged = true;
+				}
+			}
+
+			//A different level of detail casts a slightly different shadow as well
+			for (size_t idx{}; idx < meshes.size(); ++idx)
+			{
+				const TriangleMesh& mesh = meshes[idx];
+				if (!IsSameVector(mesh.transformedMinAABB, m_MeshBounds[idx].min) || !IsSameVector(mesh.transformedMaxAABB, m_MeshBounds[idx].max)
+					|| mesh.activeLOD != m_MeshLODs[idx])
+				{
+					m_MovedBounds.push_back(m_MeshBounds[idx]);
+					m_MovedBounds.push_back({ mesh.transformedMinAABB, mesh.transformedMaxAABB });
+				}
+			}
+
+			for (size_t idx{}; idx < lights.size(); ++idx)
+			{
+				const Light& light = lights[idx];
+				const Light& lastLight = m_Lights[idx];
+				if (light.type != lastLight.type || !IsSameVector(light.origin, lastLight.origin) || !IsSameVector(light.direction, lastLight.direction)
+					|| light.intensity != lastLight.intensity || light.color.r != lastLight.color.r || light.color.g != lastLight.color.g || light.color.b != lastLight.color.b)
+				{
+					if (idx < MAX_TRACKED_LIGHTS)
+						m_ChangedLights |= 1u << idx;
+					else
+						m_IsRestarted = true;
+				}
+			}
+		}
+
+		m_SphereBounds.resize(spheres.size());
+		for (size_t idx{}; idx < spheres.size(); ++idx)
+			m_SphereBounds[idx] = GetSphereBounds(spheres[idx]);
+		m_MeshBounds.resize(meshes.size());
+		m_MeshLODs.resize(meshes.size());
+		for (size_t idx{}; idx < meshes.size(); ++idx)
+		{
+			m_MeshBounds[idx] = { meshes[idx].transformedMinAABB, meshes[idx].transformedMaxAABB };
+			m_MeshLODs[idx] = meshes[idx].activeLOD;
+		}
+		m_Lights.assign(lights.begin(), lights.end());
+	}
+}
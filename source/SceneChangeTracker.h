@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "DataTypes.h"
+
+namespace dae
+{
+	//Compares the shadow casting objects and the lights of the scene with the previous frame
+	//Spheres are moved freely through Scene::GetSphere, so they are compared by value instead of being flagged by whoever moves them
+	class SceneChangeTracker final
+	{
+	public:
+		//Changes to lights past this index are reported as a restart
+		static constexpr uint32_t MAX_TRACKED_LIGHTS{ 32 };
+
+		SceneChangeTracker() = default;
+		~SceneChangeTracker() = default;
+
+		SceneChangeTracker(const SceneChangeTracker&) = delete;
+		SceneChangeTracker(SceneChangeTracker&&) noexcept = delete;
+		SceneChangeTracker& operator=(const SceneChangeTracker&) = delete;
+		SceneChangeTracker& operator=(SceneChangeTracker&&) noexcept = delete;
+
+		//Once per frame, after the meshes got their transforms and LOD
+		void Update(std::span<const Sphere> spheres, std::span<const TriangleMesh> meshes, std::span<const Light> lights);
+
+		//Objects or lights were added or removed (or this is the first frame), nothing can be matched up with the last frame
+		bool IsRestarted() const { return m_IsRestarted; }
+		//Old and new bounds of every sphere and mesh that moved or switched LOD
+		std::span<const AABB> GetMovedBounds() const { return m_MovedBounds; }
+		//Bit per light whose position, direction or type changed
+		uint32_t GetChangedLights() const { return m_ChangedLights; }
+		bool HasChanges() const { return m_IsRestarted || !m_MovedBounds.empty() || m_ChangedLights != 0; }
+		//A sphere was added, removed, moved or resized (or this is the first frame)
+		bool AreSpheresChanged() const { return m_AreSpheresChanged; }
+
+	private:
+		bool m_IsRestarted{ true };
+		std::vector<AABB> m_MovedBounds{};
+		uint32_t m_ChangedLights{};
+		bool m_AreSpheresChanged{ true };
+
+		//State of the previous frame
+		std::vector<AABB> m_SphereBounds{};
+		std::vector<AABB> m_MeshBounds{};
+		std::vector<uint32_t> m_MeshLODs{};
+		std::vector<Light> m_Lights{};
+	};
+}
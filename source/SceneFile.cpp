@@ -0,0 +1,476 @@
+#include "SceneFile.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+
+#include "DataTypes.h"
+#include "MappedFile.h"
+#include "SphereGrid.h"
+#include "Utils.h"
+
+namespace dae
+{
+	namespace SceneFile
+	{
+#pragma region Binary Layout
+		constexpr char BINARY_MAGIC[4]{ 'R', 'T', 'S', 'B' };
+		constexpr uint32_t BINARY_VERSION{ 6 };
+		constexpr uint64_t BINARY_ALIGNMENT{ 16 };
+
+		struct BinarySection
+		{
+			uint64_t offset{};
+			uint64_t count{};
+		};
+
+		struct BinaryHeader
+		{
+			char magic[4]{};
+			uint32_t version{};
+			CameraDesc camera{};
+			SettingsDesc settings{};
+			BinarySection materials{};
+			BinarySection spheres{};
+			BinarySection planes{};
+			BinarySection lights{};
+			BinarySection meshes{};
+			BinarySection positions{};
+			BinarySection normals{};
+			BinarySection indices{};
+			BinarySection textures{};
+			BinarySection texcoords{};
+			BinarySection vertexNormals{};
+		};
+
+		uint64_t AlignOffset(uint64_t offset)
+		{
+			return (offset + BINARY_ALIGNMENT - 1) & ~(BINARY_ALIGNMENT - 1);
+		}
+
+		template<typename T>
+		bool GetSection(const MappedFile& mappedFile, const BinarySection& section, std::span<const T>& span)
+		{
+			if (section.count == 0)
+			{
+				span = {};
+				return true;
+			}
+			if (section.offset % alignof(T) != 0 || section.offset > mappedFile.GetSize() ||
+				section.count > (mappedFile.GetSize() - section.offset) / sizeof(T))
+			{
+				return false;
+			}
+			span = { reinterpret_cast<const T*>(mappedFile.GetData() + section.offset), static_cast<size_t>(section.count) };
+			return true;
+		}
+#pragma endregion
+
+		SceneView SceneDescription::GetView() const
+		{
+			SceneView view{};
+			view.camera = camera;
+			view.settings = settings;
+			view.materials = materials;
+			view.spheres = spheres;
+			view.planes = planes;
+			view.lights = lights;
+			view.meshes = meshes;
+			view.positions = positions;
+			view.normals = normals;
+			view.indices = indices;
+			view.textures = textures;
+			view.texcoords = texcoords;
+			view.vertexNormals = vertexNormals;
+			return view;
+		}
+
+		bool IsBinaryFile(const std::string& filename)
+		{
+			constexpr const char* extension{ ".rtsb" };
+			return filename.size() >= 5 && filename.compare(filename.size() - 5, 5, extension) == 0;
+		}
+
+#pragma region Text Parsing
+		bool ParseCullMode(const std::string& name, uint32_t& cullMode)
+		{
+			if (name == "back")
+				cullMode = static_cast<uint32_t>(TriangleCullMode::BackFaceCulling);
+			else if (name == "front")
+				cullMode = static_cast<uint32_t>(TriangleCullMode::FrontFaceCulling);
+			else if (name == "none")
+				cullMode = static_cast<uint32_t>(TriangleCullMode::NoCulling);
+			else
+				return false;
+			return true;
+		}
+
+		bool ParseText(const std::string& filename, SceneDescription& description)
+		{
+			std::ifstream file(filename);
+			if (!file)
+			{
+				std::cout << "Could not open scene file " << filename << "\n";
+				return false;
+			}
+
+			//Material 0 is always the default solid red material every scene starts with
+			std::unordered_map<std::string, uint32_t> materialIds{ { "default", 0 } };
+			description.materials.push_back({ MaterialType::SolidColor, colors::Red });
+
+			const auto findMaterial = [&](const std::string& name, uint32_t& materialIndex)
+			{
+				const auto it = materialIds.find(name);
+				if (it == materialIds.end())
+					return false;
+				materialIndex = it->second;
+				return true;
+			};
+
+			std::unordered_map<std::string, uint32_t> textureIds{};
+			const auto findTexture = [&](const std::string& name, uint32_t& textureIndex)
+			{
+				const auto it = textureIds.find(name);
+				if (it == textureIds.end())
+					return false;
+				textureIndex = it->second;
+				return true;
+			};
+
+			std::string line{};
+			int lineNumber{};
+			while (std::getline(file, line))
+			{
+				++lineNumber;
+				std::istringstream lineStream{ line };
+				std::string sCommand{};
+				if (!(lineStream >> sCommand) || sCommand[0] == '#')
+					continue;
+
+				bool isValid{ true };
+				if (sCommand == "camera")
+				{
+					CameraDesc& camera = description.camera;
+					isValid = static_cast<bool>(lineStream >> camera.origin.x >> camera.origin.y >> camera.origin.z >> camera.fovAngle);
+					//pitch & yaw are optional
+					lineStream >> camera.pitch >> camera.yaw;
+				}
+				else if (sCommand == "spheregrid")
+				{
+					std::string type{};
+					lineStream >> type;
+					if (type == "none")
+						description.settings.sphereAcceleration = static_cast<uint32_t>(SphereAcceleration::None);
+					else if (type == "uniform")
+						description.settings.sphereAcceleration = static_cast<uint32_t>(SphereAcceleration::UniformGrid);
+					else if (type == "hashed")
+						description.settings.sphereAcceleration = static_cast<uint32_t>(SphereAcceleration::HashedGrid);
+					else
+						isValid = false;
+				}
+				else if (sCommand == "lightcache")
+				{
+					float& cellSize = description.settings.lightCacheCellSize;
+					isValid = static_cast<bool>(lineStream >> cellSize) && cellSize >= 0.f;
+				}
+				else if (sCommand == "texturecache")
+				{
+					isValid = static_cast<bool>(lineStream >> description.settings.textureCacheMegabytes);
+				}
+				else if (sCommand == "texture")
+				{
+					std::string name{}, imageFilename{}, colorSpace{};
+					lineStream >> name >> imageFilename >> colorSpace;
+					TextureDesc texture{};
+					texture.isSRGB = colorSpace == "srgb";
+					isValid = lineStream && (texture.isSRGB || colorSpace == "linear") && imageFilename.size() < sizeof(texture.filename);
+					if (isValid)
+					{
+						std::memcpy(texture.filename, imageFilename.c_str(), imageFilename.size() + 1);
+						textureIds[name] = static_cast<uint32_t>(description.textures.size());
+						description.textures.push_back(texture);
+					}
+				}
+				else if (sCommand == "material")
+				{
+					std::string name{}, type{};
+					MaterialDesc material{};
+					lineStream >> name >> type >> material.color.r >> material.color.g >> material.color.b;
+					if (type == "solid")
+						material.type = MaterialType::SolidColor;
+					else if (type == "lambert")
+					{
+						material.type = MaterialType::Lambert;
+						lineStream >> material.params[0];
+					}
+					else if (type == "lambertphong")
+					{
+						material.type = MaterialType::LambertPhong;
+						lineStream >> material.params[0] >> material.params[1] >> material.params[2];
+					}
+					else if (type == "cooktorrence")
+					{
+						material.type = MaterialType::CookTorrence;
+						lineStream >> material.params[0] >> material.params[1];
+					}
+					else if (type == "texturedcooktorrence")
+					{
+						//The roughness texture is optional
+						material.type = MaterialType::TexturedCookTorrence;
+						std::string albedoName{}, roughnessName{};
+						lineStream >> material.params[0] >> material.params[1] >> albedoName;
+						isValid = findTexture(albedoName, material.textures[0]);
+						if (lineStream >> roughnessName)
+							isValid = isValid && findTexture(roughnessName, material.textures[1]);
+						lineStream.clear();
+					}
+					else
+						isValid = false;
+
+					if (isValid && lineStream && materialIds.size() < 256)
+					{
+						materialIds[name] = static_cast<uint32_t>(description.materials.size());
+						description.materials.push_back(material);
+					}
+					else
+						isValid = false;
+				}
+				else if (sCommand == "sphere")
+				{
+					SphereDesc sphere{};
+					std::string materialName{};
+					lineStream >> sphere.origin.x >> sphere.origin.y >> sphere.origin.z >> sphere.radius >> materialName;
+					isValid = lineStream && findMaterial(materialName, sphere.materialIndex);
+					if (isValid)
+						description.spheres.push_back(sphere);
+				}
+				else if (sCommand == "plane")
+				{
+					PlaneDesc plane{};
+					std::string materialName{};
+					lineStream >> plane.origin.x >> plane.origin.y >> plane.origin.z >> plane.normal.x >> plane.normal.y >> plane.normal.z >> materialName;
+					isValid = lineStream && findMaterial(materialName, plane.materialIndex);
+					if (isValid)
+						description.planes.push_back(plane);
+				}
+				else if (sCommand == "pointlight" || sCommand == "directionallight")
+				{
+					LightDesc light{};
+					light.type = static_cast<uint32_t>(sCommand == "pointlight" ? LightType::Point : LightType::Directional);
+					lineStream >> light.origin.x >> light.origin.y >> light.origin.z >> light.intensity >> light.color.r >> light.color.g >> light.color.b;
+					isValid = static_cast<bool>(lineStream);
+					if (isValid)
+						description.lights.push_back(light);
+				}
+				else if (sCommand == "mesh" || sCommand == "triangle")
+				{
+					MeshDesc mesh{};
+					mesh.firstPosition = static_cast<uint32_t>(description.positions.size());
+					mesh.firstIndex = static_cast<uint32_t>(description.indices.size());
+
+					std::vector<Vector3> positions{}, normals{};
+					std::vector<int> indices{};
+					std::vector<Vector2> texcoords{};
+					std::vector<Vector3> vertexNormals{};
+					std::string objFilename{};
+					if (sCommand == "mesh")
+					{
+						lineStream >> objFilename;
+					}
+					else
+					{
+						Vector3 v[3]{};
+						for (Vector3& vertex : v)
+							lineStream >> vertex.x >> vertex.y >> vertex.z;
+						const Triangle triangle{ v[0], v[1], v[2] };
+						positions = { triangle.v0, triangle.v1, triangle.v2 };
+						indices = { 0, 1, 2 };
+						normals = { triangle.normal };
+					}
+
+					std::string cullModeName{}, materialName{}, shading{};
+					lineStream >> cullModeName >> materialName;
+					isValid = isValid && lineStream && ParseCullMode(cullModeName, mesh.cullMode) && findMaterial(materialName, mesh.materialIndex);
+
+					//Shading is optional, flat by default
+					const bool isSmooth{ lineStream >> shading && shading == "smooth" };
+					isValid = isValid && (shading.empty() || shading == "flat" || isSmooth);
+					if (isValid && sCommand == "mesh")
+						isValid = Utils::ParseOBJ(objFilename, positions, normals, indices, &texcoords, isSmooth ? &vertexNormals : nullptr);
+					else if (isValid && isSmooth)
+						TriangleMesh::CalculateVertexNormals(positions, indices, vertexNormals);
+					if (isValid)
+					{
+						//Indices are stored relative to the mesh' first position
+						mesh.numPositions = static_cast<uint32_t>(positions.size());
+						mesh.numIndices = static_cast<uint32_t>(indices.size());
+						mesh.firstTexcoord = static_cast<uint32_t>(description.texcoords.size());
+						mesh.numTexcoords = static_cast<uint32_t>(texcoords.size());
+						description.texcoords.insert(description.texcoords.end(), texcoords.begin(), texcoords.end());
+						mesh.firstVertexNormal = static_cast<uint32_t>(description.vertexNormals.size());
+						mesh.numVertexNormals = static_cast<uint32_t>(vertexNormals.size());
+						description.vertexNormals.insert(description.vertexNormals.end(), vertexNormals.begin(), vertexNormals.end());
+						description.positions.insert(description.positions.end(), positions.begin(), positions.end());
+						description.normals.insert(description.normals.end(), normals.begin(), normals.end());
+						description.indices.insert(description.indices.end(), indices.begin(), indices.end());
+						description.meshes.push_back(mesh);
+					}
+				}
+				else if (sCommand == "translate" || sCommand == "rotate" || sCommand == "scale" || sCommand == "spin" || sCommand == "lod")
+				{
+					//Transforms and LOD settings apply to the last mesh
+					isValid = !description.meshes.empty();
+					if (isValid)
+					{
+						MeshDesc& mesh = description.meshes.back();
+						if (sCommand == "translate")
+							lineStream >> mesh.translation.x >> mesh.translation.y >> mesh.translation.z;
+						else if (sCommand == "rotate")
+						{
+							lineStream >> mesh.rotation.x >> mesh.rotation.y >> mesh.rotation.z;
+							mesh.rotation *= TO_RADIANS;
+						}
+						else if (sCommand == "scale")
+							lineStream >> mesh.scale.x >> mesh.scale.y >> mesh.scale.z;
+						else if (sCommand == "spin")
+							lineStream >> mesh.spinSpeed;
+						else
+							lineStream >> mesh.lodLevels;
+						isValid = static_cast<bool>(lineStream);
+					}
+				}
+				else
+				{
+					isValid = false;
+				}
+
+				if (!isValid)
+				{
+					std::cout << filename << "(" << lineNumber << "): invalid command '" << line << "'\n";
+					return false;
+				}
+			}
+
+			return true;
+		}
+#pragma endregion
+
+#pragma region Binary IO
+		bool WriteBinary(const std::string& filename, const SceneView& view)
+		{
+			std::ofstream file(filename, std::ios::binary);
+			if (!file)
+			{
+				std::cout << "Could not create scene file " << filename << "\n";
+				return false;
+			}
+
+			BinaryHeader header{};
+			std::memcpy(header.magic, BINARY_MAGIC, sizeof(BINARY_MAGIC));
+			header.version = BINARY_VERSION;
+			header.camera = view.camera;
+			header.settings = view.settings;
+
+			//Lay the sections out back to back, each one aligned
+			uint64_t offset{ AlignOffset(sizeof(BinaryHeader)) };
+			const auto placeSection = [&offset](BinarySection& section, auto span)
+			{
+				section.offset = offset;
+				section.count = span.size();
+				offset = AlignOffset(offset + span.size_bytes());
+			};
+			placeSection(header.materials, view.materials);
+			placeSection(header.spheres, view.spheres);
+			placeSection(header.planes, view.planes);
+			placeSection(header.lights, view.lights);
+			placeSection(header.meshes, view.meshes);
+			placeSection(header.positions, view.positions);
+			placeSection(header.normals, view.normals);
+			placeSection(header.indices, view.indices);
+			placeSection(header.textures, view.textures);
+			placeSection(header.texcoords, view.texcoords);
+			placeSection(header.vertexNormals, view.vertexNormals);
+
+			uint64_t written{};
+			const auto writeBytes = [&](const void* pData, uint64_t numBytes, uint64_t targetOffset)
+			{
+				static constexpr char padding[BINARY_ALIGNMENT]{};
+				file.write(padding, static_cast<std::streamsize>(targetOffset - written));
+				file.write(static_cast<const char*>(pData), static_cast<std::streamsize>(numBytes));
+				written = targetOffset + numBytes;
+			};
+			writeBytes(&header, sizeof(header), 0);
+			writeBytes(view.materials.data(), view.materials.size_bytes(), header.materials.offset);
+			writeBytes(view.spheres.data(), view.spheres.size_bytes(), header.spheres.offset);
+			writeBytes(view.planes.data(), view.planes.size_bytes(), header.planes.offset);
+			writeBytes(view.lights.data(), view.lights.size_bytes(), header.lights.offset);
+			writeBytes(view.meshes.data(), view.meshes.size_bytes(), header.meshes.offset);
+			writeBytes(view.positions.data(), view.positions.size_bytes(), header.positions.offset);
+			writeBytes(view.normals.data(), view.normals.size_bytes(), header.normals.offset);
+			writeBytes(view.indices.data(), view.indices.size_bytes(), header.indices.offset);
+			writeBytes(view.textures.data(), view.textures.size_bytes(), header.textures.offset);
+			writeBytes(view.texcoords.data(), view.texcoords.size_bytes(), header.texcoords.offset);
+			writeBytes(view.vertexNormals.data(), view.vertexNormals.size_bytes(), header.vertexNormals.offset);
+
+			return static_cast<bool>(file);
+		}
+
+		bool ConvertTextToBinary(const std::string& textFilename, const std::string& binaryFilename)
+		{
+			SceneDescription description{};
+			if (!ParseText(textFilename, description) || !WriteBinary(binaryFilename, description.GetView()))
+				return false;
+
+			std::cout << "Converted " << textFilename << " to " << binaryFilename << "\n";
+			return true;
+		}
+
+		bool MapBinary(const std::string& filename, MappedFile& mappedFile, SceneView& view)
+		{
+			if (!mappedFile.Open(filename))
+			{
+				std::cout << "Could not open scene file " << filename << "\n";
+				return false;
+			}
+
+			if (mappedFile.GetSize() < sizeof(BinaryHeader))
+			{
+				std::cout << filename << ": truncated scene file\n";
+				return false;
+			}
+
+			BinaryHeader header{};
+			std::memcpy(&header, mappedFile.GetData(), sizeof(header));
+			if (std::memcmp(header.magic, BINARY_MAGIC, sizeof(BINARY_MAGIC)) != 0 || header.version != BINARY_VERSION)
+			{
+				std::cout << filename << ": not a version " << BINARY_VERSION << " binary scene file\n";
+				return false;
+			}
+
+			view.camera = header.camera;
+			view.settings = header.settings;
+			const bool isValid =
+				GetSection(mappedFile, header.materials, view.materials) &&
+				GetSection(mappedFile, header.spheres, view.spheres) &&
+				GetSection(mappedFile, header.planes, view.planes) &&
+				GetSection(mappedFile, header.lights, view.lights) &&
+				GetSection(mappedFile, header.meshes, view.meshes) &&
+				GetSection(mappedFile, header.positions, view.positions) &&
+				GetSection(mappedFile, header.normals, view.normals) &&
+				GetSection(mappedFile, header.indices, view.indices) &&
+				GetSection(mappedFile, header.textures, view.textures) &&
+				GetSection(mappedFile, header.texcoords, view.texcoords) &&
+				GetSection(mappedFile, header.vertexNormals, view.vertexNormals);
+
+			if (!isValid)
+			{
+				std::cout << filename << ": corrupt scene file\n";
+				return false;
+			}
+			return true;
+		}
+#pragma endregion
+	}
+}
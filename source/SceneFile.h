@@ -0,0 +1,154 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "Math.h"
+
+namespace dae
+{
+	class MappedFile;
+
+	//Scene description files
+	//=======================
+	//Text (.txt) : one command per line, OBJ-like, see Resources/reference_scene.txt
+	//Binary (.rtsb) : header + tightly packed arrays of the records below, mapped straight into memory
+	namespace SceneFile
+	{
+		constexpr uint32_t MAX_LOD_LEVELS{ 16 };
+
+		enum class MaterialType : uint32_t
+		{
+			SolidColor,
+			Lambert,
+			LambertPhong,
+			CookTorrence,
+			TexturedCookTorrence
+		};
+
+		constexpr uint32_t NO_TEXTURE{ UINT32_MAX };
+
+		struct CameraDesc
+		{
+			Vector3 origin{};
+			float fovAngle{ 45.f };
+			float pitch{}; //degrees
+			float yaw{}; //degrees
+		};
+
+		struct SettingsDesc
+		{
+			uint32_t sphereAcceleration{}; //SphereAcceleration
+			float lightCacheCellSize{}; //0: no LightCache
+			uint32_t textureCacheMegabytes{}; //0: TextureCache::DEFAULT_MAX_BYTES
+		};
+
+		struct MaterialDesc
+		{
+			MaterialType type{};
+			ColorRGB color{};
+			float params[3]{}; //Lambert: kd | LambertPhong: kd, ks, exponent | (Textured)CookTorrence: metalness, roughness
+			uint32_t textures[2]{ NO_TEXTURE, NO_TEXTURE }; //TexturedCookTorrence: albedo, roughness
+		};
+
+		struct TextureDesc
+		{
+			char filename[260]{};
+			uint32_t isSRGB{};
+		};
+
+		struct SphereDesc
+		{
+			Vector3 origin{};
+			float radius{};
+			uint32_t materialIndex{};
+		};
+
+		struct PlaneDesc
+		{
+			Vector3 origin{};
+			Vector3 normal{};
+			uint32_t materialIndex{};
+		};
+
+		struct LightDesc
+		{
+			Vector3 origin{}; //direction for directional lights
+			ColorRGB color{};
+			float intensity{};
+			uint32_t type{}; //LightType
+		};
+
+		struct MeshDesc
+		{
+			uint32_t cullMode{}; //TriangleCullMode
+			uint32_t materialIndex{};
+			uint32_t firstPosition{};
+			uint32_t numPositions{};
+			uint32_t firstIndex{}; //first normal is firstIndex / 3
+			uint32_t numIndices{};
+			uint32_t firstTexcoord{};
+			uint32_t numTexcoords{}; //0 or numPositions
+			uint32_t firstVertexNormal{};
+			uint32_t numVertexNormals{}; //0 (flat shading) or numPositions
+			Vector3 translation{};
+			Vector3 rotation{}; //radians
+			Vector3 scale{ 1.f, 1.f, 1.f };
+			float spinSpeed{}; //yaw animation, radians per second
+			uint32_t lodLevels{}; //simplified levels built at load time
+		};
+
+		static_assert(std::is_trivially_copyable_v<CameraDesc> && std::is_trivially_copyable_v<SettingsDesc> && std::is_trivially_copyable_v<MaterialDesc> &&
+			std::is_trivially_copyable_v<TextureDesc> && 			std::is_trivially_copyable_v<SphereDesc> && std::is_trivially_copyable_v<PlaneDesc> &&
+			std::is_trivially_copyable_v<LightDesc> && std::is_trivially_copyable_v<MeshDesc>,
+			"Scene records are written and mapped as raw bytes");
+
+		//Non-owning view on a scene, either backed by a SceneDescription or by a mapped binary file
+		struct SceneView
+		{
+			CameraDesc camera{};
+			SettingsDesc settings{};
+			std::span<const MaterialDesc> materials{};
+			std::span<const TextureDesc> textures{};
+			std::span<const SphereDesc> spheres{};
+			std::span<const PlaneDesc> planes{};
+			std::span<const LightDesc> lights{};
+			std::span<const MeshDesc> meshes{};
+			std::span<const Vector3> positions{};
+			std::span<const Vector3> normals{};
+			std::span<const int> indices{};
+			std::span<const Vector2> texcoords{};
+			std::span<const Vector3> vertexNormals{};
+		};
+
+		//Owning scene description, filled by the text parser
+		struct SceneDescription
+		{
+			CameraDesc camera{};
+			SettingsDesc settings{};
+			std::vector<MaterialDesc> materials{};
+			std::vector<TextureDesc> textures{};
+			std::vector<SphereDesc> spheres{};
+			std::vector<PlaneDesc> planes{};
+			std::vector<LightDesc> lights{};
+			std::vector<MeshDesc> meshes{};
+			std::vector<Vector3> positions{};
+			std::vector<Vector3> normals{};
+			std::vector<int> indices{};
+			std::vector<Vector2> texcoords{};
+			std::vector<Vector3> vertexNormals{};
+
+			SceneView GetView() const;
+		};
+
+		bool IsBinaryFile(const std::string& filename);
+		bool ParseText(const std::string& filename, SceneDescription& description);
+		bool WriteBinary(const std::string& filename, const SceneView& view);
+		//ParseText followed by WriteBinary, for the --convert command line option
+		bool ConvertTextToBinary(const std::string& textFilename, const std::string& binaryFilename);
+		//The returned view points into mappedFile and is valid as long as it stays open
+		bool MapBinary(const std::string& filename, MappedFile& mappedFile, SceneView& view);
+	}
+}
@@ -0,0 +1,313 @@
+#include "Socket.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+using SocketLength = int;
+using NativeSocket = SOCKET;
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+using SocketLength = socklen_t;
+using NativeSocket = int;
+#endif
+
+using namespace dae;
+
+namespace
+{
+	void CloseNative(intptr_t handle)
+	{
+#if defined(_WIN32)
+		closesocket(static_cast<NativeSocket>(handle));
+#else
+		close(static_cast<NativeSocket>(handle));
+#endif
+	}
+
+	bool IsUnixAddress(const std::string& address)
+	{
+		return address.rfind("unix:", 0) == 0;
+	}
+
+	//"tcp:host:port" or "host:port", an empty host binds to all interfaces
+	bool SplitHostPort(std::string address, std::string& host, std::string& port)
+	{
+		if (address.rfind("tcp:", 0) == 0)
+			address = address.substr(4);
+
+		const size_t separator{ address.rfind(':') };
+		if (separator == std::string::npos || separator + 1 == address.size())
+			return false;
+
+		host = address.substr(0, separator);
+		port = address.substr(separator + 1);
+		return true;
+	}
+
+	void DisableNagle(intptr_t handle)
+	{
+		//Tile requests are tiny, don't let them sit in the send buffer
+		int enable{ 1 };
+		setsockopt(static_cast<NativeSocket>(handle), IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&enable), sizeof(enable));
+	}
+}
+
+Socket::~Socket()
+{
+	Close();
+}
+
+bool Socket::InitializeNetworking()
+{
+#if defined(_WIN32)
+	WSADATA wsaData{};
+	return WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+#else
+	return true;
+#endif
+}
+
+void Socket::ShutdownNetworking()
+{
+#if defined(_WIN32)
+	WSACleanup();
+#endif
+}
+
+bool Socket::Listen(const std::string& address, int backlog)
+{
+	Close();
+
+	if (IsUnixAddress(address))
+	{
+#if defined(_WIN32)
+		std::cout << "Unix domain sockets are not supported on this platform\n";
+		return false;
+#else
+		sockaddr_un socketAddress{};
+		socketAddress.sun_family = AF_UNIX;
+		const std::string path{ address.substr(5) };
+		if (path.empty() || path.size() >= sizeof(socketAddress.sun_path))
+			return false;
+		std::memcpy(socketAddress.sun_path, path.c_str(), path.size() + 1);
+
+		const int handle = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (handle < 0)
+			return false;
+
+		unlink(path.c_str());
+		if (bind(handle, reinterpret_cast<const sockaddr*>(&socketAddress), sizeof(socketAddress)) != 0 || listen(handle, backlog) != 0)
+		{
+			CloseNative(handle);
+			return false;
+		}
+		m_Handle = handle;
+		m_UnixPath = path;
+		return true;
+#endif
+	}
+
+	std::string host{}, port{};
+	if (!SplitHostPort(address, host, port))
+		return false;
+
+	addrinfo hints{};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	addrinfo* pResults{};
+	if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &pResults) != 0)
+		return false;
+
+	for (const addrinfo* pInfo = pResults; pInfo; pInfo = pInfo->ai_next)
+	{
+		const auto handle = socket(pInfo->ai_family, pInfo->ai_socktype, pInfo->ai_protocol);
+		if (static_cast<intptr_t>(handle) == INVALID_HANDLE)
+			continue;
+
+		int reuse{ 1 };
+		setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+		if (bind(handle, pInfo->ai_addr, static_cast<SocketLength>(pInfo->ai_addrlen)) == 0 && listen(handle, backlog) == 0)
+		{
+			m_Handle = static_cast<NativeHandle>(handle);
+			break;
+		}
+		CloseNative(static_cast<NativeHandle>(handle));
+	}
+	freeaddrinfo(pResults);
+
+	return IsValid();
+}
+
+bool Socket::Accept(Socket& client) const
+{
+	client.Close();
+
+	const auto handle = accept(static_cast<NativeSocket>(m_Handle), nullptr, nullptr);
+	if (static_cast<intptr_t>(handle) == INVALID_HANDLE)
+		return false;
+
+	client.m_Handle = static_cast<NativeHandle>(handle);
+	if (m_UnixPath.empty())
+		DisableNagle(client.m_Handle);
+	return true;
+}
+
+bool Socket::Connect(const std::string& address)
+{
+	Close();
+
+	if (IsUnixAddress(address))
+	{
+#if defined(_WIN32)
+		std::cout << "Unix domain sockets are not supported on this platform\n";
+		return false;
+#else
+		sockaddr_un socketAddress{};
+		socketAddress.sun_family = AF_UNIX;
+		const std::string path{ address.substr(5) };
+		if (path.empty() || path.size() >= sizeof(socketAddress.sun_path))
+			return false;
+		std::memcpy(socketAddress.sun_path, path.c_str(), path.size() + 1);
+
+		const int handle = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (handle < 0)
+			return false;
+
+		if (connect(handle, reinterpret_cast<const sockaddr*>(&socketAddress), sizeof(socketAddress)) != 0)
+		{
+			CloseNative(handle);
+			return false;
+		}
+		m_Handle = handle;
+		return true;
+#endif
+	}
+
+	std::string host{}, port{};
+	if (!SplitHostPort(address, host, port))
+		return false;
+
+	addrinfo hints{};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	addrinfo* pResults{};
+	if (getaddrinfo(host.empty() ? "127.0.0.1" : host.c_str(), port.c_str(), &hints, &pResults) != 0)
+		return false;
+
+	for (const addrinfo* pInfo = pResults; pInfo; pInfo = pInfo->ai_next)
+	{
+		const auto handle = socket(pInfo->ai_family, pInfo->ai_socktype, pInfo->ai_protocol);
+		if (static_cast<intptr_t>(handle) == INVALID_HANDLE)
+			continue;
+
+		if (connect(handle, pInfo->ai_addr, static_cast<SocketLength>(pInfo->ai_addrlen)) == 0)
+		{
+			m_Handle = static_cast<NativeHandle>(handle);
+			DisableNagle(m_Handle);
+			break;
+		}
+		CloseNative(static_cast<NativeHandle>(handle));
+	}
+	freeaddrinfo(pResults);
+
+	return IsValid();
+}
+
+void Socket::Close()
+{
+	if (IsValid())
+	{
+		CloseNative(m_Handle);
+		m_Handle = INVALID_HANDLE;
+	}
+#if !defined(_WIN32)
+	if (!m_UnixPath.empty())
+	{
+		unlink(m_UnixPath.c_str());
+		m_UnixPath.clear();
+	}
+#endif
+}
+
+bool Socket::SendAll(const void* pData, size_t numBytes) const
+{
+	const char* pBytes = static_cast<const char*>(pData);
+	while (numBytes > 0)
+	{
+#if defined(_WIN32)
+		const int sent = send(static_cast<NativeSocket>(m_Handle), pBytes, static_cast<int>(std::min<size_t>(numBytes, INT32_MAX)), 0);
+#else
+		const ssize_t sent = send(static_cast<NativeSocket>(m_Handle), pBytes, numBytes, MSG_NOSIGNAL);
+#endif
+		if (sent <= 0)
+			return false;
+		pBytes += sent;
+		numBytes -= static_cast<size_t>(sent);
+	}
+	return true;
+}
+
+bool Socket::ReceiveAll(void* pData, size_t numBytes) const
+{
+	char* pBytes = static_cast<char*>(pData);
+	while (numBytes > 0)
+	{
+#if defined(_WIN32)
+		const int received = recv(static_cast<NativeSocket>(m_Handle), pBytes, static_cast<int>(std::min<size_t>(numBytes, INT32_MAX)), 0);
+#else
+		const ssize_t received = recv(static_cast<NativeSocket>(m_Handle), pBytes, numBytes, 0);
+#endif
+		if (received <= 0)
+			return false;
+		pBytes += received;
+		numBytes -= static_cast<size_t>(received);
+	}
+	return true;
+}
+
+bool Socket::WaitReadable(const std::vector<const Socket*>& sockets, int timeoutMs, std::vector<bool>& isReadable)
+{
+	fd_set readSet;
+	FD_ZERO(&readSet);
+
+	NativeHandle maxHandle{ 0 };
+	for (const Socket* pSocket : sockets)
+	{
+		if (!pSocket->IsValid())
+			continue;
+		FD_SET(static_cast<NativeSocket>(pSocket->m_Handle), &readSet);
+		maxHandle = std::max(maxHandle, pSocket->m_Handle);
+	}
+
+	timeval timeout{};
+	timeout.tv_sec = timeoutMs / 1000;
+	timeout.tv_usec = (timeoutMs % 1000) * 1000;
+
+	const int numReady = select(static_cast<int>(maxHandle + 1), &readSet, nullptr, nullptr, &timeout);
+
+	isReadable.assign(sockets.size(), false);
+	if (numReady <= 0)
+		return false;
+
+	for (size_t idx{}; idx < sockets.size(); ++idx)
+	{
+		isReadable[idx] = sockets[idx]->IsValid() && FD_ISSET(static_cast<NativeSocket>(sockets[idx]->m_Handle), &readSet);
+	}
+	return true;
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dae
+{
+	//Minimal blocking stream socket
+	//Addresses are "host:port" / "tcp:host:port" for TCP or "unix:/path/to/socket" for a Unix domain socket (not on Windows)
+	class Socket final
+	{
+	public:
+		Socket() = default;
+		~Socket();
+
+		Socket(const Socket&) = delete;
+		Socket(Socket&&) noexcept = delete;
+		Socket& operator=(const Socket&) = delete;
+		Socket& operator=(Socket&&) noexcept = delete;
+
+		//Has to be called once per process before any socket is used
+		static bool InitializeNetworking();
+		static void ShutdownNetworking();
+
+		bool Listen(const std::string& address, int backlog = 16);
+		bool Accept(Socket& client) const;
+		bool Connect(const std::string& address);
+		void Close();
+
+		bool SendAll(const void* pData, size_t numBytes) const;
+		bool ReceiveAll(void* pData, size_t numBytes) const;
+
+		bool IsValid() const { return m_Handle != INVALID_HANDLE; }
+
+		//Waits until at least one of the sockets has data (or was closed), isReadable is filled per socket
+		//Returns false on timeout or error
+		static bool WaitReadable(const std::vector<const Socket*>& sockets, int timeoutMs, std::vector<bool>& isReadable);
+
+	private:
+		using NativeHandle = intptr_t;
+		static constexpr NativeHandle INVALID_HANDLE{ -1 };
+
+		NativeHandle m_Handle{ INVALID_HANDLE };
+		std::string m_UnixPath{}; //removed again when a listening unix socket closes
+	};
+}
@@ -0,0 +1,369 @@
+#include "SphereGrid.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "DataTypes.h"
+#include "Parallel.h"
+#include "Utils.h"
+
+namespace dae
+{
+	constexpr int MAX_GRID_RESOLUTION{ 512 };
+	constexpr float CELLS_PER_SPHERE{ 2.f };
+	//Spheres (and slots) per task of the parallel passes, fixed so the float sums come out the same on any thread count
+	constexpr uint32_t BUILD_CHUNK_SIZE{ 4096 };
+	//The counting sort keeps a histogram over all slots per chunk of spheres, this bounds that memory
+	constexpr uint32_t MAX_BINNING_CHUNKS{ 8 };
+
+	namespace
+	{
+		//function(chunk, begin, end) over count items in chunks of chunkSize, in parallel when there is more than one
+		template<typename Function>
+		void ForEachChunk(uint32_t count, uint32_t chunkSize, Function&& function)
+		{
+			const uint32_t numChunks{ (count + chunkSize - 1) / chunkSize };
+			Parallel::For(0u, numChunks, [&](uint32_t chunk)
+			{
+				function(chunk, chunk * chunkSize, std::min(count, (chunk + 1) * chunkSize));
+			}, 1);
+		}
+
+		struct ChunkBounds
+		{
+			float min[3]{ FLT_MAX, FLT_MAX, FLT_MAX };
+			float max[3]{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		};
+	}
+
+	void SphereGrid::Build(std::span<const Sphere> spheres, bool isHashed)
+	{
+		Clear();
+		if (spheres.empty())
+			return;
+
+		m_IsHashed = isHashed;
+		const uint32_t numSpheres{ static_cast<uint32_t>(spheres.size()) };
+		const uint32_t numChunks{ (numSpheres + BUILD_CHUNK_SIZE - 1) / BUILD_CHUNK_SIZE };
+
+		//Per chunk partial sums, added up in chunk order
+		std::vector<float> radiusSums(numChunks);
+		ForEachChunk(numSpheres, BUILD_CHUNK_SIZE, [&](uint32_t chunk, uint32_t begin, uint32_t end)
+		{
+			float radiusSum{};
+			for (uint32_t sphereIndex{ begin }; sphereIndex < end; ++sphereIndex)
+				radiusSum += spheres[sphereIndex].radius;
+			radiusSums[chunk] = radiusSum;
+		});
+		float radiusSum{};
+		for (const float chunkSum : radiusSums)
+			radiusSum += chunkSum;
+		const float meanDiameter{ 2.f * radiusSum / spheres.size() };
+
+		//Bounds of the typically sized spheres, a huge ground sphere would otherwise stretch the grid
+		const float maxGridDiameter{ 2.f * meanDiameter };
+		std::vector<ChunkBounds> chunkBounds(numChunks);
+		ForEachChunk(numSpheres, BUILD_CHUNK_SIZE, [&](uint32_t chunk, uint32_t begin, uint32_t end)
+		{
+			ChunkBounds& bounds = chunkBounds[chunk];
+			for (uint32_t sphereIndex{ begin }; sphereIndex < end; ++sphereIndex)
+			{
+				const Sphere& sphere = spheres[sphereIndex];
+				if (2.f * sphere.radius > maxGridDiameter)
+					continue;
+
+				const float origin[3]{ sphere.origin.x, sphere.origin.y, sphere.origin.z };
+				for (int axis{}; axis < 3; ++axis)
+				{
+					bounds.min[axis] = std::min(bounds.min[axis], origin[axis] - sphere.radius);
+					bounds.max[axis] = std::max(bounds.max[axis], origin[axis] + sphere.radius);
+				}
+			}
+		});
+		for (int axis{}; axis < 3; ++axis)
+		{
+			m_Min[axis] = FLT_MAX;
+			m_Max[axis] = -FLT_MAX;
+			for (const ChunkBounds& bounds : chunkBounds)
+			{
+				m_Min[axis] = std::min(m_Min[axis], bounds.min[axis]);
+				m_Max[axis] = std::max(m_Max[axis], bounds.max[axis]);
+			}
+		}
+		const float extent[3]{ m_Max[0] - m_Min[0], m_Max[1] - m_Min[1], m_Max[2] - m_Min[2] };
+
+		//Cells are never smaller than a typical sphere, so a sphere overlaps at most 2 cells per axis
+		float cellSize{};
+		if (m_IsHashed)
+		{
+			//Only occupied cells take up memory, a sphere covers about 3 of them
+			cellSize = 2.f * meanDiameter;
+		}
+		else
+		{
+			//Cell count proportional to the sphere count
+			const float volume{ std::max(extent[0] * extent[1] * extent[2], 1e-12f) };
+			cellSize = std::max(std::cbrt(volume / (CELLS_PER_SPHERE * spheres.size())), meanDiameter);
+		}
+		cellSize = std::max(cellSize, 1e-4f);
+
+		for (int axis{}; axis < 3; ++axis)
+		{
+			//Rounding down keeps uniform cells at least cellSize wide
+			const float cellsAlongAxis{ extent[axis] / cellSize };
+			const int resolution{ static_cast<int>(m_IsHashed ? std::ceil(cellsAlongAxis) : std::floor(cellsAlongAxis)) };
+			m_Resolution[axis] = std::clamp(resolution, 1, m_IsHashed ? INT32_MAX / 2 : MAX_GRID_RESOLUTION);
+			m_CellSize[axis] = m_IsHashed ? cellSize : std::max(extent[axis] / m_Resolution[axis], 1e-6f);
+			m_InverseCellSize[axis] = 1.f / m_CellSize[axis];
+		}
+
+		uint32_t numSlots{};
+		if (m_IsHashed)
+		{
+			uint32_t tableSize{ 1 };
+			while (tableSize < 2 * spheres.size())
+				tableSize <<= 1;
+			m_HashMask = tableSize - 1;
+			numSlots = tableSize;
+		}
+		else
+		{
+			numSlots = static_cast<uint32_t>(m_Resolution[0] * m_Resolution[1] * m_Resolution[2]);
+		}
+
+		const auto forEachOverlappedSlot = [this](const CellSpan& span, auto&& function)
+		{
+			for (int z{ span.cellMin[2] }; z <= span.cellMax[2]; ++z)
+				for (int y{ span.cellMin[1] }; y <= span.cellMax[1]; ++y)
+					for (int x{ span.cellMin[0] }; x <= span.cellMax[0]; ++x)
+						function(GetCellSlot(x, y, z));
+		};
+
+		//Counting sort, pass 1: every binning chunk finds the cells of its spheres and counts their references per slot
+		//Spheres larger than a cell (a few big ones among the particles) are tested on every query instead
+		const float maxCellDiameter{ std::min(maxGridDiameter, std::min(m_CellSize[0], std::min(m_CellSize[1], m_CellSize[2]))) };
+		const uint32_t numBinningChunks{ std::clamp(std::min(Parallel::GetNumThreads(), numChunks), 1u, MAX_BINNING_CHUNKS) };
+		const auto getChunkBegin = [numSpheres, numBinningChunks](uint32_t chunk)
+		{
+			return static_cast<uint32_t>(uint64_t{ numSpheres } * chunk / numBinningChunks);
+		};
+		m_CellSpans.resize(spheres.size());
+		m_ChunkCounts.resize(size_t{ numBinningChunks } * numSlots);
+		Parallel::For(0u, numBinningChunks, [&](uint32_t chunk)
+		{
+			uint32_t* const pCounts{ m_ChunkCounts.data() + size_t{ chunk } * numSlots };
+			std::fill(pCounts, pCounts + numSlots, 0u);
+			const uint32_t end{ getChunkBegin(chunk + 1) };
+			for (uint32_t sphereIndex{ getChunkBegin(chunk) }; sphereIndex < end; ++sphereIndex)
+			{
+				const Sphere& sphere = spheres[sphereIndex];
+				CellSpan& span = m_CellSpans[sphereIndex];
+				span.isOversized = 2.f * sphere.radius > maxCellDiameter;
+				if (span.isOversized)
+					continue;
+
+				const float origin[3]{ sphere.origin.x, sphere.origin.y, sphere.origin.z };
+				for (int axis{}; axis < 3; ++axis)
+				{
+					span.cellMin[axis] = std::clamp(static_cast<int>((origin[axis] - sphere.radius - m_Min[axis]) * m_InverseCellSize[axis]), 0, m_Resolution[axis] - 1);
+					span.cellMax[axis] = std::clamp(static_cast<int>((origin[axis] + sphere.radius - m_Min[axis]) * m_InverseCellSize[axis]), 0, m_Resolution[axis] - 1);
+				}
+				forEachOverlappedSlot(span, [pCounts](uint32_t slot) { ++pCounts[slot]; });
+			}
+		}, 1);
+		for (uint32_t sphereIndex{}; sphereIndex < numSpheres; ++sphereIndex)
+		{
+			if (m_CellSpans[sphereIndex].isOversized)
+				m_OversizedSpheres.push_back(sphereIndex);
+		}
+
+		//Prefix sum over the slots, the references of a slot are laid out chunk after chunk so every slot lists its spheres in index order
+		//Totals per range of slots first, then every range turns its counts into the write cursors of the chunks
+		const uint32_t numSlotRanges{ (numSlots + BUILD_CHUNK_SIZE - 1) / BUILD_CHUNK_SIZE };
+		std::vector<uint32_t> rangeStarts(numSlotRanges + 1);
+		ForEachChunk(numSlots, BUILD_CHUNK_SIZE, [&](uint32_t range, uint32_t begin, uint32_t end)
+		{
+			uint32_t total{};
+			for (uint32_t chunk{}; chunk < numBinningChunks; ++chunk)
+			{
+				const uint32_t* const pCounts{ m_ChunkCounts.data() + size_t{ chunk } * numSlots };
+				for (uint32_t slot{ begin }; slot < end; ++slot)
+					total += pCounts[slot];
+			}
+			rangeStarts[range + 1] = total;
+		});
+		for (uint32_t range{}; range < numSlotRanges; ++range)
+			rangeStarts[range + 1] += rangeStarts[range];
+
+		m_CellStart.resize(numSlots + 1);
+		m_CellStart[numSlots] = rangeStarts[numSlotRanges];
+		ForEachChunk(numSlots, BUILD_CHUNK_SIZE, [&](uint32_t range, uint32_t begin, uint32_t end)
+		{
+			uint32_t start{ rangeStarts[range] };
+			for (uint32_t slot{ begin }; slot < end; ++slot)
+			{
+				m_CellStart[slot] = start;
+				for (uint32_t chunk{}; chunk < numBinningChunks; ++chunk)
+				{
+					uint32_t& count = m_ChunkCounts[size_t{ chunk } * numSlots + slot];
+					const uint32_t cursor{ start };
+					start += count;
+					count = cursor;
+				}
+			}
+		});
+
+		//Pass 2: every binning chunk scatters its sphere indices from its own cursors
+		m_SphereIndices.resize(m_CellStart[numSlots]);
+		uint32_t* const pIndices{ m_SphereIndices.data() };
+		Parallel::For(0u, numBinningChunks, [&](uint32_t chunk)
+		{
+			uint32_t* const pCursors{ m_ChunkCounts.data() + size_t{ chunk } * numSlots };
+			const uint32_t end{ getChunkBegin(chunk + 1) };
+			for (uint32_t sphereIndex{ getChunkBegin(chunk) }; sphereIndex < end; ++sphereIndex)
+			{
+				if (!m_CellSpans[sphereIndex].isOversized)
+					forEachOverlappedSlot(m_CellSpans[sphereIndex], [=](uint32_t slot) { pIndices[pCursors[slot]++] = sphereIndex; });
+			}
+		}, 1);
+	}
+
+	void SphereGrid::Clear()
+	{
+		m_CellStart.clear();
+		m_SphereIndices.clear();
+		m_OversizedSpheres.clear();
+	}
+
+	uint32_t SphereGrid::GetCellSlot(int x, int y, int z) const
+	{
+		if (!m_IsHashed)
+			return static_cast<uint32_t>((z * m_Resolution[1] + y) * m_Resolution[0] + x);
+
+		//Teschner et al. spatial hash
+		const uint32_t hash{ (static_cast<uint32_t>(x) * 73856093u) ^ (static_cast<uint32_t>(y) * 19349663u) ^ (static_cast<uint32_t>(z) * 83492791u) };
+		return hash & m_HashMask;
+	}
+
+	template<typename CellVisitor>
+	void SphereGrid::Traverse(const Ray& ray, CellVisitor&& visitCell) const
+	{
+		const float origin[3]{ ray.origin.x, ray.origin.y, ray.origin.z };
+		const float direction[3]{ ray.direction.x, ray.direction.y, ray.direction.z };
+
+		//Clip the ray against the grid bounds
+		float tEnter{ ray.min };
+		float tExit{ ray.max };
+		for (int axis{}; axis < 3; ++axis)
+		{
+			const float inverseDirection{ 1.f / direction[axis] };
+			float t0{ (m_Min[axis] - origin[axis]) * inverseDirection };
+			float t1{ (m_Max[axis] - origin[axis]) * inverseDirection };
+			if (t0 > t1)
+				std::swap(t0, t1);
+			tEnter = std::max(tEnter, t0);
+			tExit = std::min(tExit, t1);
+		}
+		if (tEnter > tExit)
+			return;
+
+		//3D-DDA setup (Amanatides & Woo)
+		int cell[3]{}, step[3]{};
+		float tNext[3]{}, tDelta[3]{};
+		for (int axis{}; axis < 3; ++axis)
+		{
+			const float entryPoint{ origin[axis] + direction[axis] * tEnter };
+			cell[axis] = std::clamp(static_cast<int>((entryPoint - m_Min[axis]) * m_InverseCellSize[axis]), 0, m_Resolution[axis] - 1);
+			if (direction[axis] > 0.f)
+			{
+				step[axis] = 1;
+				tDelta[axis] = m_CellSize[axis] / direction[axis];
+				tNext[axis] = tEnter + (m_Min[axis] + (cell[axis] + 1) * m_CellSize[axis] - entryPoint) / direction[axis];
+			}
+			else if (direction[axis] < 0.f)
+			{
+				step[axis] = -1;
+				tDelta[axis] = -m_CellSize[axis] / direction[axis];
+				tNext[axis] = tEnter + (m_Min[axis] + cell[axis] * m_CellSize[axis] - entryPoint) / direction[axis];
+			}
+			else
+			{
+				tDelta[axis] = FLT_MAX;
+				tNext[axis] = FLT_MAX;
+			}
+		}
+
+		while (true)
+		{
+			RAY_STAT(AABBTests);
+			const int nextAxis{ tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2) };
+			const float tCellExit{ std::min(tNext[nextAxis], tExit) };
+
+			const uint32_t slot{ GetCellSlot(cell[0], cell[1], cell[2]) };
+			if (m_CellStart[slot] != m_CellStart[slot + 1] && visitCell(m_CellStart[slot], m_CellStart[slot + 1], tCellExit))
+				return;
+
+			if (tNext[nextAxis] > tExit)
+				return;
+			cell[nextAxis] += step[nextAxis];
+			if (cell[nextAxis] < 0 || cell[nextAxis] >= m_Resolution[nextAxis])
+				return;
+			tNext[nextAxis] += tDelta[nextAxis];
+		}
+	}
+
+	bool SphereGrid::GetClosestHit(std::span<const Sphere> spheres, const Ray& ray, float& t, uint32_t& sphereIndex) const
+	{
+		if (IsEmpty())
+			return false;
+
+		bool didHit{};
+		float closestT{ ray.max };
+		const auto testSphere = [&](uint32_t index)
+		{
+			float hitT{};
+			if (GeometryUtils::Intersect_Sphere_Geometric(spheres[index], ray, hitT) && hitT <= closestT)
+			{
+				closestT = hitT;
+				sphereIndex = index;
+				didHit = true;
+			}
+		};
+
+		for (uint32_t oversizedIndex : m_OversizedSpheres)
+			testSphere(oversizedIndex);
+
+		Traverse(ray, [&](uint32_t first, uint32_t last, float tCellExit)
+		{
+			for (uint32_t entry{ first }; entry < last; ++entry)
+				testSphere(m_SphereIndices[entry]);
+			//Spheres span several cells, a hit only ends the walk once it lies before the end of this cell
+			return didHit && closestT <= tCellExit;
+		});
+
+		if (didHit)
+			t = closestT;
+		return didHit;
+	}
+
+	bool SphereGrid::DoesHit(std::span<const Sphere> spheres, const Ray& ray) const
+	{
+		if (IsEmpty())
+			return false;
+
+		for (uint32_t sphereIndex : m_OversizedSpheres)
+		{
+			if (GeometryUtils::HitTest_Sphere_Geometric(spheres[sphereIndex], ray))
+				return true;
+		}
+
+		bool didHit{};
+		Traverse(ray, [&](uint32_t first, uint32_t last, float)
+		{
+			for (uint32_t entry{ first }; entry < last && !didHit; ++entry)
+				didHit = GeometryUtils::HitTest_Sphere_Geometric(spheres[m_SphereIndices[entry]], ray);
+			return didHit;
+		});
+		return didHit;
+	}
+}
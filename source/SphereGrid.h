@@ -0,0 +1,76 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "Math.h"
+
+namespace dae
+{
+	struct Sphere;
+	struct Ray;
+
+	enum class SphereAcceleration : uint32_t
+	{
+		None, //brute force loop over every sphere
+		UniformGrid,
+		HashedGrid
+	};
+
+	//Grid over a set of spheres, traversed with a 3D-DDA
+	//Built with a counting sort in two linear passes, cheap enough to rebuild every frame for fully dynamic spheres
+	//Every pass of the build is split over the Parallel pool, chunks of spheres count into their own slot histograms and scatter from their own cursors
+	//- Uniform: dense cell array over the bounds of the spheres, resolution picked from the sphere count
+	//- Hashed: cells of two sphere diameters hashed into a table sized by the sphere count, memory doesn't depend on the bounds
+	//Spheres much larger than the average end up in a separate list that every query tests
+	class SphereGrid final
+	{
+	public:
+		SphereGrid() = default;
+		~SphereGrid() = default;
+
+		SphereGrid(const SphereGrid&) = delete;
+		SphereGrid(SphereGrid&&) noexcept = delete;
+		SphereGrid& operator=(const SphereGrid&) = delete;
+		SphereGrid& operator=(SphereGrid&&) noexcept = delete;
+
+		void Build(std::span<const Sphere> spheres, bool isHashed);
+		void Clear();
+		bool IsEmpty() const { return m_SphereIndices.empty() && m_OversizedSpheres.empty(); }
+
+		//spheres must be the span the grid was built from, sphereIndex indexes that span
+		bool GetClosestHit(std::span<const Sphere> spheres, const Ray& ray, float& t, uint32_t& sphereIndex) const;
+		bool DoesHit(std::span<const Sphere> spheres, const Ray& ray) const;
+
+	private:
+		//Cells overlapped by a sphere, at most 2 per axis
+		struct CellSpan
+		{
+			int cellMin[3]{};
+			int cellMax[3]{};
+			bool isOversized{};
+		};
+
+		//Calls visitCell(firstIndex, lastIndex, tCellExit) front to back until it returns true
+		template<typename CellVisitor>
+		void Traverse(const Ray& ray, CellVisitor&& visitCell) const;
+		uint32_t GetCellSlot(int x, int y, int z) const;
+
+		//Plain per-axis arrays, Vector3::operator[] isn't inlined and these are indexed by axis in the hot loops
+		bool m_IsHashed{};
+		float m_Min[3]{};
+		float m_Max[3]{};
+		float m_CellSize[3]{ 1.f, 1.f, 1.f };
+		float m_InverseCellSize[3]{ 1.f, 1.f, 1.f };
+		int m_Resolution[3]{}; //cells per axis over the bounds, also used to clip hashed traversal
+		uint32_t m_HashMask{};
+
+		std::vector<uint32_t> m_CellStart{}; //slot -> first entry in m_SphereIndices, one extra entry at the end
+		std::vector<uint32_t> m_SphereIndices{};
+		std::vector<uint32_t> m_OversizedSpheres{};
+
+		//Build scratch, kept to avoid reallocating every frame
+		std::vector<CellSpan> m_CellSpans{};
+		std::vector<uint32_t> m_ChunkCounts{}; //slot histogram per binning chunk, turned into that chunk's write cursors
+	};
+}
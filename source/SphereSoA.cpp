@@ -0,0 +1,196 @@
+#include "SphereSoA.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+#include "DataTypes.h"
+#include "RayStats.h"
+
+namespace dae
+{
+	void SphereSoA::Build(std::span<const Sphere> spheres)
+	{
+		m_Count = static_cast<uint32_t>(spheres.size());
+		const uint32_t paddedCount{ (m_Count + LANE_COUNT - 1) / LANE_COUNT * LANE_COUNT };
+
+		m_CenterX.resize(paddedCount);
+		m_CenterY.resize(paddedCount);
+		m_CenterZ.resize(paddedCount);
+		m_RadiusSquared.resize(paddedCount);
+		for (uint32_t idx{}; idx < paddedCount; ++idx)
+		{
+			const bool isPadding{ idx >= m_Count };
+			m_CenterX[idx] = isPadding ? 0.f : spheres[idx].origin.x;
+			m_CenterY[idx] = isPadding ? 0.f : spheres[idx].origin.y;
+			m_CenterZ[idx] = isPadding ? 0.f : spheres[idx].origin.z;
+			m_RadiusSquared[idx] = isPadding ? -FLT_MAX : spheres[idx].radius * spheres[idx].radius;
+		}
+	}
+
+	void SphereSoA::Clear()
+	{
+		m_Count = 0;
+		m_CenterX.clear();
+		m_CenterY.clear();
+		m_CenterZ.clear();
+		m_RadiusSquared.clear();
+	}
+
+	//Same geometric test as GeometryUtils::HitTest_Sphere_Geometric:
+	//L = center - origin, projection dp = L.d, squared distance to the ray od2 = L.L - dp^2, hit at t = dp - sqrt(r^2 - od2)
+	bool SphereSoA::GetClosestHit(const Ray& ray, float& t, uint32_t& sphereIndex) const
+	{
+		if (m_Count == 0)
+			return false;
+		if constexpr (RayStats::IS_ENABLED)
+			RayStats::Increment(RayStats::Counter::SphereTests, m_Count);
+
+		float closestT{ ray.max };
+		uint32_t closestIndex{ UINT32_MAX };
+		const uint32_t paddedCount{ static_cast<uint32_t>(m_RadiusSquared.size()) };
+
+#if defined(__AVX__)
+		const __m256 originX{ _mm256_set1_ps(ray.origin.x) };
+		const __m256 originY{ _mm256_set1_ps(ray.origin.y) };
+		const __m256 originZ{ _mm256_set1_ps(ray.origin.z) };
+		const __m256 directionX{ _mm256_set1_ps(ray.direction.x) };
+		const __m256 directionY{ _mm256_set1_ps(ray.direction.y) };
+		const __m256 directionZ{ _mm256_set1_ps(ray.direction.z) };
+		const __m256 minT{ _mm256_set1_ps(ray.min) };
+
+		//Nearest t per lane, the index is kept as raw bits in a float register since AVX has no 256-bit integer blend
+		__m256 laneT{ _mm256_set1_ps(ray.max) };
+		__m256 laneIndex{ _mm256_castsi256_ps(_mm256_set1_epi32(-1)) };
+		for (uint32_t first{}; first < paddedCount; first += LANE_COUNT)
+		{
+			const __m256 lx{ _mm256_sub_ps(_mm256_loadu_ps(m_CenterX.data() + first), originX) };
+			const __m256 ly{ _mm256_sub_ps(_mm256_loadu_ps(m_CenterY.data() + first), originY) };
+			const __m256 lz{ _mm256_sub_ps(_mm256_loadu_ps(m_CenterZ.data() + first), originZ) };
+			const __m256 radiusSquared{ _mm256_loadu_ps(m_RadiusSquared.data() + first) };
+
+			const __m256 dp{ _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lx, directionX), _mm256_mul_ps(ly, directionY)), _mm256_mul_ps(lz, directionZ)) };
+			const __m256 lengthSquared{ _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lx, lx), _mm256_mul_ps(ly, ly)), _mm256_mul_ps(lz, lz)) };
+			const __m256 od2{ _mm256_sub_ps(lengthSquared, _mm256_mul_ps(dp, dp)) };
+
+			//Lanes that miss get a NaN t here, every compare below is false for them
+			const __m256 hitT{ _mm256_sub_ps(dp, _mm256_sqrt_ps(_mm256_sub_ps(radiusSquared, od2))) };
+			const __m256 isCloser{ _mm256_and_ps(
+				_mm256_and_ps(_mm256_cmp_ps(od2, radiusSquared, _CMP_LT_OQ), _mm256_cmp_ps(hitT, minT, _CMP_GT_OQ)),
+				_mm256_cmp_ps(hitT, laneT, _CMP_LT_OQ)) };
+			if (_mm256_movemask_ps(isCloser) == 0)
+				continue;
+
+			const __m256 indices{ _mm256_castsi256_ps(_mm256_setr_epi32(
+				first, first + 1, first + 2, first + 3, first + 4, first + 5, first + 6, first + 7)) };
+			laneT = _mm256_blendv_ps(laneT, hitT, isCloser);
+			laneIndex = _mm256_blendv_ps(laneIndex, indices, isCloser);
+		}
+
+		alignas(32) float lanesT[LANE_COUNT];
+		alignas(32) uint32_t lanesIndex[LANE_COUNT];
+		_mm256_store_ps(lanesT, laneT);
+		_mm256_store_ps(reinterpret_cast<float*>(lanesIndex), laneIndex);
+		for (uint32_t lane{}; lane < LANE_COUNT; ++lane)
+		{
+			if (lanesIndex[lane] != UINT32_MAX && (lanesT[lane] < closestT || (lanesT[lane] == closestT && lanesIndex[lane] < closestIndex)))
+			{
+				closestT = lanesT[lane];
+				closestIndex = lanesIndex[lane];
+			}
+		}
+#else
+		for (uint32_t idx{}; idx < paddedCount; ++idx)
+		{
+			const float lx{ m_CenterX[idx] - ray.origin.x };
+			const float ly{ m_CenterY[idx] - ray.origin.y };
+			const float lz{ m_CenterZ[idx] - ray.origin.z };
+			const float dp{ lx * ray.direction.x + ly * ray.direction.y + lz * ray.direction.z };
+			const float od2{ lx * lx + ly * ly + lz * lz - dp * dp };
+			if (od2 >= m_RadiusSquared[idx])
+				continue;
+
+			const float hitT{ dp - sqrtf(m_RadiusSquared[idx] - od2) };
+			if (hitT > ray.min && hitT < closestT)
+			{
+				closestT = hitT;
+				closestIndex = idx;
+			}
+		}
+#endif
+
+		if (closestIndex == UINT32_MAX)
+			return false;
+
+		t = closestT;
+		sphereIndex = closestIndex;
+		return true;
+	}
+
+	bool SphereSoA::DoesHit(const Ray& ray) const
+	{
+		if (m_Count == 0)
+			return false;
+
+		const uint32_t paddedCount{ static_cast<uint32_t>(m_RadiusSquared.size()) };
+#if defined(__AVX__)
+		const __m256 originX{ _mm256_set1_ps(ray.origin.x) };
+		const __m256 originY{ _mm256_set1_ps(ray.origin.y) };
+		const __m256 originZ{ _mm256_set1_ps(ray.origin.z) };
+		const __m256 directionX{ _mm256_set1_ps(ray.direction.x) };
+		const __m256 directionY{ _mm256_set1_ps(ray.direction.y) };
+		const __m256 directionZ{ _mm256_set1_ps(ray.direction.z) };
+		const __m256 minT{ _mm256_set1_ps(ray.min) };
+		const __m256 maxT{ _mm256_set1_ps(ray.max) };
+		for (uint32_t first{}; first < paddedCount; first += LANE_COUNT)
+		{
+			const __m256 lx{ _mm256_sub_ps(_mm256_loadu_ps(m_CenterX.data() + first), originX) };
+			const __m256 ly{ _mm256_sub_ps(_mm256_loadu_ps(m_CenterY.data() + first), originY) };
+			const __m256 lz{ _mm256_sub_ps(_mm256_loadu_ps(m_CenterZ.data() + first), originZ) };
+			const __m256 radiusSquared{ _mm256_loadu_ps(m_RadiusSquared.data() + first) };
+
+			const __m256 dp{ _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lx, directionX), _mm256_mul_ps(ly, directionY)), _mm256_mul_ps(lz, directionZ)) };
+			const __m256 lengthSquared{ _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lx, lx), _mm256_mul_ps(ly, ly)), _mm256_mul_ps(lz, lz)) };
+			const __m256 od2{ _mm256_sub_ps(lengthSquared, _mm256_mul_ps(dp, dp)) };
+			const __m256 hitT{ _mm256_sub_ps(dp, _mm256_sqrt_ps(_mm256_sub_ps(radiusSquared, od2))) };
+			const __m256 isHit{ _mm256_and_ps(
+				_mm256_and_ps(_mm256_cmp_ps(od2, radiusSquared, _CMP_LT_OQ), _mm256_cmp_ps(hitT, minT, _CMP_GT_OQ)),
+				_mm256_cmp_ps(hitT, maxT, _CMP_LT_OQ)) };
+			if (_mm256_movemask_ps(isHit) != 0)
+			{
+				if constexpr (RayStats::IS_ENABLED)
+					RayStats::Increment(RayStats::Counter::SphereTests, std::min(first + LANE_COUNT, m_Count));
+				return true;
+			}
+		}
+		if constexpr (RayStats::IS_ENABLED)
+			RayStats::Increment(RayStats::Counter::SphereTests, m_Count);
+		return false;
+#else
+		for (uint32_t idx{}; idx < paddedCount; ++idx)
+		{
+			const float lx{ m_CenterX[idx] - ray.origin.x };
+			const float ly{ m_CenterY[idx] - ray.origin.y };
+			const float lz{ m_CenterZ[idx] - ray.origin.z };
+			const float dp{ lx * ray.direction.x + ly * ray.direction.y + lz * ray.direction.z };
+			const float od2{ lx * lx + ly * ly + lz * lz - dp * dp };
+			if (od2 >= m_RadiusSquared[idx])
+				continue;
+
+			const float hitT{ dp - sqrtf(m_RadiusSquared[idx] - od2) };
+			if (hitT > ray.min && hitT < ray.max)
+			{
+				if constexpr (RayStats::IS_ENABLED)
+					RayStats::Increment(RayStats::Counter::SphereTests, idx + 1);
+				return true;
+			}
+		}
+		if constexpr (RayStats::IS_ENABLED)
+			RayStats::Increment(RayStats::Counter::SphereTests, m_Count);
+		return false;
+#endif
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace dae
+{
+	struct Sphere;
+	struct Ray;
+
+	//Structure-of-arrays copy of the scene spheres for the brute force sphere loop
+	//Tests 8 spheres per iteration with AVX (built with /arch:AVX or -mavx), plain scalar loop otherwise
+	//Only t and the sphere index are tracked, the caller fills in the hit record of the winner
+	class SphereSoA final
+	{
+	public:
+		SphereSoA() = default;
+		~SphereSoA() = default;
+
+		SphereSoA(const SphereSoA&) = delete;
+		SphereSoA(SphereSoA&&) noexcept = delete;
+		SphereSoA& operator=(const SphereSoA&) = delete;
+		SphereSoA& operator=(SphereSoA&&) noexcept = delete;
+
+		void Build(std::span<const Sphere> spheres);
+		void Clear();
+
+		//Nearest hit in (ray.min, ray.max), sphereIndex is the index in the span the arrays were built from
+		bool GetClosestHit(const Ray& ray, float& t, uint32_t& sphereIndex) const;
+		bool DoesHit(const Ray& ray) const;
+
+	private:
+		static constexpr uint32_t LANE_COUNT{ 8 };
+
+		uint32_t m_Count{};
+		//Padded to a multiple of LANE_COUNT, padding lanes have a negative squared radius and never hit
+		std::vector<float> m_CenterX{};
+		std::vector<float> m_CenterY{};
+		std::vector<float> m_CenterZ{};
+		std::vector<float> m_RadiusSquared{};
+	};
+}
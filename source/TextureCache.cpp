@@ -0,0 +1,411 @@
+#include "TextureCache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+namespace dae
+{
+	namespace
+	{
+		constexpr char TILED_MAGIC[4]{ 'R', 'T', 'T', 'X' };
+		constexpr uint32_t TILED_VERSION{ 1 };
+
+		struct TiledHeader
+		{
+			char magic[4]{};
+			uint32_t version{};
+			uint32_t width{};
+			uint32_t height{};
+			uint32_t numLevels{};
+			uint32_t tileSize{};
+			uint32_t isSRGB{};
+			uint32_t padding{};
+		};
+
+		//Position of texel (x, y) of a tile, x and y interleaved bit by bit
+		uint32_t GetMortonIndex(uint32_t x, uint32_t y)
+		{
+			const auto spread = [](uint32_t value)
+			{
+				value = (value | (value << 4)) & 0x0F0F;
+				value = (value | (value << 2)) & 0x3333;
+				return (value | (value << 1)) & 0x5555;
+			};
+			return spread(x) | (spread(y) << 1);
+		}
+
+		const float* GetSRGBToLinearTable()
+		{
+			static const auto table = []()
+			{
+				std::vector<float> values(256);
+				for (int value{}; value < 256; ++value)
+				{
+					const float srgb{ value / 255.f };
+					values[value] = srgb <= 0.04045f ? srgb / 12.92f : std::pow((srgb + 0.055f) / 1.055f, 2.4f);
+				}
+				return values;
+			}();
+			return table.data();
+		}
+
+		uint8_t LinearToSRGB(float linear)
+		{
+			linear = std::clamp(linear, 0.f, 1.f);
+			const float srgb{ linear <= 0.0031308f ? linear * 12.92f : 1.055f * std::pow(linear, 1.f / 2.4f) - 0.055f };
+			return static_cast<uint8_t>(srgb * 255.f + 0.5f);
+		}
+
+		//Mip chain sizes down to 1x1, each level half the one before (rounded down)
+		std::vector<std::pair<int, int>> GetLevelSizes(int width, int height)
+		{
+			std::vector<std::pair<int, int>> sizes{ { width, height } };
+			while (width > 1 || height > 1)
+			{
+				width = std::max(1, width / 2);
+				height = std::max(1, height / 2);
+				sizes.emplace_back(width, height);
+			}
+			return sizes;
+		}
+
+		int GetNumTiles(int size)
+		{
+			return (size + TextureCache::TILE_SIZE - 1) / TextureCache::TILE_SIZE;
+		}
+
+		//Binary PPM (P6) with 8-bit channels, comments allowed in the header
+		bool ReadPPM(const std::string& filename, int& width, int& height, std::vector<uint8_t>& rgb)
+		{
+			std::ifstream file(filename, std::ios::binary);
+			if (!file)
+				return false;
+
+			const auto readToken = [&file]()
+			{
+				std::string token{};
+				while (file >> token && token[0] == '#')
+					file.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				return token;
+			};
+			if (readToken() != "P6")
+				return false;
+			width = std::atoi(readToken().c_str());
+			height = std::atoi(readToken().c_str());
+			const int maxValue{ std::atoi(readToken().c_str()) };
+			if (width <= 0 || height <= 0 || maxValue != 255)
+				return false;
+
+			//Exactly one whitespace character separates the header from the pixels
+			file.get();
+			rgb.resize(static_cast<size_t>(width) * height * 3);
+			file.read(reinterpret_cast<char*>(rgb.data()), static_cast<std::streamsize>(rgb.size()));
+			return static_cast<bool>(file);
+		}
+	}
+
+	TextureCache::TextureCache(size_t maxBytes)
+		: m_pShards{ std::make_unique<Shard[]>(NUM_SHARDS) }
+		, m_NumShardSlots{ static_cast<uint32_t>(std::max<size_t>(maxBytes / (NUM_SHARDS * TILE_BYTES), 4)) }
+	{
+		for (uint32_t shardIndex{}; shardIndex < NUM_SHARDS; ++shardIndex)
+		{
+			Shard& shard = m_pShards[shardIndex];
+			shard.slotKeys.resize(m_NumShardSlots);
+			shard.isReferenced.resize(m_NumShardSlots);
+			shard.slots.reserve(m_NumShardSlots);
+			//Slots get their memory on first use, a small scene doesn't pay for the whole budget
+		}
+	}
+
+	TextureCache::~TextureCache()
+	{
+		for (const std::unique_ptr<Texture>& pTexture : m_Textures)
+			std::fclose(pTexture->pFile);
+	}
+
+	uint32_t TextureCache::AddTexture(const std::string& filename, bool isSRGB)
+	{
+		constexpr const char* TILED_EXTENSION{ ".rttx" };
+		const bool isTiled{ filename.size() >= 5 && filename.compare(filename.size() - 5, 5, TILED_EXTENSION) == 0 };
+		const std::string tiledFilename{ isTiled ? filename : filename + TILED_EXTENSION };
+
+		const auto readHeader = [&tiledFilename](TiledHeader& header)
+		{
+			std::ifstream file(tiledFilename, std::ios::binary);
+			return file.read(reinterpret_cast<char*>(&header), sizeof(header)) &&
+				std::memcmp(header.magic, TILED_MAGIC, sizeof(TILED_MAGIC)) == 0 && header.version == TILED_VERSION && header.tileSize == TILE_SIZE;
+		};
+
+		//Convert when there's no up to date tiled file for this colour space yet
+		TiledHeader header{};
+		if (!isTiled)
+		{
+			std::error_code error{};
+			const bool isUpToDate{ std::filesystem::exists(tiledFilename, error) &&
+				std::filesystem::last_write_time(tiledFilename, error) >= std::filesystem::last_write_time(filename, error) && !error &&
+				readHeader(header) && header.isSRGB == static_cast<uint32_t>(isSRGB) };
+			if (!isUpToDate && !ConvertImage(filename, tiledFilename, isSRGB))
+				return INVALID_TEXTURE;
+		}
+		if (!readHeader(header))
+		{
+			std::cout << "Could not read tiled texture " << tiledFilename << "\n";
+			return INVALID_TEXTURE;
+		}
+
+		auto pTexture{ std::make_unique<Texture>() };
+		pTexture->isSRGB = header.isSRGB != 0;
+		pTexture->pFile = std::fopen(tiledFilename.c_str(), "rb");
+		if (!pTexture->pFile)
+			return INVALID_TEXTURE;
+
+		uint64_t offset{ sizeof(TiledHeader) };
+		for (const auto& [width, height] : GetLevelSizes(static_cast<int>(header.width), static_cast<int>(header.height)))
+		{
+			const Level level{ width, height, GetNumTiles(width), GetNumTiles(height), offset };
+			offset += static_cast<uint64_t>(level.tilesX) * level.tilesY * TILE_BYTES;
+			pTexture->levels.push_back(level);
+		}
+		if (pTexture->levels.size() != header.numLevels)
+		{
+			std::fclose(pTexture->pFile);
+			std::cout << tiledFilename << ": corrupt tiled texture\n";
+			return INVALID_TEXTURE;
+		}
+
+		m_Textures.push_back(std::move(pTexture));
+		return static_cast<uint32_t>(m_Textures.size() - 1);
+	}
+
+	bool TextureCache::ConvertImage(const std::string& imageFilename, const std::string& tiledFilename, bool isSRGB)
+	{
+		int width{}, height{};
+		std::vector<uint8_t> rgb{};
+		if (!ReadPPM(imageFilename, width, height, rgb))
+		{
+			std::cout << "Could not load texture " << imageFilename << " (binary 8-bit PPM expected)\n";
+			return false;
+		}
+
+		std::ofstream file(tiledFilename, std::ios::binary);
+		if (!file)
+		{
+			std::cout << "Could not create tiled texture " << tiledFilename << "\n";
+			return false;
+		}
+
+		const std::vector<std::pair<int, int>> levelSizes{ GetLevelSizes(width, height) };
+		TiledHeader header{};
+		std::memcpy(header.magic, TILED_MAGIC, sizeof(TILED_MAGIC));
+		header.version = TILED_VERSION;
+		header.width = static_cast<uint32_t>(width);
+		header.height = static_cast<uint32_t>(height);
+		header.numLevels = static_cast<uint32_t>(levelSizes.size());
+		header.tileSize = TILE_SIZE;
+		header.isSRGB = isSRGB;
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		//Mips are box filtered in linear space, so sRGB colours don't darken down the chain
+		const float* pToLinear{ GetSRGBToLinearTable() };
+		std::vector<float> level(rgb.size());
+		for (size_t idx{}; idx < rgb.size(); ++idx)
+			level[idx] = isSRGB ? pToLinear[rgb[idx]] : rgb[idx] / 255.f;
+
+		std::vector<uint8_t> tile(TILE_BYTES);
+		for (size_t levelIndex{}; levelIndex < levelSizes.size(); ++levelIndex)
+		{
+			const auto [levelWidth, levelHeight] = levelSizes[levelIndex];
+			if (levelIndex > 0)
+			{
+				const int previousWidth{ levelSizes[levelIndex - 1].first };
+				const int previousHeight{ levelSizes[levelIndex - 1].second };
+				std::vector<float> next(static_cast<size_t>(levelWidth) * levelHeight * 3);
+				for (int y{}; y < levelHeight; ++y)
+				{
+					for (int x{}; x < levelWidth; ++x)
+					{
+						//2x2 box, clamped where an odd size leaves a single row or column
+						const int x0{ std::min(2 * x, previousWidth - 1) }, x1{ std::min(2 * x + 1, previousWidth - 1) };
+						const int y0{ std::min(2 * y, previousHeight - 1) }, y1{ std::min(2 * y + 1, previousHeight - 1) };
+						for (int channel{}; channel < 3; ++channel)
+						{
+							next[(x + y * levelWidth) * 3 + channel] = 0.25f * (
+								level[(x0 + y0 * previousWidth) * 3 + channel] + level[(x1 + y0 * previousWidth) * 3 + channel] +
+								level[(x0 + y1 * previousWidth) * 3 + channel] + level[(x1 + y1 * previousWidth) * 3 + channel]);
+						}
+					}
+				}
+				level = std::move(next);
+			}
+
+			//Row by row of tiles, texels past the edge repeat the last row and column
+			for (int tileY{}; tileY < GetNumTiles(levelHeight); ++tileY)
+			{
+				for (int tileX{}; tileX < GetNumTiles(levelWidth); ++tileX)
+				{
+					for (int y{}; y < TILE_SIZE; ++y)
+					{
+						for (int x{}; x < TILE_SIZE; ++x)
+						{
+							const int sourceX{ std::min(tileX * TILE_SIZE + x, levelWidth - 1) };
+							const int sourceY{ std::min(tileY * TILE_SIZE + y, levelHeight - 1) };
+							const float* pSource{ &level[(sourceX + sourceY * levelWidth) * 3] };
+							uint8_t* pTexel{ &tile[GetMortonIndex(x, y) * 4] };
+							for (int channel{}; channel < 3; ++channel)
+							{
+								pTexel[channel] = isSRGB ? LinearToSRGB(pSource[channel]) :
+									static_cast<uint8_t>(std::clamp(pSource[channel], 0.f, 1.f) * 255.f + 0.5f);
+							}
+							pTexel[3] = 255;
+						}
+					}
+					file.write(reinterpret_cast<const char*>(tile.data()), static_cast<std::streamsize>(tile.size()));
+				}
+			}
+		}
+
+		if (!file)
+		{
+			std::cout << "Could not write tiled texture " << tiledFilename << "\n";
+			return false;
+		}
+		std::cout << "Converted " << imageFilename << " to " << tiledFilename << " (" << width << "x" << height << ", " << levelSizes.size() << " levels)\n";
+		return true;
+	}
+
+	ColorRGB TextureCache::Sample(uint32_t textureId, const Vector2& texcoord, float footprint) const
+	{
+		const Texture& texture = *m_Textures[textureId];
+		const uint32_t numLevels{ static_cast<uint32_t>(texture.levels.size()) };
+
+		//One texel of a level covers 2^level texels of the full resolution
+		const float size{ static_cast<float>(std::max(texture.levels[0].width, texture.levels[0].height)) };
+		const float lod{ footprint > 0.f ? std::clamp(std::log2(footprint * size), 0.f, static_cast<float>(numLevels - 1)) : 0.f };
+		const uint32_t level{ static_cast<uint32_t>(lod) };
+		const float blend{ lod - level };
+
+		ColorRGB color{ SampleBilinear(textureId, level, texcoord) };
+		if (blend > 0.f && level + 1 < numLevels)
+		{
+			const ColorRGB coarser{ SampleBilinear(textureId, level + 1, texcoord) };
+			color = color * (1.f - blend) + coarser * blend;
+		}
+		return color;
+	}
+
+	ColorRGB TextureCache::SampleBilinear(uint32_t textureId, uint32_t level, const Vector2& texcoord) const
+	{
+		const Level& levelInfo = m_Textures[textureId]->levels[level];
+		const float x{ (texcoord.x - std::floor(texcoord.x)) * levelInfo.width - 0.5f };
+		const float y{ (texcoord.y - std::floor(texcoord.y)) * levelInfo.height - 0.5f };
+		const float floorX{ std::floor(x) };
+		const float floorY{ std::floor(y) };
+		const float weightX{ x - floorX };
+		const float weightY{ y - floorY };
+
+		//Wrap around the edges, the texel left of column 0 is the last one
+		const int x0{ (static_cast<int>(floorX) + levelInfo.width) % levelInfo.width };
+		const int y0{ (static_cast<int>(floorY) + levelInfo.height) % levelInfo.height };
+		const int x1{ (x0 + 1) % levelInfo.width };
+		const int y1{ (y0 + 1) % levelInfo.height };
+
+		const int texelX[4]{ x0, x1, x0, x1 };
+		const int texelY[4]{ y0, y0, y1, y1 };
+		uint8_t texels[4][4]{};
+		FetchTexels(textureId, level, texelX, texelY, texels);
+
+		const float weights[4]{ (1.f - weightX) * (1.f - weightY), weightX * (1.f - weightY), (1.f - weightX) * weightY, weightX * weightY };
+		const float* pToLinear{ GetSRGBToLinearTable() };
+		const bool isSRGB{ m_Textures[textureId]->isSRGB };
+		ColorRGB color{};
+		for (int idx{}; idx < 4; ++idx)
+		{
+			const uint8_t* pTexel{ texels[idx] };
+			if (isSRGB)
+				color += ColorRGB{ pToLinear[pTexel[0]], pToLinear[pTexel[1]], pToLinear[pTexel[2]] } * weights[idx];
+			else
+				color += ColorRGB{ pTexel[0] / 255.f, pTexel[1] / 255.f, pTexel[2] / 255.f } * weights[idx];
+		}
+		return color;
+	}
+
+	void TextureCache::FetchTexels(uint32_t textureId, uint32_t level, const int (&x)[4], const int (&y)[4], uint8_t (&texels)[4][4]) const
+	{
+		const Texture& texture = *m_Textures[textureId];
+		bool isDone[4]{};
+		for (int first{}; first < 4; ++first)
+		{
+			if (isDone[first])
+				continue;
+
+			//Every texel of the same tile is copied under one lock, usually that is all four
+			const int tileX{ x[first] / TILE_SIZE };
+			const int tileY{ y[first] / TILE_SIZE };
+			const uint64_t key{ (uint64_t{ textureId } << 40) | (uint64_t{ level } << 32) | (static_cast<uint64_t>(tileY) << 16) | static_cast<uint64_t>(tileX) };
+			Shard& shard = m_pShards[HashUint(static_cast<uint32_t>(key ^ (key >> 29))) % NUM_SHARDS];
+
+			const std::lock_guard lock{ shard.mutex };
+			const uint8_t* pTile{ GetTile(shard, key, texture, level, tileX, tileY) };
+			for (int idx{ first }; idx < 4; ++idx)
+			{
+				if (isDone[idx] || x[idx] / TILE_SIZE != tileX || y[idx] / TILE_SIZE != tileY)
+					continue;
+				std::memcpy(texels[idx], pTile + GetMortonIndex(x[idx] % TILE_SIZE, y[idx] % TILE_SIZE) * 4, 4);
+				isDone[idx] = true;
+			}
+		}
+	}
+
+	const uint8_t* TextureCache::GetTile(Shard& shard, uint64_t key, const Texture& texture, uint32_t level, int tileX, int tileY) const
+	{
+		const auto it = shard.slots.find(key);
+		if (it != shard.slots.end())
+		{
+			shard.isReferenced[it->second] = 1;
+			return &shard.texels[it->second * TILE_BYTES];
+		}
+
+		//Free slot while the budget lasts, then the clock: the first slot not referenced since the hand last passed it
+		uint32_t slot{};
+		if (shard.numUsedSlots < m_NumShardSlots)
+		{
+			slot = shard.numUsedSlots++;
+			shard.texels.resize(shard.numUsedSlots * TILE_BYTES);
+		}
+		else
+		{
+			while (shard.isReferenced[shard.clockHand])
+			{
+				shard.isReferenced[shard.clockHand] = 0;
+				shard.clockHand = (shard.clockHand + 1) % m_NumShardSlots;
+			}
+			slot = shard.clockHand;
+			shard.clockHand = (shard.clockHand + 1) % m_NumShardSlots;
+			shard.slots.erase(shard.slotKeys[slot]);
+		}
+
+		uint8_t* pTile{ &shard.texels[slot * TILE_BYTES] };
+		const Level& levelInfo = texture.levels[level];
+		const uint64_t offset{ levelInfo.firstTileOffset + (static_cast<uint64_t>(tileY) * levelInfo.tilesX + tileX) * TILE_BYTES };
+		{
+			const std::lock_guard fileLock{ texture.fileMutex };
+			const bool isRead{ std::fseek(texture.pFile, static_cast<long>(offset), SEEK_SET) == 0 &&
+				std::fread(pTile, 1, TILE_BYTES, texture.pFile) == TILE_BYTES };
+			//A truncated file shows up as black instead of taking the render down
+			if (!isRead)
+				std::memset(pTile, 0, TILE_BYTES);
+		}
+		m_NumTileLoads.fetch_add(1, std::memory_order_relaxed);
+
+		shard.slots.emplace(key, slot);
+		shard.slotKeys[slot] = key;
+		shard.isReferenced[slot] = 1;
+		return pTile;
+	}
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Math.h"
+
+namespace dae
+{
+	//Textures of the materials, sampled through a fixed size cache of tiles so only what rays actually touch is in memory
+	//Images are converted once into a tiled mip chain (.rttx next to the image, rebuilt when the image is newer):
+	//tiles of TILE_SIZE x TILE_SIZE RGBA8 texels, Morton ordered inside the tile so a bilinear footprint shares cache lines
+	//Tiles are read from that file when a sample misses and evicted with the clock algorithm once the budget is used up
+	class TextureCache final
+	{
+	public:
+		static constexpr uint32_t INVALID_TEXTURE{ UINT32_MAX };
+		static constexpr int TILE_SIZE{ 16 };
+		static constexpr size_t TILE_BYTES{ TILE_SIZE * TILE_SIZE * 4 };
+		static constexpr size_t DEFAULT_MAX_BYTES{ size_t{ 64 } << 20 };
+
+		explicit TextureCache(size_t maxBytes = DEFAULT_MAX_BYTES);
+		~TextureCache();
+
+		TextureCache(const TextureCache&) = delete;
+		TextureCache(TextureCache&&) noexcept = delete;
+		TextureCache& operator=(const TextureCache&) = delete;
+		TextureCache& operator=(TextureCache&&) noexcept = delete;
+
+		//Opens a binary PPM image (converted to .rttx first when needed) or a .rttx file, INVALID_TEXTURE if that fails
+		//sRGB textures (colours) are sampled as linear values, linear ones (roughness, masks) as stored
+		uint32_t AddTexture(const std::string& filename, bool isSRGB);
+
+		//Trilinear sample, texture coordinates wrap around
+		//footprint is the width the sample covers in texture coordinate units (HitRecord::texcoordFootprint), 0 samples the full resolution
+		ColorRGB Sample(uint32_t textureId, const Vector2& texcoord, float footprint) const;
+
+		size_t GetMaxBytes() const { return m_NumShardSlots * NUM_SHARDS * TILE_BYTES; }
+		uint64_t GetNumTileLoads() const { return m_NumTileLoads.load(std::memory_order_relaxed); }
+
+		//Writes the tiled mip chain of a binary PPM image, sRGB images are filtered in linear space
+		static bool ConvertImage(const std::string& imageFilename, const std::string& tiledFilename, bool isSRGB);
+
+	private:
+		//Lock striping, samples of different tiles rarely wait on each other
+		static constexpr uint32_t NUM_SHARDS{ 16 };
+
+		struct Level
+		{
+			int width{};
+			int height{};
+			int tilesX{};
+			int tilesY{};
+			uint64_t firstTileOffset{}; //in the .rttx file
+		};
+
+		struct Texture
+		{
+			std::FILE* pFile{};
+			mutable std::mutex fileMutex{};
+			std::vector<Level> levels{};
+			bool isSRGB{};
+		};
+
+		struct Shard
+		{
+			std::mutex mutex{};
+			std::unordered_map<uint64_t, uint32_t> slots{}; //tile key > slot
+			std::vector<uint64_t> slotKeys{};
+			std::vector<uint8_t> isReferenced{}; //second chance bits of the clock
+			std::vector<uint8_t> texels{};
+			uint32_t numUsedSlots{};
+			uint32_t clockHand{};
+		};
+
+		//Texels (x[i], y[i]) of a level as RGBA8, loads the tiles they're in when needed
+		void FetchTexels(uint32_t textureId, uint32_t level, const int (&x)[4], const int (&y)[4], uint8_t (&texels)[4][4]) const;
+		//Resident copy of a tile, shard.mutex has to be held
+		const uint8_t* GetTile(Shard& shard, uint64_t key, const Texture& texture, uint32_t level, int tileX, int tileY) const;
+		ColorRGB SampleBilinear(uint32_t textureId, uint32_t level, const Vector2& texcoord) const;
+
+		std::vector<std::unique_ptr<Texture>> m_Textures{};
+		std::unique_ptr<Shard[]> m_pShards{};
+		uint32_t m_NumShardSlots{};
+		mutable std::atomic<uint64_t> m_NumTileLoads{};
+	};
+}
@@ -1,42 +1,56 @@
 #include "Timer.h"
 
-#include <iostream>
+#include <algorithm>
+#include <cfloat>
 #include <numeric>
 
 #include <iostream>
 #include <fstream>
 
-#include "SDL.h"
 using namespace dae;
 
+namespace
+{
+	float ToSeconds(std::chrono::steady_clock::duration duration)
+	{
+		return std::chrono::duration<float>(duration).count();
+	}
+}
+
 Timer::Timer()
 {
-	const uint64_t countsPerSecond = SDL_GetPerformanceFrequency();
-	m_SecondsPerCount = 1.0f / static_cast<float>(countsPerSecond);
+	const auto currentTime = Clock::now();
+	m_BaseTime = currentTime;
+	m_PreviousTime = currentTime;
 }
 
 void Timer::Reset()
 {
-	const uint64_t currentTime = SDL_GetPerformanceCounter();
+	const auto currentTime = Clock::now();
 
 	m_BaseTime = currentTime;
 	m_PreviousTime = currentTime;
-	m_StopTime = 0;
+	m_PausedTime = {};
+	m_StopTime = {};
 	m_FPSTimer = 0.0f;
 	m_FPSCount = 0;
+	m_FixedStepCount = 0;
 	m_IsStopped = false;
 }
 
 void Timer::Start()
 {
-	const uint64_t startTime = SDL_GetPerformanceCounter();
+	const auto startTime = Clock::now();
 
 	if (m_IsStopped)
 	{
-		m_PausedTime += (startTime - m_StopTime);
+		if (m_StopTime != Clock::time_point{})
+			m_PausedTime += startTime - m_StopTime;
+		else
+			m_BaseTime = startTime;
 
 		m_PreviousTime = startTime;
-		m_StopTime = 0;
+		m_StopTime = {};
 		m_IsStopped = false;
 	}
 }
@@ -70,28 +84,36 @@ void Timer::Update()
 	{
 		m_FPS = 0;
 		m_ElapsedTime = 0.0f;
-		m_TotalTime = (float)(((m_StopTime - m_PausedTime) - m_BaseTime) * m_BaseTime);
+		m_FrameDuration = 0.0f;
+		if (!IsFixedTimeStep())
+			m_TotalTime = ToSeconds((m_StopTime - m_PausedTime) - m_BaseTime);
 		return;
 	}
 
-	const uint64_t currentTime = SDL_GetPerformanceCounter();
-	m_CurrentTime = currentTime;
+	m_CurrentTime = Clock::now();
 
-	m_ElapsedTime = (float)((m_CurrentTime - m_PreviousTime) * m_SecondsPerCount);
+	m_FrameDuration = std::max(ToSeconds(m_CurrentTime - m_PreviousTime), 0.0f);
 	m_PreviousTime = m_CurrentTime;
 
-	if (m_ElapsedTime < 0.0f)
-		m_ElapsedTime = 0.0f;
-
-	if (m_ForceElapsedUpperBound && m_ElapsedTime > m_ElapsedUpperBound)
+	if (IsFixedTimeStep())
 	{
-		m_ElapsedTime = m_ElapsedUpperBound;
+		//The scene sees the same times every run however long a frame took
+		m_ElapsedTime = m_FixedTimeStep;
+		m_TotalTime = ++m_FixedStepCount * m_FixedTimeStep;
 	}
+	else
+	{
+		m_ElapsedTime = m_FrameDuration;
+		if (m_ForceElapsedUpperBound && m_ElapsedTime > m_ElapsedUpperBound)
+		{
+			m_ElapsedTime = m_ElapsedUpperBound;
+		}
 
-	m_TotalTime = (float)(((m_CurrentTime - m_PausedTime) - m_BaseTime) * m_SecondsPerCount);
+		m_TotalTime = ToSeconds((m_CurrentTime - m_PausedTime) - m_BaseTime);
+	}
 
-	//FPS LOGIC
-	m_FPSTimer += m_ElapsedTime;
+	//FPS LOGIC, always wall clock
+	m_FPSTimer += m_FrameDuration;
 	++m_FPSCount;
 	if (m_FPSTimer >= 1.0f)
 	{
@@ -135,9 +157,7 @@ void Timer::Stop()
 {
 	if (!m_IsStopped)
 	{
-		const uint64_t currentTime = SDL_GetPerformanceCounter();
-
-		m_StopTime = currentTime;
+		m_StopTime = Clock::now();
 		m_IsStopped = true;
 	}
 }
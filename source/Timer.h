@@ -1,6 +1,7 @@
 #pragma once
 
 //Standard includes
+#include <chrono>
 #include <cstdint>
 #include <vector>
 
@@ -18,24 +19,33 @@ namespace dae
 		Timer& operator=(Timer&&) noexcept = delete;
 
 		void StartBenchmark(int numFrames = 10);
+		//Every Update advances the simulated time by exactly seconds instead of the measured time, 0 goes back to real time
+		//The scene then sees the same times every run, so animated benchmarks trace the same rays
+		void SetFixedTimeStep(float seconds) { m_FixedTimeStep = seconds; }
+		bool IsFixedTimeStep() const { return m_FixedTimeStep > 0.0f; }
 
 		void Reset();
 		void Start();
 		void Update();
 		void Stop();
 
+		//FPS and frame durations are wall clock, also with a fixed time step
 		uint32_t GetFPS() const { return m_FPS; };
 		float GetdFPS() const { return m_dFPS; };
+		float GetFrameDuration() const { return m_FrameDuration; };
+		//Simulated time the scene animates with
 		float GetElapsed() const { return m_ElapsedTime; };
 		float GetTotal() const { return m_TotalTime; };
 		bool IsRunning() const { return !m_IsStopped; };
 
 	private:
-		uint64_t m_BaseTime = 0;
-		uint64_t m_PausedTime = 0;
-		uint64_t m_StopTime = 0;
-		uint64_t m_PreviousTime = 0;
-		uint64_t m_CurrentTime = 0;
+		using Clock = std::chrono::steady_clock;
+
+		Clock::time_point m_BaseTime{};
+		Clock::duration m_PausedTime{};
+		Clock::time_point m_StopTime{};
+		Clock::time_point m_PreviousTime{};
+		Clock::time_point m_CurrentTime{};
 
 		uint32_t m_FPS = 0;
 		float m_dFPS = 0.0f;
@@ -43,9 +53,11 @@ namespace dae
 
 		float m_TotalTime = 0.0f;
 		float m_ElapsedTime = 0.0f;
-		float m_SecondsPerCount = 0.0f;
+		float m_FrameDuration = 0.0f;
 		float m_ElapsedUpperBound = 0.03f;
 		float m_FPSTimer = 0.0f;
+		float m_FixedTimeStep = 0.0f;
+		uint32_t m_FixedStepCount = 0;
 
 		bool m_IsStopped = true;
 		bool m_ForceElapsedUpperBound = false;
@@ -1,8 +1,14 @@
 #pragma once
 #include <cassert>
+#include <cstdlib>
 #include <fstream>
+#include <span>
+#include <sstream>
+#include <string>
+#include <unordered_map>
 #include "Math.h"
 #include "DataTypes.h"
+#include "RayStats.h"
 
 namespace dae
 {
@@ -10,25 +16,32 @@ namespace dae
 	{
 #pragma region Sphere HitTest
 		//SPHERE HIT-TESTS
-		inline bool HitTest_Sphere_Geometric(const Sphere& sphere, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
-		{           
+		//The Intersect_* tests only find t (and barycentrics for triangles), ResolveHit_* fills in the hit record once the closest hit is known
+		//Fills in the hit record of a sphere hit at distance t
+		inline void ResolveHit_Sphere(const Sphere& sphere, const Ray& ray, float t, HitRecord& hitRecord)
+		{
+			hitRecord.didHit = true;
+			hitRecord.t = t;
+			hitRecord.origin = ray.origin + t * ray.direction;
+			hitRecord.materialIndex = sphere.materialIndex;
+			hitRecord.normal = (hitRecord.origin - sphere.origin).Normalized();
+			hitRecord.texcoord = {};
+			hitRecord.texcoordFootprint = 0.f;
+		}
+
+		inline bool Intersect_Sphere_Geometric(const Sphere& sphere, const Ray& ray, float& t)
+		{
+			RAY_STAT(SphereTests);
 			const Vector3 L{ sphere.origin - ray.origin };
 			const float dp{ Vector3::Dot(L,ray.direction) };
 			const float od_squared{ L.SqrMagnitude() - (dp*dp) };
 
 			if (od_squared < (sphere.radius * sphere.radius) )
 			{
-				float t{ dp - sqrtf(Square(sphere.radius) - od_squared) };
-				if (t > ray.min && t < ray.max)
+				const float hitT{ dp - sqrtf(Square(sphere.radius) - od_squared) };
+				if (hitT > ray.min && hitT < ray.max)
 				{
-					if (!ignoreHitRecord)
-					{
-						hitRecord.didHit = true;
-						hitRecord.t = t;
-						hitRecord.origin = ray.origin + hitRecord.t * ray.direction;
-						hitRecord.materialIndex = sphere.materialIndex;
-						hitRecord.normal = (hitRecord.origin - sphere.origin).Normalized();
-					}
+					t = hitT;
 					return true;
 				}
 			}
@@ -36,80 +49,100 @@ namespace dae
 			return false;
 		}
 
+		inline bool HitTest_Sphere_Geometric(const Sphere& sphere, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		{           
+			float t{};
+			if (!Intersect_Sphere_Geometric(sphere, ray, t))
+				return false;
+
+			if (!ignoreHitRecord)
+				ResolveHit_Sphere(sphere, ray, t, hitRecord);
+			return true;
+		}
+
 		inline bool HitTest_Sphere_Geometric(const Sphere& sphere, const Ray& ray)
 		{
-			HitRecord temp{};
-			return HitTest_Sphere_Geometric(sphere, ray, temp, true);
+			float t{};
+			return Intersect_Sphere_Geometric(sphere, ray, t);
 		}
-		inline bool HitTest_Sphere_Analytical(const Sphere& sphere, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
-		{            
+
+		inline bool Intersect_Sphere_Analytical(const Sphere& sphere, const Ray& ray, float& t)
+		{
+			RAY_STAT(SphereTests);
+			const Vector3 originToCenter{ ray.origin - sphere.origin };
 			float	A{ Vector3::Dot(ray.direction,ray.direction) },
-					B{ Vector3::Dot(2 * ray.direction,(ray.origin - sphere.origin)) },
-					C{ Vector3::Dot((ray.origin - sphere.origin),(ray.origin - sphere.origin)) - Square(sphere.radius) },
+					B{ 2.f * Vector3::Dot(ray.direction,originToCenter) },
+					C{ Vector3::Dot(originToCenter,originToCenter) - Square(sphere.radius) },
 					D{ Square(B) - 4 * A * C };
 
-			float	t_0{ (-B - sqrtf(D)) / (2 * A) };
-
-			Vector3 hitPoint{};
-			Vector3 hitNormal{};
+			if (D <= 0)
+				return false;
 
-			if (D > 0)
+			//Near root first, the far one when the ray starts inside the sphere
+			const float sqrtD{ sqrtf(D) };
+			float hitT{ (-B - sqrtD) / (2 * A) };
+			if (hitT <= ray.min || hitT >= ray.max)
 			{
-				hitRecord.didHit = true;
-				if (t_0 > ray.min && t_0 < ray.max)
-				{
-					hitRecord.t = t_0;
-					hitRecord.origin = ray.origin + t_0 * ray.direction;
-					hitPoint = ray.origin + t_0 * ray.direction;
-					hitNormal = hitPoint - sphere.origin;
-					hitRecord.normal = hitNormal.Normalized();
-					hitRecord.materialIndex = sphere.materialIndex;
-					return true;
-				}
-				else
-				{
-					float t_1{ (-B + sqrtf(D)) / (2 * A) };
-					if (t_1 > ray.min && t_1 < ray.max)
-					{
-						hitRecord.t = t_1;
-						hitRecord.origin = ray.origin + t_1 * ray.direction;
-						hitPoint = ray.origin + t_1 * ray.direction;
-						hitNormal = hitPoint - sphere.origin;
-						hitRecord.normal = hitNormal.Normalized();
-						hitRecord.materialIndex = sphere.materialIndex;
-						return true;
-					}
-				}
+				hitT = (-B + sqrtD) / (2 * A);
+				if (hitT <= ray.min || hitT >= ray.max)
+					return false;
 			}
-			else
-			{
-				hitRecord.didHit = false;
+
+			t = hitT;
+			return true;
+		}
+
+		inline bool HitTest_Sphere_Analytical(const Sphere& sphere, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		{            
+			float t{};
+			if (!Intersect_Sphere_Analytical(sphere, ray, t))
 				return false;
-			}
-		
+
+			if (!ignoreHitRecord)
+				ResolveHit_Sphere(sphere, ray, t, hitRecord);
+			return true;
 		}
 
 		inline bool HitTest_Sphere_Analytical(const Sphere& sphere, const Ray& ray)
 		{
-			HitRecord temp{};
-			return HitTest_Sphere_Analytical(sphere, ray, temp, true);
+			float t{};
+			return Intersect_Sphere_Analytical(sphere, ray, t);
 		}
 #pragma endregion
 #pragma region Plane HitTest
 		//PLANE HIT-TESTS
-		inline bool HitTest_Plane(const Plane& plane, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		inline void ResolveHit_Plane(const Plane& plane, const Ray& ray, float t, HitRecord& hitRecord)
+		{
+			hitRecord.didHit = true;
+			hitRecord.materialIndex = plane.materialIndex;
+			hitRecord.normal = plane.normal;
+			hitRecord.origin = ray.origin + t * ray.direction;
+			hitRecord.t = t;
+			hitRecord.texcoord = {};
+			hitRecord.texcoordFootprint = 0.f;
+		}
+
+		inline bool Intersect_Plane(const Plane& plane, const Ray& ray, float& t)
 		{
+			RAY_STAT(PlaneTests);
 			//todo W1 DONE
-			float t{ Vector3::Dot((plane.origin - ray.origin),plane.normal) / Vector3::Dot(ray.direction,plane.normal)};
-			if (t > ray.min && t < ray.max)
+			const float hitT{ Vector3::Dot((plane.origin - ray.origin),plane.normal) / Vector3::Dot(ray.direction,plane.normal)};
+			if (hitT > ray.min && hitT < ray.max)
 			{
-				hitRecord.didHit = true;
-				hitRecord.materialIndex = plane.materialIndex;
-				hitRecord.normal = plane.normal;
-				hitRecord.origin = ray.origin + t * ray.direction;
-				hitRecord.t = t;
+				t = hitT;
 				return true;
+			}
+			return false;
+		}
 
+		inline bool HitTest_Plane(const Plane& plane, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		{
+			float t{};
+			if (Intersect_Plane(plane, ray, t))
+			{
+				if (!ignoreHitRecord)
+					ResolveHit_Plane(plane, ray, t, hitRecord);
+				return true;
 			}
 			hitRecord.didHit = false;
 			return false;
@@ -117,70 +150,77 @@ namespace dae
 
 		inline bool HitTest_Plane(const Plane& plane, const Ray& ray)
 		{
-			HitRecord temp{};
-			return HitTest_Plane(plane, ray, temp, true);
+			float t{};
+			return Intersect_Plane(plane, ray, t);
 		}
 #pragma endregion
 #pragma region Triangle HitTest
 		//TRIANGLE HIT-TESTS
-		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		//isShadowRay flips the culling mode, shadow rays test the side facing away from the camera ray
+		//u and v are the barycentric weights of v1 and v2
+		inline bool Intersect_Triangle(const Vector3& v0, const Vector3& v1, const Vector3& v2, const Vector3& normal, TriangleCullMode cullMode,
+			const Ray& ray, bool isShadowRay, float& t, float& u, float& v)
 		{
-			const float dot{ Vector3::Dot(ray.direction,triangle.normal) };
+			RAY_STAT(TriangleTests);
+			const float dot{ Vector3::Dot(ray.direction,normal) };
 
 			//check culling mode first for potential early exit
-			if (triangle.cullMode == TriangleCullMode::BackFaceCulling)
+			if (cullMode == TriangleCullMode::BackFaceCulling)
 			{
-				if ((!ignoreHitRecord && dot > 0.f) || (ignoreHitRecord && dot < 0.f))
+				if ((!isShadowRay && dot > 0.f) || (isShadowRay && dot < 0.f))
 				{
 					return false;
 				}
 			}
-			if (triangle.cullMode == TriangleCullMode::FrontFaceCulling)
+			if (cullMode == TriangleCullMode::FrontFaceCulling)
 			{
-				if ((ignoreHitRecord && dot > 0.f) || (!ignoreHitRecord && dot < 0.f))
+				if ((isShadowRay && dot > 0.f) || (!isShadowRay && dot < 0.f))
 				{
 					return false;
 				}
 			}
 
 			//check if we hit the plane the triangle lives in
-			if (dot != 0.f)
-			{
-				const Vector3 L{ triangle.v0 - ray.origin}; //any point in the triangle-plane suffices
-				const float t{Vector3::Dot(L, triangle.normal) / Vector3::Dot(ray.direction, triangle.normal)};
-				if (t > ray.min && t < ray.max)
-				{
-					const Vector3 p {ray.origin + t * ray.direction};
+			if (dot == 0.f)
+				return false;
 
-					//check if we hit the triangle
-					Vector3 edge {triangle.v1 - triangle.v0};
-					Vector3 pointToSide{ p - triangle.v0 };
+			const Vector3 L{ v0 - ray.origin}; //any point in the triangle-plane suffices
+			const float hitT{Vector3::Dot(L, normal) / dot};
+			if (!(hitT > ray.min && hitT < ray.max))
+				return false;
 
-					//First edge check
-					if (Vector3::Dot(triangle.normal,Vector3::Cross(edge,pointToSide)) > 0.f)
-					{
-						edge = triangle.v2 - triangle.v1;
-						pointToSide =  p - triangle.v1;
-						//Second edge check
-						if (Vector3::Dot(triangle.normal, Vector3::Cross(edge, pointToSide)) > 0.f)
-						{
-							edge = triangle.v0 - triangle.v2;
-							pointToSide = p - triangle.v2;
-							//Third edge check
-							if (Vector3::Dot(triangle.normal, Vector3::Cross(edge, pointToSide)) > 0.f)
-							{
-								hitRecord.didHit = true;
-								hitRecord.normal = triangle.normal;
-								hitRecord.materialIndex = triangle.materialIndex;
-								hitRecord.origin = p;
-								hitRecord.t = t;
-								return true;
-							}
-						}
-					}
-				}
-			}
-			return false;
+			const Vector3 p {ray.origin + hitT * ray.direction};
+
+			//check if we hit the triangle, each edge test is twice the area of the sub-triangle opposite a vertex (written so NaNs fail)
+			const float w2{ Vector3::Dot(normal, Vector3::Cross(v1 - v0, p - v0)) };
+			if (!(w2 > 0.f))
+				return false;
+			const float w0{ Vector3::Dot(normal, Vector3::Cross(v2 - v1, p - v1)) };
+			if (!(w0 > 0.f))
+				return false;
+			const float w1{ Vector3::Dot(normal, Vector3::Cross(v0 - v2, p - v2)) };
+			if (!(w1 > 0.f))
+				return false;
+
+			const float invTotal{ 1.f / (w0 + w1 + w2) };
+			t = hitT;
+			u = w1 * invTotal;
+			v = w2 * invTotal;
+			return true;
+		}
+
+		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		{
+			float t{}, u{}, v{};
+			if (!Intersect_Triangle(triangle.v0, triangle.v1, triangle.v2, triangle.normal, triangle.cullMode, ray, ignoreHitRecord, t, u, v))
+				return false;
+
+			hitRecord.didHit = true;
+			hitRecord.normal = triangle.normal;
+			hitRecord.materialIndex = triangle.materialIndex;
+			hitRecord.origin = ray.origin + t * ray.direction;
+			hitRecord.t = t;
+			return true;
 		}
 
 		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray)
@@ -192,6 +232,7 @@ namespace dae
 #pragma region TriangeMesh HitTest
 		inline bool SlabTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray)
 		{
+			RAY_STAT(AABBTests);
 			float tx1 = (mesh.transformedMinAABB.x - ray.origin.x) / ray.direction.x;
 			float tx2 = (mesh.transformedMaxAABB.x - ray.origin.x) / ray.direction.x;
 
@@ -213,7 +254,67 @@ namespace dae
 			return tmax > 0 && tmax >= tmin;
 		}
 
-		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		//Fills in the hit record of triangle triangleIndex of the mesh's active LOD
+		//u and v are the barycentric weights of the second and third vertex
+		inline void ResolveHit_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, float t, uint32_t triangleIndex, float u, float v, HitRecord& hitRecord)
+		{
+			const TriangleMeshLOD* pLOD = mesh.GetActiveLOD();
+			const std::vector<Vector3>& transformedNormals = pLOD ? pLOD->transformedNormals : mesh.transformedNormals;
+			const std::vector<Vector3>& transformedVertexNormals = pLOD ? pLOD->transformedVertexNormals : mesh.transformedVertexNormals;
+			const std::vector<Vector2>& texcoords = pLOD ? pLOD->texcoords : mesh.texcoords;
+
+			hitRecord.didHit = true;
+			hitRecord.normal = transformedNormals[triangleIndex];
+			hitRecord.materialIndex = mesh.materialIndex;
+			hitRecord.origin = ray.origin + t * ray.direction;
+			hitRecord.t = t;
+			hitRecord.texcoord = {};
+			hitRecord.texcoordFootprint = 0.f;
+			if (texcoords.empty() && transformedVertexNormals.empty())
+				return;
+
+			const std::vector<int>& indices = pLOD ? pLOD->indices : mesh.indices;
+			const int i0{ indices[3 * triangleIndex] };
+			const int i1{ indices[3 * triangleIndex + 1] };
+			const int i2{ indices[3 * triangleIndex + 2] };
+
+			const std::vector<Vector3>& transformedPositions = pLOD ? pLOD->transformedPositions : mesh.transformedPositions;
+
+			//Smooth shading, falls back to the face normal where the vertex normals cancel out
+			if (!transformedVertexNormals.empty())
+			{
+				const Vector3& n0 = transformedVertexNormals[i0];
+				const Vector3& n1 = transformedVertexNormals[i1];
+				const Vector3& n2 = transformedVertexNormals[i2];
+				const float w{ 1.f - u - v };
+				const Vector3 normal{ n0 * w + n1 * u + n2 * v };
+				const float sqrMagnitude{ normal.SqrMagnitude() };
+				if (sqrMagnitude > 1e-12f)
+					hitRecord.normal = normal / std::sqrt(sqrMagnitude);
+
+				//Shadow terminator (Hanika 2021): the flat triangle lies below the smooth surface the normals describe,
+				//so shadow rays from it get caught by the neighbouring triangles. Lifting the point onto the vertices' tangent planes avoids that
+				const float lift0{ std::min(0.f, Vector3::Dot(hitRecord.origin - transformedPositions[i0], n0)) };
+				const float lift1{ std::min(0.f, Vector3::Dot(hitRecord.origin - transformedPositions[i1], n1)) };
+				const float lift2{ std::min(0.f, Vector3::Dot(hitRecord.origin - transformedPositions[i2], n2)) };
+				hitRecord.origin -= n0 * (w * lift0) + n1 * (u * lift1) + n2 * (v * lift2);
+			}
+			if (texcoords.empty())
+				return;
+
+			hitRecord.texcoord = texcoords[i0] * (1.f - u - v) + texcoords[i1] * u + texcoords[i2] * v;
+
+			//The cone footprint scaled from world to texture coordinate units by the triangle's uv/world area ratio
+			//and stretched by the grazing angle
+			const float worldArea{ Vector3::Cross(transformedPositions[i1] - transformedPositions[i0], transformedPositions[i2] - transformedPositions[i0]).Magnitude() };
+			const float texcoordArea{ std::abs(Vector2::Cross(texcoords[i1] - texcoords[i0], texcoords[i2] - texcoords[i0])) };
+			const float cosine{ std::max(std::abs(Vector3::Dot(transformedNormals[triangleIndex], ray.direction)), 0.01f) };
+			const float coneWidth{ ray.coneWidth + t * ray.coneSpread };
+			hitRecord.texcoordFootprint = worldArea > 0.f ? coneWidth / cosine * std::sqrt(texcoordArea / worldArea) : 0.f;
+		}
+
+		//Closest triangle in (ray.min, ray.max), shadow rays stop at the first one they find
+		inline bool Intersect_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, bool isShadowRay, float& t, uint32_t& triangleIndex, float& u, float& v)
 		{
 			//Slabtest
 			if (!SlabTest_TriangleMesh(mesh,ray))
@@ -221,45 +322,168 @@ namespace dae
 				return false;
 			}
 
-			
-			Triangle triangle{};
-			const int amountOfTriangles = mesh.normals.size();
+			//The level of detail picked for this frame
+			const TriangleMeshLOD* pLOD = mesh.GetActiveLOD();
+			const std::vector<Vector3>& transformedPositions = pLOD ? pLOD->transformedPositions : mesh.transformedPositions;
+			const std::vector<Vector3>& transformedNormals = pLOD ? pLOD->transformedNormals : mesh.transformedNormals;
+			const std::vector<int>& indices = pLOD ? pLOD->indices : mesh.indices;
+			const BVH& bvh = pLOD ? pLOD->bvh : mesh.bvh;
+
+			const uint32_t amountOfTriangles = static_cast<uint32_t>(transformedNormals.size());
+			//Shrinks with every hit so later triangles only count when they are closer
+			Ray clippedRay{ ray };
+			bool didHit{};
+			const auto testTriangle = [&](uint32_t index)
+			{
+				float hitT{}, hitU{}, hitV{};
+				if (!Intersect_Triangle(transformedPositions[indices[3 * index]], transformedPositions[indices[3 * index + 1]], transformedPositions[indices[3 * index + 2]],
+					transformedNormals[index], mesh.cullMode, clippedRay, isShadowRay, hitT, hitU, hitV))
+				{
+					return false;
+				}
 
-			triangle.cullMode		= mesh.cullMode;
-			triangle.materialIndex	= mesh.materialIndex;
-			float distance{ FLT_MAX };
-			HitRecord tempHitRecord{};
+				didHit = true;
+				t = hitT;
+				triangleIndex = index;
+				u = hitU;
+				v = hitV;
+				clippedRay.max = hitT;
+				return isShadowRay;
+			};
 
-			for (size_t index = 0; index < amountOfTriangles; ++index)
+			if (!bvh.IsEmpty())
 			{
-				triangle.v0				= mesh.transformedPositions[mesh.indices[3 * index]];
-				triangle.v1				= mesh.transformedPositions[mesh.indices[3 * index + 1]];
-				triangle.v2				= mesh.transformedPositions[mesh.indices[3 * index + 2]];
-				triangle.normal			= mesh.transformedNormals[index];
-
-				if (HitTest_Triangle(triangle, ray, tempHitRecord, ignoreHitRecord))
+				//Only the leaves the ray reaches, front to back, distance culls the rest once something is hit
+				const std::vector<uint32_t>& triangleIndices = bvh.GetTriangleIndices();
+				bvh.Traverse(ray.origin, ray.direction, ray.min, clippedRay.max, [&](uint32_t first, uint32_t count)
 				{
-					if (ignoreHitRecord)
+					for (uint32_t idx{ first }; idx < first + count; ++idx)
 					{
-						return true;
+						if (testTriangle(triangleIndices[idx]))
+							return true;
 					}
-					if (tempHitRecord.didHit && tempHitRecord.t < distance)
-					{
-						distance = tempHitRecord.t;
-						hitRecord = tempHitRecord;
-					}
-				}
+					return false;
+				});
+				return didHit;
+			}
 
+			for (uint32_t index{}; index < amountOfTriangles; ++index)
+			{
+				if (testTriangle(index))
+					return true;
 			}
-			return hitRecord.didHit;
+			return didHit;
+		}
+
+		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		{
+			float t{}, u{}, v{};
+			uint32_t triangleIndex{};
+			if (!Intersect_TriangleMesh(mesh, ray, ignoreHitRecord, t, triangleIndex, u, v))
+				return false;
+
+			if (!ignoreHitRecord)
+				ResolveHit_TriangleMesh(mesh, ray, t, triangleIndex, u, v, hitRecord);
+			return true;
 		}
 
 		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray)
 		{
-			HitRecord temp{};
-			return HitTest_TriangleMesh(mesh, ray, temp, true);
+			float t{}, u{}, v{};
+			uint32_t triangleIndex{};
+			return Intersect_TriangleMesh(mesh, ray, true, t, triangleIndex, u, v);
 		}
 
+		//Largest number of shadow rays Occluded_TriangleMesh takes at once
+		constexpr size_t MAX_SHADOW_BUNDLE_SIZE{ 64 };
+
+		//Shadow rays towards one point light tested together, isOccluded is set for the rays the mesh blocks
+		//BVH nodes are culled for the whole bundle with interval arithmetic, the leaves that survive are tested ray by ray
+		inline void Occluded_TriangleMesh(const TriangleMesh& mesh, std::span<const Ray> rays, std::span<uint8_t> isOccluded)
+		{
+			assert(rays.size() <= MAX_SHADOW_BUNDLE_SIZE && rays.size() == isOccluded.size());
+
+			const TriangleMeshLOD* pLOD = mesh.GetActiveLOD();
+			const std::vector<Vector3>& transformedPositions = pLOD ? pLOD->transformedPositions : mesh.transformedPositions;
+			const std::vector<Vector3>& transformedNormals = pLOD ? pLOD->transformedNormals : mesh.transformedNormals;
+			const std::vector<int>& indices = pLOD ? pLOD->indices : mesh.indices;
+			const BVH& bvh = pLOD ? pLOD->bvh : mesh.bvh;
+
+			//Rays still in flight, segments are stored light first: start = origin + max * direction, delta = (min - max) * direction
+			uint32_t activeRays[MAX_SHADOW_BUNDLE_SIZE];
+			uint32_t numActiveRays{};
+			BVH::SegmentBundle bundle{ { FLT_MAX, FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX, -FLT_MAX }, { FLT_MAX, FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX, -FLT_MAX } };
+			bool isBundleBounded{ true };
+			for (uint32_t rayIndex{}; rayIndex < rays.size(); ++rayIndex)
+			{
+				const Ray& ray = rays[rayIndex];
+				if (isOccluded[rayIndex] || !SlabTest_TriangleMesh(mesh, ray))
+					continue;
+
+				activeRays[numActiveRays++] = rayIndex;
+				const float origin[3]{ ray.origin.x, ray.origin.y, ray.origin.z };
+				const float direction[3]{ ray.direction.x, ray.direction.y, ray.direction.z };
+				for (int axis{}; axis < 3; ++axis)
+				{
+					const float start{ origin[axis] + ray.max * direction[axis] };
+					const float delta{ (ray.min - ray.max) * direction[axis] };
+					bundle.startMin[axis] = std::min(bundle.startMin[axis], start);
+					bundle.startMax[axis] = std::max(bundle.startMax[axis], start);
+					bundle.deltaMin[axis] = std::min(bundle.deltaMin[axis], delta);
+					bundle.deltaMax[axis] = std::max(bundle.deltaMax[axis], delta);
+				}
+				isBundleBounded = isBundleBounded && ray.max < FLT_MAX;
+			}
+
+			//Rays towards directional lights have no end point to bundle around
+			if (bvh.IsEmpty() || !isBundleBounded)
+			{
+				for (uint32_t idx{}; idx < numActiveRays; ++idx)
+				{
+					float t{}, u{}, v{};
+					uint32_t triangleIndex{};
+					isOccluded[activeRays[idx]] = Intersect_TriangleMesh(mesh, rays[activeRays[idx]], true, t, triangleIndex, u, v);
+				}
+				return;
+			}
+
+			BVH::BundleRay bundleRays[MAX_SHADOW_BUNDLE_SIZE];
+			for (uint32_t idx{}; idx < numActiveRays; ++idx)
+			{
+				const Ray& ray = rays[activeRays[idx]];
+				bundleRays[idx] = BVH::BundleRay{ { ray.origin.x, ray.origin.y, ray.origin.z },
+					{ 1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z }, ray.min, ray.max };
+			}
+
+			const std::vector<uint32_t>& triangleIndices = bvh.GetTriangleIndices();
+			uint32_t numOpenRays{ numActiveRays };
+			bvh.TraverseBundle(bundle, { bundleRays, numActiveRays }, [&](const BVH::Node& leaf, uint32_t firstRay)
+			{
+				for (uint32_t idx{ firstRay }; idx < numActiveRays; ++idx)
+				{
+					BVH::BundleRay& bundleRay = bundleRays[idx];
+					float entryT{};
+					if (bundleRay.minT > bundleRay.maxT || !BVH::IntersectNode(leaf, bundleRay.origin, bundleRay.inverseDirection, bundleRay.minT, bundleRay.maxT, entryT))
+						continue;
+
+					const Ray& ray = rays[activeRays[idx]];
+					for (uint32_t entry{ leaf.left }; entry < leaf.left + leaf.GetCount(); ++entry)
+					{
+						const uint32_t index{ triangleIndices[entry] };
+						float t{}, u{}, v{};
+						if (Intersect_Triangle(transformedPositions[indices[3 * index]], transformedPositions[indices[3 * index + 1]], transformedPositions[indices[3 * index + 2]],
+							transformedNormals[index], mesh.cullMode, ray, true, t, u, v))
+						{
+							isOccluded[activeRays[idx]] = true;
+							bundleRay.maxT = -FLT_MAX;
+							--numOpenRays;
+							break;
+						}
+					}
+				}
+				return numOpenRays == 0;
+			});
+		}
 #pragma endregion
 	}
 
@@ -312,15 +536,60 @@ namespace dae
 
 	namespace Utils
 	{
-		//Just parses vertices and indices
+		//Parses vertices, texture coordinates, vertex normals and faces, polygons are split into triangle fans
+		//normals gets the flat normal of every face
+		//Without pTexcoords and pVertexNormals the vt and vn entries are ignored, with either every distinct corner of the faces becomes a vertex
+		//pTexcoords gets one entry per position (empty if the file has no texture coordinates)
+		//pVertexNormals gets one per position, the file's vn when every corner has one, area weighted face averages otherwise
 #pragma warning(push)
 #pragma warning(disable : 4505) //Warning unreferenced local function
-		static bool ParseOBJ(const std::string& filename, std::vector<Vector3>& positions, std::vector<Vector3>& normals, std::vector<int>& indices)
+		static bool ParseOBJ(const std::string& filename, std::vector<Vector3>& positions, std::vector<Vector3>& normals, std::vector<int>& indices,
+			std::vector<Vector2>* pTexcoords = nullptr, std::vector<Vector3>* pVertexNormals = nullptr)
 		{
 			std::ifstream file(filename);
 			if (!file)
 				return false;
 
+			//Indices refer to the file's own vertices, so the outputs start out empty
+			positions.clear();
+			normals.clear();
+			indices.clear();
+			if (pTexcoords)
+				pTexcoords->clear();
+
+			std::vector<Vector3> filePositions{};
+			std::vector<Vector2> fileTexcoords{};
+			std::vector<Vector3> fileNormals{};
+
+			//Vertex of a v/vt/vn corner, only used with pTexcoords or pVertexNormals
+			struct CornerKey
+			{
+				int position, texcoord, normal;
+				bool operator==(const CornerKey&) const = default;
+			};
+			struct CornerKeyHash
+			{
+				size_t operator()(const CornerKey& key) const
+				{
+					const uint64_t hash{ (static_cast<uint64_t>(key.position) * 0x9E3779B97F4A7C15ull) ^
+						(static_cast<uint64_t>(static_cast<uint32_t>(key.texcoord)) << 32) ^ static_cast<uint32_t>(key.normal) * 0xC2B2AE35u };
+					return static_cast<size_t>(hash ^ (hash >> 29));
+				}
+			};
+			std::unordered_map<CornerKey, int, CornerKeyHash> vertexIds{};
+			std::vector<int> vertexPositions{}; //file position of each vertex
+			std::vector<int> vertexNormalIds{}; //file normal of each vertex
+			const bool isSplittingCorners{ pTexcoords || pVertexNormals };
+			bool hasTexcoords{};
+			bool hasAllNormals{ true };
+			std::vector<int> faceVertices{};
+
+			//OBJ indices start at 1, negative ones count back from the last element read
+			const auto resolveIndex = [](int index, size_t count)
+			{
+				return index < 0 ? static_cast<int>(count) + index : index - 1;
+			};
+
 			std::string sCommand;
 			// start a while iteration ending when the end of file is reached (ios::eof)
 			while (!file.eof())
@@ -337,16 +606,72 @@ namespace dae
 					//Vertex
 					float x, y, z;
 					file >> x >> y >> z;
-					positions.push_back({ x, y, z });
+					filePositions.push_back({ x, y, z });
+				}
+				else if (sCommand == "vt")
+				{
+					//Texture coordinate, image rows start at the top so v is flipped
+					float u, v;
+					file >> u >> v;
+					fileTexcoords.push_back({ u, 1.f - v });
+				}
+				else if (sCommand == "vn")
+				{
+					float x, y, z;
+					file >> x >> y >> z;
+					fileNormals.push_back({ x, y, z });
 				}
 				else if (sCommand == "f")
 				{
-					float i0, i1, i2;
-					file >> i0 >> i1 >> i2;
+					//v, v/vt, v/vt/vn or v//vn per corner
+					std::string line{};
+					std::getline(file, line);
+					std::istringstream lineStream{ line };
+					std::string corner{};
+					faceVertices.clear();
+					while (lineStream >> corner)
+					{
+						const int positionIndex{ resolveIndex(std::atoi(corner.c_str()), filePositions.size()) };
+						const size_t slash{ corner.find('/') };
+						const bool hasTexcoord{ slash != std::string::npos && slash + 1 < corner.size() && corner[slash + 1] != '/' };
+						const int texcoordIndex{ hasTexcoord ? resolveIndex(std::atoi(corner.c_str() + slash + 1), fileTexcoords.size()) : -1 };
+						const size_t secondSlash{ slash != std::string::npos ? corner.find('/', slash + 1) : std::string::npos };
+						const bool hasNormal{ secondSlash != std::string::npos && secondSlash + 1 < corner.size() };
+						const int normalIndex{ hasNormal ? resolveIndex(std::atoi(corner.c_str() + secondSlash + 1), fileNormals.size()) : -1 };
+						if (positionIndex < 0 || positionIndex >= static_cast<int>(filePositions.size()) || texcoordIndex >= static_cast<int>(fileTexcoords.size()) ||
+							normalIndex >= static_cast<int>(fileNormals.size()))
+						{
+							return false;
+						}
+
+						if (!isSplittingCorners)
+						{
+							faceVertices.push_back(positionIndex);
+							continue;
+						}
 
-					indices.push_back((int)i0 - 1);
-					indices.push_back((int)i1 - 1);
-					indices.push_back((int)i2 - 1);
+						hasTexcoords = hasTexcoords || hasTexcoord;
+						hasAllNormals = hasAllNormals && normalIndex >= 0;
+						const CornerKey key{ positionIndex, pTexcoords ? texcoordIndex : -1, pVertexNormals ? normalIndex : -1 };
+						const auto [it, isNew] = vertexIds.try_emplace(key, static_cast<int>(positions.size()));
+						if (isNew)
+						{
+							positions.push_back(filePositions[positionIndex]);
+							vertexPositions.push_back(positionIndex);
+							vertexNormalIds.push_back(normalIndex);
+							if (pTexcoords)
+								pTexcoords->push_back(hasTexcoord ? fileTexcoords[texcoordIndex] : Vector2{});
+						}
+						faceVertices.push_back(it->second);
+					}
+
+					for (size_t corner{ 2 }; corner < faceVertices.size(); ++corner)
+					{
+						indices.push_back(faceVertices[0]);
+						indices.push_back(faceVertices[corner - 1]);
+						indices.push_back(faceVertices[corner]);
+					}
+					continue;
 				}
 				//read till end of line and ignore all remaining chars
 				file.ignore(1000, '\n');
@@ -355,6 +680,34 @@ namespace dae
 					break;
 			}
 
+			if (!isSplittingCorners)
+				positions.insert(positions.end(), filePositions.begin(), filePositions.end());
+			else if (pTexcoords && !hasTexcoords)
+				pTexcoords->clear();
+
+			if (pVertexNormals)
+			{
+				pVertexNormals->clear();
+				pVertexNormals->reserve(positions.size());
+				if (hasAllNormals && !indices.empty())
+				{
+					for (const int normalIndex : vertexNormalIds)
+						pVertexNormals->push_back(fileNormals[normalIndex].Normalized());
+				}
+				else
+				{
+					//Averaged over the file's positions, so vertices split at texture seams still get the same normal
+					std::vector<Vector3> positionNormals{};
+					std::vector<int> fileIndices{};
+					fileIndices.reserve(indices.size());
+					for (const int index : indices)
+						fileIndices.push_back(vertexPositions[index]);
+					TriangleMesh::CalculateVertexNormals(filePositions, fileIndices, positionNormals);
+					for (const int positionIndex : vertexPositions)
+						pVertexNormals->push_back(positionNormals[positionIndex]);
+				}
+			}
+
 			//Precompute normals
 			for (uint64_t index = 0; index < indices.size(); index += 3)
 			{
@@ -366,13 +719,13 @@ namespace dae
 				Vector3 edgeV0V2 = positions[i2] - positions[i0];
 				Vector3 normal = Vector3::Cross(edgeV0V1, edgeV0V2);
 
-				if(isnan(normal.x))
+				if(std::isnan(normal.x))
 				{
 					int k = 0;
 				}
 
 				normal.Normalize();
-				if (isnan(normal.x))
+				if (std::isnan(normal.x))
 				{
 					int k = 0;
 				}
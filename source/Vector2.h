@@ -0,0 +1,18 @@
+#pragma once
+
+namespace dae
+{
+	//Texture coordinates, header only since nothing more than interpolation is done with them
+	struct Vector2
+	{
+		float x{};
+		float y{};
+
+		Vector2 operator*(float scale) const { return { x * scale, y * scale }; }
+		Vector2 operator+(const Vector2& v) const { return { x + v.x, y + v.y }; }
+		Vector2 operator-(const Vector2& v) const { return { x - v.x, y - v.y }; }
+
+		//Signed area of the parallelogram spanned by v1 and v2
+		static float Cross(const Vector2& v1, const Vector2& v2) { return v1.x * v2.y - v1.y * v2.x; }
+	};
+}
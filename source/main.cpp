@@ -1,16 +1,31 @@
 //External includes
+#if defined(RT_ENABLE_VLD)
 #include "vld.h"
+#endif
 #include "SDL.h"
 #include "SDL_surface.h"
 #undef main
 
 //Standard includes
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <string>
 
 //Project includes
 #include "Timer.h"
+#include "Benchmarks.h"
 #include "Renderer.h"
 #include "Scene.h"
+#include "Socket.h"
+#include "DistributedRenderer.h"
+#include "Profiler.h"
+#include "RayStats.h"
+#include "ImageWriter.h"
 
 using namespace dae;
 
@@ -20,11 +35,192 @@ void ShutDown(SDL_Window* pWindow)
 	SDL_Quit();
 }
 
+void PrintUsage()
+{
+	std::cout << "Usage:\n"
+		<< "  RayTracer [scene.txt | scene.rtsb]\n"
+		<< "  RayTracer --convert <scene.txt> <scene.rtsb>\n"
+		<< "  RayTracer --coordinator <address> [--workers N] [--spawn] [--size WxH] [--tile N] [--output file.ppm|file.png] [scene]\n"
+		<< "  RayTracer --worker <address>\n"
+		<< "  RayTracer --trace <trace.json> [scene]   (needs a build with RT_ENABLE_PROFILING)\n"
+		<< "  RayTracer --stats-csv <stats.csv> [scene]   (needs a build with RT_ENABLE_RAY_STATS)\n"
+		<< "  RayTracer --bench-bvh <mesh.obj> [repeats]\n"
+		<< "  RayTracer --brdf-accuracy [samples]   (compares the fast BRDF terms against the reference ones, fails outside the tolerances)\n"
+		<< "  RayTracer --reproject [max traced pixels per frame] [scene]   (toggle with F5)\n"
+		<< "  RayTracer --target-fps <fps> [scene]   (dynamic resolution, toggle with F7)\n"
+		<< "  RayTracer --checkerboard [scene]   (toggle with F8)\n"
+		<< "  RayTracer --max-bounces <N> --bounce-budget <rays per frame> [scene]   (reflection depth, default 3, and bounce rays per frame, default 2 per pixel, 0: no limit)\n"
+		<< "  RayTracer --save-frames <name.ppm|name.png|name.pfm> [count] [scene]   (every frame as name_00000.ext, stops after count frames)\n"
+		<< "  RayTracer --stream <name.y4m|name.rgb|-> [scene]   (every frame to a Y4M video, or raw RGB to a file, named pipe or stdout)\n"
+		<< "  RayTracer --animation <frames> [fps] [scene]   (renders frames at a fixed time step of 1/fps, default 30, then stops)\n"
+		<< "  RayTracer --fixed-step <fps> [scene]   (scene time advances 1/fps per frame, so benchmarks (F6) render the same frames every run)\n"
+		<< "Addresses are host:port or unix:/path/to/socket\n";
+}
+
 int main(int argc, char* args[])
 {
-	//Unreferenced parameters
-	(void)argc;
-	(void)args;
+	//Command line
+	std::string sceneFilename{};
+	std::string workerAddress{};
+	std::string traceFilename{};
+	std::string statsFilename{};
+	bool isReprojectionEnabled{};
+	uint32_t reprojectionBudget{};
+	float targetFPS{};
+	bool isCheckerboardEnabled{};
+	int maxBounces{ -1 };
+	int64_t bounceRayBudget{ -1 };
+	std::string framesFilename{};
+	ImageFormat framesFormat{};
+	uint32_t numFramesToSave{};
+	std::string streamTarget{};
+	uint32_t numAnimationFrames{};
+	int animationFPS{ 30 };
+	float fixedStepFPS{};
+	bool isCoordinator{};
+	DistributedRenderer::CoordinatorSettings coordinatorSettings{};
+	for (int idx{ 1 }; idx < argc; ++idx)
+	{
+		const std::string argument{ args[idx] };
+		const bool hasValue{ idx + 1 < argc };
+		if (argument == "--convert" && idx + 2 < argc)
+		{
+			return SceneFile::ConvertTextToBinary(args[idx + 1], args[idx + 2]) ? 0 : 1;
+		}
+		else if (argument == "--bench-bvh" && hasValue)
+		{
+			return Benchmarks::BuildBVH(args[idx + 1], idx + 2 < argc ? std::max(1, std::atoi(args[idx + 2])) : 5);
+		}
+		else if (argument == "--brdf-accuracy")
+		{
+			return Benchmarks::BRDFAccuracy(hasValue ? std::max(1, std::atoi(args[idx + 1])) : 1'000'000);
+		}
+		else if (argument == "--coordinator" && hasValue)
+		{
+			isCoordinator = true;
+			coordinatorSettings.address = args[++idx];
+		}
+		else if (argument == "--worker" && hasValue)
+		{
+			workerAddress = args[++idx];
+		}
+		else if (argument == "--workers" && hasValue)
+		{
+			coordinatorSettings.numWorkers = std::atoi(args[++idx]);
+		}
+		else if (argument == "--spawn")
+		{
+			coordinatorSettings.spawnLocalWorkers = true;
+		}
+		else if (argument == "--size" && hasValue)
+		{
+			if (std::sscanf(args[++idx], "%dx%d", &coordinatorSettings.width, &coordinatorSettings.height) != 2)
+			{
+				PrintUsage();
+				return 1;
+			}
+		}
+		else if (argument == "--tile" && hasValue)
+		{
+			coordinatorSettings.tileSize = std::atoi(args[++idx]);
+		}
+		else if (argument == "--output" && hasValue)
+		{
+			coordinatorSettings.outputFilename = args[++idx];
+		}
+		else if (argument == "--trace" && hasValue)
+		{
+			traceFilename = args[++idx];
+		}
+		else if (argument == "--reproject")
+		{
+			isReprojectionEnabled = true;
+			if (hasValue && std::isdigit(static_cast<unsigned char>(args[idx + 1][0])))
+				reprojectionBudget = static_cast<uint32_t>(std::atoi(args[++idx]));
+		}
+		else if (argument == "--target-fps" && hasValue)
+		{
+			targetFPS = static_cast<float>(std::atof(args[++idx]));
+		}
+		else if (argument == "--max-bounces" && hasValue)
+		{
+			maxBounces = std::max(std::atoi(args[++idx]), 0);
+		}
+		else if (argument == "--bounce-budget" && hasValue)
+		{
+			bounceRayBudget = static_cast<int64_t>(std::max(std::atoll(args[++idx]), 0ll));
+		}
+		else if (argument == "--checkerboard")
+		{
+			isCheckerboardEnabled = true;
+		}
+		else if (argument == "--save-frames" && hasValue)
+		{
+			framesFilename = args[++idx];
+			if (!ImageWriter::GetFormat(framesFilename, framesFormat))
+			{
+				std::cout << "Unknown image format " << framesFilename << ", use .ppm, .png or .pfm\n";
+				return 1;
+			}
+			if (idx + 1 < argc && std::isdigit(static_cast<unsigned char>(args[idx + 1][0])))
+				numFramesToSave = static_cast<uint32_t>(std::atoi(args[++idx]));
+		}
+		else if (argument == "--stream" && hasValue)
+		{
+			streamTarget = args[++idx];
+		}
+		else if (argument == "--animation" && hasValue)
+		{
+			numAnimationFrames = static_cast<uint32_t>(std::max(std::atoi(args[++idx]), 1));
+			if (idx + 1 < argc && std::isdigit(static_cast<unsigned char>(args[idx + 1][0])))
+				animationFPS = std::max(std::atoi(args[++idx]), 1);
+		}
+		else if (argument == "--fixed-step" && hasValue)
+		{
+			fixedStepFPS = static_cast<float>(std::atof(args[++idx]));
+		}
+		else if (argument == "--stats-csv" && hasValue)
+		{
+			statsFilename = args[++idx];
+		}
+		else if (argument[0] != '-' && sceneFilename.empty())
+		{
+			sceneFilename = argument;
+		}
+		else
+		{
+			PrintUsage();
+			return argument != "--help";
+		}
+	}
+
+	//Raw frames on stdout leave the console output to stderr
+	if (streamTarget == "-")
+		std::cout.rdbuf(std::cerr.rdbuf());
+
+	//Distributed rendering runs without a window
+	if (isCoordinator || !workerAddress.empty())
+	{
+		if (!Socket::InitializeNetworking())
+			return 1;
+
+		int exitCode{};
+		if (isCoordinator)
+		{
+			coordinatorSettings.sceneFilename = sceneFilename;
+			coordinatorSettings.executablePath = args[0];
+			coordinatorSettings.maxBounces = maxBounces;
+			coordinatorSettings.bounceRayBudget = bounceRayBudget;
+			exitCode = DistributedRenderer::RunCoordinator(coordinatorSettings);
+		}
+		else
+		{
+			exitCode = DistributedRenderer::RunWorker(workerAddress);
+		}
+
+		Socket::ShutdownNetworking();
+		return exitCode;
+	}
 
 	//Create window + surfaces
 	SDL_Init(SDL_INIT_VIDEO);
@@ -44,9 +240,77 @@ int main(int argc, char* args[])
 	//Initialize "framework"
 	const auto pTimer = new Timer();
 	const auto pRenderer = new Renderer(pWindow);
+	pRenderer->SetReprojection(isReprojectionEnabled, reprojectionBudget);
+	if (fixedStepFPS > 0.f)
+		pTimer->SetFixedTimeStep(1.f / fixedStepFPS);
+	//Animations are deterministic, nothing may adapt to how long a frame took
+	if (numAnimationFrames > 0)
+	{
+		pTimer->SetFixedTimeStep(1.f / animationFPS);
+		pRenderer->SetTargetFrameTime(0.f);
+		if (targetFPS > 0.f)
+			std::cout << "--target-fps is ignored for animations\n";
+	}
+	else if (targetFPS > 0.f)
+		pRenderer->SetDynamicResolution(true, 1.f / targetFPS);
+	pRenderer->SetCheckerboard(isCheckerboardEnabled);
+	if (maxBounces >= 0)
+		pRenderer->SetMaxBounces(maxBounces);
+	if (bounceRayBudget >= 0)
+		pRenderer->SetBounceRayBudget(static_cast<uint32_t>(std::min<int64_t>(bounceRayBudget, UINT32_MAX)));
+
+	//Frames are saved from a background thread with two buffers per output, rendering the next frame overlaps writing this one
+	std::unique_ptr<ImageWriter> pImageWriter{};
+	std::string framesPrefix{};
+	std::string framesExtension{};
+	ImageFormat streamFormat{ ImageFormat::RawRGB };
+	if (!framesFilename.empty() || !streamTarget.empty())
+		pImageWriter = std::make_unique<ImageWriter>(framesFilename.empty() || streamTarget.empty() ? 2 : 4);
+	if (!streamTarget.empty())
+	{
+		const size_t dot{ streamTarget.find_last_of('.') };
+		if (dot != std::string::npos && (streamTarget.substr(dot) == ".y4m" || streamTarget.substr(dot) == ".Y4M"))
+			streamFormat = ImageFormat::Y4M;
+		if (!pImageWriter->OpenStream(streamTarget, streamFormat, static_cast<int>(width), static_cast<int>(height), animationFPS))
+		{
+			delete pRenderer;
+			delete pTimer;
+			ShutDown(pWindow);
+			return 1;
+		}
+	}
+	if (!framesFilename.empty())
+	{
+		const size_t dot{ framesFilename.find_last_of('.') };
+		framesPrefix = framesFilename.substr(0, dot);
+		framesExtension = framesFilename.substr(dot);
+		pRenderer->SetHdrCapture(framesFormat == ImageFormat::PFM);
+	}
+
+	Scene* const pScene{ CreateScene(sceneFilename) };
+	if (!pScene)
+	{
+		delete pRenderer;
+		delete pTimer;
+		ShutDown(pWindow);
+		return 1;
+	}
 
-	const auto pScene = new Scene_W4_ReferenceScene();
-	pScene->Initialize();
+	if (!traceFilename.empty())
+		Profiler::BeginSession(traceFilename);
+
+	std::ofstream statsFile{};
+	if (!statsFilename.empty())
+	{
+		if (!RayStats::IS_ENABLED)
+			std::cout << "Ray statistics are not compiled in, rebuild with RT_ENABLE_RAY_STATS to write " << statsFilename << "\n";
+		else
+		{
+			statsFile.open(statsFilename);
+			RayStats::WriteCsvHeader(statsFile);
+		}
+	}
+	uint32_t frameIndex{};
 
 	//Start loop
 	pTimer->Start();
@@ -55,6 +319,8 @@ int main(int argc, char* args[])
 	bool takeScreenshot = false;
 	while (isLooping)
 	{
+		PROFILE_SCOPE("Frame");
+
 		//--------- Get input events ---------
 		SDL_Event e;
 		while (SDL_PollEvent(&e))
@@ -77,18 +343,41 @@ int main(int argc, char* args[])
 		}
 
 		//--------- Update ---------
-		pScene->Update(pTimer);
+		{
+			PROFILE_SCOPE("Scene::Update");
+			pScene->Update(pTimer);
+		}
 
 		//--------- Render ---------
 		pRenderer->Render(pScene);
+		if (!framesFilename.empty())
+		{
+			char frameNumber[16]{};
+			std::snprintf(frameNumber, sizeof(frameNumber), "_%05u", frameIndex);
+			pRenderer->SubmitFrame(*pImageWriter, framesPrefix + frameNumber + framesExtension, framesFormat);
+			if (numFramesToSave > 0 && frameIndex + 1 >= numFramesToSave)
+				isLooping = false;
+		}
+		if (!streamTarget.empty())
+			pRenderer->SubmitFrame(*pImageWriter, streamTarget, streamFormat);
+		if (numAnimationFrames > 0 && frameIndex + 1 >= numAnimationFrames)
+			isLooping = false;
+		Profiler::EndFrame();
 
 		//--------- Timer ---------
 		pTimer->Update();
-		printTimer += pTimer->GetElapsed();
+		const RayStats::FrameStats frameStats{ RayStats::CollectFrame() };
+		if (statsFile.is_open())
+			RayStats::WriteCsvRow(statsFile, frameIndex, pTimer->GetFrameDuration(), frameStats);
+		++frameIndex;
+
+		printTimer += pTimer->GetFrameDuration();
 		if (printTimer >= 1.f)
 		{
 			printTimer = 0.f;
 			std::cout << "dFPS: " << pTimer->GetdFPS() << std::endl;
+			if (RayStats::IS_ENABLED)
+				RayStats::Print(std::cout, frameStats);
 		}
 
 		//Save screenshot after full render
@@ -102,6 +391,18 @@ int main(int argc, char* args[])
 		}
 	}
 	pTimer->Stop();
+	Profiler::EndSession();
+	if (pImageWriter)
+	{
+		pImageWriter->CloseStream();
+		if (pImageWriter->GetNumFailed() > 0)
+			std::cout << pImageWriter->GetNumFailed() << " frames could not be written" << std::endl;
+		if (!framesFilename.empty())
+			std::cout << "Saved frames to " << framesPrefix << "_*" << framesExtension << std::endl;
+		if (!streamTarget.empty() && streamTarget != "-")
+			std::cout << "Streamed " << frameIndex << " frames to " << streamTarget << std::endl;
+		pImageWriter.reset();
+	}
 
 	//Shutdown "framework"
 	delete pScene;
@@ -0,0 +1,83 @@
+//Standard includes
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+//Project includes
+#include "Benchmarks.h"
+
+using namespace dae;
+
+//Frame time, BVH build and BRDF benchmarks, without a window so they run the same on build machines
+
+void PrintUsage()
+{
+	std::cout << "Usage:\n"
+		<< "  RayTracerBench [--size WxH] [--frames N] [--warmup N] [--fps F] [scene.txt | scene.rtsb]...\n"
+		<< "      (frame times of every scene, the reference scene without one, default 100 frames after 10 warm-up frames at 640x480)\n"
+		<< "  RayTracerBench --bvh <mesh.obj> [repeats]\n"
+		<< "  RayTracerBench --brdf [samples]   (compares the fast BRDF terms against the reference ones, fails outside the tolerances)\n";
+}
+
+int main(int argc, char* args[])
+{
+	//Command line
+	Benchmarks::FrameSettings settings{};
+	std::vector<std::string> sceneFilenames{};
+	for (int idx{ 1 }; idx < argc; ++idx)
+	{
+		const std::string argument{ args[idx] };
+		const bool hasValue{ idx + 1 < argc };
+		if (argument == "--bvh" && hasValue)
+		{
+			return Benchmarks::BuildBVH(args[idx + 1], idx + 2 < argc ? std::max(1, std::atoi(args[idx + 2])) : 5);
+		}
+		else if (argument == "--brdf")
+		{
+			return Benchmarks::BRDFAccuracy(hasValue ? std::max(1, std::atoi(args[idx + 1])) : 1'000'000);
+		}
+		else if (argument == "--size" && hasValue)
+		{
+			if (std::sscanf(args[++idx], "%dx%d", &settings.width, &settings.height) != 2 || settings.width <= 0 || settings.height <= 0)
+			{
+				PrintUsage();
+				return 1;
+			}
+		}
+		else if (argument == "--frames" && hasValue)
+		{
+			settings.numFrames = static_cast<uint32_t>(std::max(std::atoi(args[++idx]), 1));
+		}
+		else if (argument == "--warmup" && hasValue)
+		{
+			settings.numWarmupFrames = static_cast<uint32_t>(std::max(std::atoi(args[++idx]), 0));
+		}
+		else if (argument == "--fps" && hasValue)
+		{
+			settings.fps = static_cast<float>(std::max(std::atoi(args[++idx]), 1));
+		}
+		else if (argument[0] != '-')
+		{
+			sceneFilenames.push_back(argument);
+		}
+		else
+		{
+			PrintUsage();
+			return argument != "--help";
+		}
+	}
+
+	if (sceneFilenames.empty())
+		sceneFilenames.emplace_back();
+
+	int exitCode{};
+	for (const std::string& sceneFilename : sceneFilenames)
+	{
+		settings.sceneFilename = sceneFilename;
+		exitCode = std::max(exitCode, Benchmarks::RenderFrames(settings));
+	}
+	return exitCode;
+}
@@ -0,0 +1,302 @@
+//Standard includes
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+
+//Project includes
+#include "Timer.h"
+#include "Renderer.h"
+#include "Scene.h"
+#include "Socket.h"
+#include "DistributedRenderer.h"
+#include "Profiler.h"
+#include "RayStats.h"
+#include "ImageWriter.h"
+
+using namespace dae;
+
+//Renders scenes to image files or a stream without a window, for servers, batch jobs and builds without SDL
+
+void PrintUsage()
+{
+	std::cout << "Usage:\n"
+		<< "  RayTracerHeadless [--size WxH] [--frames N] [--fps F] [--output name.ppm|name.png|name.pfm] [scene.txt | scene.rtsb]\n"
+		<< "      (frames at a fixed time step of 1/fps, default 1 frame at 30 fps to RayTracing_Buffer.ppm, more than one frame as name_00000.ext)\n"
+		<< "  RayTracerHeadless --stream <name.y4m|name.rgb|-> [--frames N] [--fps F] [scene]   (Y4M video, or raw RGB to a file, named pipe or stdout)\n"
+		<< "  RayTracerHeadless --reproject [max traced pixels per frame] | --checkerboard   (temporal rendering modes for multi-frame renders)\n"
+		<< "  RayTracerHeadless --max-bounces <N> --bounce-budget <rays per frame>   (reflection depth, default 3, and bounce rays per frame, default 2 per pixel, 0: no limit)\n"
+		<< "  RayTracerHeadless --trace <trace.json> [scene]   (needs a build with RT_ENABLE_PROFILING)\n"
+		<< "  RayTracerHeadless --stats-csv <stats.csv> [scene]   (needs a build with RT_ENABLE_RAY_STATS)\n"
+		<< "  RayTracerHeadless --convert <scene.txt> <scene.rtsb>\n"
+		<< "  RayTracerHeadless --coordinator <address> [--workers N] [--spawn] [--size WxH] [--tile N] [--output file.ppm|file.png] [scene]\n"
+		<< "  RayTracerHeadless --worker <address>\n"
+		<< "Addresses are host:port or unix:/path/to/socket\n";
+}
+
+int main(int argc, char* args[])
+{
+	//Command line
+	std::string sceneFilename{};
+	std::string workerAddress{};
+	std::string traceFilename{};
+	std::string statsFilename{};
+	std::string outputFilename{};
+	std::string streamTarget{};
+	int width{ 640 };
+	int height{ 480 };
+	uint32_t numFrames{ 1 };
+	int fps{ 30 };
+	bool isReprojectionEnabled{};
+	uint32_t reprojectionBudget{};
+	bool isCheckerboardEnabled{};
+	int maxBounces{ -1 };
+	int64_t bounceRayBudget{ -1 };
+	bool isCoordinator{};
+	DistributedRenderer::CoordinatorSettings coordinatorSettings{};
+	for (int idx{ 1 }; idx < argc; ++idx)
+	{
+		const std::string argument{ args[idx] };
+		const bool hasValue{ idx + 1 < argc };
+		if (argument == "--convert" && idx + 2 < argc)
+		{
+			return SceneFile::ConvertTextToBinary(args[idx + 1], args[idx + 2]) ? 0 : 1;
+		}
+		else if (argument == "--coordinator" && hasValue)
+		{
+			isCoordinator = true;
+			coordinatorSettings.address = args[++idx];
+		}
+		else if (argument == "--worker" && hasValue)
+		{
+			workerAddress = args[++idx];
+		}
+		else if (argument == "--workers" && hasValue)
+		{
+			coordinatorSettings.numWorkers = std::atoi(args[++idx]);
+		}
+		else if (argument == "--spawn")
+		{
+			coordinatorSettings.spawnLocalWorkers = true;
+		}
+		else if (argument == "--tile" && hasValue)
+		{
+			coordinatorSettings.tileSize = std::atoi(args[++idx]);
+		}
+		else if (argument == "--size" && hasValue)
+		{
+			if (std::sscanf(args[++idx], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0)
+			{
+				PrintUsage();
+				return 1;
+			}
+		}
+		else if (argument == "--frames" && hasValue)
+		{
+			numFrames = static_cast<uint32_t>(std::max(std::atoi(args[++idx]), 1));
+		}
+		else if (argument == "--fps" && hasValue)
+		{
+			fps = std::max(std::atoi(args[++idx]), 1);
+		}
+		else if (argument == "--output" && hasValue)
+		{
+			outputFilename = args[++idx];
+		}
+		else if (argument == "--stream" && hasValue)
+		{
+			streamTarget = args[++idx];
+		}
+		else if (argument == "--reproject")
+		{
+			isReprojectionEnabled = true;
+			if (hasValue && std::isdigit(static_cast<unsigned char>(args[idx + 1][0])))
+				reprojectionBudget = static_cast<uint32_t>(std::atoi(args[++idx]));
+		}
+		else if (argument == "--max-bounces" && hasValue)
+		{
+			maxBounces = std::max(std::atoi(args[++idx]), 0);
+		}
+		else if (argument == "--bounce-budget" && hasValue)
+		{
+			bounceRayBudget = static_cast<int64_t>(std::max(std::atoll(args[++idx]), 0ll));
+		}
+		else if (argument == "--checkerboard")
+		{
+			isCheckerboardEnabled = true;
+		}
+		else if (argument == "--trace" && hasValue)
+		{
+			traceFilename = args[++idx];
+		}
+		else if (argument == "--stats-csv" && hasValue)
+		{
+			statsFilename = args[++idx];
+		}
+		else if (argument[0] != '-' && sceneFilename.empty())
+		{
+			sceneFilename = argument;
+		}
+		else
+		{
+			PrintUsage();
+			return argument != "--help";
+		}
+	}
+
+	//Raw frames on stdout leave the console output to stderr
+	if (streamTarget == "-")
+		std::cout.rdbuf(std::cerr.rdbuf());
+
+	if (isCoordinator || !workerAddress.empty())
+	{
+		if (!Socket::InitializeNetworking())
+			return 1;
+
+		int exitCode{};
+		if (isCoordinator)
+		{
+			coordinatorSettings.sceneFilename = sceneFilename;
+			coordinatorSettings.executablePath = args[0];
+			coordinatorSettings.width = width;
+			coordinatorSettings.height = height;
+			coordinatorSettings.maxBounces = maxBounces;
+			coordinatorSettings.bounceRayBudget = bounceRayBudget;
+			if (!outputFilename.empty())
+				coordinatorSettings.outputFilename = outputFilename;
+			exitCode = DistributedRenderer::RunCoordinator(coordinatorSettings);
+		}
+		else
+		{
+			exitCode = DistributedRenderer::RunWorker(workerAddress);
+		}
+
+		Socket::ShutdownNetworking();
+		return exitCode;
+	}
+
+	//Without a stream the frames go to image files
+	if (outputFilename.empty() && streamTarget.empty())
+		outputFilename = "RayTracing_Buffer.ppm";
+	ImageFormat outputFormat{};
+	if (!outputFilename.empty() && !ImageWriter::GetFormat(outputFilename, outputFormat))
+	{
+		std::cout << "Unknown image format " << outputFilename << ", use .ppm, .png or .pfm\n";
+		return 1;
+	}
+
+	Scene* const pScene{ CreateScene(sceneFilename) };
+	if (!pScene)
+		return 1;
+
+	//Every run renders the same frames, nothing may adapt to how long a frame took
+	const auto pTimer = new Timer();
+	pTimer->SetFixedTimeStep(1.f / fps);
+	const auto pRenderer = new Renderer(width, height);
+	pRenderer->SetTargetFrameTime(0.f);
+	pRenderer->SetReprojection(isReprojectionEnabled, reprojectionBudget);
+	pRenderer->SetCheckerboard(isCheckerboardEnabled);
+	if (maxBounces >= 0)
+		pRenderer->SetMaxBounces(maxBounces);
+	if (bounceRayBudget >= 0)
+		pRenderer->SetBounceRayBudget(static_cast<uint32_t>(std::min<int64_t>(bounceRayBudget, UINT32_MAX)));
+
+	//Frames are written from a background thread with two buffers per output, rendering the next frame overlaps writing this one
+	auto pImageWriter = std::make_unique<ImageWriter>(outputFilename.empty() || streamTarget.empty() ? 2 : 4);
+	ImageFormat streamFormat{ ImageFormat::RawRGB };
+	if (!streamTarget.empty())
+	{
+		const size_t dot{ streamTarget.find_last_of('.') };
+		if (dot != std::string::npos && (streamTarget.substr(dot) == ".y4m" || streamTarget.substr(dot) == ".Y4M"))
+			streamFormat = ImageFormat::Y4M;
+		if (!pImageWriter->OpenStream(streamTarget, streamFormat, width, height, fps))
+		{
+			delete pRenderer;
+			delete pTimer;
+			delete pScene;
+			return 1;
+		}
+	}
+	std::string framesPrefix{};
+	std::string framesExtension{};
+	if (!outputFilename.empty())
+	{
+		const size_t dot{ outputFilename.find_last_of('.') };
+		framesPrefix = outputFilename.substr(0, dot);
+		framesExtension = outputFilename.substr(dot);
+		pRenderer->SetHdrCapture(outputFormat == ImageFormat::PFM);
+	}
+
+	if (!traceFilename.empty())
+		Profiler::BeginSession(traceFilename);
+
+	std::ofstream statsFile{};
+	if (!statsFilename.empty())
+	{
+		if (!RayStats::IS_ENABLED)
+			std::cout << "Ray statistics are not compiled in, rebuild with RT_ENABLE_RAY_STATS to write " << statsFilename << "\n";
+		else
+		{
+			statsFile.open(statsFilename);
+			RayStats::WriteCsvHeader(statsFile);
+		}
+	}
+
+	pTimer->Start();
+	float renderTime{};
+	for (uint32_t frameIndex{}; frameIndex < numFrames; ++frameIndex)
+	{
+		PROFILE_SCOPE("Frame");
+		{
+			PROFILE_SCOPE("Scene::Update");
+			pScene->Update(pTimer);
+		}
+
+		pRenderer->Render(pScene);
+		if (!outputFilename.empty())
+		{
+			//A single frame keeps the name it was given
+			std::string filename{ outputFilename };
+			if (numFrames > 1)
+			{
+				char frameNumber[16]{};
+				std::snprintf(frameNumber, sizeof(frameNumber), "_%05u", frameIndex);
+				filename = framesPrefix + frameNumber + framesExtension;
+			}
+			pRenderer->SubmitFrame(*pImageWriter, filename, outputFormat);
+		}
+		if (!streamTarget.empty())
+			pRenderer->SubmitFrame(*pImageWriter, streamTarget, streamFormat);
+		Profiler::EndFrame();
+
+		pTimer->Update();
+		renderTime += pTimer->GetFrameDuration();
+		const RayStats::FrameStats frameStats{ RayStats::CollectFrame() };
+		if (statsFile.is_open())
+			RayStats::WriteCsvRow(statsFile, frameIndex, pTimer->GetFrameDuration(), frameStats);
+	}
+	pTimer->Stop();
+	Profiler::EndSession();
+
+	pImageWriter->CloseStream();
+	const uint32_t numFailed{ pImageWriter->GetNumFailed() };
+	pImageWriter.reset();
+
+	std::cout << "Rendered " << numFrames << (numFrames == 1 ? " frame" : " frames") << " at " << width << "x" << height << " in " << renderTime << " s";
+	if (!outputFilename.empty())
+		std::cout << " to " << (numFrames == 1 ? outputFilename : framesPrefix + "_*" + framesExtension);
+	if (!streamTarget.empty() && streamTarget != "-")
+		std::cout << (outputFilename.empty() ? " to " : " and ") << streamTarget;
+	std::cout << std::endl;
+	if (numFailed > 0)
+		std::cout << numFailed << " frames could not be written" << std::endl;
+
+	delete pScene;
+	delete pRenderer;
+	delete pTimer;
+	return numFailed > 0 ? 1 : 0;
+}